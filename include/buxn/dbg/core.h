@@ -8,10 +8,10 @@
 #include <buxn/vm/vm.h>
 
 #if UINTPTR_MAX == 0xFFFFFFFF
-#	define BUXN_DBG_SIZE      1044
+#	define BUXN_DBG_SIZE      9556
 #	define BUXN_DBG_ALIGNMENT 4
 #else
-#	define BUXN_DBG_SIZE      1056
+#	define BUXN_DBG_SIZE      9568
 #	define BUXN_DBG_ALIGNMENT 8
 #endif
 
@@ -118,6 +118,11 @@ buxn_dbg_request_pause(buxn_dbg_t* dbg);
 buxn_vm_hook_t
 buxn_dbg_vm_hook(buxn_dbg_t* dbg);
 
+// Only call the hook at breakpoints, watched addresses and while stepping.
+// It is updated by the hook so it must be attached together with it.
+const buxn_vm_hook_filter_t*
+buxn_dbg_vm_hook_filter(buxn_dbg_t* dbg);
+
 bool
 buxn_dbg_should_hook(buxn_dbg_t* dbg);
 
@@ -125,9 +130,12 @@ static inline void
 buxn_dbg_exec(buxn_dbg_t* dbg, buxn_vm_t* vm, uint16_t vector) {
 	if (buxn_dbg_should_hook(dbg)) {
 		buxn_vm_hook_t old_hook = vm->config.hook;
+		const buxn_vm_hook_filter_t* old_hook_filter = vm->config.hook_filter;
 		vm->config.hook = buxn_dbg_vm_hook(dbg);
+		vm->config.hook_filter = buxn_dbg_vm_hook_filter(dbg);
 		buxn_vm_execute(vm, vector);
 		vm->config.hook = old_hook;
+		vm->config.hook_filter = old_hook_filter;
 	} else {
 		buxn_vm_execute(vm, vector);
 	}
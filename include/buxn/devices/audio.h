@@ -63,6 +63,9 @@ buxn_audio_render(buxn_audio_t* device, float* stream, int len, int num_channels
 void
 buxn_audio_receive(const buxn_audio_message_t* message);
 
+// See: buxn/devices/ports.h
+extern const struct buxn_port_device_s buxn_audio_ports;
+
 // Must be provided by the host program
 
 extern void
@@ -39,6 +39,9 @@ buxn_console_send_input(struct buxn_vm_s* vm, buxn_console_t* device, char c);
 void
 buxn_console_send_input_end(struct buxn_vm_s* vm, buxn_console_t* device);
 
+// See: buxn/devices/ports.h
+extern const struct buxn_port_device_s buxn_console_ports;
+
 // Must be provided by the host program
 
 extern void
@@ -71,4 +71,7 @@ buxn_controller_send_char(
 	device->ch = 0;
 }
 
+// See: buxn/devices/ports.h
+extern const struct buxn_port_device_s buxn_controller_ports;
+
 #endif
@@ -8,4 +8,7 @@ struct buxn_vm_s;
 uint8_t
 buxn_datetime_dei(struct buxn_vm_s* vm, uint8_t addr);
 
+// See: buxn/devices/ports.h
+extern const struct buxn_port_device_s buxn_datetime_ports;
+
 #endif
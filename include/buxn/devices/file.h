@@ -46,6 +46,9 @@ buxn_file_dei(struct buxn_vm_s* vm, buxn_file_t* device, uint8_t* mem, uint8_t p
 void
 buxn_file_deo(struct buxn_vm_s* vm, buxn_file_t* device, uint8_t* mem, uint8_t port);
 
+// See: buxn/devices/ports.h
+extern const struct buxn_port_device_s buxn_file_ports;
+
 // Must be provided by the host program
 
 buxn_file_handle_t*
@@ -39,4 +39,7 @@ buxn_mouse_check_button(buxn_mouse_t* device, uint8_t button) {
 	return (device->state & mask) > 0;
 }
 
+// See: buxn/devices/ports.h
+extern const struct buxn_port_device_s buxn_mouse_ports;
+
 #endif
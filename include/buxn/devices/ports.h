@@ -0,0 +1,70 @@
+#ifndef BUXN_DEVICE_PORTS_H
+#define BUXN_DEVICE_PORTS_H
+
+// A table from port to device handler.
+// It replaces the switch on the device id in buxn_vm_dei/buxn_vm_deo and
+// tells the VM which ports can be accessed without calling them.
+// See: doc/devices.md
+
+#include "../vm/vm.h"
+
+#define BUXN_PORT(PORT) (1u << (PORT))
+
+typedef uint8_t (*buxn_port_dei_fn_t)(buxn_vm_t* vm, void* device, uint8_t address);
+typedef void (*buxn_port_deo_fn_t)(buxn_vm_t* vm, void* device, uint8_t address);
+
+// Each device type provides one of those, e.g: buxn_screen_ports
+typedef struct buxn_port_device_s {
+	buxn_port_dei_fn_t dei;
+	buxn_port_deo_fn_t deo;
+	// Bit N is set when reading or writing port N has a side effect.
+	// The handler is not called for the other ports.
+	uint16_t dei_ports;
+	uint16_t deo_ports;
+} buxn_port_device_t;
+
+typedef struct {
+	buxn_port_dei_fn_t dei;
+	buxn_port_deo_fn_t deo;
+	void* device;
+} buxn_port_handler_t;
+
+typedef struct {
+	// Assign to buxn_vm_config_t.noop_ports
+	buxn_vm_noop_ports_t noop_ports;
+	buxn_port_handler_t handlers[BUXN_DEVICE_MEM_SIZE];
+} buxn_port_table_t;
+
+// All ports start as plain memory
+void
+buxn_port_table_init(buxn_port_table_t* table);
+
+void
+buxn_port_table_register(
+	buxn_port_table_t* table,
+	uint8_t device_id,
+	const buxn_port_device_t* type,
+	void* device
+);
+
+// For use in buxn_vm_dei
+static inline uint8_t
+buxn_port_table_dei(const buxn_port_table_t* table, buxn_vm_t* vm, uint8_t address) {
+	const buxn_port_handler_t* handler = &table->handlers[address];
+	if (handler->dei != NULL) {
+		return handler->dei(vm, handler->device, address);
+	} else {
+		return vm->device[address];
+	}
+}
+
+// For use in buxn_vm_deo
+static inline void
+buxn_port_table_deo(const buxn_port_table_t* table, buxn_vm_t* vm, uint8_t address) {
+	const buxn_port_handler_t* handler = &table->handlers[address];
+	if (handler->deo != NULL) {
+		handler->deo(vm, handler->device, address);
+	}
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef BUXN_DEVICE_REPLAY_H
+#define BUXN_DEVICE_REPLAY_H
+
+// Record every vector sent to the VM with its device inputs and play them
+// back later.
+// See: doc/devices.md
+
+#include "ports.h"
+#include "console.h"
+#include "mouse.h"
+#include "controller.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef enum {
+	BUXN_REPLAY_OFF,
+	BUXN_REPLAY_RECORD,
+	BUXN_REPLAY_PLAY,
+} buxn_replay_mode_t;
+
+typedef enum {
+	// Console/read with its type: BUXN_CONSOLE_STDIN or BUXN_CONSOLE_END
+	BUXN_REPLAY_CONSOLE = 0x01,
+	// The whole mouse state, followed by the mouse vector
+	BUXN_REPLAY_MOUSE = 0x02,
+	// The whole controller state, followed by the controller vector.
+	// The character is cleared after the vector like in buxn_controller_send_char.
+	BUXN_REPLAY_CONTROLLER = 0x03,
+	// Screen vector
+	BUXN_REPLAY_SCREEN = 0x04,
+	// Audio vector of the given device
+	BUXN_REPLAY_AUDIO = 0x05,
+	// The value returned by a captured port, see buxn_replay_capture
+	BUXN_REPLAY_DEI = 0x06,
+} buxn_replay_event_type_t;
+
+typedef struct {
+	buxn_replay_event_type_t type;
+	union {
+		struct {
+			uint8_t type;
+			uint8_t value;
+		} console;
+		buxn_mouse_t mouse;
+		buxn_controller_t controller;
+		uint8_t audio_device_id;
+		struct {
+			uint8_t address;
+			uint8_t value;
+		} dei;
+	};
+} buxn_replay_event_t;
+
+typedef struct {
+	buxn_replay_mode_t mode;
+	FILE* file;
+
+	// Screen size when recording started, 0 when there is no screen
+	uint16_t screen_width;
+	uint16_t screen_height;
+
+	// Devices which receive the events
+	buxn_console_t* console;
+	buxn_mouse_t* mouse;
+	buxn_controller_t* controller;
+
+	// Number of events which did not match what the VM did while playing
+	uint32_t num_mismatches;
+	uint32_t num_events;
+
+	bool has_next;
+	buxn_replay_event_t next;
+	buxn_port_handler_t captured[BUXN_DEVICE_MEM_SIZE];
+} buxn_replay_t;
+
+// Write the header, the device pointers and screen size must be set before
+bool
+buxn_replay_begin_record(buxn_replay_t* replay, FILE* file);
+
+// Read the header which sets the screen size
+bool
+buxn_replay_begin_play(buxn_replay_t* replay, FILE* file);
+
+// Log the values read from a device which can change between runs such as
+// datetime.
+// Call after the device was registered in the table.
+void
+buxn_replay_capture(buxn_replay_t* replay, buxn_port_table_t* table, uint8_t device_id);
+
+// Run the vector of an event on the VM and log it when recording
+void
+buxn_replay_send(buxn_replay_t* replay, struct buxn_vm_s* vm, const buxn_replay_event_t* event);
+
+// Next event to send while playing, false at the end of the log
+bool
+buxn_replay_next(buxn_replay_t* replay, buxn_replay_event_t* event);
+
+#endif
@@ -23,12 +23,29 @@ typedef struct {
 	int x1, y1, x2, y2;
 } buxn_screen_rect_t;
 
+// Changes are tracked in tiles of this many pixels on each side
+#define BUXN_SCREEN_TILE_SIZE 8
+
+// Number of spans buxn_screen_render_spans can return for a screen height
+#define BUXN_SCREEN_MAX_SPANS(height) (((height) + BUXN_SCREEN_TILE_SIZE - 1) / BUXN_SCREEN_TILE_SIZE)
+
+// Bytes in a row of a packed layer
+#define BUXN_SCREEN_PACKED_ROW_SIZE(width) (((width) + 16 + 3) / 4)
+
+// Each layer has a margin of 8 pixels on every side.
+// A row is width + 16 bytes, one per pixel.
+// When packed is set, a row is BUXN_SCREEN_PACKED_ROW_SIZE(width) bytes and
+// pixel x is in the bits (x % 4) * 2 and (x % 4) * 2 + 1 of byte x / 4.
 typedef struct {
 	int rX, rY, rA, rMX, rMY, rMA, rML, rDX, rDY;
 	int width, height;
+	// Must be set before buxn_screen_resize and not changed afterward
+	bool packed;
 
-	buxn_screen_rect_t fg_dirty_rect;
-	buxn_screen_rect_t bg_dirty_rect;
+	// One bit per tile changed since the last render, a row of tiles starts
+	// on a new byte
+	uint8_t* fg_dirty_tiles;
+	uint8_t* bg_dirty_tiles;
 
 	uint8_t* fg;
 	uint8_t bg[];
@@ -36,12 +53,17 @@ typedef struct {
 
 typedef struct {
 	size_t screen_mem_size;
+	// For a packed screen
+	size_t packed_screen_mem_size;
 	size_t target_mem_size;
 } buxn_screen_info_t;
 
 typedef enum {
 	BUXN_SCREEN_LAYER_BACKGROUND,
 	BUXN_SCREEN_LAYER_FOREGROUND,
+	// The foreground over the background, color 0 of the foreground being
+	// transparent
+	BUXN_SCREEN_LAYER_COMPOSITE,
 } buxn_screen_layer_type_t;
 
 buxn_screen_info_t
@@ -50,12 +72,21 @@ buxn_screen_info(uint16_t width, uint16_t height);
 void
 buxn_screen_resize(buxn_screen_t* screen, uint16_t width, uint16_t height);
 
+// Copy the layers of src into dst, which is resized to src when needed.
+// dst must be allocated for the size and layout of src.
+// The tiles changed in src are added to the ones of dst and cleared in src
+// so dst can be rendered by another thread while src keeps changing.
+void
+buxn_screen_copy(buxn_screen_t* dst, buxn_screen_t* src);
+
 void
 buxn_screen_preferred_size(struct buxn_vm_s* vm, uint16_t* width, uint16_t* height);
 
 void
 buxn_screen_update(struct buxn_vm_s* vm);
 
+// Only the tiles changed since the last render are written to target.
+// Returns whether anything changed.
 bool
 buxn_screen_render(
 	buxn_screen_t* screen,
@@ -64,6 +95,20 @@ buxn_screen_render(
 	uint32_t* target
 );
 
+// Same as buxn_screen_render and the changed regions are listed in spans.
+// A span is a band of rows, top to bottom, with the columns of all the tiles
+// changed in it.
+// spans must hold BUXN_SCREEN_MAX_SPANS(height) entries.
+// Returns the number of spans.
+int
+buxn_screen_render_spans(
+	buxn_screen_t* screen,
+	buxn_screen_layer_type_t layer,
+	uint32_t palette[4],
+	uint32_t* target,
+	buxn_screen_rect_t* spans
+);
+
 uint8_t
 buxn_screen_dei(struct buxn_vm_s* vm, buxn_screen_t* device, uint8_t address);
 
@@ -73,6 +118,9 @@ buxn_screen_deo(struct buxn_vm_s* vm, buxn_screen_t* device, uint8_t address);
 void
 buxn_screen_force_refresh(buxn_screen_t* device);
 
+// See: buxn/devices/ports.h
+extern const struct buxn_port_device_s buxn_screen_ports;
+
 // Must be provided by the host program
 
 extern buxn_screen_t*
@@ -3,6 +3,11 @@
 
 #include <stdint.h>
 
+// System/expansion extension: [ 80 count* ] followed by count fill or copy
+// records, back to back.
+// Processing stops at the first unknown operation.
+#define BUXN_SYSTEM_EXPANSION_BATCH 0x80
+
 struct buxn_vm_s;
 
 int
@@ -17,6 +22,9 @@ buxn_system_dei(struct buxn_vm_s* vm, uint8_t address);
 void
 buxn_system_deo(struct buxn_vm_s* vm, uint8_t address);
 
+// See: buxn/devices/ports.h
+extern const struct buxn_port_device_s buxn_system_ports;
+
 // Must be provided by the host program
 
 extern void
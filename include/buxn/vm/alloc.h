@@ -0,0 +1,25 @@
+#ifndef BUXN_VM_ALLOC_H
+#define BUXN_VM_ALLOC_H
+
+#include <stdint.h>
+
+struct buxn_vm_s;
+
+// Allocates a VM with memory_size bytes of zeroed memory.
+// Where the platform allows it, the memory is only reserved and pages are
+// backed by physical memory once they are touched.
+// Unused banks cost nothing so it is fine to always ask for all of them.
+// Only config.memory_size is set and it must not be changed afterwards.
+// Returns NULL when memory could not be allocated.
+struct buxn_vm_s*
+buxn_vm_alloc(uint32_t memory_size);
+
+void
+buxn_vm_free(struct buxn_vm_s* vm);
+
+// Meant for buxn_vm_config_t.zero_memory of a VM from buxn_vm_alloc.
+// Whole pages are handed back to the OS instead of being cleared.
+void
+buxn_vm_zero_memory(struct buxn_vm_s* vm, uint32_t addr, uint32_t size);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef BUXN_VM_COVERAGE_H
+#define BUXN_VM_COVERAGE_H
+
+// Bitmaps filled when buxn_vm_config_t.coverage is set.
+// See: doc/vm.md
+
+#include "vm.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+struct buxn_vm_coverage_s {
+	// One bit per address in the first bank where an instruction was executed
+	uint8_t executed[BUXN_MEMORY_BANK_SIZE / 8];
+
+	// Also fill the branch bitmaps for JCN and JCI
+	bool record_branches;
+	// One bit per address of a conditional jump which was taken
+	uint8_t branch_taken[BUXN_MEMORY_BANK_SIZE / 8];
+	// One bit per address of a conditional jump which fell through
+	uint8_t branch_not_taken[BUXN_MEMORY_BANK_SIZE / 8];
+};
+
+// Write the set bits as text
+bool
+buxn_vm_coverage_write(const buxn_vm_coverage_t* coverage, FILE* file);
+
+// Add the bits in a file written by buxn_vm_coverage_write
+bool
+buxn_vm_coverage_read(buxn_vm_coverage_t* coverage, FILE* file);
+
+#endif
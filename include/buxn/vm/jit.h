@@ -0,0 +1,23 @@
+#ifndef BUXN_VM_JIT_H
+#define BUXN_VM_JIT_H
+
+#include <stdint.h>
+
+typedef struct buxn_vm_jit_s buxn_vm_jit_t;
+struct buxn_vm_s;
+
+// Returns NULL when the platform is not supported or memory could not be
+// mapped.
+// The VM must outlive the JIT.
+buxn_vm_jit_t*
+buxn_vm_jit_init(struct buxn_vm_s* vm);
+
+void
+buxn_vm_jit_cleanup(buxn_vm_jit_t* jit);
+
+// Equivalent to buxn_vm_execute.
+// Falls back to the interpreter when a hook is attached.
+void
+buxn_vm_jit_execute(buxn_vm_jit_t* jit, uint16_t vector);
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef BUXN_VM_PROFILE_H
+#define BUXN_VM_PROFILE_H
+
+// Counters collected when buxn_vm_config_t.profile is set.
+// See: doc/vm.md
+
+#include "vm.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Must be a power of 2
+#define BUXN_VM_PROFILE_MAX_CALL_EDGES 4096
+// Must be a power of 2
+#define BUXN_VM_PROFILE_MAX_STACKS 1024
+// Deeper stacks lose their outermost frames
+#define BUXN_VM_PROFILE_MAX_STACK_DEPTH 32
+
+typedef struct {
+	// Address of the JSR or JSI instruction
+	uint16_t from;
+	uint16_t to;
+	uint64_t count;
+} buxn_vm_call_edge_t;
+
+typedef struct {
+	// Outermost first, the last frame is the sampled pc.
+	// The other frames are the addresses of the calling instructions.
+	uint16_t frames[BUXN_VM_PROFILE_MAX_STACK_DEPTH];
+	uint8_t depth;
+	uint64_t count;
+} buxn_vm_stack_sample_t;
+
+struct buxn_vm_profile_s {
+	uint64_t opcode_counts[256];
+	uint64_t pc_counts[BUXN_MEMORY_BANK_SIZE];
+	// Open addressing hash table, unused entries have a count of 0
+	buxn_vm_call_edge_t call_edges[BUXN_VM_PROFILE_MAX_CALL_EDGES];
+	// Calls which did not fit in call_edges
+	uint64_t num_dropped_calls;
+
+	// Sample the call stack every that many instructions, 0 to disable
+	uint32_t sample_interval;
+	uint32_t sample_clock;
+	// Open addressing hash table, unused entries have a count of 0
+	buxn_vm_stack_sample_t stacks[BUXN_VM_PROFILE_MAX_STACKS];
+	// Samples which did not fit in stacks
+	uint64_t num_dropped_samples;
+};
+
+// Write the non-zero counters as text
+bool
+buxn_vm_profile_write(const buxn_vm_profile_t* profile, FILE* file);
+
+// Add the counters in a file written by buxn_vm_profile_write
+bool
+buxn_vm_profile_read(buxn_vm_profile_t* profile, FILE* file);
+
+// Returns NULL when the table is full
+static inline buxn_vm_call_edge_t*
+buxn_vm_profile_call_edge(buxn_vm_profile_t* profile, uint16_t from, uint16_t to) {
+	uint32_t key = ((uint32_t)from << 16) | to;
+	uint32_t mask = BUXN_VM_PROFILE_MAX_CALL_EDGES - 1;
+	uint32_t index = (key * 2654435761u) >> 16;
+	for (uint32_t i = 0; i < BUXN_VM_PROFILE_MAX_CALL_EDGES; ++i) {
+		buxn_vm_call_edge_t* edge = &profile->call_edges[(index + i) & mask];
+		if (edge->count == 0) {
+			edge->from = from;
+			edge->to = to;
+			return edge;
+		} else if (edge->from == from && edge->to == to) {
+			return edge;
+		}
+	}
+
+	return NULL;
+}
+
+static inline void
+buxn_vm_profile_record_call(buxn_vm_profile_t* profile, uint16_t from, uint16_t to) {
+	buxn_vm_call_edge_t* edge = buxn_vm_profile_call_edge(profile, from, to);
+	if (edge != NULL) {
+		edge->count += 1;
+	} else {
+		profile->num_dropped_calls += 1;
+	}
+}
+
+// Returns NULL when the table is full
+static inline buxn_vm_stack_sample_t*
+buxn_vm_profile_stack(
+	buxn_vm_profile_t* profile,
+	const uint16_t* frames,
+	uint8_t depth
+) {
+	uint32_t hash = 2166136261u;
+	for (uint8_t i = 0; i < depth; ++i) {
+		hash = (hash ^ frames[i]) * 16777619u;
+	}
+
+	uint32_t mask = BUXN_VM_PROFILE_MAX_STACKS - 1;
+	for (uint32_t i = 0; i < BUXN_VM_PROFILE_MAX_STACKS; ++i) {
+		buxn_vm_stack_sample_t* sample = &profile->stacks[(hash + i) & mask];
+		if (sample->count == 0) {
+			memcpy(sample->frames, frames, sizeof(frames[0]) * depth);
+			sample->depth = depth;
+			return sample;
+		} else if (
+			sample->depth == depth
+			&& memcmp(sample->frames, frames, sizeof(frames[0]) * depth) == 0
+		) {
+			return sample;
+		}
+	}
+
+	return NULL;
+}
+
+// Whether a short on the return stack looks like it was pushed by JSR or JSI
+static inline bool
+buxn_vm_profile_is_return_addr(const uint8_t* mem, uint16_t addr) {
+	uint8_t opcode = mem[(uint16_t)(addr - 1)];
+	return (opcode & 0x5f) == 0x0e  // JSR without the return flag
+		|| mem[(uint16_t)(addr - 3)] == 0x60;  // JSI
+}
+
+// Reconstruct the call stack from the return stack.
+// Values which were stashed on it are skipped as long as they do not look like
+// a return address.
+static inline void
+buxn_vm_profile_record_stack(
+	buxn_vm_profile_t* profile,
+	const uint8_t* mem,
+	const uint8_t* rs,
+	uint8_t rsp,
+	uint16_t pc
+) {
+	uint16_t frames[BUXN_VM_PROFILE_MAX_STACK_DEPTH];
+	uint8_t depth = BUXN_VM_PROFILE_MAX_STACK_DEPTH;
+	frames[--depth] = pc;
+	for (int top = rsp; top >= 2 && depth > 0;) {
+		uint16_t addr = buxn_vm_load2(rs, (uint16_t)(top - 2), 0xff);
+		if (buxn_vm_profile_is_return_addr(mem, addr)) {
+			frames[--depth] = mem[(uint16_t)(addr - 3)] == 0x60 ? addr - 3 : addr - 1;
+			top -= 2;
+		} else {
+			top -= 1;
+		}
+	}
+
+	buxn_vm_stack_sample_t* sample = buxn_vm_profile_stack(
+		profile,
+		frames + depth,
+		BUXN_VM_PROFILE_MAX_STACK_DEPTH - depth
+	);
+	if (sample != NULL) {
+		sample->count += 1;
+	} else {
+		profile->num_dropped_samples += 1;
+	}
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef BUXN_VM_ROM2C_H
+#define BUXN_VM_ROM2C_H
+
+// Runtime support for C code generated by buxn-rom2c.
+// See: doc/rom2c.md
+
+#include "vm.h"
+#include <stdbool.h>
+
+// Returned by translated routines, the lower 16 bits is pc
+#define BUXN_ROM2C_BRK      (1u << 16)
+#define BUXN_ROM2C_VALIDATE (1u << 17)
+
+// Native calls deeper than this continue through the dispatcher instead
+#define BUXN_ROM2C_MAX_DEPTH 512
+
+// Runs from pc until it leaves the routine.
+// Returns the next pc, possibly with one of the flags above.
+typedef uint32_t (*buxn_rom2c_fn_t)(buxn_vm_t* vm, uint16_t pc, uint32_t depth);
+
+// Copy the translated rom into memory
+void
+buxn_rom2c_load_rom(buxn_vm_t* vm);
+
+// Can be used as buxn_vm_config_t.native.
+// Falls back to the interpreter for code that was not translated or was
+// modified.
+void
+buxn_rom2c_execute(buxn_vm_t* vm, uint16_t pc);
+
+// Must be provided by the generated code
+
+extern const uint8_t buxn_rom2c_rom[];
+
+extern const uint32_t buxn_rom2c_rom_size;
+
+// Bitmap of the bytes in memory which the generated code depends on
+extern const uint8_t buxn_rom2c_code_map[BUXN_MEMORY_BANK_SIZE / 8];
+
+// Returns NULL if there is no translated code at pc
+extern buxn_rom2c_fn_t
+buxn_rom2c_lookup(uint16_t pc);
+
+// Helpers for the generated code
+
+static inline uint16_t
+buxn_rom2c_pop(const uint8_t* stack, uint8_t* ptr, int size) {
+	if (size == 2) {
+		*ptr -= 2;
+		return buxn_vm_load2(stack, *ptr, 0xff);
+	} else {
+		*ptr -= 1;
+		return stack[*ptr];
+	}
+}
+
+static inline void
+buxn_rom2c_push(uint8_t* stack, uint8_t* ptr, int size, uint16_t value) {
+	if (size == 2) {
+		stack[*ptr] = value >> 8;
+		stack[(uint8_t)(*ptr + 1)] = value & 0xff;
+		*ptr += 2;
+	} else {
+		stack[*ptr] = value & 0xff;
+		*ptr += 1;
+	}
+}
+
+static inline uint16_t
+buxn_rom2c_mem_load(const uint8_t* mem, uint16_t addr, uint16_t addr_mask, int size) {
+	if (size == 2) {
+		return buxn_vm_load2(mem, addr, addr_mask);
+	} else {
+		return mem[addr & addr_mask];
+	}
+}
+
+// Returns whether the store overwrote translated code
+static inline bool
+buxn_rom2c_mem_store(
+	buxn_vm_t* vm,
+	uint16_t addr,
+	uint16_t addr_mask,
+	int size,
+	uint16_t value
+) {
+	uint8_t* mem = vm->memory;
+	uint16_t first = addr & addr_mask;
+	vm->dirty_pages[first >> BUXN_VM_PAGE_SHIFT] = 1;
+	if (size == 2) {
+		uint16_t second = (addr + 1) & addr_mask;
+		mem[first] = value >> 8;
+		mem[second] = value & 0xff;
+		vm->dirty_pages[second >> BUXN_VM_PAGE_SHIFT] = 1;
+		if (vm->config.code_cache != NULL) {
+			buxn_vm_mem_invalidate(vm, first, 1);
+			buxn_vm_mem_invalidate(vm, second, 1);
+		}
+		return ((buxn_rom2c_code_map[first >> 3] >> (first & 7)) & 1)
+			| ((buxn_rom2c_code_map[second >> 3] >> (second & 7)) & 1);
+	} else {
+		mem[first] = value & 0xff;
+		if (vm->config.code_cache != NULL) { buxn_vm_mem_invalidate(vm, first, 1); }
+		return (buxn_rom2c_code_map[first >> 3] >> (first & 7)) & 1;
+	}
+}
+
+static inline uint8_t
+buxn_rom2c_dei1(buxn_vm_t* vm, uint8_t port) {
+	const buxn_vm_noop_ports_t* noop_ports = vm->config.noop_ports;
+	if (noop_ports != NULL && noop_ports->dei[port]) {
+		return vm->device[port];
+	} else {
+		return buxn_vm_dei(vm, port);
+	}
+}
+
+static inline uint16_t
+buxn_rom2c_dei(buxn_vm_t* vm, uint8_t port, int size) {
+	if (size == 2) {
+		uint16_t hi = buxn_rom2c_dei1(vm, port);
+		uint16_t lo = buxn_rom2c_dei1(vm, (uint8_t)(port + 1));
+		return (uint16_t)(hi << 8) | lo;
+	} else {
+		return buxn_rom2c_dei1(vm, port);
+	}
+}
+
+static inline bool
+buxn_rom2c_port_may_write_memory(uint8_t port) {
+	uint8_t device = buxn_device_id(port);
+	return device == BUXN_DEVICE_FILE_0
+		|| device == BUXN_DEVICE_FILE_1
+		// System/expansion
+		|| port == 0x02
+		|| port == 0x03;
+}
+
+// Returns whether the device could have written to memory
+static inline bool
+buxn_rom2c_deo1(buxn_vm_t* vm, uint8_t port) {
+	const buxn_vm_noop_ports_t* noop_ports = vm->config.noop_ports;
+	if (noop_ports != NULL && noop_ports->deo[port]) {
+		return false;
+	} else {
+		buxn_vm_deo(vm, port);
+		return buxn_rom2c_port_may_write_memory(port);
+	}
+}
+
+// Returns whether the device could have written to memory
+static inline bool
+buxn_rom2c_deo(buxn_vm_t* vm, uint8_t port, int size, uint16_t value) {
+	if (size == 2) {
+		uint8_t next_port = (uint8_t)(port + 1);
+		vm->device[port] = value >> 8;
+		vm->device[next_port] = value & 0xff;
+		bool first = buxn_rom2c_deo1(vm, port);
+		bool second = buxn_rom2c_deo1(vm, next_port);
+		return first || second;
+	} else {
+		vm->device[port] = value & 0xff;
+		return buxn_rom2c_deo1(vm, port);
+	}
+}
+
+#endif
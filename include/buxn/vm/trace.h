@@ -0,0 +1,101 @@
+#ifndef BUXN_VM_TRACE_H
+#define BUXN_VM_TRACE_H
+
+// Ring buffer of the last instructions, written when buxn_vm_config_t.trace is
+// set.
+// See: doc/vm.md
+
+#include "vm.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BUXN_VM_TRACE_MAGIC 0x43525442  // "BTRC" in little endian
+#define BUXN_VM_TRACE_VERSION 1
+
+// Also record the top short of the working stack
+#define BUXN_VM_TRACE_TOS 1
+
+typedef struct {
+	uint16_t pc;
+	uint8_t opcode;
+	// Stack pointers before the instruction
+	uint8_t wsp;
+	uint8_t rsp;
+	uint8_t reserved;
+	// 0 without BUXN_VM_TRACE_TOS
+	uint16_t tos;
+} buxn_vm_trace_record_t;
+
+// This is also the layout of a trace file, in the byte order of the host.
+// A file can be mapped as the buffer so the records are kept when the process
+// dies and another process can read them while the VM runs.
+struct buxn_vm_trace_s {
+	uint32_t magic;
+	uint16_t version;
+	// BUXN_VM_TRACE_*
+	uint16_t flags;
+	// Must be a power of 2
+	uint32_t capacity;
+	uint32_t reserved;
+	// Number of records ever written.
+	// The newest one is at (head - 1) & (capacity - 1).
+	_Atomic uint64_t head;
+	buxn_vm_trace_record_t records[];
+};
+
+size_t
+buxn_vm_trace_mem_size(uint32_t capacity);
+
+// mem must be buxn_vm_trace_mem_size(capacity) bytes, aligned for a uint64_t
+buxn_vm_trace_t*
+buxn_vm_trace_init(void* mem, uint32_t capacity, uint16_t flags);
+
+// Check the header of size bytes read from an untrusted source
+bool
+buxn_vm_trace_is_valid(const buxn_vm_trace_t* trace, size_t size);
+
+// Copy the records still in the buffer, oldest first, into capacity records.
+// At most the last capacity - 1 records are kept: the trace can be written to
+// at the same time by a single VM and records which were overwritten during
+// the copy are left out.
+// first_index is optional and receives the number of records written before
+// the first one copied.
+// Returns the number of records copied.
+uint32_t
+buxn_vm_trace_copy(
+	const buxn_vm_trace_t* trace,
+	buxn_vm_trace_record_t* records,
+	uint64_t* first_index
+);
+
+// Create or truncate a file and map it as a trace.
+// Returns NULL when the platform or the file does not allow it.
+buxn_vm_trace_t*
+buxn_vm_trace_map_file(const char* path, uint32_t capacity, uint16_t flags);
+
+void
+buxn_vm_trace_unmap(buxn_vm_trace_t* trace);
+
+static inline void
+buxn_vm_trace_record(
+	buxn_vm_trace_t* trace,
+	uint16_t pc,
+	uint8_t opcode,
+	uint8_t wsp,
+	uint8_t rsp,
+	uint16_t tos
+) {
+	// There is only one writer, readers only look at head
+	uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+	trace->records[head & (trace->capacity - 1)] = (buxn_vm_trace_record_t){
+		.pc = pc,
+		.opcode = opcode,
+		.wsp = wsp,
+		.rsp = rsp,
+		.tos = tos,
+	};
+	atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+#endif
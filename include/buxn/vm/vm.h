@@ -2,12 +2,16 @@
 #define BUXN_VM_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define BUXN_STACK_SIZE 256
 #define BUXN_RESET_VECTOR 0x0100
 #define BUXN_MEMORY_BANK_SIZE ((size_t)UINT16_MAX + 1)
 #define BUXN_MAX_NUM_MEMORY_BANKS 16
 #define BUXN_DEVICE_MEM_SIZE 256
+#define BUXN_VM_PAGE_SHIFT 12
+#define BUXN_VM_PAGE_SIZE ((size_t)1 << BUXN_VM_PAGE_SHIFT)
+#define BUXN_VM_MAX_NUM_PAGES (BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS / BUXN_VM_PAGE_SIZE)
 
 #define BUXN_DEVICE_SYSTEM     0x00
 #define BUXN_DEVICE_CONSOLE    0x10
@@ -49,30 +53,161 @@ typedef struct {
 	buxn_vm_hook_fn_t fn;
 } buxn_vm_hook_t;
 
+typedef void (*buxn_vm_native_fn_t)(buxn_vm_t* vm, uint16_t pc);
+
+typedef void (*buxn_vm_zero_memory_fn_t)(buxn_vm_t* vm, uint32_t addr, uint32_t size);
+
+typedef enum {
+	// The vector ended with BRK
+	BUXN_VM_FINISHED,
+	// The budget ran out before the vector ended, it can be resumed from vm->pc
+	BUXN_VM_BUDGET_EXHAUSTED,
+	// System/state was set, vm->pc is after the DEO which set it
+	BUXN_VM_HALTED,
+} buxn_vm_status_t;
+
+typedef struct {
+	const void* handler;
+	uint16_t operand;
+} buxn_vm_cached_op_t;
+
+typedef struct buxn_vm_code_cache_s {
+	const void* miss_handler;
+	buxn_vm_cached_op_t ops[BUXN_MEMORY_BANK_SIZE];
+} buxn_vm_code_cache_t;
+
+typedef struct buxn_vm_profile_s buxn_vm_profile_t;
+typedef struct buxn_vm_trace_s buxn_vm_trace_t;
+typedef struct buxn_vm_coverage_s buxn_vm_coverage_t;
+
+#define BUXN_VM_HOOK_FILTER_ALWAYS 1
+#define BUXN_VM_HOOK_FILTER_WATCH  2
+#define BUXN_VM_HOOK_FILTER_PAGE_SHIFT 8
+
+// Limits the opcodes before which config.hook is called.
+// The hook is still called before the first opcode of every vector.
+typedef struct {
+	// Non-zero to call the hook before every opcode, e.g: when stepping
+	uint8_t all;
+	// One of BUXN_VM_HOOK_FILTER_* for each opcode, 0 to only check exec.
+	// With BUXN_VM_HOOK_FILTER_WATCH, the address accessed by a load, store,
+	// DEI or DEO is checked against mem_pages or dev_ports.
+	uint8_t opcodes[256];
+	// One bit per address in the first bank
+	uint8_t exec[BUXN_MEMORY_BANK_SIZE / 8];
+	// One bit per 1 << BUXN_VM_HOOK_FILTER_PAGE_SHIFT bytes of the first bank
+	uint8_t mem_pages[(BUXN_MEMORY_BANK_SIZE >> BUXN_VM_HOOK_FILTER_PAGE_SHIFT) / 8];
+	// One bit per port
+	uint8_t dev_ports[BUXN_DEVICE_MEM_SIZE / 8];
+} buxn_vm_hook_filter_t;
+
+// Non-zero for ports which are plain memory: reading or writing them only
+// needs vm->device so buxn_vm_dei/buxn_vm_deo are not called.
+// See: buxn/devices/ports.h
+typedef struct {
+	uint8_t dei[BUXN_DEVICE_MEM_SIZE];
+	uint8_t deo[BUXN_DEVICE_MEM_SIZE];
+} buxn_vm_noop_ports_t;
+
 typedef struct {
 	void* userdata;
 	uint32_t memory_size;
 	buxn_vm_hook_t hook;
+	// Optional, must be kept alive while hook is attached.
+	// buxn_vm_execute_budget still calls the hook before every opcode.
+	const buxn_vm_hook_filter_t* hook_filter;
+	// Optional, must be zero-initialized before use.
+	// Stores invalidate it in every execution mode, so it stays valid when
+	// code is written under a hook, a budget, profile, trace, coverage or
+	// native code.
+	buxn_vm_code_cache_t* code_cache;
+	// Optional, must be zero-initialized before use.
+	// Takes precedence over code_cache and native.
+	// See: buxn/vm/profile.h
+	buxn_vm_profile_t* profile;
+	// Optional, must be initialized with buxn_vm_trace_init.
+	// Takes precedence over profile, code_cache and native.
+	// See: buxn/vm/trace.h
+	buxn_vm_trace_t* trace;
+	// Optional, must be zero-initialized before use.
+	// Takes precedence over code_cache and native.
+	// See: buxn/vm/coverage.h
+	buxn_vm_coverage_t* coverage;
+	// Optional, every port has side effects when this is NULL.
+	// Must not be changed while the JIT is attached.
+	const buxn_vm_noop_ports_t* noop_ports;
+	// Optional, runs vectors in place of the interpreter when no hook is
+	// attached.
+	// See: doc/rom2c.md
+	buxn_vm_native_fn_t native;
+	// Optional, clears memory in buxn_vm_reset in place of memset.
+	// See: buxn/vm/alloc.h
+	buxn_vm_zero_memory_fn_t zero_memory;
 } buxn_vm_config_t;
 
 struct buxn_vm_s {
 	buxn_vm_config_t config;
 
 	// VM state
+	// Where buxn_vm_execute_budget stopped
+	uint16_t pc;
 	uint8_t wsp;
 	uint8_t rsp;
 	uint8_t ws[BUXN_STACK_SIZE];
 	uint8_t rs[BUXN_STACK_SIZE];
 	uint8_t device[BUXN_DEVICE_MEM_SIZE];
+	// Non-zero for every page of memory written since the last snapshot
+	uint8_t dirty_pages[BUXN_VM_MAX_NUM_PAGES];
 	uint8_t memory[];
 };
 
+// Must be allocated with sizeof(buxn_vm_snapshot_t) + config.memory_size bytes
+typedef struct {
+	uint16_t pc;
+	uint8_t wsp;
+	uint8_t rsp;
+	uint8_t ws[BUXN_STACK_SIZE];
+	uint8_t rs[BUXN_STACK_SIZE];
+	uint8_t device[BUXN_DEVICE_MEM_SIZE];
+	uint8_t memory[];
+} buxn_vm_snapshot_t;
+
 void
 buxn_vm_reset(buxn_vm_t* vm, uint8_t reset_flags);
 
 void
 buxn_vm_execute(buxn_vm_t* vm, uint16_t vector);
 
+// Like buxn_vm_execute but starts at pc even when it is 0.
+// Used by native code (e.g: rom2c) to hand a jump over to the interpreter.
+void
+buxn_vm_execute_from(buxn_vm_t* vm, uint16_t pc);
+
+// Execute at most max_instructions opcodes.
+// Nothing runs when vector is 0.
+// Call buxn_vm_resume_budget to continue after BUXN_VM_BUDGET_EXHAUSTED.
+// The code cache and config.native are not used.
+buxn_vm_status_t
+buxn_vm_execute_budget(buxn_vm_t* vm, uint16_t vector, uint32_t max_instructions);
+
+// Continue from vm->pc for at most max_instructions opcodes, even when it is 0
+buxn_vm_status_t
+buxn_vm_resume_budget(buxn_vm_t* vm, uint32_t max_instructions);
+
+// Must be called when memory is modified outside of the VM's own instructions
+void
+buxn_vm_mem_invalidate(buxn_vm_t* vm, uint32_t addr, uint32_t size);
+
+// Copy the whole state of the VM and start tracking the pages written after
+void
+buxn_vm_snapshot(buxn_vm_t* vm, buxn_vm_snapshot_t* snapshot);
+
+// Bring the parts selected by restore_flags (BUXN_VM_RESET_*) back to the
+// last snapshot of this VM.
+// Only the pages of memory written since then are copied.
+void
+buxn_vm_restore(buxn_vm_t* vm, const buxn_vm_snapshot_t* snapshot, uint8_t restore_flags);
+
 static inline uint8_t
 buxn_device_id(uint8_t address) {
 	return address & 0xf0;
@@ -83,6 +218,16 @@ buxn_device_port(uint8_t address) {
 	return address & 0x0f;
 }
 
+static inline uint8_t
+buxn_vm_bit_test(const uint8_t* bits, uint32_t index) {
+	return bits[index >> 3] & (1 << (index & 7));
+}
+
+static inline void
+buxn_vm_bit_set(uint8_t* bits, uint32_t index) {
+	bits[index >> 3] |= (uint8_t)(1 << (index & 7));
+}
+
 static inline uint16_t
 buxn_vm_load2(const uint8_t* mem, uint16_t addr, uint16_t addr_mask) {
 	uint16_t hi = (uint16_t)mem[(addr + 0) & addr_mask] << 8;
@@ -103,12 +248,20 @@ buxn_vm_mem_load2(const buxn_vm_t* vm, uint16_t addr) {
 static inline void
 buxn_vm_mem_store(buxn_vm_t* vm, uint16_t addr, uint8_t value) {
 	vm->memory[addr] = value;
+	vm->dirty_pages[addr >> BUXN_VM_PAGE_SHIFT] = 1;
+	if (vm->config.code_cache != NULL) { buxn_vm_mem_invalidate(vm, addr, 1); }
 }
 
 static inline void
 buxn_vm_mem_store2(buxn_vm_t* vm, uint16_t addr, uint16_t value) {
 	vm->memory[(uint16_t)(addr + 0)] = (value & 0xff00) >> 8;
 	vm->memory[(uint16_t)(addr + 1)] = (value & 0x00ff) >> 0;
+	vm->dirty_pages[(uint16_t)(addr + 0) >> BUXN_VM_PAGE_SHIFT] = 1;
+	vm->dirty_pages[(uint16_t)(addr + 1) >> BUXN_VM_PAGE_SHIFT] = 1;
+	if (vm->config.code_cache != NULL) {
+		buxn_vm_mem_invalidate(vm, (uint16_t)(addr + 0), 1);
+		buxn_vm_mem_invalidate(vm, (uint16_t)(addr + 1), 1);
+	}
 }
 
 static inline uint8_t
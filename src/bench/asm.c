@@ -0,0 +1,125 @@
+#include "common.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_ROUTINES 1200
+
+typedef struct {
+	barena_pool_t pool;
+	barena_t arena;
+	buxn_asm_ctx_t basm;
+	buxn_vfs_entry_t vfs[2];
+	char* source;
+	size_t source_size;
+	size_t source_capacity;
+} asm_bench_t;
+
+static void
+append(asm_bench_t* bench, const char* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	int size = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	size_t required = bench->source_size + (size_t)size + 1;
+	if (required > bench->source_capacity) {
+		bench->source_capacity = required > bench->source_capacity * 2 ? required : bench->source_capacity * 2;
+		bench->source = realloc(bench->source, bench->source_capacity);
+	}
+
+	va_start(args, fmt);
+	vsnprintf(bench->source + bench->source_size, (size_t)size + 1, fmt, args);
+	va_end(args);
+	bench->source_size += (size_t)size;
+}
+
+// Typed routines with a branch each so the type checker has work to do
+static void
+generate_source(asm_bench_t* bench) {
+	append(bench, "|0100\n");
+	for (int i = 0; i < NUM_ROUTINES; ++i) {
+		append(bench, "\t#0001 #%02x routine-%d POP2\n", i & 0xff, i);
+	}
+	append(bench, "\tBRK\n\n");
+
+	for (int i = 0; i < NUM_ROUTINES; ++i) {
+		append(
+			bench,
+			"@routine-%d ( a* b -- c* )\n"
+			"\tDUP #%02x GTH ?{ POP JMP2r }\n"
+			"\t#00 SWP ADD2 JMP2r\n"
+			"\t&label-%d\n\n",
+			i, (i * 31) & 0xff, i
+		);
+	}
+
+	for (int i = 0; i < NUM_ROUTINES / 4; ++i) {
+		append(bench, "@text-%d \"routine-%d $1 =routine-%d/label-%d\n", i, i, i, i);
+	}
+}
+
+static void*
+asm_bench_init_common(bool enable_chess) {
+	asm_bench_t* bench = calloc(1, sizeof(asm_bench_t));
+	barena_pool_init(&bench->pool, 1);
+	barena_init(&bench->arena, &bench->pool);
+	generate_source(bench);
+
+	bench->vfs[0] = (buxn_vfs_entry_t){
+		.name = "generated.tal",
+		.content = { .data = (const unsigned char*)bench->source, .size = (unsigned int)bench->source_size },
+	};
+	bench->basm = (buxn_asm_ctx_t){
+		.arena = &bench->arena,
+		.vfs = bench->vfs,
+		.enable_chess = enable_chess,
+	};
+
+	if (!buxn_bench_assemble(&bench->basm)) {
+		fprintf(stderr, "Could not assemble generated.tal (%d errors)\n", bench->basm.num_errors);
+	}
+
+	return bench;
+}
+
+static void*
+asm_bench_init(void) {
+	return asm_bench_init_common(false);
+}
+
+static void*
+chess_bench_init(void) {
+	return asm_bench_init_common(true);
+}
+
+static void
+asm_bench_run(void* userdata) {
+	asm_bench_t* bench = userdata;
+	buxn_bench_assemble(&bench->basm);
+}
+
+static void
+asm_bench_cleanup(void* userdata) {
+	asm_bench_t* bench = userdata;
+	barena_reset(&bench->arena);
+	barena_pool_cleanup(&bench->pool);
+	free(bench->source);
+	free(bench);
+}
+
+const buxn_bench_t buxn_bench_asm[] = {
+	{
+		.name = "asm/generated",
+		.init = asm_bench_init,
+		.run = asm_bench_run,
+		.cleanup = asm_bench_cleanup,
+	},
+	{
+		.name = "chess/generated",
+		.init = chess_bench_init,
+		.run = asm_bench_run,
+		.cleanup = asm_bench_cleanup,
+	},
+	{ 0 },
+};
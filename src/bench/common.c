@@ -0,0 +1,251 @@
+#include "common.h"
+#include <buxn/devices/system.h>
+#include <buxn/devices/console.h>
+#include <buxn/devices/screen.h>
+#include <buxn/devices/audio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct buxn_asm_file_s {
+	const char* content;
+	size_t size;
+	size_t pos;
+};
+
+buxn_bench_vm_t*
+buxn_bench_vm_init(uint32_t memory_size) {
+	buxn_bench_vm_t* bench_vm = malloc(sizeof(buxn_bench_vm_t));
+	buxn_port_table_init(&bench_vm->ports);
+	buxn_port_table_register(&bench_vm->ports, BUXN_DEVICE_SYSTEM, &buxn_system_ports, NULL);
+
+	bench_vm->vm = calloc(1, sizeof(buxn_vm_t) + memory_size);
+	bench_vm->vm->config = (buxn_vm_config_t){
+		.userdata = &bench_vm->ports,
+		.memory_size = memory_size,
+		.noop_ports = &bench_vm->ports.noop_ports,
+	};
+	buxn_vm_reset(bench_vm->vm, BUXN_VM_RESET_ALL);
+
+	return bench_vm;
+}
+
+void
+buxn_bench_vm_cleanup(buxn_bench_vm_t* bench_vm) {
+	free(bench_vm->vm);
+	free(bench_vm);
+}
+
+bool
+buxn_bench_assemble(buxn_asm_ctx_t* basm) {
+	barena_snapshot_t snapshot = barena_snapshot(basm->arena);
+	basm->rom_size = 0;
+	basm->num_errors = 0;
+	basm->chess = basm->enable_chess ? buxn_chess_begin(basm) : NULL;
+
+	bool result = buxn_asm(basm, basm->vfs[0].name);
+	if (result && basm->chess != NULL) {
+		result &= buxn_chess_end(basm->chess);
+	}
+
+	basm->chess = NULL;
+	barena_restore(basm->arena, snapshot);
+	return result;
+}
+
+// VM
+
+uint8_t
+buxn_vm_dei(buxn_vm_t* vm, uint8_t address) {
+	buxn_port_table_t* ports = vm->config.userdata;
+	return buxn_port_table_dei(ports, vm, address);
+}
+
+void
+buxn_vm_deo(buxn_vm_t* vm, uint8_t address) {
+	buxn_port_table_t* ports = vm->config.userdata;
+	buxn_port_table_deo(ports, vm, address);
+}
+
+void
+buxn_system_debug(buxn_vm_t* vm, uint8_t value) {
+	(void)vm;
+	(void)value;
+}
+
+void
+buxn_system_set_metadata(buxn_vm_t* vm, uint16_t address) {
+	(void)vm;
+	(void)address;
+}
+
+void
+buxn_system_theme_changed(buxn_vm_t* vm) {
+	(void)vm;
+}
+
+void
+buxn_console_handle_write(struct buxn_vm_s* vm, buxn_console_t* device, char c) {
+	(void)vm;
+	(void)device;
+	(void)c;
+}
+
+void
+buxn_console_handle_error(struct buxn_vm_s* vm, buxn_console_t* device, char c) {
+	(void)vm;
+	(void)device;
+	(void)c;
+}
+
+buxn_screen_t*
+buxn_screen_request_resize(
+	struct buxn_vm_s* vm,
+	buxn_screen_t* screen,
+	uint16_t width, uint16_t height
+) {
+	(void)vm;
+	(void)width;
+	(void)height;
+	return screen;
+}
+
+void
+buxn_audio_send(struct buxn_vm_s* vm, const buxn_audio_message_t* message) {
+	(void)vm;
+	buxn_audio_receive(message);
+}
+
+// Assembler
+
+void*
+buxn_asm_alloc(buxn_asm_ctx_t* ctx, size_t size, size_t alignment) {
+	return barena_memalign(ctx->arena, size, alignment);
+}
+
+void
+buxn_asm_put_rom(buxn_asm_ctx_t* ctx, uint16_t address, uint8_t value) {
+	uint16_t offset = address - 256;
+	ctx->rom[offset] = value;
+	ctx->rom_size = offset + 1 > ctx->rom_size ? offset + 1 : ctx->rom_size;
+}
+
+void
+buxn_asm_put_symbol(buxn_asm_ctx_t* ctx, uint16_t addr, const buxn_asm_sym_t* sym) {
+	if (ctx->chess != NULL) {
+		buxn_chess_handle_symbol(ctx->chess, addr, sym);
+	}
+}
+
+buxn_asm_file_t*
+buxn_asm_fopen(buxn_asm_ctx_t* ctx, const char* filename) {
+	for (buxn_vfs_entry_t* entry = ctx->vfs; entry->name != NULL; ++entry) {
+		if (strcmp(entry->name, filename) == 0) {
+			buxn_asm_file_t* file = barena_memalign(
+				ctx->arena, sizeof(buxn_asm_file_t), _Alignof(buxn_asm_file_t)
+			);
+			file->content = (const char*)entry->content.data;
+			file->size = entry->content.size;
+			file->pos = 0;
+			return file;
+		}
+	}
+
+	return NULL;
+}
+
+void
+buxn_asm_fclose(buxn_asm_ctx_t* ctx, buxn_asm_file_t* file) {
+	(void)ctx;
+	(void)file;
+}
+
+int
+buxn_asm_fgetc(buxn_asm_ctx_t* ctx, buxn_asm_file_t* file) {
+	(void)ctx;
+	if (file->pos >= file->size) {
+		return BUXN_ASM_IO_EOF;
+	} else {
+		return (int)file->content[file->pos++];
+	}
+}
+
+void
+buxn_asm_report(
+	buxn_asm_ctx_t* ctx,
+	buxn_asm_report_type_t type,
+	const buxn_asm_report_t* report
+) {
+	(void)report;
+	if (type == BUXN_ASM_REPORT_ERROR) { ++ctx->num_errors; }
+}
+
+// Type checker
+
+void*
+buxn_chess_alloc(buxn_asm_ctx_t* ctx, size_t size, size_t alignment) {
+	return buxn_asm_alloc(ctx, size, alignment);
+}
+
+uint8_t
+buxn_chess_get_rom(buxn_asm_ctx_t* ctx, uint16_t address) {
+	return ctx->rom[address - 256];
+}
+
+void*
+buxn_chess_begin_mem_region(buxn_asm_ctx_t* ctx) {
+	return (void*)barena_snapshot(ctx->arena);
+}
+
+void
+buxn_chess_end_mem_region(buxn_asm_ctx_t* ctx, void* region) {
+	barena_restore(ctx->arena, (barena_snapshot_t)region);
+}
+
+void
+buxn_chess_report(
+	buxn_asm_ctx_t* ctx,
+	buxn_chess_id_t trace_id,
+	buxn_chess_report_type_t type,
+	const buxn_asm_report_t* report
+) {
+	(void)trace_id;
+	(void)report;
+	if (type == BUXN_CHESS_REPORT_ERROR) { ++ctx->num_errors; }
+}
+
+void
+buxn_chess_begin_trace(
+	buxn_asm_ctx_t* ctx,
+	buxn_chess_id_t trace_id,
+	buxn_chess_id_t parent_id
+) {
+	(void)ctx;
+	(void)trace_id;
+	(void)parent_id;
+}
+
+void
+buxn_chess_end_trace(
+	buxn_asm_ctx_t* ctx,
+	buxn_chess_id_t trace_id,
+	bool success
+) {
+	(void)ctx;
+	(void)trace_id;
+	(void)success;
+}
+
+void
+buxn_chess_deo(
+	buxn_asm_ctx_t* ctx,
+	buxn_chess_id_t trace_id,
+	const buxn_chess_vm_state_t* state,
+	uint8_t value,
+	uint8_t port
+) {
+	(void)ctx;
+	(void)trace_id;
+	(void)state;
+	(void)value;
+	(void)port;
+}
@@ -0,0 +1,62 @@
+#ifndef BUXN_BENCH_COMMON_H
+#define BUXN_BENCH_COMMON_H
+
+#include <xincbin.h>
+#include <barena.h>
+#include <buxn/asm/asm.h>
+#include <buxn/asm/chess.h>
+#include <buxn/vm/vm.h>
+#include <buxn/devices/ports.h>
+
+typedef struct {
+	const char* name;
+	// Bytes processed by one run, used to report a throughput.
+	// 0 when it does not apply.
+	uint64_t num_bytes;
+
+	// Everything which should not be measured, the result is passed to run
+	void* (*init)(void);
+	void (*run)(void* userdata);
+	void (*cleanup)(void* userdata);
+} buxn_bench_t;
+
+// Each list ends with an entry without a name
+extern const buxn_bench_t buxn_bench_vm[];
+extern const buxn_bench_t buxn_bench_devices[];
+extern const buxn_bench_t buxn_bench_asm[];
+
+typedef struct {
+	const char* name;
+	xincbin_data_t content;
+} buxn_vfs_entry_t;
+
+struct buxn_asm_ctx_s {
+	buxn_vfs_entry_t* vfs;
+	barena_t* arena;
+	buxn_chess_t* chess;
+	bool enable_chess;
+
+	char rom[UINT16_MAX];
+	uint16_t rom_size;
+
+	int num_errors;
+};
+
+// A VM whose devices are in buxn_vm_config_t.userdata
+typedef struct {
+	buxn_port_table_t ports;
+	buxn_vm_t* vm;
+} buxn_bench_vm_t;
+
+buxn_bench_vm_t*
+buxn_bench_vm_init(uint32_t memory_size);
+
+void
+buxn_bench_vm_cleanup(buxn_bench_vm_t* bench_vm);
+
+// Assemble the first file of the vfs.
+// Errors are counted but not printed.
+bool
+buxn_bench_assemble(buxn_asm_ctx_t* basm);
+
+#endif
@@ -0,0 +1,442 @@
+#include "common.h"
+#include <buxn/devices/system.h>
+#include <buxn/devices/screen.h>
+#include <buxn/devices/audio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void
+dev_store2(buxn_vm_t* vm, uint8_t address, uint16_t value) {
+	vm->device[address + 0] = (uint8_t)(value >> 8);
+	vm->device[address + 1] = (uint8_t)(value & 0xff);
+}
+
+// Screen
+
+#define SCREEN_WIDTH 512
+#define SCREEN_HEIGHT 320
+#define SPRITE_ADDR 0x1000
+
+typedef struct {
+	buxn_bench_vm_t* bench_vm;
+	buxn_screen_t* screen;
+	uint32_t* target;
+} screen_bench_t;
+
+static void
+screen_set_short(buxn_vm_t* vm, buxn_screen_t* screen, uint8_t address, uint16_t value) {
+	dev_store2(vm, address, value);
+	buxn_screen_deo(vm, screen, address + 1);
+}
+
+static screen_bench_t*
+screen_bench_init_layout(bool packed) {
+	screen_bench_t* bench = malloc(sizeof(screen_bench_t));
+	bench->bench_vm = buxn_bench_vm_init(BUXN_MEMORY_BANK_SIZE);
+	buxn_vm_t* vm = bench->bench_vm->vm;
+
+	buxn_screen_info_t screen_info = buxn_screen_info(SCREEN_WIDTH, SCREEN_HEIGHT);
+	bench->screen = calloc(1, packed ? screen_info.packed_screen_mem_size : screen_info.screen_mem_size);
+	bench->screen->packed = packed;
+	buxn_screen_resize(bench->screen, SCREEN_WIDTH, SCREEN_HEIGHT);
+	bench->target = malloc(screen_info.target_mem_size);
+	buxn_port_table_register(&bench->bench_vm->ports, BUXN_DEVICE_SCREEN, &buxn_screen_ports, bench->screen);
+
+	// 256 tiles of noise
+	for (uint32_t i = 0; i < 256 * 16; ++i) {
+		vm->memory[SPRITE_ADDR + i] = (uint8_t)(i * 37 + (i >> 3));
+	}
+
+	return bench;
+}
+
+static void*
+screen_bench_init(void) {
+	return screen_bench_init_layout(false);
+}
+
+static void*
+screen_packed_bench_init(void) {
+	return screen_bench_init_layout(true);
+}
+
+static void
+screen_bench_cleanup(void* userdata) {
+	screen_bench_t* bench = userdata;
+	free(bench->target);
+	free(bench->screen);
+	buxn_bench_vm_cleanup(bench->bench_vm);
+	free(bench);
+}
+
+// One DEO per tile over the whole screen with every blend mode and flip
+static void
+screen_sprite_2bpp_run(void* userdata) {
+	screen_bench_t* bench = userdata;
+	buxn_vm_t* vm = bench->bench_vm->vm;
+	buxn_screen_t* screen = bench->screen;
+
+	vm->device[0x26] = 0;
+	buxn_screen_deo(vm, screen, 0x26);
+	int i = 0;
+	for (uint16_t y = 0; y < SCREEN_HEIGHT; y += 8) {
+		screen_set_short(vm, screen, 0x2a, y);
+		for (uint16_t x = 0; x < SCREEN_WIDTH; x += 8, ++i) {
+			screen_set_short(vm, screen, 0x28, x);
+			screen_set_short(vm, screen, 0x2c, (uint16_t)(SPRITE_ADDR + (i & 0xff) * 16));
+			vm->device[0x2f] = (uint8_t)(0x80 | (i & 0x40) | ((i >> 2) & 0x30) | (i & 0x0f));
+			buxn_screen_deo(vm, screen, 0x2f);
+		}
+	}
+}
+
+// Rows of 16 tiles with auto x and auto address, as used for text
+static void
+screen_sprite_1bpp_auto_run(void* userdata) {
+	screen_bench_t* bench = userdata;
+	buxn_vm_t* vm = bench->bench_vm->vm;
+	buxn_screen_t* screen = bench->screen;
+
+	vm->device[0x26] = 0xf5;
+	buxn_screen_deo(vm, screen, 0x26);
+	for (uint16_t y = 0; y < SCREEN_HEIGHT; y += 8) {
+		for (uint16_t x = 0; x < SCREEN_WIDTH; x += 16 * 8) {
+			screen_set_short(vm, screen, 0x28, x);
+			screen_set_short(vm, screen, 0x2a, y);
+			screen_set_short(vm, screen, 0x2c, (uint16_t)(SPRITE_ADDR + (x + y) % 0x800));
+			vm->device[0x2f] = 0x41;
+			buxn_screen_deo(vm, screen, 0x2f);
+		}
+	}
+}
+
+static void
+screen_render_run(void* userdata) {
+	screen_bench_t* bench = userdata;
+	uint32_t palette[4] = { 0xff000000, 0xffffffff, 0xff77ddcc, 0xffff6622 };
+	buxn_screen_force_refresh(bench->screen);
+	buxn_screen_render(bench->screen, BUXN_SCREEN_LAYER_BACKGROUND, palette, bench->target);
+	buxn_screen_render(bench->screen, BUXN_SCREEN_LAYER_FOREGROUND, palette, bench->target);
+}
+
+static void
+screen_render_composite_run(void* userdata) {
+	screen_bench_t* bench = userdata;
+	uint32_t palette[4] = { 0xff000000, 0xffffffff, 0xff77ddcc, 0xffff6622 };
+	buxn_screen_force_refresh(bench->screen);
+	buxn_screen_render(bench->screen, BUXN_SCREEN_LAYER_COMPOSITE, palette, bench->target);
+}
+
+static void*
+screen_render_init(void) {
+	screen_bench_t* bench = screen_bench_init();
+	screen_sprite_2bpp_run(bench);
+	return bench;
+}
+
+static void*
+screen_packed_render_init(void) {
+	screen_bench_t* bench = screen_packed_bench_init();
+	screen_sprite_2bpp_run(bench);
+	return bench;
+}
+
+// Audio
+
+#define AUDIO_NUM_DEVICES 4
+#define AUDIO_SAMPLE_ADDR 0x2000
+#define AUDIO_NUM_FRAMES 44100
+#define AUDIO_CHUNK_FRAMES 512
+
+typedef struct {
+	buxn_bench_vm_t* bench_vm;
+	buxn_audio_t audio[AUDIO_NUM_DEVICES];
+	float buffer[AUDIO_CHUNK_FRAMES * BUXN_AUDIO_PREFERRED_NUM_CHANNELS];
+} audio_bench_t;
+
+static void*
+audio_bench_init(void) {
+	audio_bench_t* bench = calloc(1, sizeof(audio_bench_t));
+	bench->bench_vm = buxn_bench_vm_init(BUXN_MEMORY_BANK_SIZE);
+	buxn_vm_t* vm = bench->bench_vm->vm;
+
+	// A triangle wave
+	for (int i = 0; i < 256; ++i) {
+		vm->memory[AUDIO_SAMPLE_ADDR + i] = (uint8_t)(i < 128 ? i * 2 : (255 - i) * 2);
+	}
+
+	for (int i = 0; i < AUDIO_NUM_DEVICES; ++i) {
+		bench->audio[i].sample_frequency = BUXN_AUDIO_PREFERRED_SAMPLE_RATE;
+	}
+
+	return bench;
+}
+
+static void
+audio_bench_cleanup(void* userdata) {
+	audio_bench_t* bench = userdata;
+	buxn_bench_vm_cleanup(bench->bench_vm);
+	free(bench);
+}
+
+// 1 second on all devices
+static void
+audio_render_run(void* userdata) {
+	audio_bench_t* bench = userdata;
+	buxn_vm_t* vm = bench->bench_vm->vm;
+
+	for (int i = 0; i < AUDIO_NUM_DEVICES; ++i) {
+		buxn_audio_receive(&(buxn_audio_message_t){
+			.device = &bench->audio[i],
+			.addr = vm->memory + AUDIO_SAMPLE_ADDR,
+			.adsr = 0x1234,
+			.len = 256,
+			.pitch = (uint8_t)(48 + i * 7),
+			.repeat = 1,
+			.volume = { 0xf, 0x8 },
+		});
+	}
+
+	for (int frame = 0; frame < AUDIO_NUM_FRAMES; frame += AUDIO_CHUNK_FRAMES) {
+		for (int i = 0; i < AUDIO_NUM_DEVICES; ++i) {
+			buxn_audio_render(
+				&bench->audio[i],
+				bench->buffer,
+				AUDIO_CHUNK_FRAMES,
+				BUXN_AUDIO_PREFERRED_NUM_CHANNELS
+			);
+		}
+	}
+}
+
+// System/expansion
+
+#define EXPANSION_NUM_BANKS 16
+#define EXPANSION_RECORD_ADDR 0x0100
+#define EXPANSION_MAX_LENGTH 0xffff
+
+static uint8_t*
+write_short(uint8_t* ptr, uint16_t value) {
+	ptr[0] = value >> 8;
+	ptr[1] = value & 0xff;
+	return ptr + 2;
+}
+
+static uint8_t*
+write_fill(uint8_t* ptr, uint16_t length, uint16_t bank, uint16_t addr, uint8_t value) {
+	*ptr++ = 0x00;
+	ptr = write_short(ptr, length);
+	ptr = write_short(ptr, bank);
+	ptr = write_short(ptr, addr);
+	*ptr++ = value;
+	return ptr;
+}
+
+static uint8_t*
+write_copy(
+	uint8_t* ptr,
+	uint8_t op,
+	uint16_t length,
+	uint16_t src_bank, uint16_t src_addr,
+	uint16_t dst_bank, uint16_t dst_addr
+) {
+	*ptr++ = op;
+	ptr = write_short(ptr, length);
+	ptr = write_short(ptr, src_bank);
+	ptr = write_short(ptr, src_addr);
+	ptr = write_short(ptr, dst_bank);
+	ptr = write_short(ptr, dst_addr);
+	return ptr;
+}
+
+static uint8_t*
+write_batch(uint8_t* ptr, uint16_t count) {
+	*ptr++ = BUXN_SYSTEM_EXPANSION_BATCH;
+	return write_short(ptr, count);
+}
+
+static buxn_bench_vm_t*
+expansion_init(void) {
+	uint32_t memory_size = BUXN_MEMORY_BANK_SIZE * EXPANSION_NUM_BANKS;
+	buxn_bench_vm_t* bench_vm = buxn_bench_vm_init(memory_size);
+	buxn_vm_t* vm = bench_vm->vm;
+	for (uint32_t i = EXPANSION_RECORD_ADDR + 0x1000; i < memory_size; ++i) {
+		vm->memory[i] = (uint8_t)(i * 7);
+	}
+	dev_store2(vm, 0x02, EXPANSION_RECORD_ADDR);
+	return bench_vm;
+}
+
+static void*
+expansion_fill_64k_init(void) {
+	buxn_bench_vm_t* bench_vm = expansion_init();
+	write_fill(bench_vm->vm->memory + EXPANSION_RECORD_ADDR, EXPANSION_MAX_LENGTH, 1, 0, 0xaa);
+	return bench_vm;
+}
+
+static void*
+expansion_copy_64k_init(void) {
+	buxn_bench_vm_t* bench_vm = expansion_init();
+	write_copy(bench_vm->vm->memory + EXPANSION_RECORD_ADDR, 0x01, EXPANSION_MAX_LENGTH, 1, 0, 2, 0);
+	return bench_vm;
+}
+
+// The destination starts 1 byte after the source: the first byte is repeated
+static void*
+expansion_copy_64k_overlap_forward_init(void) {
+	buxn_bench_vm_t* bench_vm = expansion_init();
+	write_copy(bench_vm->vm->memory + EXPANSION_RECORD_ADDR, 0x01, EXPANSION_MAX_LENGTH - 1, 1, 0, 1, 1);
+	return bench_vm;
+}
+
+// The destination ends 256 bytes before the source
+static void*
+expansion_copy_64k_overlap_backward_init(void) {
+	buxn_bench_vm_t* bench_vm = expansion_init();
+	write_copy(bench_vm->vm->memory + EXPANSION_RECORD_ADDR, 0x02, EXPANSION_MAX_LENGTH - 256, 1, 256, 1, 0);
+	return bench_vm;
+}
+
+static void*
+expansion_fill_1m_init(void) {
+	buxn_bench_vm_t* bench_vm = expansion_init();
+	uint8_t* ptr = write_batch(bench_vm->vm->memory + EXPANSION_RECORD_ADDR, EXPANSION_NUM_BANKS);
+	for (uint16_t bank = 0; bank < EXPANSION_NUM_BANKS; ++bank) {
+		// Leave the records alone
+		uint16_t addr = bank == 0 ? 0x1000 : 0;
+		ptr = write_fill(ptr, EXPANSION_MAX_LENGTH - addr, bank, addr, 0xaa);
+	}
+	return bench_vm;
+}
+
+static void*
+expansion_copy_1m_init(void) {
+	buxn_bench_vm_t* bench_vm = expansion_init();
+	uint8_t* ptr = write_batch(bench_vm->vm->memory + EXPANSION_RECORD_ADDR, EXPANSION_NUM_BANKS);
+	for (uint16_t bank = 0; bank < EXPANSION_NUM_BANKS; ++bank) {
+		uint16_t src_bank = (bank + EXPANSION_NUM_BANKS / 2) % EXPANSION_NUM_BANKS;
+		uint16_t addr = bank == 0 || src_bank == 0 ? 0x1000 : 0;
+		ptr = write_copy(ptr, 0x01, EXPANSION_MAX_LENGTH - addr, src_bank, addr, bank, addr);
+	}
+	return bench_vm;
+}
+
+static void
+expansion_run(void* userdata) {
+	buxn_bench_vm_t* bench_vm = userdata;
+	buxn_system_deo(bench_vm->vm, 0x03);
+}
+
+static void
+expansion_cleanup(void* userdata) {
+	buxn_bench_vm_cleanup(userdata);
+}
+
+const buxn_bench_t buxn_bench_devices[] = {
+	{
+		.name = "screen/sprite-2bpp",
+		.num_bytes = SCREEN_WIDTH * SCREEN_HEIGHT,
+		.init = screen_bench_init,
+		.run = screen_sprite_2bpp_run,
+		.cleanup = screen_bench_cleanup,
+	},
+	{
+		.name = "screen/sprite-1bpp-auto",
+		.num_bytes = SCREEN_WIDTH * SCREEN_HEIGHT,
+		.init = screen_bench_init,
+		.run = screen_sprite_1bpp_auto_run,
+		.cleanup = screen_bench_cleanup,
+	},
+	{
+		.name = "screen/render",
+		.num_bytes = SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t) * 2,
+		.init = screen_render_init,
+		.run = screen_render_run,
+		.cleanup = screen_bench_cleanup,
+	},
+	{
+		.name = "screen/render-composite",
+		.num_bytes = SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t),
+		.init = screen_render_init,
+		.run = screen_render_composite_run,
+		.cleanup = screen_bench_cleanup,
+	},
+	{
+		.name = "screen/packed-sprite-2bpp",
+		.num_bytes = SCREEN_WIDTH * SCREEN_HEIGHT,
+		.init = screen_packed_bench_init,
+		.run = screen_sprite_2bpp_run,
+		.cleanup = screen_bench_cleanup,
+	},
+	{
+		.name = "screen/packed-sprite-1bpp-auto",
+		.num_bytes = SCREEN_WIDTH * SCREEN_HEIGHT,
+		.init = screen_packed_bench_init,
+		.run = screen_sprite_1bpp_auto_run,
+		.cleanup = screen_bench_cleanup,
+	},
+	{
+		.name = "screen/packed-render",
+		.num_bytes = SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t) * 2,
+		.init = screen_packed_render_init,
+		.run = screen_render_run,
+		.cleanup = screen_bench_cleanup,
+	},
+	{
+		.name = "screen/packed-render-composite",
+		.num_bytes = SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t),
+		.init = screen_packed_render_init,
+		.run = screen_render_composite_run,
+		.cleanup = screen_bench_cleanup,
+	},
+	{
+		.name = "audio/render",
+		.num_bytes = (uint64_t)AUDIO_NUM_FRAMES * BUXN_AUDIO_PREFERRED_NUM_CHANNELS * sizeof(float) * AUDIO_NUM_DEVICES,
+		.init = audio_bench_init,
+		.run = audio_render_run,
+		.cleanup = audio_bench_cleanup,
+	},
+	{
+		.name = "system/expansion-fill-64k",
+		.num_bytes = EXPANSION_MAX_LENGTH,
+		.init = expansion_fill_64k_init,
+		.run = expansion_run,
+		.cleanup = expansion_cleanup,
+	},
+	{
+		.name = "system/expansion-copy-64k",
+		.num_bytes = EXPANSION_MAX_LENGTH,
+		.init = expansion_copy_64k_init,
+		.run = expansion_run,
+		.cleanup = expansion_cleanup,
+	},
+	{
+		.name = "system/expansion-copy-64k-overlap-forward",
+		.num_bytes = EXPANSION_MAX_LENGTH - 1,
+		.init = expansion_copy_64k_overlap_forward_init,
+		.run = expansion_run,
+		.cleanup = expansion_cleanup,
+	},
+	{
+		.name = "system/expansion-copy-64k-overlap-backward",
+		.num_bytes = EXPANSION_MAX_LENGTH - 256,
+		.init = expansion_copy_64k_overlap_backward_init,
+		.run = expansion_run,
+		.cleanup = expansion_cleanup,
+	},
+	{
+		.name = "system/expansion-fill-1m",
+		.num_bytes = BUXN_MEMORY_BANK_SIZE * EXPANSION_NUM_BANKS,
+		.init = expansion_fill_1m_init,
+		.run = expansion_run,
+		.cleanup = expansion_cleanup,
+	},
+	{
+		.name = "system/expansion-copy-1m",
+		.num_bytes = BUXN_MEMORY_BANK_SIZE * EXPANSION_NUM_BANKS,
+		.init = expansion_copy_1m_init,
+		.run = expansion_run,
+		.cleanup = expansion_cleanup,
+	},
+	{ 0 },
+};
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include "common.h"
+#include "../bflag.h"
+
+#define FLAG_WARMUP "-warmup="
+#define FLAG_REPETITIONS "-repetitions="
+#define FLAG_MIN_TIME "-min-time="
+#define FLAG_OUTPUT "-output="
+#define FLAG_COMPARE "-compare="
+#define FLAG_THRESHOLD "-threshold="
+
+#define MAX_REPETITIONS 1000
+#define MAX_NAME_LEN 128
+
+typedef struct {
+	int warmup;
+	int repetitions;
+	double min_time_ns;
+	const char* filter;
+} options_t;
+
+typedef struct {
+	const buxn_bench_t* bench;
+	uint64_t iterations;
+	int repetitions;
+	double min_ns;
+	double median_ns;
+	double mean_ns;
+	double stddev_ns;
+} result_t;
+
+typedef struct {
+	char name[MAX_NAME_LEN];
+	double median_ns;
+} baseline_t;
+
+static double
+now_ns(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static double
+time_iterations(const buxn_bench_t* bench, void* userdata, uint64_t iterations) {
+	double start = now_ns();
+	for (uint64_t i = 0; i < iterations; ++i) {
+		bench->run(userdata);
+	}
+	return now_ns() - start;
+}
+
+static int
+compare_double(const void* lhs, const void* rhs) {
+	double a = *(const double*)lhs;
+	double b = *(const double*)rhs;
+	return (a > b) - (a < b);
+}
+
+static result_t
+run_bench(const buxn_bench_t* bench, const options_t* options) {
+	void* userdata = bench->init();
+
+	// Double the iteration count until a repetition is long enough to be
+	// measured reliably.
+	// This also serves as the first warm up.
+	uint64_t iterations = 1;
+	while (time_iterations(bench, userdata, iterations) < options->min_time_ns) {
+		iterations *= 2;
+	}
+
+	for (int i = 0; i < options->warmup; ++i) {
+		time_iterations(bench, userdata, iterations);
+	}
+
+	double samples[MAX_REPETITIONS];
+	double sum = 0.0;
+	for (int i = 0; i < options->repetitions; ++i) {
+		samples[i] = time_iterations(bench, userdata, iterations) / (double)iterations;
+		sum += samples[i];
+	}
+
+	bench->cleanup(userdata);
+
+	result_t result = {
+		.bench = bench,
+		.iterations = iterations,
+		.repetitions = options->repetitions,
+		.mean_ns = sum / options->repetitions,
+	};
+
+	double variance = 0.0;
+	for (int i = 0; i < options->repetitions; ++i) {
+		double diff = samples[i] - result.mean_ns;
+		variance += diff * diff;
+	}
+	result.stddev_ns = options->repetitions > 1
+		? sqrt(variance / (options->repetitions - 1))
+		: 0.0;
+
+	qsort(samples, (size_t)options->repetitions, sizeof(samples[0]), compare_double);
+	result.min_ns = samples[0];
+	result.median_ns = options->repetitions % 2 == 1
+		? samples[options->repetitions / 2]
+		: (samples[options->repetitions / 2 - 1] + samples[options->repetitions / 2]) * 0.5;
+
+	return result;
+}
+
+static void
+print_result(const result_t* result) {
+	printf(
+		"%-44s %12.1f %12.1f %7.1f%%",
+		result->bench->name,
+		result->median_ns / 1000.0,
+		result->min_ns / 1000.0,
+		result->mean_ns > 0.0 ? result->stddev_ns / result->mean_ns * 100.0 : 0.0
+	);
+	if (result->bench->num_bytes > 0) {
+		double gib_per_sec = (double)result->bench->num_bytes / result->median_ns * 1e9 / (1024.0 * 1024.0 * 1024.0);
+		printf(" %10.2f", gib_per_sec);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+static bool
+write_json(const char* filename, const result_t* results, int num_results) {
+	FILE* file = fopen(filename, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+		return false;
+	}
+
+	// One benchmark per line so it is easy to diff and to read back
+	fprintf(file, "{\"benchmarks\": [\n");
+	for (int i = 0; i < num_results; ++i) {
+		const result_t* result = &results[i];
+		fprintf(
+			file,
+			"\t{\"name\": \"%s\", \"iterations\": %llu, \"repetitions\": %d, "
+			"\"min_ns\": %.3f, \"median_ns\": %.3f, \"mean_ns\": %.3f, \"stddev_ns\": %.3f, "
+			"\"bytes\": %llu}%s\n",
+			result->bench->name,
+			(unsigned long long)result->iterations,
+			result->repetitions,
+			result->min_ns,
+			result->median_ns,
+			result->mean_ns,
+			result->stddev_ns,
+			(unsigned long long)result->bench->num_bytes,
+			i + 1 < num_results ? "," : ""
+		);
+	}
+	fprintf(file, "]}\n");
+
+	bool success = ferror(file) == 0;
+	fclose(file);
+	return success;
+}
+
+// Only reads back what write_json produces
+static int
+read_baseline(const char* filename, baseline_t* baselines, int max_baselines) {
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	int num_baselines = 0;
+	char line[1024];
+	while (num_baselines < max_baselines && fgets(line, sizeof(line), file) != NULL) {
+		const char* name = strstr(line, "\"name\": \"");
+		const char* median = strstr(line, "\"median_ns\": ");
+		if (name == NULL || median == NULL) { continue; }
+
+		name += strlen("\"name\": \"");
+		const char* name_end = strchr(name, '"');
+		if (name_end == NULL || name_end - name >= MAX_NAME_LEN) { continue; }
+
+		baseline_t* baseline = &baselines[num_baselines];
+		if (sscanf(median + strlen("\"median_ns\": "), "%lf", &baseline->median_ns) != 1) {
+			continue;
+		}
+		memcpy(baseline->name, name, (size_t)(name_end - name));
+		baseline->name[name_end - name] = '\0';
+		++num_baselines;
+	}
+
+	fclose(file);
+	return num_baselines;
+}
+
+static int
+compare_results(
+	const result_t* results, int num_results,
+	const baseline_t* baselines, int num_baselines,
+	double threshold
+) {
+	int num_regressions = 0;
+	printf("\n%-44s %12s %12s %8s\n", "benchmark", "base (us)", "new (us)", "change");
+	for (int i = 0; i < num_results; ++i) {
+		const result_t* result = &results[i];
+		const baseline_t* baseline = NULL;
+		for (int j = 0; j < num_baselines; ++j) {
+			if (strcmp(baselines[j].name, result->bench->name) == 0) {
+				baseline = &baselines[j];
+				break;
+			}
+		}
+		if (baseline == NULL || baseline->median_ns <= 0.0) { continue; }
+
+		double change = (result->median_ns - baseline->median_ns) / baseline->median_ns * 100.0;
+		bool regressed = change > threshold;
+		num_regressions += regressed;
+		printf(
+			"%-44s %12.1f %12.1f %+7.1f%%%s\n",
+			result->bench->name,
+			baseline->median_ns / 1000.0,
+			result->median_ns / 1000.0,
+			change,
+			regressed ? " REGRESSION" : ""
+		);
+	}
+	fflush(stdout);
+
+	return num_regressions;
+}
+
+static bool
+parse_int_flag(const char* flag_name, const char* value, int min, int max, int* out) {
+	char* end;
+	long parsed = strtol(value, &end, 10);
+	if (*value == '\0' || *end != '\0' || parsed < min || parsed > max) {
+		fprintf(stderr, "%s must be between %d and %d\n", flag_name, min, max);
+		return false;
+	}
+
+	*out = (int)parsed;
+	return true;
+}
+
+int
+main(int argc, const char* argv[]) {
+	options_t options = {
+		.warmup = 1,
+		.repetitions = 10,
+		.min_time_ns = 20e6,
+	};
+	const char* output_filename = NULL;
+	const char* compare_filename = NULL;
+	int threshold = 5;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* flag_value;
+		const char* arg = argv[i];
+
+		if ((flag_value = parse_flag(arg, "--help")) != NULL) {
+			fprintf(stderr,
+				"Usage: buxn-bench [options] [filter]\n"
+				"Run the benchmarks whose name contains filter.\n"
+				"\n"
+				"--help               Print this message.\n"
+				"-warmup=<n>          (Optional) Untimed repetitions before measuring.\n"
+				"                     This defaults to 1.\n"
+				"-repetitions=<n>     (Optional) Timed repetitions.\n"
+				"                     This defaults to 10.\n"
+				"-min-time=<ms>       (Optional) Minimum duration of a repetition.\n"
+				"                     This defaults to 20.\n"
+				"-output=<file>       (Optional) Write the results to this JSON file.\n"
+				"-compare=<file>      (Optional) Compare against a JSON file written with -output.\n"
+				"                     Exit with an error if a benchmark regressed.\n"
+				"-threshold=<percent> (Optional) Allowed increase of the median time.\n"
+				"                     This defaults to 5.\n"
+			);
+			return 0;
+		} else if ((flag_value = parse_flag(arg, FLAG_WARMUP)) != NULL) {
+			if (!parse_int_flag(FLAG_WARMUP, flag_value, 0, 1000, &options.warmup)) { return 1; }
+		} else if ((flag_value = parse_flag(arg, FLAG_REPETITIONS)) != NULL) {
+			if (!parse_int_flag(FLAG_REPETITIONS, flag_value, 1, MAX_REPETITIONS, &options.repetitions)) {
+				return 1;
+			}
+		} else if ((flag_value = parse_flag(arg, FLAG_MIN_TIME)) != NULL) {
+			int min_time_ms;
+			if (!parse_int_flag(FLAG_MIN_TIME, flag_value, 0, 60000, &min_time_ms)) { return 1; }
+			options.min_time_ns = min_time_ms * 1e6;
+		} else if ((flag_value = parse_flag(arg, FLAG_OUTPUT)) != NULL) {
+			if (output_filename != NULL) {
+				fprintf(stderr, "%s can only be specified once\n", FLAG_OUTPUT);
+				return 1;
+			}
+			output_filename = flag_value;
+		} else if ((flag_value = parse_flag(arg, FLAG_COMPARE)) != NULL) {
+			if (compare_filename != NULL) {
+				fprintf(stderr, "%s can only be specified once\n", FLAG_COMPARE);
+				return 1;
+			}
+			compare_filename = flag_value;
+		} else if ((flag_value = parse_flag(arg, FLAG_THRESHOLD)) != NULL) {
+			if (!parse_int_flag(FLAG_THRESHOLD, flag_value, 0, 1000, &threshold)) { return 1; }
+		} else if (options.filter == NULL) {
+			options.filter = arg;
+		} else {
+			fprintf(stderr, "Too many arguments\n");
+			return 1;
+		}
+	}
+
+	const buxn_bench_t* groups[] = {
+		buxn_bench_vm,
+		buxn_bench_devices,
+		buxn_bench_asm,
+	};
+	int max_results = 0;
+	for (size_t i = 0; i < sizeof(groups) / sizeof(groups[0]); ++i) {
+		for (const buxn_bench_t* bench = groups[i]; bench->name != NULL; ++bench) {
+			++max_results;
+		}
+	}
+
+	int exit_code = 1;
+	result_t* results = malloc(sizeof(result_t) * (size_t)max_results);
+	baseline_t* baselines = NULL;
+	int num_results = 0;
+
+	printf("%-44s %12s %12s %8s %10s\n", "benchmark", "median (us)", "min (us)", "stddev", "GiB/s");
+	for (size_t i = 0; i < sizeof(groups) / sizeof(groups[0]); ++i) {
+		for (const buxn_bench_t* bench = groups[i]; bench->name != NULL; ++bench) {
+			if (options.filter != NULL && strstr(bench->name, options.filter) == NULL) {
+				continue;
+			}
+
+			results[num_results] = run_bench(bench, &options);
+			print_result(&results[num_results]);
+			++num_results;
+		}
+	}
+
+	if (output_filename != NULL && !write_json(output_filename, results, num_results)) {
+		goto end;
+	}
+
+	if (compare_filename != NULL) {
+		baselines = malloc(sizeof(baseline_t) * (size_t)max_results);
+		int num_baselines = read_baseline(compare_filename, baselines, max_results);
+		if (num_baselines < 0) { goto end; }
+
+		int num_regressions = compare_results(
+			results, num_results,
+			baselines, num_baselines,
+			(double)threshold
+		);
+		if (num_regressions > 0) {
+			fprintf(stderr, "%d benchmark(s) regressed by more than %d%%\n", num_regressions, threshold);
+			goto end;
+		}
+	}
+
+	exit_code = 0;
+end:
+	free(baselines);
+	free(results);
+	return exit_code;
+}
+
+#define BLIB_IMPLEMENTATION
+#include <barena.h>
+
+#define XINCBIN_IMPLEMENTATION
+#include "resources.h"
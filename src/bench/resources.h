@@ -0,0 +1,6 @@
+#ifndef BUXN_BENCH_RESOURCES_H
+#define BUXN_BENCH_RESOURCES_H
+
+#include "resources.rc"
+
+#endif
@@ -0,0 +1,84 @@
+#include "common.h"
+#include "resources.h"
+#include <buxn/devices/console.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	barena_pool_t pool;
+	barena_t arena;
+	buxn_asm_ctx_t basm;
+	buxn_bench_vm_t* bench_vm;
+	buxn_console_t console;
+} rom_bench_t;
+
+static rom_bench_t*
+rom_bench_init(const char* name, xincbin_data_t content) {
+	rom_bench_t* bench = calloc(1, sizeof(rom_bench_t));
+	barena_pool_init(&bench->pool, 1);
+	barena_init(&bench->arena, &bench->pool);
+	bench->basm = (buxn_asm_ctx_t){
+		.arena = &bench->arena,
+		.vfs = (buxn_vfs_entry_t[]){
+			{ .name = name, .content = content },
+			{ 0 },
+		},
+	};
+	if (!buxn_bench_assemble(&bench->basm)) {
+		fprintf(stderr, "Could not assemble %s\n", name);
+	}
+	// Only valid during this call
+	bench->basm.vfs = NULL;
+
+	bench->bench_vm = buxn_bench_vm_init(BUXN_MEMORY_BANK_SIZE);
+	buxn_port_table_register(
+		&bench->bench_vm->ports, BUXN_DEVICE_CONSOLE, &buxn_console_ports, &bench->console
+	);
+	return bench;
+}
+
+static void
+rom_bench_run(void* userdata) {
+	rom_bench_t* bench = userdata;
+	buxn_vm_t* vm = bench->bench_vm->vm;
+	buxn_vm_reset(vm, BUXN_VM_RESET_ALL);
+	buxn_console_init(vm, &bench->console, 0, NULL);
+	memcpy(vm->memory + BUXN_RESET_VECTOR, bench->basm.rom, bench->basm.rom_size);
+	buxn_vm_execute(vm, BUXN_RESET_VECTOR);
+}
+
+static void
+rom_bench_cleanup(void* userdata) {
+	rom_bench_t* bench = userdata;
+	buxn_bench_vm_cleanup(bench->bench_vm);
+	barena_reset(&bench->arena);
+	barena_pool_cleanup(&bench->pool);
+	free(bench);
+}
+
+static void*
+opctest_init(void) {
+	return rom_bench_init("opctest.tal", XINCBIN_GET(opctest_tal));
+}
+
+static void*
+acid_init(void) {
+	return rom_bench_init("acid.tal", XINCBIN_GET(acid_tal));
+}
+
+const buxn_bench_t buxn_bench_vm[] = {
+	{
+		.name = "vm/opctest",
+		.init = opctest_init,
+		.run = rom_bench_run,
+		.cleanup = rom_bench_cleanup,
+	},
+	{
+		.name = "vm/acid",
+		.init = acid_init,
+		.run = rom_bench_run,
+		.cleanup = rom_bench_cleanup,
+	},
+	{ 0 },
+};
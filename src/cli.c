@@ -1,9 +1,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <time.h>
 #include <physfs.h>
 #include <errno.h>
 #include <buxn/vm/vm.h>
+#include <buxn/vm/alloc.h>
+#include <buxn/vm/jit.h>
+#include <buxn/vm/profile.h>
+#include <buxn/vm/trace.h>
+#include <buxn/vm/coverage.h>
+#ifdef BUXN_CLI_ROM2C
+#include <buxn/vm/rom2c.h>
+#endif
 #ifndef _WIN32
 #include "dbg.h"
 #endif
@@ -12,57 +21,34 @@
 #include <buxn/devices/system.h>
 #include <buxn/devices/datetime.h>
 #include <buxn/devices/file.h>
+#include <buxn/devices/ports.h>
+#include <buxn/devices/screen.h>
+#include <buxn/devices/mouse.h>
+#include <buxn/devices/controller.h>
+#include <buxn/devices/audio.h>
+#include <buxn/devices/replay.h>
 
 typedef struct {
 	buxn_console_t console;
 	buxn_file_t file[BUXN_NUM_FILE_DEVICES];
+	// Only used when replaying a recording from buxn-gui
+	buxn_mouse_t mouse;
+	buxn_controller_t controller;
+	buxn_audio_t audio[BUXN_NUM_AUDIO_DEVICES];
+	buxn_screen_t* screen;
+	buxn_port_table_t ports;
 } vm_data_t;
 
 uint8_t
 buxn_vm_dei(buxn_vm_t* vm, uint8_t address) {
 	vm_data_t* devices = vm->config.userdata;
-	uint8_t device_id = buxn_device_id(address);
-	switch (device_id) {
-		case BUXN_DEVICE_SYSTEM:
-			return buxn_system_dei(vm, address);
-		case BUXN_DEVICE_CONSOLE:
-			return buxn_console_dei(vm, &devices->console, address);
-		case BUXN_DEVICE_DATETIME:
-			return buxn_datetime_dei(vm, address);
-		case BUXN_DEVICE_FILE_0:
-		case BUXN_DEVICE_FILE_1:
-			return buxn_file_dei(
-				vm,
-				devices->file + (device_id - BUXN_DEVICE_FILE_0) / (BUXN_DEVICE_FILE_1 - BUXN_DEVICE_FILE_0),
-				vm->device + device_id,
-				buxn_device_port(address)
-			);
-		default:
-			return vm->device[address];
-	}
+	return buxn_port_table_dei(&devices->ports, vm, address);
 }
 
 void
 buxn_vm_deo(buxn_vm_t* vm, uint8_t address) {
 	vm_data_t* devices = vm->config.userdata;
-	uint8_t device_id = buxn_device_id(address);
-	switch (device_id) {
-		case BUXN_DEVICE_SYSTEM:
-			buxn_system_deo(vm, address);
-			break;
-		case BUXN_DEVICE_CONSOLE:
-			buxn_console_deo(vm, &devices->console, address);
-			break;
-		case BUXN_DEVICE_FILE_0:
-		case BUXN_DEVICE_FILE_1:
-			buxn_file_deo(
-				vm,
-				devices->file + (device_id - BUXN_DEVICE_FILE_0) / (BUXN_DEVICE_FILE_1 - BUXN_DEVICE_FILE_0),
-				vm->device + device_id,
-				buxn_device_port(address)
-			);
-			break;
-	}
+	buxn_port_table_deo(&devices->ports, vm, address);
 }
 
 void
@@ -109,15 +95,103 @@ buxn_console_handle_error(struct buxn_vm_s* vm, buxn_console_t* device, char c)
 	fflush(stdout);
 }
 
+buxn_screen_t*
+buxn_screen_request_resize(
+	struct buxn_vm_s* vm,
+	buxn_screen_t* screen,
+	uint16_t width, uint16_t height
+) {
+	vm_data_t* devices = vm->config.userdata;
+	buxn_screen_info_t screen_info = buxn_screen_info(width, height);
+	screen = realloc(screen, screen_info.screen_mem_size);
+	buxn_screen_resize(screen, width, height);
+	devices->screen = screen;
+	buxn_port_table_register(&devices->ports, BUXN_DEVICE_SCREEN, &buxn_screen_ports, screen);
+	return screen;
+}
+
+void
+buxn_audio_send(buxn_vm_t* vm, const buxn_audio_message_t* message) {
+	// Replays are silent
+	(void)vm;
+	(void)message;
+}
+
+static void
+register_headless_devices(vm_data_t* devices, uint16_t width, uint16_t height) {
+	buxn_screen_info_t screen_info = buxn_screen_info(width, height);
+	devices->screen = calloc(1, screen_info.screen_mem_size);
+	buxn_screen_resize(devices->screen, width, height);
+
+	buxn_port_table_t* ports = &devices->ports;
+	buxn_port_table_register(ports, BUXN_DEVICE_SCREEN, &buxn_screen_ports, devices->screen);
+	for (int i = 0; i < BUXN_NUM_AUDIO_DEVICES; ++i) {
+		devices->audio[i].sample_frequency = BUXN_AUDIO_PREFERRED_SAMPLE_RATE;
+		buxn_port_table_register(
+			ports,
+			BUXN_DEVICE_AUDIO_0 + i * (BUXN_DEVICE_AUDIO_1 - BUXN_DEVICE_AUDIO_0),
+			&buxn_audio_ports, &devices->audio[i]
+		);
+	}
+	buxn_port_table_register(ports, BUXN_DEVICE_CONTROLLER, &buxn_controller_ports, &devices->controller);
+	buxn_port_table_register(ports, BUXN_DEVICE_MOUSE, &buxn_mouse_ports, &devices->mouse);
+}
+
 static int
 boot(int argc, const char* argv[], FILE* rom_file, uint32_t rom_size) {
 	int exit_code = 0;
 	vm_data_t devices = { 0 };
+	buxn_port_table_init(&devices.ports);
+	buxn_port_table_register(&devices.ports, BUXN_DEVICE_SYSTEM, &buxn_system_ports, NULL);
+	buxn_port_table_register(&devices.ports, BUXN_DEVICE_CONSOLE, &buxn_console_ports, &devices.console);
+	buxn_port_table_register(&devices.ports, BUXN_DEVICE_DATETIME, &buxn_datetime_ports, NULL);
+	buxn_port_table_register(&devices.ports, BUXN_DEVICE_FILE_0, &buxn_file_ports, &devices.file[0]);
+	buxn_port_table_register(&devices.ports, BUXN_DEVICE_FILE_1, &buxn_file_ports, &devices.file[1]);
+
+	buxn_replay_t replay = {
+		.console = &devices.console,
+		.mouse = &devices.mouse,
+		.controller = &devices.controller,
+	};
+	// Opt-in, inputs recorded with BUXN_RECORD are played back at full speed
+	// instead of reading stdin
+	const char* replay_path = getenv("BUXN_REPLAY");
+	const char* record_path = getenv("BUXN_RECORD");
+	if (replay_path != NULL) {
+		FILE* replay_file = fopen(replay_path, "rb");
+		if (replay_file == NULL || !buxn_replay_begin_play(&replay, replay_file)) {
+			fprintf(stderr, "Could not read replay from %s\n", replay_path);
+			if (replay_file != NULL) { fclose(replay_file); }
+			if (rom_file != NULL) { fclose(rom_file); }
+			return 1;
+		}
 
-	buxn_vm_t* vm = malloc(sizeof(buxn_vm_t) + BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS);
+		if (replay.screen_width > 0) {
+			register_headless_devices(&devices, replay.screen_width, replay.screen_height);
+			for (int i = 0; i < BUXN_NUM_AUDIO_DEVICES; ++i) {
+				buxn_replay_capture(
+					&replay, &devices.ports,
+					BUXN_DEVICE_AUDIO_0 + i * (BUXN_DEVICE_AUDIO_1 - BUXN_DEVICE_AUDIO_0)
+				);
+			}
+		}
+		buxn_replay_capture(&replay, &devices.ports, BUXN_DEVICE_DATETIME);
+	} else if (record_path != NULL) {
+		FILE* record_file = fopen(record_path, "wb");
+		if (record_file != NULL && buxn_replay_begin_record(&replay, record_file)) {
+			buxn_replay_capture(&replay, &devices.ports, BUXN_DEVICE_DATETIME);
+		} else {
+			fprintf(stderr, "Could not record inputs to %s\n", record_path);
+			if (record_file != NULL) { fclose(record_file); }
+		}
+	}
+
+	buxn_vm_t* vm = buxn_vm_alloc(BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS);
 	vm->config = (buxn_vm_config_t){
 		.userdata = &devices,
 		.memory_size = BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS,
+		.noop_ports = &devices.ports.noop_ports,
+		.zero_memory = buxn_vm_zero_memory,
 	};
 	buxn_vm_reset(vm, BUXN_VM_RESET_ALL);
 
@@ -135,7 +209,61 @@ boot(int argc, const char* argv[], FILE* rom_file, uint32_t rom_size) {
 	}
 #endif
 
+	// Opt-in, written to the given path on exit
+	const char* profile_path = getenv("BUXN_PROFILE");
+	if (profile_path != NULL) {
+		vm->config.profile = calloc(1, sizeof(buxn_vm_profile_t));
+		const char* interval = getenv("BUXN_PROFILE_INTERVAL");
+		vm->config.profile->sample_interval = interval != NULL
+			? (uint32_t)strtoul(interval, NULL, 10)
+			: 1000;
+	}
+
+	// Opt-in, written to the given path on exit
+	const char* coverage_path = getenv("BUXN_COVERAGE");
+	if (coverage_path != NULL) {
+		vm->config.coverage = calloc(1, sizeof(buxn_vm_coverage_t));
+		vm->config.coverage->record_branches = getenv("BUXN_COVERAGE_BRANCHES") != NULL;
+	}
+
+	// Opt-in, the file is mapped so it is readable even if the process dies
+	const char* trace_path = getenv("BUXN_TRACE");
+	if (trace_path != NULL) {
+		const char* size = getenv("BUXN_TRACE_SIZE");
+		uint32_t capacity = size != NULL ? (uint32_t)strtoul(size, NULL, 10) : 65536;
+		uint32_t rounded_capacity = 1;
+		while (rounded_capacity < capacity && rounded_capacity < (1u << 28)) {
+			rounded_capacity <<= 1;
+		}
+		vm->config.trace = buxn_vm_trace_map_file(
+			trace_path,
+			rounded_capacity,
+			getenv("BUXN_TRACE_TOS") != NULL ? BUXN_VM_TRACE_TOS : 0
+		);
+		if (vm->config.trace == NULL) {
+			fprintf(stderr, "Could not map trace file %s\n", trace_path);
+		}
+	}
+
+	// Opt-in, only available on x86-64 Linux
+	buxn_vm_jit_t* jit = NULL;
+	if (
+		getenv("BUXN_JIT") != NULL
+		&& profile_path == NULL
+		&& trace_path == NULL
+		&& coverage_path == NULL
+	) {
+		jit = buxn_vm_jit_init(vm);
+	}
+
 	// Read rom
+#ifdef BUXN_CLI_ROM2C
+	// The rom was translated and linked into the program
+	(void)rom_file;
+	(void)rom_size;
+	buxn_rom2c_load_rom(vm);
+	vm->config.native = buxn_rom2c_execute;
+#else
 	{
 		uint8_t* read_pos = &vm->memory[BUXN_RESET_VECTOR];
 		if (rom_size == 0) {
@@ -149,10 +277,18 @@ boot(int argc, const char* argv[], FILE* rom_file, uint32_t rom_size) {
 		}
 	}
 	fclose(rom_file);
+#endif
 
 	buxn_console_init(vm, &devices.console, argc, argv);
 
-	buxn_vm_execute(vm, BUXN_RESET_VECTOR);
+	struct timespec replay_start;
+	timespec_get(&replay_start, TIME_UTC);
+
+	if (jit != NULL) {
+		buxn_vm_jit_execute(jit, BUXN_RESET_VECTOR);
+	} else {
+		buxn_vm_execute(vm, BUXN_RESET_VECTOR);
+	}
 	if ((exit_code = buxn_system_exit_code(vm)) > 0) {
 		goto end;
 	}
@@ -162,23 +298,74 @@ boot(int argc, const char* argv[], FILE* rom_file, uint32_t rom_size) {
 		goto end;
 	}
 
-	while (
-		buxn_system_exit_code(vm) < 0
-		&& buxn_console_should_send_input(vm)
-	) {
-		int ch = fgetc(stdin);
-		if (ch != EOF) {
-			buxn_console_send_input(vm, &devices.console, ch);
-		} else {
-			buxn_console_send_input_end(vm, &devices.console);
-			break;
+	if (replay.mode == BUXN_REPLAY_PLAY) {
+		buxn_replay_event_t event;
+		while (
+			buxn_system_exit_code(vm) < 0
+			&& buxn_replay_next(&replay, &event)
+		) {
+			buxn_replay_send(&replay, vm, &event);
+		}
+	} else {
+		while (
+			buxn_system_exit_code(vm) < 0
+			&& buxn_console_should_send_input(vm)
+		) {
+			int ch = fgetc(stdin);
+			if (ch != EOF) {
+				buxn_replay_send(&replay, vm, &(buxn_replay_event_t){
+					.type = BUXN_REPLAY_CONSOLE,
+					.console = { .type = BUXN_CONSOLE_STDIN, .value = (uint8_t)ch },
+				});
+			} else {
+				buxn_replay_send(&replay, vm, &(buxn_replay_event_t){
+					.type = BUXN_REPLAY_CONSOLE,
+					.console = { .type = BUXN_CONSOLE_END },
+				});
+				break;
+			}
 		}
 	}
 
 	exit_code = buxn_system_exit_code(vm);
 	if (exit_code < 0) { exit_code = 0; }
 end:
-	free(vm);
+	if (replay.mode == BUXN_REPLAY_PLAY) {
+		struct timespec replay_end;
+		timespec_get(&replay_end, TIME_UTC);
+		double elapsed_ms =
+			(double)(replay_end.tv_sec - replay_start.tv_sec) * 1000.0
+			+ (double)(replay_end.tv_nsec - replay_start.tv_nsec) / 1000000.0;
+		fprintf(stderr, "Replayed %u events in %.3f ms\n", replay.num_events, elapsed_ms);
+		if (replay.num_mismatches > 0) {
+			fprintf(stderr, "%u inputs did not match the recording\n", replay.num_mismatches);
+		}
+	}
+	if (replay.file != NULL) { fclose(replay.file); }
+	free(devices.screen);
+	if (jit != NULL) { buxn_vm_jit_cleanup(jit); }
+	if (vm->config.profile != NULL) {
+		FILE* profile_file = fopen(profile_path, "wb");
+		if (profile_file != NULL) {
+			buxn_vm_profile_write(vm->config.profile, profile_file);
+			fclose(profile_file);
+		} else {
+			perror("Error while writing profile");
+		}
+		free(vm->config.profile);
+	}
+	if (vm->config.coverage != NULL) {
+		FILE* coverage_file = fopen(coverage_path, "wb");
+		if (coverage_file != NULL) {
+			buxn_vm_coverage_write(vm->config.coverage, coverage_file);
+			fclose(coverage_file);
+		} else {
+			perror("Error while writing coverage");
+		}
+		free(vm->config.coverage);
+	}
+	buxn_vm_trace_unmap(vm->config.trace);
+	buxn_vm_free(vm);
 #ifndef _WIN32
 	buxn_dbg_integration_cleanup(&dbg);
 #endif
@@ -187,6 +374,7 @@ end:
 	return exit_code;
 }
 
+#ifndef BUXN_CLI_ROM2C
 static int
 cli_main(int argc, const char* argv[]) {
 	PHYSFS_init(argv[0]);
@@ -212,6 +400,7 @@ end:
 	PHYSFS_deinit();
 	return exit_code;
 }
+#endif
 
 static int
 embd_main(int argc, const char* argv[], FILE* rom_file, uint32_t rom_size) {
@@ -227,6 +416,9 @@ embd_main(int argc, const char* argv[], FILE* rom_file, uint32_t rom_size) {
 
 int
 main(int argc, const char* argv[]) {
+#ifdef BUXN_CLI_ROM2C
+	return embd_main(argc, argv, NULL, 0);
+#else
 	if (argc == 0) { return cli_main(argc, argv); }
 
 	FILE* self = fopen(argv[0], "rb");
@@ -239,6 +431,7 @@ main(int argc, const char* argv[]) {
 	} else {
 		return embd_main(argc, argv, self, rom_size);
 	}
+#endif
 }
 
 #define BLIB_IMPLEMENTATION
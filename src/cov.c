@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <barena.h>
+#include <barray.h>
+#include <buxn/vm/coverage.h>
+#include <buxn/dbg/symtab.h>
+#define BSERIAL_STDIO
+#include <bserial.h>
+#include "bflag.h"
+
+#define FLAG_OUTPUT "-output="
+
+typedef struct {
+	const char* filename;
+	int line;
+	uint16_t addr;
+	uint8_t opcode;
+} instruction_t;
+
+static bool
+is_branch(uint8_t opcode) {
+	return (opcode & 0x1f) == 0x0d  // JCN
+		|| opcode == 0x20;  // JCI
+}
+
+static int
+sort_instruction(const void* lhs, const void* rhs) {
+	const instruction_t* lhs_inst = lhs;
+	const instruction_t* rhs_inst = rhs;
+	int cmp = strcmp(lhs_inst->filename, rhs_inst->filename);
+	if (cmp != 0) { return cmp; }
+	if (lhs_inst->line != rhs_inst->line) { return lhs_inst->line - rhs_inst->line; }
+	return (int)lhs_inst->addr - (int)rhs_inst->addr;
+}
+
+static void
+write_branch(
+	const buxn_vm_coverage_t* coverage,
+	const instruction_t* inst,
+	int* num_branches,
+	int* num_branches_hit,
+	FILE* out
+) {
+	if (!buxn_vm_bit_test(coverage->executed, inst->addr)) {
+		fprintf(out, "BRDA:%d,%d,0,-\n", inst->line, inst->addr);
+		fprintf(out, "BRDA:%d,%d,1,-\n", inst->line, inst->addr);
+	} else {
+		bool taken = buxn_vm_bit_test(coverage->branch_taken, inst->addr);
+		bool not_taken = buxn_vm_bit_test(coverage->branch_not_taken, inst->addr);
+		fprintf(out, "BRDA:%d,%d,0,%d\n", inst->line, inst->addr, taken ? 1 : 0);
+		fprintf(out, "BRDA:%d,%d,1,%d\n", inst->line, inst->addr, not_taken ? 1 : 0);
+		*num_branches_hit += (taken ? 1 : 0) + (not_taken ? 1 : 0);
+	}
+	*num_branches += 2;
+}
+
+// One record per source file.
+// A line is hit when any instruction assembled from it was executed.
+static void
+write_lcov(
+	const buxn_dbg_symtab_t* symtab,
+	const buxn_vm_coverage_t* coverage,
+	bool with_branches,
+	FILE* out
+) {
+	barray(instruction_t) instructions = NULL;
+	for (uint32_t i = 0; i < symtab->num_symbols; ++i) {
+		const buxn_dbg_sym_t* sym = &symtab->symbols[i];
+		if (sym->type != BUXN_DBG_SYM_OPCODE) { continue; }
+
+		instruction_t inst = {
+			.filename = sym->region.filename,
+			.line = sym->region.range.start.line,
+			.addr = sym->addr_min,
+			.opcode = (uint8_t)sym->id,
+		};
+		barray_push(instructions, inst, NULL);
+	}
+
+	size_t len = barray_len(instructions);
+	if (len > 0) {
+		qsort(instructions, len, sizeof(instructions[0]), sort_instruction);
+	}
+
+	size_t file_start = 0;
+	while (file_start < len) {
+		const char* filename = instructions[file_start].filename;
+		size_t file_end = file_start;
+		while (file_end < len && strcmp(instructions[file_end].filename, filename) == 0) {
+			++file_end;
+		}
+
+		fprintf(out, "TN:\nSF:%s\n", filename);
+
+		if (with_branches) {
+			int num_branches = 0;
+			int num_branches_hit = 0;
+			for (size_t i = file_start; i < file_end; ++i) {
+				if (!is_branch(instructions[i].opcode)) { continue; }
+
+				write_branch(coverage, &instructions[i], &num_branches, &num_branches_hit, out);
+			}
+			fprintf(out, "BRF:%d\nBRH:%d\n", num_branches, num_branches_hit);
+		}
+
+		int num_lines = 0;
+		int num_lines_hit = 0;
+		size_t line_start = file_start;
+		while (line_start < file_end) {
+			int line = instructions[line_start].line;
+			bool hit = false;
+			size_t line_end = line_start;
+			for (; line_end < file_end && instructions[line_end].line == line; ++line_end) {
+				hit |= buxn_vm_bit_test(coverage->executed, instructions[line_end].addr) > 0;
+			}
+
+			fprintf(out, "DA:%d,%d\n", line, hit ? 1 : 0);
+			num_lines += 1;
+			num_lines_hit += hit ? 1 : 0;
+			line_start = line_end;
+		}
+		fprintf(out, "LF:%d\nLH:%d\nend_of_record\n", num_lines, num_lines_hit);
+
+		file_start = file_end;
+	}
+
+	barray_free(NULL, instructions);
+}
+
+static bool
+has_branches(const buxn_vm_coverage_t* coverage) {
+	for (size_t i = 0; i < sizeof(coverage->branch_taken); ++i) {
+		if (coverage->branch_taken[i] != 0 || coverage->branch_not_taken[i] != 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int
+main(int argc, const char* argv[]) {
+	const char* output_filename = NULL;
+	const char* dbg_filename = NULL;
+	int first_coverage_arg = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* flag_value;
+		const char* arg = argv[i];
+
+		if ((flag_value = parse_flag(arg, "--help")) != NULL) {
+			fprintf(stderr,
+				"Usage: buxn-cov [options] <input.rom.dbg> <coverage>...\n"
+				"Convert coverage written through BUXN_COVERAGE to lcov.\n"
+				"Several coverage files of the same ROM are merged.\n"
+				"\n"
+				"--help             Print this message.\n"
+				"-output=<file>     (Optional) Write the lcov tracefile to this file.\n"
+				"                   This defaults to stdout.\n"
+			);
+			return 0;
+		} else if ((flag_value = parse_flag(arg, FLAG_OUTPUT)) != NULL) {
+			if (output_filename != NULL) {
+				fprintf(stderr, "%s can only be specified once\n", FLAG_OUTPUT);
+				return 1;
+			}
+			output_filename = flag_value;
+		} else if (dbg_filename == NULL) {
+			dbg_filename = arg;
+		} else {
+			first_coverage_arg = i;
+			break;
+		}
+	}
+
+	if (dbg_filename == NULL || first_coverage_arg == 0) {
+		fprintf(stderr, "Please specify a debug file and at least one coverage file\n");
+		return 1;
+	}
+
+	int exit_code = 1;
+	barena_pool_t pool;
+	barena_pool_init(&pool, 1);
+	barena_t arena;
+	barena_init(&arena, &pool);
+	buxn_vm_coverage_t* coverage = calloc(1, sizeof(buxn_vm_coverage_t));
+
+	for (int i = first_coverage_arg; i < argc; ++i) {
+		FILE* coverage_file = fopen(argv[i], "rb");
+		if (coverage_file == NULL) {
+			fprintf(stderr, "Could not open coverage %s: %s\n", argv[i], strerror(errno));
+			goto end;
+		}
+
+		bool success = buxn_vm_coverage_read(coverage, coverage_file);
+		fclose(coverage_file);
+		if (!success) {
+			fprintf(stderr, "Error while reading coverage %s\n", argv[i]);
+			goto end;
+		}
+	}
+
+	buxn_dbg_symtab_t* symtab = NULL;
+	{
+		FILE* dbg_file = fopen(dbg_filename, "rb");
+		if (dbg_file == NULL) {
+			fprintf(stderr, "Could not open debug file: %s\n", strerror(errno));
+			goto end;
+		}
+
+		bserial_stdio_in_t stdio_in;
+		buxn_dbg_symtab_reader_opts_t reader_opts = {
+			.input = bserial_stdio_init_in(&stdio_in, dbg_file),
+		};
+		buxn_dbg_symtab_reader_t* reader = buxn_dbg_make_symtab_reader(
+			barena_malloc(&arena, buxn_dbg_symtab_reader_mem_size(&reader_opts)),
+			&reader_opts
+		);
+
+		if (buxn_dbg_read_symtab_header(reader) == BUXN_DBG_SYMTAB_OK) {
+			symtab = barena_malloc(&arena, buxn_dbg_symtab_mem_size(reader));
+			if (buxn_dbg_read_symtab(reader, symtab) != BUXN_DBG_SYMTAB_OK) {
+				symtab = NULL;
+			}
+		}
+		fclose(dbg_file);
+
+		if (symtab == NULL) {
+			fprintf(stderr, "Error while reading debug file\n");
+			goto end;
+		}
+	}
+
+	{
+		FILE* out = output_filename != NULL ? fopen(output_filename, "wb") : stdout;
+		if (out == NULL) {
+			fprintf(stderr, "Could not open output file: %s\n", strerror(errno));
+			goto end;
+		}
+		// Without BUXN_COVERAGE_BRANCHES, every branch would look untaken
+		write_lcov(symtab, coverage, has_branches(coverage), out);
+		if (out != stdout && fclose(out) != 0) {
+			fprintf(stderr, "Error while writing output file: %s\n", strerror(errno));
+			goto end;
+		}
+	}
+
+	exit_code = 0;
+end:
+	free(coverage);
+	barena_reset(&arena);
+	barena_pool_cleanup(&pool);
+	return exit_code;
+}
+
+#define BLIB_IMPLEMENTATION
+#include <barena.h>
+#include <bserial.h>
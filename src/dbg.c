@@ -17,6 +17,7 @@ buxn_dbg_integration_init(buxn_dbg_integration_t* dbg_int, buxn_vm_t* vm, int fd
 
 		dbg_int->dbg = buxn_dbg_init(dbg_int->dbg_mem, &dbg_int->wire);
 		vm->config.hook = buxn_dbg_vm_hook(dbg_int->dbg);
+		vm->config.hook_filter = buxn_dbg_vm_hook_filter(dbg_int->dbg);
 		dbg_int->vm = vm;
 
 		buxn_dbg_request_pause(dbg_int->dbg);
@@ -29,9 +30,11 @@ buxn_dbg_integration_update(buxn_dbg_integration_t* dbg_int) {
 	buxn_dbg_transport_fd_update(&dbg_int->transport, dbg_int->dbg);
 	if (buxn_dbg_should_hook(dbg_int->dbg)) {
 		dbg_int->vm->config.hook = buxn_dbg_vm_hook(dbg_int->dbg);
+		dbg_int->vm->config.hook_filter = buxn_dbg_vm_hook_filter(dbg_int->dbg);
 		return true;
 	} else {
 		dbg_int->vm->config.hook = (buxn_vm_hook_t) { 0 };
+		dbg_int->vm->config.hook_filter = NULL;
 		return false;
 	}
 }
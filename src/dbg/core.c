@@ -31,6 +31,8 @@ struct buxn_dbg_s {
 	uint8_t nbrkps;
 	uint8_t brkp_mask;
 	buxn_dbg_brkp_t brkps[255];
+
+	buxn_vm_hook_filter_t hook_filter;
 };
 
 _Static_assert(sizeof(buxn_dbg_t) == BUXN_DBG_SIZE, "Declared size does not match");
@@ -39,12 +41,58 @@ _Static_assert(_Alignof(buxn_dbg_t) == BUXN_DBG_ALIGNMENT, "Declared alignment d
 static void
 buxn_dbg_hook(buxn_vm_t* vm, uint16_t pc, void* userdata);
 
+// Device exec breakpoints are matched at the start of a vector which is always
+// hooked
+static void
+buxn_dbg_update_brkp_filter(buxn_dbg_t* dbg) {
+	buxn_vm_hook_filter_t* filter = &dbg->hook_filter;
+	memset(filter->opcodes, 0, sizeof(filter->opcodes));
+	memset(filter->exec, 0, sizeof(filter->exec));
+	memset(filter->mem_pages, 0, sizeof(filter->mem_pages));
+	memset(filter->dev_ports, 0, sizeof(filter->dev_ports));
+	// Ends the execution
+	filter->opcodes[0x00] = BUXN_VM_HOOK_FILTER_ALWAYS;
+
+	bool watch_mem = false;
+	bool watch_dev = false;
+	for (uint8_t i = 0; i < dbg->nbrkps; ++i) {
+		buxn_dbg_brkp_t brkp = dbg->brkps[i];
+		bool watch = (brkp.mask & (BUXN_DBG_BRKP_LOAD | BUXN_DBG_BRKP_STORE)) > 0;
+
+		if ((brkp.mask & BUXN_DBG_BRKP_TYPE_MASK) == BUXN_DBG_BRKP_DEV) {
+			if (watch) {
+				buxn_vm_bit_set(filter->dev_ports, (uint8_t)brkp.addr);
+				watch_dev = true;
+			}
+		} else {
+			if ((brkp.mask & BUXN_DBG_BRKP_EXEC) > 0) {
+				buxn_vm_bit_set(filter->exec, brkp.addr);
+			}
+			if (watch) {
+				buxn_vm_bit_set(filter->mem_pages, brkp.addr >> BUXN_VM_HOOK_FILTER_PAGE_SHIFT);
+				watch_mem = true;
+			}
+		}
+	}
+
+	for (int opcode = 0; opcode < 256; ++opcode) {
+		uint8_t base_opcode = opcode & 0x1f;
+		if (
+			(watch_mem && base_opcode >= 0x10 && base_opcode <= 0x15)  // LDZ to STA
+			|| (watch_dev && (base_opcode == 0x16 || base_opcode == 0x17))  // DEI, DEO
+		) {
+			filter->opcodes[opcode] = BUXN_VM_HOOK_FILTER_WATCH;
+		}
+	}
+}
+
 buxn_dbg_t*
 buxn_dbg_init(void* mem, buxn_dbg_wire_t* wire) {
 	buxn_dbg_t* dbg = mem;
 	*dbg = (buxn_dbg_t){
 		.wire = wire,
 	};
+	buxn_dbg_update_brkp_filter(dbg);
 
 	return dbg;
 }
@@ -52,6 +100,7 @@ buxn_dbg_init(void* mem, buxn_dbg_wire_t* wire) {
 void
 buxn_dbg_request_pause(buxn_dbg_t* dbg) {
 	dbg->standing_cmd.type = BUXN_DBG_STANDING_CMD_PAUSE;
+	dbg->hook_filter.all = 1;
 }
 
 buxn_vm_hook_t
@@ -62,6 +111,11 @@ buxn_dbg_vm_hook(buxn_dbg_t* dbg) {
 	};
 }
 
+const buxn_vm_hook_filter_t*
+buxn_dbg_vm_hook_filter(buxn_dbg_t* dbg) {
+	return &dbg->hook_filter;
+}
+
 bool
 buxn_dbg_should_hook(buxn_dbg_t* dbg) {
 	return dbg->standing_cmd.type != BUXN_DBG_STANDING_CMD_EXECUTE
@@ -294,6 +348,7 @@ buxn_dbg_hook(buxn_vm_t* vm, uint16_t pc, void* userdata) {
 							brkp_mask |= dbg->brkps[i].mask;
 						}
 						dbg->brkp_mask = brkp_mask;
+						buxn_dbg_update_brkp_filter(dbg);
 					}
 					break;
 				case BUXN_DBG_CMD_DEV_READ:
@@ -319,6 +374,7 @@ buxn_dbg_hook(buxn_vm_t* vm, uint16_t pc, void* userdata) {
 					for (uint16_t i = 0; i < cmd.mem_write.size; ++i) {
 						uint16_t write_addr = cmd.mem_write.addr + i;  // Ensure wrap around
 						vm->memory[write_addr] = cmd.mem_write.values[i];
+						buxn_vm_mem_invalidate(vm, write_addr, 1);
 					}
 					break;
 			}
@@ -327,6 +383,9 @@ buxn_dbg_hook(buxn_vm_t* vm, uint16_t pc, void* userdata) {
 		buxn_dbg_end_break(wire);
 	}
 
+	// Stepping needs every opcode
+	dbg->hook_filter.all = dbg->standing_cmd.type != BUXN_DBG_STANDING_CMD_EXECUTE;
+
 	if (vm->memory[pc] == 0x00) {  // BRK
 		buxn_dbg_end_exec(wire);
 		dbg->executing = false;
@@ -1,4 +1,5 @@
 #include <buxn/devices/audio.h>
+#include <buxn/devices/ports.h>
 #include <buxn/vm/vm.h>
 
 // Adapted from: https://git.sr.ht/~rabbits/uxn/tree/main/item/src/devices/audio.h
@@ -157,3 +158,22 @@ buxn_audio_notify_finished(struct buxn_vm_s* vm, uint8_t device_id) {
 	uint16_t vector_addr = buxn_vm_dev_load2(vm, device_id);
 	if (vector_addr != 0) { buxn_vm_execute(vm, vector_addr); }
 }
+
+static uint8_t
+buxn_audio_port_dei(buxn_vm_t* vm, void* device, uint8_t address) {
+	uint8_t device_id = buxn_device_id(address);
+	return buxn_audio_dei(vm, device, vm->device + device_id, buxn_device_port(address));
+}
+
+static void
+buxn_audio_port_deo(buxn_vm_t* vm, void* device, uint8_t address) {
+	uint8_t device_id = buxn_device_id(address);
+	buxn_audio_deo(vm, device, vm->device + device_id, buxn_device_port(address));
+}
+
+const buxn_port_device_t buxn_audio_ports = {
+	.dei = buxn_audio_port_dei,
+	.deo = buxn_audio_port_deo,
+	.dei_ports = BUXN_PORT(0x2) | BUXN_PORT(0x4),
+	.deo_ports = BUXN_PORT(0xf),
+};
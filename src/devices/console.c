@@ -1,4 +1,5 @@
 #include <buxn/devices/console.h>
+#include <buxn/devices/ports.h>
 #include <buxn/vm/vm.h>
 
 static inline void
@@ -82,3 +83,20 @@ void
 buxn_console_send_input_end(struct buxn_vm_s* vm, buxn_console_t* device) {
 	buxn_console_send_data(vm, device, BUXN_CONSOLE_END, 0);
 }
+
+static uint8_t
+buxn_console_port_dei(buxn_vm_t* vm, void* device, uint8_t address) {
+	return buxn_console_dei(vm, device, address);
+}
+
+static void
+buxn_console_port_deo(buxn_vm_t* vm, void* device, uint8_t address) {
+	buxn_console_deo(vm, device, address);
+}
+
+const buxn_port_device_t buxn_console_ports = {
+	.dei = buxn_console_port_dei,
+	.deo = buxn_console_port_deo,
+	.dei_ports = BUXN_PORT(0x2) | BUXN_PORT(0x7),
+	.deo_ports = BUXN_PORT(0x8) | BUXN_PORT(0x9),
+};
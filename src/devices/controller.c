@@ -1,4 +1,5 @@
 #include <buxn/devices/controller.h>
+#include <buxn/devices/ports.h>
 #include <buxn/vm/vm.h>
 
 uint8_t
@@ -25,3 +26,13 @@ buxn_controller_send_event(struct buxn_vm_s* vm) {
 	uint16_t vector_addr = buxn_vm_dev_load2(vm, 0x80);
 	if (vector_addr != 0) { buxn_vm_execute(vm, vector_addr); }
 }
+
+static uint8_t
+buxn_controller_port_dei(buxn_vm_t* vm, void* device, uint8_t address) {
+	return buxn_controller_dei(vm, device, address);
+}
+
+const buxn_port_device_t buxn_controller_ports = {
+	.dei = buxn_controller_port_dei,
+	.dei_ports = BUXN_PORT(0x2) | BUXN_PORT(0x3) | BUXN_PORT(0x5) | BUXN_PORT(0x6) | BUXN_PORT(0x7),
+};
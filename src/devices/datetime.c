@@ -1,4 +1,5 @@
 #include <buxn/devices/datetime.h>
+#include <buxn/devices/ports.h>
 #include <buxn/vm/vm.h>
 #include <time.h>
 
@@ -26,3 +27,15 @@ buxn_datetime_dei(struct buxn_vm_s* vm, uint8_t addr) {
 		default: return vm->device[addr];
 	}
 }
+
+static uint8_t
+buxn_datetime_port_dei(buxn_vm_t* vm, void* device, uint8_t address) {
+	(void)device;
+	return buxn_datetime_dei(vm, address);
+}
+
+const buxn_port_device_t buxn_datetime_ports = {
+	.dei = buxn_datetime_port_dei,
+	// Every field from the year to the daylight saving flag
+	.dei_ports = 0x07ff,
+};
@@ -1,4 +1,5 @@
 #include <buxn/devices/file.h>
+#include <buxn/devices/ports.h>
 #include <buxn/vm/vm.h>
 #include <string.h>
 
@@ -119,6 +120,7 @@ buxn_file_deo(struct buxn_vm_s* vm, buxn_file_t* device, uint8_t* mem, uint8_t p
 			);
 			if (device->handle != NULL) {
 				buxn_file_format_stat((char*)&vm->memory[stat_addr], length, &device->stat);
+				buxn_vm_mem_invalidate(vm, stat_addr, length);
 				device->success = length;
 			} else {
 				char path_buf[BUXN_FILE_MAX_PATH];
@@ -126,6 +128,7 @@ buxn_file_deo(struct buxn_vm_s* vm, buxn_file_t* device, uint8_t* mem, uint8_t p
 				if (path != NULL) {
 					buxn_file_stat_t stat = buxn_file_stat(vm, path);
 					buxn_file_format_stat((char*)&vm->memory[stat_addr], length, &stat);
+					buxn_vm_mem_invalidate(vm, stat_addr, length);
 					device->success = length;
 				} else {
 					device->success = 0;
@@ -158,6 +161,7 @@ buxn_file_deo(struct buxn_vm_s* vm, buxn_file_t* device, uint8_t* mem, uint8_t p
 				buxn_vm_load2(mem, 0xa, BUXN_DEV_PRIV_ADDR_MASK),
 				read_addr
 			);
+			uint16_t start_addr = read_addr;
 			uint16_t total_bytes_read = 0;
 
 			if (file == NULL) {
@@ -217,6 +221,7 @@ buxn_file_deo(struct buxn_vm_s* vm, buxn_file_t* device, uint8_t* mem, uint8_t p
 				}
 			}
 
+			buxn_vm_mem_invalidate(vm, start_addr, total_bytes_read);
 			device->success = total_bytes_read;
 		} break;
 		case 0x0f: {
@@ -248,3 +253,22 @@ buxn_file_deo(struct buxn_vm_s* vm, buxn_file_t* device, uint8_t* mem, uint8_t p
 		} break;
 	}
 }
+
+static uint8_t
+buxn_file_port_dei(buxn_vm_t* vm, void* device, uint8_t address) {
+	uint8_t device_id = buxn_device_id(address);
+	return buxn_file_dei(vm, device, vm->device + device_id, buxn_device_port(address));
+}
+
+static void
+buxn_file_port_deo(buxn_vm_t* vm, void* device, uint8_t address) {
+	uint8_t device_id = buxn_device_id(address);
+	buxn_file_deo(vm, device, vm->device + device_id, buxn_device_port(address));
+}
+
+const buxn_port_device_t buxn_file_ports = {
+	.dei = buxn_file_port_dei,
+	.deo = buxn_file_port_deo,
+	.dei_ports = BUXN_PORT(0x2) | BUXN_PORT(0x3),
+	.deo_ports = BUXN_PORT(0x5) | BUXN_PORT(0x6) | BUXN_PORT(0x9) | BUXN_PORT(0xd) | BUXN_PORT(0xf),
+};
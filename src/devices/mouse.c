@@ -1,4 +1,5 @@
 #include <buxn/devices/mouse.h>
+#include <buxn/devices/ports.h>
 #include <buxn/vm/vm.h>
 
 uint8_t
@@ -29,3 +30,13 @@ buxn_mouse_update(struct buxn_vm_s* vm) {
 	uint16_t vector_addr = buxn_vm_dev_load2(vm, 0x90);
 	if (vector_addr != 0) { buxn_vm_execute(vm, vector_addr); }
 }
+
+static uint8_t
+buxn_mouse_port_dei(buxn_vm_t* vm, void* device, uint8_t address) {
+	return buxn_mouse_dei(vm, device, address);
+}
+
+const buxn_port_device_t buxn_mouse_ports = {
+	.dei = buxn_mouse_port_dei,
+	.dei_ports = BUXN_PORT(0x2) | BUXN_PORT(0x3) | BUXN_PORT(0x4) | BUXN_PORT(0x5) | BUXN_PORT(0x6) | BUXN_PORT(0xa) | BUXN_PORT(0xb) | BUXN_PORT(0xc) | BUXN_PORT(0xd),
+};
@@ -0,0 +1,31 @@
+#include <buxn/devices/ports.h>
+#include <stdbool.h>
+#include <string.h>
+
+void
+buxn_port_table_init(buxn_port_table_t* table) {
+	memset(table->noop_ports.dei, 1, sizeof(table->noop_ports.dei));
+	memset(table->noop_ports.deo, 1, sizeof(table->noop_ports.deo));
+	memset(table->handlers, 0, sizeof(table->handlers));
+}
+
+void
+buxn_port_table_register(
+	buxn_port_table_t* table,
+	uint8_t device_id,
+	const buxn_port_device_t* type,
+	void* device
+) {
+	for (uint8_t port = 0; port < 16; ++port) {
+		uint8_t address = device_id | port;
+		buxn_port_handler_t* handler = &table->handlers[address];
+		bool has_dei = (type->dei_ports & BUXN_PORT(port)) != 0;
+		bool has_deo = (type->deo_ports & BUXN_PORT(port)) != 0;
+
+		handler->dei = has_dei ? type->dei : NULL;
+		handler->deo = has_deo ? type->deo : NULL;
+		handler->device = device;
+		table->noop_ports.dei[address] = !has_dei;
+		table->noop_ports.deo[address] = !has_deo;
+	}
+}
@@ -0,0 +1,260 @@
+#include <buxn/devices/replay.h>
+#include <buxn/devices/screen.h>
+#include <buxn/devices/audio.h>
+#include <buxn/vm/vm.h>
+#include <string.h>
+
+#define BUXN_REPLAY_VERSION 1
+#define BUXN_REPLAY_MAX_EVENT_SIZE 16
+
+static const char buxn_replay_magic[4] = { 'B', 'X', 'R', 'P' };
+
+static inline uint8_t*
+buxn_replay_put2(uint8_t* out, uint16_t value) {
+	*out++ = (uint8_t)(value >> 8);
+	*out++ = (uint8_t)value;
+	return out;
+}
+
+static inline uint16_t
+buxn_replay_get2(const uint8_t* in) {
+	return (uint16_t)((in[0] << 8) | in[1]);
+}
+
+static size_t
+buxn_replay_payload_size(uint8_t type) {
+	switch (type) {
+		case BUXN_REPLAY_CONSOLE: return 2;
+		case BUXN_REPLAY_MOUSE: return 9;
+		case BUXN_REPLAY_CONTROLLER: return BUXN_NUM_CONTROLLERS + 1;
+		case BUXN_REPLAY_SCREEN: return 0;
+		case BUXN_REPLAY_AUDIO: return 1;
+		case BUXN_REPLAY_DEI: return 2;
+		default: return SIZE_MAX;
+	}
+}
+
+static void
+buxn_replay_write(buxn_replay_t* replay, const buxn_replay_event_t* event) {
+	uint8_t buf[BUXN_REPLAY_MAX_EVENT_SIZE];
+	uint8_t* out = buf;
+	*out++ = (uint8_t)event->type;
+	switch (event->type) {
+		case BUXN_REPLAY_CONSOLE:
+			*out++ = event->console.type;
+			*out++ = event->console.value;
+			break;
+		case BUXN_REPLAY_MOUSE:
+			out = buxn_replay_put2(out, event->mouse.x);
+			out = buxn_replay_put2(out, event->mouse.y);
+			*out++ = event->mouse.state;
+			out = buxn_replay_put2(out, (uint16_t)event->mouse.scroll_x);
+			out = buxn_replay_put2(out, (uint16_t)event->mouse.scroll_y);
+			break;
+		case BUXN_REPLAY_CONTROLLER:
+			memcpy(out, event->controller.buttons, BUXN_NUM_CONTROLLERS);
+			out += BUXN_NUM_CONTROLLERS;
+			*out++ = event->controller.ch;
+			break;
+		case BUXN_REPLAY_SCREEN:
+			break;
+		case BUXN_REPLAY_AUDIO:
+			*out++ = event->audio_device_id;
+			break;
+		case BUXN_REPLAY_DEI:
+			*out++ = event->dei.address;
+			*out++ = event->dei.value;
+			break;
+	}
+
+	fwrite(buf, (size_t)(out - buf), 1, replay->file);
+}
+
+static bool
+buxn_replay_read(buxn_replay_t* replay, buxn_replay_event_t* event) {
+	int type = fgetc(replay->file);
+	if (type == EOF) { return false; }
+
+	size_t size = buxn_replay_payload_size((uint8_t)type);
+	if (size == SIZE_MAX) { return false; }
+
+	uint8_t buf[BUXN_REPLAY_MAX_EVENT_SIZE];
+	if (size > 0 && fread(buf, size, 1, replay->file) != 1) { return false; }
+
+	const uint8_t* in = buf;
+	event->type = (buxn_replay_event_type_t)type;
+	switch (event->type) {
+		case BUXN_REPLAY_CONSOLE:
+			event->console.type = in[0];
+			event->console.value = in[1];
+			break;
+		case BUXN_REPLAY_MOUSE:
+			event->mouse.x = buxn_replay_get2(in + 0);
+			event->mouse.y = buxn_replay_get2(in + 2);
+			event->mouse.state = in[4];
+			event->mouse.scroll_x = (int16_t)buxn_replay_get2(in + 5);
+			event->mouse.scroll_y = (int16_t)buxn_replay_get2(in + 7);
+			break;
+		case BUXN_REPLAY_CONTROLLER:
+			memcpy(event->controller.buttons, in, BUXN_NUM_CONTROLLERS);
+			event->controller.ch = in[BUXN_NUM_CONTROLLERS];
+			break;
+		case BUXN_REPLAY_SCREEN:
+			break;
+		case BUXN_REPLAY_AUDIO:
+			event->audio_device_id = in[0];
+			break;
+		case BUXN_REPLAY_DEI:
+			event->dei.address = in[0];
+			event->dei.value = in[1];
+			break;
+	}
+
+	return true;
+}
+
+static bool
+buxn_replay_peek(buxn_replay_t* replay) {
+	if (!replay->has_next) {
+		replay->has_next = buxn_replay_read(replay, &replay->next);
+	}
+
+	return replay->has_next;
+}
+
+bool
+buxn_replay_begin_record(buxn_replay_t* replay, FILE* file) {
+	uint8_t header[sizeof(buxn_replay_magic) + 5];
+	memcpy(header, buxn_replay_magic, sizeof(buxn_replay_magic));
+	uint8_t* out = header + sizeof(buxn_replay_magic);
+	*out++ = BUXN_REPLAY_VERSION;
+	out = buxn_replay_put2(out, replay->screen_width);
+	out = buxn_replay_put2(out, replay->screen_height);
+	if (fwrite(header, sizeof(header), 1, file) != 1) { return false; }
+
+	replay->mode = BUXN_REPLAY_RECORD;
+	replay->file = file;
+	return true;
+}
+
+bool
+buxn_replay_begin_play(buxn_replay_t* replay, FILE* file) {
+	uint8_t header[sizeof(buxn_replay_magic) + 5];
+	if (fread(header, sizeof(header), 1, file) != 1) { return false; }
+	if (memcmp(header, buxn_replay_magic, sizeof(buxn_replay_magic)) != 0) { return false; }
+
+	const uint8_t* in = header + sizeof(buxn_replay_magic);
+	if (in[0] != BUXN_REPLAY_VERSION) { return false; }
+	replay->screen_width = buxn_replay_get2(in + 1);
+	replay->screen_height = buxn_replay_get2(in + 3);
+
+	replay->mode = BUXN_REPLAY_PLAY;
+	replay->file = file;
+	replay->has_next = false;
+	return true;
+}
+
+static uint8_t
+buxn_replay_port_dei(buxn_vm_t* vm, void* device, uint8_t address) {
+	buxn_replay_t* replay = device;
+	const buxn_port_handler_t* handler = &replay->captured[address];
+
+	if (replay->mode == BUXN_REPLAY_PLAY) {
+		if (
+			buxn_replay_peek(replay)
+			&& replay->next.type == BUXN_REPLAY_DEI
+			&& replay->next.dei.address == address
+		) {
+			replay->has_next = false;
+			return replay->next.dei.value;
+		}
+
+		// The ROM went another way than when it was recorded
+		++replay->num_mismatches;
+		return handler->dei(vm, handler->device, address);
+	}
+
+	uint8_t value = handler->dei(vm, handler->device, address);
+	if (replay->mode == BUXN_REPLAY_RECORD) {
+		buxn_replay_write(replay, &(buxn_replay_event_t){
+			.type = BUXN_REPLAY_DEI,
+			.dei = { .address = address, .value = value },
+		});
+	}
+	return value;
+}
+
+static void
+buxn_replay_port_deo(buxn_vm_t* vm, void* device, uint8_t address) {
+	buxn_replay_t* replay = device;
+	const buxn_port_handler_t* handler = &replay->captured[address];
+	handler->deo(vm, handler->device, address);
+}
+
+void
+buxn_replay_capture(buxn_replay_t* replay, buxn_port_table_t* table, uint8_t device_id) {
+	for (uint8_t port = 0; port < 16; ++port) {
+		uint8_t address = device_id | port;
+		buxn_port_handler_t* handler = &table->handlers[address];
+		if (handler->dei == NULL) { continue; }
+
+		// The device pointer is shared with deo so that is forwarded too
+		replay->captured[address] = *handler;
+		handler->dei = buxn_replay_port_dei;
+		handler->deo = handler->deo != NULL ? buxn_replay_port_deo : NULL;
+		handler->device = replay;
+	}
+}
+
+void
+buxn_replay_send(buxn_replay_t* replay, struct buxn_vm_s* vm, const buxn_replay_event_t* event) {
+	if (event->type == BUXN_REPLAY_DEI) { return; }
+
+	if (replay->mode == BUXN_REPLAY_RECORD) {
+		buxn_replay_write(replay, event);
+	}
+	++replay->num_events;
+
+	switch (event->type) {
+		case BUXN_REPLAY_CONSOLE:
+			if (event->console.type == BUXN_CONSOLE_END) {
+				buxn_console_send_input_end(vm, replay->console);
+			} else {
+				buxn_console_send_input(vm, replay->console, (char)event->console.value);
+			}
+			break;
+		case BUXN_REPLAY_MOUSE:
+			*replay->mouse = event->mouse;
+			buxn_mouse_update(vm);
+			break;
+		case BUXN_REPLAY_CONTROLLER:
+			*replay->controller = event->controller;
+			buxn_controller_send_event(vm);
+			replay->controller->ch = 0;
+			break;
+		case BUXN_REPLAY_SCREEN:
+			buxn_screen_update(vm);
+			break;
+		case BUXN_REPLAY_AUDIO:
+			buxn_audio_notify_finished(vm, event->audio_device_id);
+			break;
+		case BUXN_REPLAY_DEI:
+			break;
+	}
+}
+
+bool
+buxn_replay_next(buxn_replay_t* replay, buxn_replay_event_t* event) {
+	while (buxn_replay_peek(replay)) {
+		replay->has_next = false;
+		if (replay->next.type != BUXN_REPLAY_DEI) {
+			*event = replay->next;
+			return true;
+		}
+
+		// A value recorded for a read which did not happen
+		++replay->num_mismatches;
+	}
+
+	return false;
+}
@@ -1,5 +1,6 @@
 #include <string.h>
 #include <buxn/devices/screen.h>
+#include <buxn/devices/ports.h>
 #include <buxn/vm/vm.h>
 
 // Adapted from: https://git.sr.ht/~rabbits/uxn/tree/main/item/src/devices/screen.h
@@ -26,36 +27,292 @@ static const uint8_t BUXN_BLENDING[4][16] = {
 	{2, 3, 1, 2, 2, 3, 1, 2, 2, 3, 1, 2, 2, 3, 1, 2}
 };
 
+// Build with -DBUXN_SCREEN_ENABLE_SIMD=0 to use the portable sprite blitter
+#ifndef BUXN_SCREEN_ENABLE_SIMD
+#define BUXN_SCREEN_ENABLE_SIMD 1
+#endif
+
+#if BUXN_SCREEN_ENABLE_SIMD && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define BUXN_SCREEN_SSE2 1
+#include <emmintrin.h>
+#elif BUXN_SCREEN_ENABLE_SIMD && (defined(__ARM_NEON) || defined(_M_ARM64))
+#define BUXN_SCREEN_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* byte shuffles for the palette */
+#if defined(BUXN_SCREEN_SSE2) && (defined(__SSSE3__) || defined(__AVX__))
+#define BUXN_SCREEN_SSSE3 1
+#define BUXN_SCREEN_VEC __m128i
+#include <tmmintrin.h>
+#elif defined(BUXN_SCREEN_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+#define BUXN_SCREEN_NEON64 1
+#define BUXN_SCREEN_VEC uint8x16_t
+#endif
+
+#define BUXN_SPRITE_ROW(B) { \
+	((B) >> 7) & 1, ((B) >> 6) & 1, ((B) >> 5) & 1, ((B) >> 4) & 1, \
+	((B) >> 3) & 1, ((B) >> 2) & 1, ((B) >> 1) & 1, (B) & 1, \
+}
+#define BUXN_SPRITE_ROW_FLIPPED(B) { \
+	(B) & 1, ((B) >> 1) & 1, ((B) >> 2) & 1, ((B) >> 3) & 1, \
+	((B) >> 4) & 1, ((B) >> 5) & 1, ((B) >> 6) & 1, ((B) >> 7) & 1, \
+}
+#define BUXN_SPRITE_ROWS4(ROW, B) ROW(B), ROW(B + 1), ROW(B + 2), ROW(B + 3)
+#define BUXN_SPRITE_ROWS16(ROW, B) \
+	BUXN_SPRITE_ROWS4(ROW, B), BUXN_SPRITE_ROWS4(ROW, B + 4), \
+	BUXN_SPRITE_ROWS4(ROW, B + 8), BUXN_SPRITE_ROWS4(ROW, B + 12)
+#define BUXN_SPRITE_ROWS64(ROW, B) \
+	BUXN_SPRITE_ROWS16(ROW, B), BUXN_SPRITE_ROWS16(ROW, B + 16), \
+	BUXN_SPRITE_ROWS16(ROW, B + 32), BUXN_SPRITE_ROWS16(ROW, B + 48)
+#define BUXN_SPRITE_ROWS256(ROW) \
+	BUXN_SPRITE_ROWS64(ROW, 0), BUXN_SPRITE_ROWS64(ROW, 64), \
+	BUXN_SPRITE_ROWS64(ROW, 128), BUXN_SPRITE_ROWS64(ROW, 192)
+
+// A row of a sprite plane as one 0 or 1 byte per pixel, left to right.
+// The second half is for sprites flipped horizontally.
+static const uint8_t BUXN_SPRITE_PIXELS[2][256][8] = {
+	{ BUXN_SPRITE_ROWS256(BUXN_SPRITE_ROW) },
+	{ BUXN_SPRITE_ROWS256(BUXN_SPRITE_ROW_FLIPPED) },
+};
+
+#define BUXN_SPRITE_SPREAD(B) ( \
+	(((B) >> 7) & 1) << 0 | (((B) >> 6) & 1) << 2 | (((B) >> 5) & 1) << 4 | (((B) >> 4) & 1) << 6 | \
+	(((B) >> 3) & 1) << 8 | (((B) >> 2) & 1) << 10 | (((B) >> 1) & 1) << 12 | ((B) & 1) << 14 \
+)
+#define BUXN_SPRITE_SPREAD_FLIPPED(B) ( \
+	((B) & 1) << 0 | (((B) >> 1) & 1) << 2 | (((B) >> 2) & 1) << 4 | (((B) >> 3) & 1) << 6 | \
+	(((B) >> 4) & 1) << 8 | (((B) >> 5) & 1) << 10 | (((B) >> 6) & 1) << 12 | (((B) >> 7) & 1) << 14 \
+)
+
+// The same for a packed layer: the bit of pixel k is at bit k * 2
+static const uint16_t BUXN_SPRITE_SPREAD_BITS[2][256] = {
+	{ BUXN_SPRITE_ROWS256(BUXN_SPRITE_SPREAD) },
+	{ BUXN_SPRITE_ROWS256(BUXN_SPRITE_SPREAD_FLIPPED) },
+};
+
+typedef struct {
+	// BUXN_BLENDING of each color, repeated for the 8 pixels of a row
+	uint8_t colors[4][8];
+	// 0xff when color 0 is drawn
+	uint8_t opaque[8];
+} buxn_screen_blend_t;
+
+static void
+buxn_screen_blend_init(buxn_screen_blend_t* blend, int mode) {
+	for(int i = 0; i < 4; i++) {
+		memset(blend->colors[i], BUXN_BLENDING[i][mode], 8);
+	}
+	memset(blend->opaque, mode % 5 ? 0xff : 0x00, 8);
+}
+
+// Draw the 8 rows of a sprite at dst, each row being 8 pixels.
+// hi_plane is NULL for a 1bpp sprite.
+// Pixels are selected from the blended colors with byte masks instead of a
+// branch per pixel.
+static void
+buxn_screen_blit(
+	uint8_t* dst, int stride,
+	const uint8_t* lo_plane, const uint8_t* hi_plane,
+	int qy, int fy,
+	const uint8_t (*pixels)[8],
+	const buxn_screen_blend_t* blend
+) {
+#if defined(BUXN_SCREEN_SSE2)
+	__m128i zero = _mm_setzero_si128();
+	__m128i c0 = _mm_loadl_epi64((const __m128i*)blend->colors[0]);
+	__m128i c1 = _mm_loadl_epi64((const __m128i*)blend->colors[1]);
+	__m128i c2 = _mm_loadl_epi64((const __m128i*)blend->colors[2]);
+	__m128i c3 = _mm_loadl_epi64((const __m128i*)blend->colors[3]);
+	__m128i opaque = _mm_loadl_epi64((const __m128i*)blend->opaque);
+	for(int i = 0; i < 8; i++, dst += stride, qy += fy) {
+		__m128i m1 = _mm_sub_epi8(zero, _mm_loadl_epi64((const __m128i*)pixels[lo_plane[qy]]));
+		__m128i m2 = hi_plane != NULL
+			? _mm_sub_epi8(zero, _mm_loadl_epi64((const __m128i*)pixels[hi_plane[qy]]))
+			: zero;
+		__m128i lo = _mm_or_si128(_mm_andnot_si128(m1, c0), _mm_and_si128(m1, c1));
+		__m128i hi = _mm_or_si128(_mm_andnot_si128(m1, c2), _mm_and_si128(m1, c3));
+		__m128i color = _mm_or_si128(_mm_andnot_si128(m2, lo), _mm_and_si128(m2, hi));
+		__m128i mask = _mm_or_si128(_mm_or_si128(m1, m2), opaque);
+		__m128i old = _mm_loadl_epi64((const __m128i*)dst);
+		__m128i result = _mm_or_si128(_mm_andnot_si128(mask, old), _mm_and_si128(mask, color));
+		_mm_storel_epi64((__m128i*)dst, result);
+	}
+#elif defined(BUXN_SCREEN_NEON)
+	uint8x8_t c0 = vld1_u8(blend->colors[0]);
+	uint8x8_t c1 = vld1_u8(blend->colors[1]);
+	uint8x8_t c2 = vld1_u8(blend->colors[2]);
+	uint8x8_t c3 = vld1_u8(blend->colors[3]);
+	uint8x8_t opaque = vld1_u8(blend->opaque);
+	for(int i = 0; i < 8; i++, dst += stride, qy += fy) {
+		uint8x8_t bits1 = vld1_u8(pixels[lo_plane[qy]]);
+		uint8x8_t m1 = vtst_u8(bits1, bits1);
+		uint8x8_t m2 = vdup_n_u8(0);
+		if(hi_plane != NULL) {
+			uint8x8_t bits2 = vld1_u8(pixels[hi_plane[qy]]);
+			m2 = vtst_u8(bits2, bits2);
+		}
+		uint8x8_t lo = vbsl_u8(m1, c1, c0);
+		uint8x8_t hi = vbsl_u8(m1, c3, c2);
+		uint8x8_t color = vbsl_u8(m2, hi, lo);
+		uint8x8_t mask = vorr_u8(vorr_u8(m1, m2), opaque);
+		vst1_u8(dst, vbsl_u8(mask, color, vld1_u8(dst)));
+	}
+#else
+	// The same masks on the 8 pixels of a row packed in a uint64_t
+	uint64_t c0, c1, c2, c3, opaque;
+	memcpy(&c0, blend->colors[0], 8);
+	memcpy(&c1, blend->colors[1], 8);
+	memcpy(&c2, blend->colors[2], 8);
+	memcpy(&c3, blend->colors[3], 8);
+	memcpy(&opaque, blend->opaque, 8);
+	for(int i = 0; i < 8; i++, dst += stride, qy += fy) {
+		uint64_t m1, m2 = 0, old;
+		memcpy(&m1, pixels[lo_plane[qy]], 8);
+		m1 *= 0xff;
+		if(hi_plane != NULL) {
+			memcpy(&m2, pixels[hi_plane[qy]], 8);
+			m2 *= 0xff;
+		}
+		uint64_t lo = (c0 & ~m1) | (c1 & m1);
+		uint64_t hi = (c2 & ~m1) | (c3 & m1);
+		uint64_t color = (lo & ~m2) | (hi & m2);
+		uint64_t mask = m1 | m2 | opaque;
+		memcpy(&old, dst, 8);
+		old = (old & ~mask) | (color & mask);
+		memcpy(dst, &old, 8);
+	}
+#endif
+}
+
+// Same as buxn_screen_blit for a packed layer with the sprite starting at
+// pixel x of row.
+// A row of the sprite is 16 bits which can straddle 3 bytes.
+static void
+buxn_screen_blit_packed(
+	uint8_t* row, int x, int stride,
+	const uint8_t* lo_plane, const uint8_t* hi_plane,
+	int qy, int fy,
+	const uint16_t* spread,
+	const buxn_screen_blend_t* blend
+) {
+	uint32_t c0 = blend->colors[0][0], c1 = blend->colors[1][0];
+	uint32_t c2 = blend->colors[2][0], c3 = blend->colors[3][0];
+	uint32_t opaque = blend->opaque[0] ? 0xffff : 0;
+	int shift = (x & 3) * 2;
+	uint8_t* dst = row + (x >> 2);
+	for(int i = 0; i < 8; i++, dst += stride, qy += fy) {
+		uint32_t lo = spread[lo_plane[qy]];
+		uint32_t hi = hi_plane != NULL ? spread[hi_plane[qy]] : 0;
+		// The low bit of every pixel holding each color
+		uint32_t m0 = ~(lo | hi) & 0x5555, m1 = lo & ~hi, m2 = hi & ~lo, m3 = lo & hi;
+		uint32_t color = (m0 * c0 | m1 * c1 | m2 * c2 | m3 * c3) << shift;
+		uint32_t mask = (((lo | hi) * 3) | opaque) << shift;
+		uint32_t old = dst[0] | dst[1] << 8 | (uint32_t)dst[2] << 16;
+		old = (old & ~mask) | (color & mask);
+		dst[0] = (uint8_t)old;
+		dst[1] = (uint8_t)(old >> 8);
+		dst[2] = (uint8_t)(old >> 16);
+	}
+}
+
+static void
+buxn_screen_put_packed(uint8_t* row, int x, int color) {
+	int shift = (x & 3) * 2;
+	row[x >> 2] = (uint8_t)((row[x >> 2] & ~(3 << shift)) | color << shift);
+}
+
+static void
+buxn_screen_fill_packed(uint8_t* row, int x1, int x2, int color) {
+	for(; x1 < x2 && (x1 & 3); x1++) buxn_screen_put_packed(row, x1, color);
+	if(x2 - x1 >= 4) {
+		memset(row + (x1 >> 2), color * 0x55, (x2 >> 2) - (x1 >> 2));
+		x1 = x2 & ~3;
+	}
+	for(; x1 < x2; x1++) buxn_screen_put_packed(row, x1, color);
+}
+
+static int
+buxn_screen_row_size(const buxn_screen_t* device) {
+	return device->packed ? BUXN_SCREEN_PACKED_ROW_SIZE(device->width) : MAR2(device->width);
+}
+
+#define TILE_SHIFT 3
+
+static size_t
+buxn_screen_tiles_row_size(int width) {
+	size_t num_tiles = (size_t)(width + BUXN_SCREEN_TILE_SIZE - 1) >> TILE_SHIFT;
+	return (num_tiles + 7) >> 3;
+}
+
+static size_t
+buxn_screen_tiles_size(int width, int height) {
+	return buxn_screen_tiles_row_size(width) * BUXN_SCREEN_MAX_SPANS(height);
+}
+
 static void
 buxn_screen_dirty(
-	buxn_screen_rect_t* rect,
+	const buxn_screen_t* device,
+	uint8_t* tiles,
 	int x1, int y1, int x2, int y2
 ) {
-	if(x1 < rect->x1) rect->x1 = x1;
-	if(y1 < rect->y1) rect->y1 = y1;
-	if(x2 > rect->x2) rect->x2 = x2;
-	if(y2 > rect->y2) rect->y2 = y2;
+	clamp(x1, 0, device->width);
+	clamp(x2, 0, device->width);
+	clamp(y1, 0, device->height);
+	clamp(y2, 0, device->height);
+	if(x1 >= x2 || y1 >= y2) return;
+
+	size_t row_size = buxn_screen_tiles_row_size(device->width);
+	int tx1 = x1 >> TILE_SHIFT, tx2 = (x2 - 1) >> TILE_SHIFT;
+	int ty1 = y1 >> TILE_SHIFT, ty2 = (y2 - 1) >> TILE_SHIFT;
+	for(int ty = ty1; ty <= ty2; ty++) {
+		uint8_t* row = &tiles[ty * row_size];
+		for(int tx = tx1; tx <= tx2; tx++) {
+			buxn_vm_bit_set(row, tx);
+		}
+	}
 }
 
 buxn_screen_info_t
 buxn_screen_info(uint16_t width, uint16_t height) {
 	size_t length = MAR2(width) * MAR2(height);
+	size_t packed_length = BUXN_SCREEN_PACKED_ROW_SIZE(width) * MAR2(height);
+	size_t tiles_size = buxn_screen_tiles_size(width, height);
 	return (buxn_screen_info_t){
-		.screen_mem_size = sizeof(buxn_screen_t) + length * 2,
+		.screen_mem_size = sizeof(buxn_screen_t) + (length + tiles_size) * 2,
+		.packed_screen_mem_size = sizeof(buxn_screen_t) + (packed_length + tiles_size) * 2,
 		.target_mem_size = width * height * sizeof(uint32_t),
 	};
 }
 
 void
 buxn_screen_resize(buxn_screen_t* screen, uint16_t width, uint16_t height) {
-	size_t length = MAR2(width) * MAR2(height);
-	screen->fg = screen->bg + length;
 	screen->width = width;
 	screen->height = height;
-	memset(screen->bg, 0, length * 2);
+	size_t length = buxn_screen_row_size(screen) * MAR2(height);
+	screen->fg = screen->bg + length;
+	screen->bg_dirty_tiles = screen->fg + length;
+	size_t tiles_size = buxn_screen_tiles_size(width, height);
+	screen->fg_dirty_tiles = screen->bg_dirty_tiles + tiles_size;
+	memset(screen->bg, 0, (length + tiles_size) * 2);
+
+	buxn_screen_force_refresh(screen);
+}
 
-	buxn_screen_dirty(&screen->bg_dirty_rect, 0, 0, width, height);
-	buxn_screen_dirty(&screen->fg_dirty_rect, 0, 0, width, height);
+void
+buxn_screen_copy(buxn_screen_t* dst, buxn_screen_t* src) {
+	if(dst->width != src->width || dst->height != src->height || dst->packed != src->packed) {
+		dst->packed = src->packed;
+		buxn_screen_resize(dst, src->width, src->height);
+	}
+
+	size_t length = buxn_screen_row_size(src) * MAR2(src->height);
+	memcpy(dst->bg, src->bg, length * 2);
+	/* both layers of tiles follow each other */
+	size_t tiles_size = buxn_screen_tiles_size(src->width, src->height) * 2;
+	for(size_t i = 0; i < tiles_size; i++)
+		dst->bg_dirty_tiles[i] |= src->bg_dirty_tiles[i];
+	memset(src->bg_dirty_tiles, 0, tiles_size);
 }
 
 void
@@ -64,38 +321,256 @@ buxn_screen_preferred_size(struct buxn_vm_s* vm, uint16_t* width, uint16_t* heig
 	*height = buxn_vm_dev_load2(vm, 0x24);
 }
 
-bool
-buxn_screen_render(
+typedef struct {
+	const uint32_t* colors;
+	/* every combination of 4 pixels of a packed layer */
+	uint32_t packed[256][4];
+#if defined(BUXN_SCREEN_SSSE3) || defined(BUXN_SCREEN_NEON64)
+	/* byte i of every color, for a table lookup per byte of the pixels */
+	BUXN_SCREEN_VEC bytes[4];
+#elif defined(BUXN_SCREEN_SSE2)
+	__m128i splat[4];
+#endif
+} buxn_screen_palette_t;
+
+static void
+buxn_screen_palette_init(buxn_screen_palette_t* palette, const uint32_t* colors, bool packed) {
+	palette->colors = colors;
+	if(packed) {
+		for(int i = 0; i < 256; i++) {
+			palette->packed[i][0] = colors[i & 3];
+			palette->packed[i][1] = colors[(i >> 2) & 3];
+			palette->packed[i][2] = colors[(i >> 4) & 3];
+			palette->packed[i][3] = colors[i >> 6];
+		}
+	}
+#if defined(BUXN_SCREEN_SSSE3) || defined(BUXN_SCREEN_NEON64)
+	for(int i = 0; i < 4; i++) {
+		uint8_t bytes[16] = { 0 };
+		for(int c = 0; c < 4; c++) bytes[c] = (uint8_t)(colors[c] >> (i * 8));
+#if defined(BUXN_SCREEN_SSSE3)
+		palette->bytes[i] = _mm_loadu_si128((const __m128i*)bytes);
+#else
+		palette->bytes[i] = vld1q_u8(bytes);
+#endif
+	}
+#elif defined(BUXN_SCREEN_SSE2)
+	for(int c = 0; c < 4; c++) palette->splat[c] = _mm_set1_epi32((int)colors[c]);
+#endif
+}
+
+#if defined(BUXN_SCREEN_SSE2) && !defined(BUXN_SCREEN_SSSE3)
+static inline __m128i
+buxn_screen_select_colors(__m128i bit0, __m128i bit1, const __m128i* colors) {
+	__m128i c01 = _mm_or_si128(_mm_and_si128(bit0, colors[1]), _mm_andnot_si128(bit0, colors[0]));
+	__m128i c23 = _mm_or_si128(_mm_and_si128(bit0, colors[3]), _mm_andnot_si128(bit0, colors[2]));
+	return _mm_or_si128(_mm_and_si128(bit1, c23), _mm_andnot_si128(bit1, c01));
+}
+#endif
+
+// Convert count color indices into pixels.
+// When fg is not NULL, its non-zero indices replace those of bg.
+static void
+buxn_screen_expand_row(
+	uint32_t* out,
+	const uint8_t* bg, const uint8_t* fg,
+	int count,
+	const buxn_screen_palette_t* palette
+) {
+	int x = 0;
+#if defined(BUXN_SCREEN_SSE2)
+	__m128i zero = _mm_setzero_si128();
+	for(; x + 16 <= count; x += 16) {
+		__m128i index = _mm_loadu_si128((const __m128i*)(bg + x));
+		if(fg != NULL) {
+			__m128i fg_index = _mm_loadu_si128((const __m128i*)(fg + x));
+			__m128i transparent = _mm_cmpeq_epi8(fg_index, zero);
+			index = _mm_or_si128(_mm_and_si128(transparent, index), _mm_andnot_si128(transparent, fg_index));
+		}
+#if defined(BUXN_SCREEN_SSSE3)
+		/* one lookup per byte of the pixels then interleave them */
+		__m128i b0 = _mm_shuffle_epi8(palette->bytes[0], index);
+		__m128i b1 = _mm_shuffle_epi8(palette->bytes[1], index);
+		__m128i b2 = _mm_shuffle_epi8(palette->bytes[2], index);
+		__m128i b3 = _mm_shuffle_epi8(palette->bytes[3], index);
+		__m128i b01_lo = _mm_unpacklo_epi8(b0, b1), b01_hi = _mm_unpackhi_epi8(b0, b1);
+		__m128i b23_lo = _mm_unpacklo_epi8(b2, b3), b23_hi = _mm_unpackhi_epi8(b2, b3);
+		_mm_storeu_si128((__m128i*)(out + x + 0), _mm_unpacklo_epi16(b01_lo, b23_lo));
+		_mm_storeu_si128((__m128i*)(out + x + 4), _mm_unpackhi_epi16(b01_lo, b23_lo));
+		_mm_storeu_si128((__m128i*)(out + x + 8), _mm_unpacklo_epi16(b01_hi, b23_hi));
+		_mm_storeu_si128((__m128i*)(out + x + 12), _mm_unpackhi_epi16(b01_hi, b23_hi));
+#else
+		/* select between the 4 colors with the bits of the index widened to 32 bits */
+		__m128i one = _mm_set1_epi8(1), two = _mm_set1_epi8(2);
+		__m128i bit0 = _mm_cmpeq_epi8(_mm_and_si128(index, one), one);
+		__m128i bit1 = _mm_cmpeq_epi8(_mm_and_si128(index, two), two);
+		__m128i bit0_lo = _mm_unpacklo_epi8(bit0, bit0), bit0_hi = _mm_unpackhi_epi8(bit0, bit0);
+		__m128i bit1_lo = _mm_unpacklo_epi8(bit1, bit1), bit1_hi = _mm_unpackhi_epi8(bit1, bit1);
+		_mm_storeu_si128((__m128i*)(out + x + 0), buxn_screen_select_colors(
+			_mm_unpacklo_epi16(bit0_lo, bit0_lo), _mm_unpacklo_epi16(bit1_lo, bit1_lo), palette->splat
+		));
+		_mm_storeu_si128((__m128i*)(out + x + 4), buxn_screen_select_colors(
+			_mm_unpackhi_epi16(bit0_lo, bit0_lo), _mm_unpackhi_epi16(bit1_lo, bit1_lo), palette->splat
+		));
+		_mm_storeu_si128((__m128i*)(out + x + 8), buxn_screen_select_colors(
+			_mm_unpacklo_epi16(bit0_hi, bit0_hi), _mm_unpacklo_epi16(bit1_hi, bit1_hi), palette->splat
+		));
+		_mm_storeu_si128((__m128i*)(out + x + 12), buxn_screen_select_colors(
+			_mm_unpackhi_epi16(bit0_hi, bit0_hi), _mm_unpackhi_epi16(bit1_hi, bit1_hi), palette->splat
+		));
+#endif
+	}
+#elif defined(BUXN_SCREEN_NEON64)
+	for(; x + 16 <= count; x += 16) {
+		uint8x16_t index = vld1q_u8(bg + x);
+		if(fg != NULL) {
+			uint8x16_t fg_index = vld1q_u8(fg + x);
+			index = vbslq_u8(vceqq_u8(fg_index, vdupq_n_u8(0)), index, fg_index);
+		}
+		/* one lookup per byte of the pixels, interleaved by the store */
+		uint8x16x4_t pixels = {{
+			vqtbl1q_u8(palette->bytes[0], index),
+			vqtbl1q_u8(palette->bytes[1], index),
+			vqtbl1q_u8(palette->bytes[2], index),
+			vqtbl1q_u8(palette->bytes[3], index),
+		}};
+		vst4q_u8((uint8_t*)(out + x), pixels);
+	}
+#endif
+	for(; x < count; x++) {
+		int index = bg[x];
+		if(fg != NULL && fg[x]) index = fg[x];
+		out[x] = palette->colors[index];
+	}
+}
+
+static inline uint8_t
+buxn_screen_packed_over(uint8_t bg, uint8_t fg) {
+	/* both bits of every pixel of fg which is not color 0 */
+	uint8_t opaque = (uint8_t)(((fg | fg >> 1) & 0x55) * 3);
+	return (uint8_t)((fg & opaque) | (bg & ~opaque));
+}
+
+static void
+buxn_screen_render_rect(
+	const buxn_screen_t* device,
+	const uint8_t* bg, const uint8_t* fg,
+	const buxn_screen_palette_t* palette,
+	uint32_t* target,
+	int x1, int y1, int x2, int y2
+) {
+	int x, y;
+	if(device->packed) {
+		int row_size = BUXN_SCREEN_PACKED_ROW_SIZE(device->width);
+		for(y = y1; y < y2; y++) {
+			/* the margin is 2 bytes */
+			const uint8_t* bg_row = &bg[MAR(y) * row_size + 2];
+			const uint8_t* fg_row = fg != NULL ? &fg[MAR(y) * row_size + 2] : NULL;
+			uint32_t* out = &target[y * device->width];
+			for(x = x1; x < x2; ) {
+				uint8_t pixels = bg_row[x >> 2];
+				if(fg_row != NULL) pixels = buxn_screen_packed_over(pixels, fg_row[x >> 2]);
+				if((x & 3) == 0 && x + 4 <= x2) {
+					memcpy(&out[x], palette->packed[pixels], sizeof(palette->packed[0]));
+					x += 4;
+				} else {
+					out[x] = palette->packed[pixels][x & 3];
+					x++;
+				}
+			}
+		}
+	} else {
+		int row_size = MAR2(device->width);
+		for(y = y1; y < y2; y++) {
+			int i = MAR(x1) + MAR(y) * row_size;
+			buxn_screen_expand_row(
+				&target[y * device->width + x1],
+				&bg[i], fg != NULL ? &fg[i] : NULL,
+				x2 - x1,
+				palette
+			);
+		}
+	}
+}
+
+int
+buxn_screen_render_spans(
 	buxn_screen_t* device,
 	buxn_screen_layer_type_t layer,
 	uint32_t palette[4],
-	uint32_t* target
+	uint32_t* target,
+	buxn_screen_rect_t* spans
 ) {
-	const uint8_t* rendered_layer = layer == BUXN_SCREEN_LAYER_BACKGROUND ? &device->bg[0] : &device->fg[0];
-	buxn_screen_rect_t* rect = layer == BUXN_SCREEN_LAYER_BACKGROUND ? &device->bg_dirty_rect : &device->fg_dirty_rect;
+	const uint8_t* rendered_layer = layer == BUXN_SCREEN_LAYER_FOREGROUND ? &device->fg[0] : &device->bg[0];
+	const uint8_t* fg = layer == BUXN_SCREEN_LAYER_COMPOSITE ? &device->fg[0] : NULL;
+	uint8_t* tiles = layer == BUXN_SCREEN_LAYER_FOREGROUND ? device->fg_dirty_tiles : device->bg_dirty_tiles;
 
-	clamp(rect->x1, 0, device->width);
-	clamp(rect->x2, 0, device->width);
-	clamp(rect->y1, 0, device->height);
-	clamp(rect->y2, 0, device->height);
+	buxn_screen_palette_t render_palette;
+	buxn_screen_palette_init(&render_palette, palette, device->packed);
 
-	if (!(rect->x2 > rect->x1 && rect->y2 > rect->y1)) {
-		return false;
-	}
+	size_t row_size = buxn_screen_tiles_row_size(device->width);
+	int num_tiles = (device->width + BUXN_SCREEN_TILE_SIZE - 1) >> TILE_SHIFT;
+	int num_rows = BUXN_SCREEN_MAX_SPANS(device->height);
+	int num_spans = 0;
+	buxn_screen_rect_t span = { 0 };
+	for(int ty = 0; ty < num_rows; ty++) {
+		uint8_t* row = &tiles[ty * row_size];
+		int y1 = ty << TILE_SHIFT, y2 = y1 + BUXN_SCREEN_TILE_SIZE;
+		if(y2 > device->height) y2 = device->height;
+
+		if(fg != NULL) {
+			/* a tile changed in either layer */
+			uint8_t* fg_row = &device->fg_dirty_tiles[ty * row_size];
+			for(size_t i = 0; i < row_size; i++) row[i] |= fg_row[i];
+			memset(fg_row, 0, row_size);
+		}
+
+		int x1 = device->width, x2 = 0;
+		for(int tx = 0; tx < num_tiles;) {
+			if(row[tx >> 3] == 0) {
+				tx = (tx | 7) + 1;
+				continue;
+			}
+			if(!buxn_vm_bit_test(row, tx)) {
+				tx++;
+				continue;
+			}
 
-	int i, x, y;
-	for(y = rect->y1; y < rect->y2; y++) {
-		for(x = rect->x1, i = MAR(x) + MAR(y) * MAR2(device->width); x < rect->x2; x++, i++) {
-			int c = palette[rendered_layer[i]];
-			int oo = (y * device->width + x);
-			target[oo] = c;
+			/* a run of dirty tiles */
+			int run_start = tx;
+			while(tx < num_tiles && buxn_vm_bit_test(row, tx)) tx++;
+			int run_x1 = run_start << TILE_SHIFT, run_x2 = tx << TILE_SHIFT;
+			if(run_x2 > device->width) run_x2 = device->width;
+			buxn_screen_render_rect(device, rendered_layer, fg, &render_palette, target, run_x1, y1, run_x2, y2);
+			if(run_x1 < x1) x1 = run_x1;
+			if(run_x2 > x2) x2 = run_x2;
+		}
+		if(x1 >= x2) continue;
+		memset(row, 0, row_size);
+
+		if(num_spans > 0 && span.y2 == y1) {
+			if(x1 < span.x1) span.x1 = x1;
+			if(x2 > span.x2) span.x2 = x2;
+			span.y2 = y2;
+		} else {
+			if(num_spans > 0 && spans != NULL) spans[num_spans - 1] = span;
+			span = (buxn_screen_rect_t){ .x1 = x1, .y1 = y1, .x2 = x2, .y2 = y2 };
+			num_spans++;
 		}
 	}
-	rect->x1 = device->width + 1;
-	rect->y1 = device->height + 1;
-	rect->x2 = rect->y2 = 0;
+	if(num_spans > 0 && spans != NULL) spans[num_spans - 1] = span;
+
+	return num_spans;
+}
 
-	return true;
+bool
+buxn_screen_render(
+	buxn_screen_t* device,
+	buxn_screen_layer_type_t layer,
+	uint32_t palette[4],
+	uint32_t* target
+) {
+	return buxn_screen_render_spans(device, layer, palette, target, NULL) > 0;
 }
 
 static buxn_screen_t*
@@ -161,7 +636,7 @@ buxn_screen_deo(struct buxn_vm_s* vm, buxn_screen_t* device, uint8_t address) {
 			int color = ctrl & 0x3;
 			int len = MAR2(device->width);
 			uint8_t* layer = ctrl & 0x40 ? device->fg : device->bg;
-			buxn_screen_rect_t* rect = ctrl & 0x40 ? &device->fg_dirty_rect : &device->bg_dirty_rect;
+			uint8_t* tiles = ctrl & 0x40 ? device->fg_dirty_tiles : device->bg_dirty_tiles;
 			if(ctrl & 0x80) {
 				/* fill mode */
 				int x1, y1, x2, y2, ax, bx, ay, by, hor, ver;
@@ -175,19 +650,37 @@ buxn_screen_deo(struct buxn_vm_s* vm, buxn_screen_t* device, uint8_t address) {
 				} else {
 					y1 = MAR(device->rY), y2 = MAR(device->height);
 				}
-				hor = x2 - x1, ver = y2 - y1;
-				for(ay = y1 * len, by = ay + ver * len; ay < by; ay += len) {
-					for(ax = ay + x1, bx = ax + hor; ax < bx; ax++) {
-						layer[ax] = color;
+				if(device->packed) {
+					/* a packed row cannot run into the next one */
+					int px1 = x1, px2 = x2, py1 = y1, py2 = y2;
+					int row_size = BUXN_SCREEN_PACKED_ROW_SIZE(device->width);
+					clamp(px1, 0, len);
+					clamp(px2, 0, len);
+					clamp(py1, 0, MAR2(device->height));
+					clamp(py2, 0, MAR2(device->height));
+					for(ay = py1; ay < py2; ay++) {
+						buxn_screen_fill_packed(&layer[ay * row_size], px1, px2, color);
+					}
+				} else {
+					hor = x2 - x1, ver = y2 - y1;
+					for(ay = y1 * len, by = ay + ver * len; ay < by; ay += len) {
+						for(ax = ay + x1, bx = ax + hor; ax < bx; ax++) {
+							layer[ax] = color;
+						}
 					}
 				}
-				buxn_screen_dirty(rect, x1 - 0x08, y1 - 0x08, x2 - 0x08, y2 - 0x08);
+				buxn_screen_dirty(device, tiles, x1 - 0x08, y1 - 0x08, x2 - 0x08, y2 - 0x08);
 			} else {
 				/* pixel mode */
 				if(device->rX >= 0 && device->rY >= 0 && device->rX < len && device->rY < device->height) {
-					layer[MAR(device->rX) + MAR(device->rY) * len] = color;
+					if(device->packed) {
+						int row_size = BUXN_SCREEN_PACKED_ROW_SIZE(device->width);
+						buxn_screen_put_packed(&layer[MAR(device->rY) * row_size], MAR(device->rX), color);
+					} else {
+						layer[MAR(device->rX) + MAR(device->rY) * len] = color;
+					}
 				}
-				buxn_screen_dirty(rect, device->rX, device->rY, device->rX + 1, device->rY + 1);
+				buxn_screen_dirty(device, tiles, device->rX, device->rY, device->rX + 1, device->rY + 1);
 				if(device->rMX) device->rX++;
 				if(device->rMY) device->rY++;
 			}
@@ -195,65 +688,45 @@ buxn_screen_deo(struct buxn_vm_s* vm, buxn_screen_t* device, uint8_t address) {
 		case 0x2f: {
 			device = buxn_screen_maybe_resize(vm, device);
 			int ctrl = vm->device[0x2f];
-			int blend = ctrl & 0xf, opaque = blend % 5;
 			int fx = ctrl & 0x10 ? -1 : 1, fy = ctrl & 0x20 ? -1 : 1;
-			int qfx = fx > 0 ? 7 : 0, qfy = fy < 0 ? 7 : 0;
+			int qfy = fy < 0 ? 7 : 0;
 			int dxy = fy * device->rDX, dyx = fx * device->rDY;
-			int wmar = MAR(device->width), wmar2 = MAR2(device->width);
-			int hmar2 = MAR2(device->height);
-			int i, x1, x2, y1, y2, ax, ay, qx, qy, x = device->rX, y = device->rY;
+			int wmar = MAR(device->width), row_size = buxn_screen_row_size(device);
+			int hmar = MAR(device->height);
+			int i, x = device->rX, y = device->rY;
 			uint8_t* layer = ctrl & 0x40 ? device->fg : device->bg;
-			buxn_screen_rect_t* rect = ctrl & 0x40 ? &device->fg_dirty_rect : &device->bg_dirty_rect;
-			if(ctrl & 0x80) {
-				int addr_incr = device->rMA << 2;
-				for(i = 0; i <= device->rML; i++, x += dyx, y += dxy, device->rA += addr_incr) {
-					uint16_t xmar = MAR(x), ymar = MAR(y);
-					uint16_t xmar2 = MAR2(x), ymar2 = MAR2(y);
-					if(xmar < wmar && ymar2 < hmar2) {
-						uint8_t *sprite = &vm->memory[device->rA];
-						int by = ymar2 * wmar2;
-						for(ay = ymar * wmar2, qy = qfy; ay < by; ay += wmar2, qy += fy) {
-							int ch1 = sprite[qy], ch2 = sprite[qy + 8] << 1, bx = xmar2 + ay;
-							for(ax = xmar + ay, qx = qfx; ax < bx; ax++, qx -= fx) {
-								int color = ((ch1 >> qx) & 1) | ((ch2 >> qx) & 2);
-								if(opaque || color) {
-									layer[ax] = BUXN_BLENDING[color][blend];
-								}
-							}
-						}
-					}
-				}
-			} else {
-				int addr_incr = device->rMA << 1;
-				for(i = 0; i <= device->rML; i++, x += dyx, y += dxy, device->rA += addr_incr) {
-					uint16_t xmar = MAR(x), ymar = MAR(y);
-					uint16_t xmar2 = MAR2(x), ymar2 = MAR2(y);
-					if(xmar < wmar && ymar2 < hmar2) {
-						uint8_t *sprite = &vm->memory[device->rA];
-						int by = ymar2 * wmar2;
-						for(ay = ymar * wmar2, qy = qfy; ay < by; ay += wmar2, qy += fy) {
-							int ch1 = sprite[qy], bx = xmar2 + ay;
-							for(ax = xmar + ay, qx = qfx; ax < bx; ax++, qx -= fx) {
-								int color = (ch1 >> qx) & 1;
-								if(opaque || color) {
-									layer[ax] = BUXN_BLENDING[color][blend];
-								}
-							}
-						}
+			uint8_t* tiles = ctrl & 0x40 ? device->fg_dirty_tiles : device->bg_dirty_tiles;
+			buxn_screen_blend_t blend;
+			buxn_screen_blend_init(&blend, ctrl & 0xf);
+			const uint8_t (*pixels)[8] = BUXN_SPRITE_PIXELS[fx < 0];
+			const uint16_t* spread = BUXN_SPRITE_SPREAD_BITS[fx < 0];
+			int two_bpp = ctrl & 0x80;
+			int addr_incr = device->rMA << (two_bpp ? 2 : 1);
+			for(i = 0; i <= device->rML; i++, x += dyx, y += dxy, device->rA += addr_incr) {
+				uint16_t xmar = MAR(x), ymar = MAR(y);
+				/* the margin always fits the whole sprite */
+				if(xmar < wmar && ymar < hmar) {
+					uint8_t *sprite = &vm->memory[device->rA];
+					if(device->packed) {
+						buxn_screen_blit_packed(
+							&layer[ymar * row_size], xmar, row_size,
+							sprite, two_bpp ? sprite + 8 : NULL,
+							qfy, fy,
+							spread,
+							&blend
+						);
+					} else {
+						buxn_screen_blit(
+							&layer[xmar + ymar * row_size], row_size,
+							sprite, two_bpp ? sprite + 8 : NULL,
+							qfy, fy,
+							pixels,
+							&blend
+						);
 					}
+					buxn_screen_dirty(device, tiles, x, y, x + 8, y + 8);
 				}
 			}
-			if(fx < 0) {
-				x1 = x, x2 = device->rX;
-			} else {
-				x1 = device->rX, x2 = x;
-			}
-			if(fy < 0) {
-				y1 = y, y2 = device->rY;
-			} else {
-				y1 = device->rY, y2 = y;
-			}
-			buxn_screen_dirty(rect, x1 - 8, y1 - 8, x2 + 8, y2 + 8);
 			if(device->rMX) device->rX += device->rDX * fx;
 			if(device->rMY) device->rY += device->rDY * fy;
 		} break;
@@ -268,6 +741,23 @@ buxn_screen_update(struct buxn_vm_s* vm) {
 
 void
 buxn_screen_force_refresh(buxn_screen_t* device) {
-	buxn_screen_dirty(&device->bg_dirty_rect, 0, 0, device->width, device->height);
-	buxn_screen_dirty(&device->fg_dirty_rect, 0, 0, device->width, device->height);
+	buxn_screen_dirty(device, device->bg_dirty_tiles, 0, 0, device->width, device->height);
+	buxn_screen_dirty(device, device->fg_dirty_tiles, 0, 0, device->width, device->height);
+}
+
+static uint8_t
+buxn_screen_port_dei(buxn_vm_t* vm, void* device, uint8_t address) {
+	return buxn_screen_dei(vm, device, address);
+}
+
+static void
+buxn_screen_port_deo(buxn_vm_t* vm, void* device, uint8_t address) {
+	buxn_screen_deo(vm, device, address);
 }
+
+const buxn_port_device_t buxn_screen_ports = {
+	.dei = buxn_screen_port_dei,
+	.deo = buxn_screen_port_deo,
+	.dei_ports = BUXN_PORT(0x2) | BUXN_PORT(0x3) | BUXN_PORT(0x4) | BUXN_PORT(0x5) | BUXN_PORT(0x8) | BUXN_PORT(0x9) | BUXN_PORT(0xa) | BUXN_PORT(0xb) | BUXN_PORT(0xc) | BUXN_PORT(0xd),
+	.deo_ports = BUXN_PORT(0x6) | BUXN_PORT(0x8) | BUXN_PORT(0x9) | BUXN_PORT(0xa) | BUXN_PORT(0xb) | BUXN_PORT(0xc) | BUXN_PORT(0xd) | BUXN_PORT(0xe) | BUXN_PORT(0xf),
+};
@@ -1,4 +1,5 @@
 #include <buxn/devices/system.h>
+#include <buxn/devices/ports.h>
 #include <buxn/vm/vm.h>
 #include <string.h>
 
@@ -17,54 +18,115 @@ buxn_system_dei(struct buxn_vm_s* vm, uint8_t address) {
 	}
 }
 
+// Same result as copying one byte at a time from the first one.
+// When the destination starts inside the source, the bytes in between are
+// repeated.
+static void
+buxn_system_copy_forward(uint8_t* mem, uint32_t dst, uint32_t src, uint32_t length) {
+	if (dst <= src || dst >= src + length) {
+		memmove(mem + dst, mem + src, length);
+		return;
+	}
+
+	// mem[src, dst + done) repeats every period bytes, copy it as a whole
+	uint32_t period = dst - src;
+	uint32_t done = 0;
+	while (done < length) {
+		uint32_t chunk = period + done;
+		chunk = chunk <= length - done ? chunk : length - done;
+		memcpy(mem + dst + done, mem + src, chunk);
+		done += chunk;
+	}
+}
+
+// Same result as copying one byte at a time from the last one.
+// When the destination ends inside the source, the bytes in between are
+// repeated.
+static void
+buxn_system_copy_backward(uint8_t* mem, uint32_t dst, uint32_t src, uint32_t length) {
+	if (dst >= src || src >= dst + length) {
+		memmove(mem + dst, mem + src, length);
+		return;
+	}
+
+	// mem[dst + length - done, src + length) repeats every period bytes
+	uint32_t period = src - dst;
+	uint32_t done = 0;
+	while (done < length) {
+		uint32_t chunk = period + done;
+		chunk = chunk <= length - done ? chunk : length - done;
+		memcpy(mem + dst + length - done - chunk, mem + src + length - chunk, chunk);
+		done += chunk;
+	}
+}
+
+// Returns the size of the record or 0 if it is not a known operation
+static uint16_t
+buxn_system_expansion(struct buxn_vm_s* vm, uint16_t op_addr) {
+	uint8_t op = vm->memory[op_addr];
+	uint32_t memory_size = vm->config.memory_size;
+	uint32_t length = buxn_vm_mem_load2(vm, op_addr + 1);
+	switch (op) {
+		case 0x00: {
+			uint32_t bank = buxn_vm_mem_load2(vm, op_addr + 3);
+			uint32_t addr = buxn_vm_mem_load2(vm, op_addr + 5);
+			uint32_t start = bank * ((uint32_t)UINT16_MAX + 1) + addr;
+			start = start < memory_size ? start : memory_size - 1;
+
+			uint32_t end = start + length;
+			end = end <= memory_size ? end : memory_size;
+
+			uint8_t fill_value = vm->memory[(uint16_t)(op_addr + 7)];
+			memset(vm->memory + start, fill_value, end - start);
+			buxn_vm_mem_invalidate(vm, start, end - start);
+			return 8;
+		}
+		case 0x01:
+		case 0x02: {
+			uint32_t src_bank = buxn_vm_mem_load2(vm, op_addr + 3);
+			uint32_t src_addr = buxn_vm_mem_load2(vm, op_addr + 5);
+			uint32_t src = src_bank * ((uint32_t)UINT16_MAX + 1) + src_addr;
+			src = src < memory_size ? src : memory_size - 1;
+
+			uint32_t dst_bank = buxn_vm_mem_load2(vm, op_addr + 7);
+			uint32_t dst_addr = buxn_vm_mem_load2(vm, op_addr + 9);
+			uint32_t dst = dst_bank * ((uint32_t)UINT16_MAX + 1) + dst_addr;
+			dst = dst < memory_size ? dst : memory_size - 1;
+
+			uint32_t max = src > dst ? src : dst;
+			uint32_t end = max + length;
+			end = end <= memory_size ? end : memory_size;
+			length = end - max;
+
+			if (op == 0x01) {
+				buxn_system_copy_forward(vm->memory, dst, src, length);
+			} else {
+				buxn_system_copy_backward(vm->memory, dst, src, length);
+			}
+			buxn_vm_mem_invalidate(vm, dst, length);
+			return 11;
+		}
+		default:
+			return 0;
+	}
+}
+
 void
 buxn_system_deo(struct buxn_vm_s* vm, uint8_t address) {
 	switch (address) {
 		case 0x03: {
 			uint16_t op_addr = buxn_vm_dev_load2(vm, 0x02);
-			uint8_t op = vm->memory[op_addr];
-			uint32_t memory_size = vm->config.memory_size;
-			uint32_t length = buxn_vm_mem_load2(vm, op_addr + 1);
-			switch (op) {
-				case 0x00: {
-					uint32_t bank = buxn_vm_mem_load2(vm, op_addr + 3);
-					uint32_t addr = buxn_vm_mem_load2(vm, op_addr + 5);
-					uint32_t start = bank * ((uint32_t)UINT16_MAX + 1) + addr;
-					start = start < memory_size ? start : memory_size - 1;
-
-					uint32_t end = start + length;
-					end = end <= memory_size ? end : memory_size;
-
-					uint8_t fill_value = vm->memory[op_addr + 7];
-					memset(vm->memory + start, fill_value, end - start);
-				} break;
-				case 0x01:
-				case 0x02: {
-					uint32_t src_bank = buxn_vm_mem_load2(vm, op_addr + 3);
-					uint32_t src_addr = buxn_vm_mem_load2(vm, op_addr + 5);
-					uint32_t src = src_bank * ((uint32_t)UINT16_MAX + 1) + src_addr;
-					src = src < memory_size ? src : memory_size - 1;
-
-					uint32_t dst_bank = buxn_vm_mem_load2(vm, op_addr + 7);
-					uint32_t dst_addr = buxn_vm_mem_load2(vm, op_addr + 9);
-					uint32_t dst = dst_bank * ((uint32_t)UINT16_MAX + 1) + dst_addr;
-					dst = dst < memory_size ? dst : memory_size - 1;
-
-					uint32_t max = src > dst ? src : dst;
-					uint32_t end = max + length;
-					end = end <= memory_size ? end : memory_size;
-					length = end - max;
-
-					if (op == 0x01) {
-						for (uint32_t i = 0; i < length; ++i) {
-							vm->memory[dst + i] = vm->memory[src + i];
-						}
-					} else {
-						for (uint32_t i = 1; i <= length; ++i) {
-							vm->memory[dst + length - i] = vm->memory[src + length - i];
-						}
-					}
-				} break;
+			if (vm->memory[op_addr] == BUXN_SYSTEM_EXPANSION_BATCH) {
+				// The records follow the header back to back
+				uint16_t count = buxn_vm_mem_load2(vm, op_addr + 1);
+				uint16_t record_addr = op_addr + 3;
+				for (uint16_t i = 0; i < count; ++i) {
+					uint16_t size = buxn_system_expansion(vm, record_addr);
+					if (size == 0) { break; }
+					record_addr += size;
+				}
+			} else {
+				buxn_system_expansion(vm, op_addr);
 			}
 		} break;
 		case 0x04: vm->wsp = vm->device[address]; break;
@@ -104,3 +166,22 @@ buxn_system_palette(struct buxn_vm_s* vm, uint32_t palette[4]) {
 	palette[2] = buxn_make_rgba((r >>  4) & 0x0f, (g >>  4) & 0x0f, (b >>  4) & 0x0f);
 	palette[3] = buxn_make_rgba((r >>  0) & 0x0f, (g >>  0) & 0x0f, (b >>  0) & 0x0f);
 }
+
+static uint8_t
+buxn_system_port_dei(buxn_vm_t* vm, void* device, uint8_t address) {
+	(void)device;
+	return buxn_system_dei(vm, address);
+}
+
+static void
+buxn_system_port_deo(buxn_vm_t* vm, void* device, uint8_t address) {
+	(void)device;
+	buxn_system_deo(vm, address);
+}
+
+const buxn_port_device_t buxn_system_ports = {
+	.dei = buxn_system_port_dei,
+	.deo = buxn_system_port_deo,
+	.dei_ports = BUXN_PORT(0x4) | BUXN_PORT(0x5),
+	.deo_ports = BUXN_PORT(0x3) | BUXN_PORT(0x4) | BUXN_PORT(0x5) | BUXN_PORT(0x7) | BUXN_PORT(0x9) | BUXN_PORT(0xb) | BUXN_PORT(0xd) | BUXN_PORT(0xe),
+};
@@ -11,6 +11,10 @@
 #include <math.h>
 #include <stdatomic.h>
 #include <buxn/vm/vm.h>
+#include <buxn/vm/alloc.h>
+#include <buxn/vm/profile.h>
+#include <buxn/vm/trace.h>
+#include <buxn/vm/coverage.h>
 #include <buxn/metadata.h>
 #include <buxn/devices/system.h>
 #include <buxn/devices/console.h>
@@ -20,9 +24,17 @@
 #include <buxn/devices/datetime.h>
 #include <buxn/devices/audio.h>
 #include <buxn/devices/file.h>
+#include <buxn/devices/replay.h>
+#include <buxn/devices/ports.h>
 #include "platform.h"
+#include "thread.h"
 
 #define FRAME_TIME_US (1000000.0 / 60.0)
+// A frame callback this close to FRAME_TIME_US is taken as a vsync interval
+#define VSYNC_TOLERANCE_US 1500.0
+// Leaves time to render and present before the next vsync
+#define FAST_FORWARD_BUDGET_US (FRAME_TIME_US * 0.75)
+#define DEFAULT_MAX_CATCH_UP 4
 #define CONSOLE_BUFFER_SIZE 256
 
 #define DEFAULT_WIDTH 512
@@ -35,6 +47,7 @@ typedef struct {
 	buxn_audio_t audio[BUXN_NUM_AUDIO_DEVICES];
 	buxn_screen_t* screen;
 	buxn_file_t file[BUXN_NUM_FILE_DEVICES];
+	buxn_port_table_t ports;
 } devices_t;
 
 typedef struct {
@@ -48,6 +61,51 @@ typedef struct {
 	size_t size;
 } layer_texture_t;
 
+// Rows of the composited screen uploaded by a single strip
+#define COMPOSITE_STRIP_ROWS 32
+
+typedef struct {
+	sg_image gpu;
+	int y;
+} composite_strip_t;
+
+typedef struct {
+	// Both layers composited by buxn_screen_render_spans
+	uint32_t* cpu;
+	int width;
+	int height;
+	buxn_screen_rect_t* spans;
+
+	// Changed rows are uploaded to the next strips in the ring and drawn into
+	// the target, which keeps the rest of the screen from previous frames
+	composite_strip_t* strips;
+	int num_strips;
+	int next_strip;
+	sg_image target;
+	sg_attachments attachments;
+} composite_texture_t;
+
+// Input events waiting for the VM thread
+#define VM_EVENT_QUEUE_SIZE 1024
+
+// A frame published by the VM thread
+typedef struct {
+	buxn_screen_t* screen;
+	size_t size;
+	uint32_t palette[4];
+	uint64_t number;
+} vm_frame_t;
+
+// Set along the index of the published frame until the render thread takes it
+#define VM_FRAME_FRESH 0x4
+
+typedef struct {
+	// Lines longer than this are cut
+	char title[256];
+	bool has_icon;
+	uint32_t icon[24 * 24];
+} window_metadata_t;
+
 typedef struct {
 	int actual_width;
 	int actual_height;
@@ -63,16 +121,62 @@ static struct {
 
 	buxn_vm_t* vm;
 	devices_t devices;
+	buxn_replay_t replay;
+	const char* profile_path;
+	const char* coverage_path;
 	uint64_t last_frame;
 	double frame_time_accumulator;
+	// Screen vectors run by a single update, the time past this is dropped
+	int max_catch_up;
+	// Frames in a row which are not drawn while catching up
+	int max_frame_skip;
+	int num_skipped_frames;
+	// Opt-in, the screen vector runs as fast as possible
+	bool fast_forward;
+	uint64_t start_time;
+	uint64_t num_screen_updates;
+
+	// Input state of the window, sent as a whole on every change
+	buxn_mouse_t mouse;
+	buxn_controller_t controller;
+
+	// Opt-in, the VM runs on its own thread and the frame callback only draws
+	// the last frame it published
+	bool threaded;
+	thread_t* vm_thread;
+	thread_signal_t* vm_signal;
+	atomic_bool vm_should_stop;
+	atomic_bool vm_exited;
+	// Written by the event callback and read by the VM thread
+	buxn_replay_event_t vm_events[VM_EVENT_QUEUE_SIZE];
+	atomic_uint vm_events_head;
+	atomic_uint vm_events_tail;
+	// One frame is written by the VM, one is drawn and the last one is
+	// exchanged between them so neither waits for the other
+	vm_frame_t vm_frames[3];
+	atomic_uint vm_published_frame;
+	unsigned vm_frame;
+	uint64_t vm_frame_number;
+	unsigned displayed_frame;
+	uint64_t displayed_frame_number;
+	// The window can only be changed from the frame callback
+	window_metadata_t vm_metadata;
+	bool vm_has_metadata;
+	window_metadata_t pending_metadata;
+	atomic_bool has_pending_metadata;
 
 	console_buf_t console_out_buf;
 	console_buf_t console_err_buf;
 	bool stdin_closed;
 
 	sg_sampler sampler;
+	int texture_width;
+	int texture_height;
 	layer_texture_t background_texture;
 	layer_texture_t foreground_texture;
+	bool composite_screen;
+	sg_pipeline composite_pipeline;
+	composite_texture_t composite_texture;
 
 	atomic_int audio_finished_count[BUXN_NUM_AUDIO_DEVICES];
 	int audio_finished_ack[BUXN_NUM_AUDIO_DEVICES];
@@ -110,6 +214,132 @@ cleanup_layer_texture(layer_texture_t* texture) {
 	free(texture->cpu);
 }
 
+static void
+init_composite_texture(composite_texture_t* texture, int width, int height) {
+	int num_strips = (height + COMPOSITE_STRIP_ROWS - 1) / COMPOSITE_STRIP_ROWS;
+	// The last strip can go past the bottom of the screen
+	size_t size = sizeof(uint32_t) * (size_t)width * (size_t)(num_strips * COMPOSITE_STRIP_ROWS);
+	texture->cpu = malloc(size);
+	memset(texture->cpu, 0, size);
+	texture->width = width;
+	texture->height = height;
+	texture->spans = malloc(sizeof(buxn_screen_rect_t) * BUXN_SCREEN_MAX_SPANS(height));
+
+	texture->strips = malloc(sizeof(composite_strip_t) * num_strips);
+	texture->num_strips = num_strips;
+	texture->next_strip = 0;
+	for (int i = 0; i < num_strips; ++i) {
+		texture->strips[i] = (composite_strip_t){
+			.gpu = sg_make_image(&(sg_image_desc){
+				.type = SG_IMAGETYPE_2D,
+				.width = width,
+				.height = COMPOSITE_STRIP_ROWS,
+				.usage = SG_USAGE_STREAM,
+				.label = "uxn.screen.strip",
+			}),
+		};
+	}
+
+	texture->target = sg_make_image(&(sg_image_desc){
+		.type = SG_IMAGETYPE_2D,
+		.render_target = true,
+		.width = width,
+		.height = height,
+		.pixel_format = SG_PIXELFORMAT_RGBA8,
+		.sample_count = 1,
+		.label = "uxn.screen.composite",
+	});
+	texture->attachments = sg_make_attachments(&(sg_attachments_desc){
+		.colors[0].image = texture->target,
+		.label = "uxn.screen.composite",
+	});
+	BLOG_INFO("Created composite texture with size %dx%d and %d strips", width, height, num_strips);
+}
+
+static void
+cleanup_composite_texture(composite_texture_t* texture) {
+	sg_destroy_attachments(texture->attachments);
+	sg_destroy_image(texture->target);
+	for (int i = 0; i < texture->num_strips; ++i) {
+		sg_destroy_image(texture->strips[i].gpu);
+	}
+	free(texture->strips);
+	free(texture->spans);
+	free(texture->cpu);
+}
+
+static void
+update_composite_texture(
+	composite_texture_t* texture,
+	buxn_screen_t* screen,
+	uint32_t palette[4]
+) {
+	int num_spans = buxn_screen_render_spans(
+		screen,
+		BUXN_SCREEN_LAYER_COMPOSITE,
+		palette,
+		texture->cpu,
+		texture->spans
+	);
+	if (num_spans == 0) { return; }
+
+	// Strips are aligned so each row is uploaded at most once and a frame
+	// never needs more strips than the ring has
+	int first_strip = texture->next_strip;
+	int num_uploads = 0;
+	int next_row = 0;
+	for (int i = 0; i < num_spans; ++i) {
+		const buxn_screen_rect_t* span = &texture->spans[i];
+		int y = span->y1 / COMPOSITE_STRIP_ROWS * COMPOSITE_STRIP_ROWS;
+		if (y < next_row) { y = next_row; }
+
+		for (; y < span->y2; y += COMPOSITE_STRIP_ROWS) {
+			composite_strip_t* strip = &texture->strips[texture->next_strip];
+			texture->next_strip = (texture->next_strip + 1) % texture->num_strips;
+			strip->y = y;
+			sg_update_image(
+				strip->gpu,
+				&(sg_image_data) {
+					.subimage[0][0] = {
+						.ptr = texture->cpu + (size_t)y * (size_t)texture->width,
+						.size = sizeof(uint32_t) * (size_t)texture->width * COMPOSITE_STRIP_ROWS,
+					},
+				}
+			);
+			++num_uploads;
+		}
+		next_row = y;
+	}
+
+	sg_begin_pass(&(sg_pass){
+		.attachments = texture->attachments,
+		.action.colors[0].load_action = SG_LOADACTION_LOAD,
+	});
+	{
+		sgp_begin(texture->width, texture->height);
+		{
+			sgp_viewport(0, 0, texture->width, texture->height);
+			// Keep the first row at the top of the texture, like uploaded images
+			if (sg_query_features().origin_top_left) {
+				sgp_project(0.f, (float)texture->width, 0.f, (float)texture->height);
+			} else {
+				sgp_project(0.f, (float)texture->width, (float)texture->height, 0.f);
+			}
+			sgp_set_pipeline(app.composite_pipeline);
+			sgp_set_sampler(0, app.sampler);
+
+			for (int i = 0; i < num_uploads; ++i) {
+				const composite_strip_t* strip = &texture->strips[(first_strip + i) % texture->num_strips];
+				sgp_set_image(0, strip->gpu);
+				sgp_draw_filled_rect(0.f, (float)strip->y, (float)texture->width, (float)COMPOSITE_STRIP_ROWS);
+			}
+		}
+		sgp_flush();
+		sgp_end();
+	}
+	sg_end_pass();
+}
+
 static void
 sokol_log(const char* tag, uint32_t log_level, uint32_t log_item, const char* message, uint32_t line_nr, const char* filename, void* user_data) {
 	(void)user_data;
@@ -141,18 +371,19 @@ draw_chr(uint8_t* dst, int x, int y, uint16_t addr) {
 }
 
 static void
-apply_metadata(buxn_metadata_t metadata) {
-	char* ch = metadata.content;
-	while (ch < metadata.content + metadata.content_len && *ch != '\n') {
-		++ch;
+read_metadata(buxn_metadata_t metadata, window_metadata_t* out) {
+	size_t title_len = 0;
+	while (
+		title_len < (size_t)metadata.content_len
+		&& title_len < sizeof(out->title) - 1
+		&& metadata.content[title_len] != '\n'
+	) {
+		++title_len;
 	}
-	// It is VM so the memory is writable
-	// We can avoid allocation
-	char old_char = *ch;
-	*ch = '\0';
-	sapp_set_window_title(metadata.content);
-	*ch = old_char;
+	memcpy(out->title, metadata.content, title_len);
+	out->title[title_len] = '\0';
 
+	out->has_icon = false;
 	for (int i = 0; i < metadata.num_extensions; ++i) {
 		buxn_metadata_ext_t ext = buxn_metadata_get_ext(&metadata, i);
 
@@ -169,7 +400,6 @@ apply_metadata(buxn_metadata_t metadata) {
 					}
 				}
 
-				uint32_t rendered_icon[24 * 24];
 				// Using potato default theme
 				uint32_t palette[4];
 				palette[0] = 0;
@@ -178,105 +408,68 @@ apply_metadata(buxn_metadata_t metadata) {
 				palette[3] = 0xffffffff;
 
 				for (int j = 0; j < (int)sizeof(paletted_icon); ++j) {
-					rendered_icon[j] = palette[paletted_icon[j]];
+					out->icon[j] = palette[paletted_icon[j]];
 				}
-
-				sapp_set_icon(&(sapp_icon_desc){
-					.images[0] = {
-						.width = 24,
-						.height = 24,
-						.pixels = {
-							.ptr = rendered_icon,
-							.size = sizeof(rendered_icon),
-						},
-					}
-				});
+				out->has_icon = true;
 			} break;
 		}
 	}
 }
 
+static void
+apply_metadata(const window_metadata_t* metadata) {
+	sapp_set_window_title(metadata->title);
+
+	if (metadata->has_icon) {
+		sapp_set_icon(&(sapp_icon_desc){
+			.images[0] = {
+				.width = 24,
+				.height = 24,
+				.pixels = {
+					.ptr = metadata->icon,
+					.size = sizeof(metadata->icon),
+				},
+			}
+		});
+	}
+}
+
+static void
+send_pending_metadata(void) {
+	if (
+		app.vm_has_metadata
+		&& !atomic_load_explicit(&app.has_pending_metadata, memory_order_acquire)
+	) {
+		app.pending_metadata = app.vm_metadata;
+		atomic_store_explicit(&app.has_pending_metadata, true, memory_order_release);
+		app.vm_has_metadata = false;
+	}
+}
+
+static void
+set_metadata(buxn_metadata_t metadata) {
+	if (app.threaded) {
+		// Applied by the frame callback once it took the previous one
+		read_metadata(metadata, &app.vm_metadata);
+		app.vm_has_metadata = true;
+		send_pending_metadata();
+	} else {
+		window_metadata_t window_metadata;
+		read_metadata(metadata, &window_metadata);
+		apply_metadata(&window_metadata);
+	}
+}
+
 uint8_t
 buxn_vm_dei(buxn_vm_t* vm, uint8_t address) {
 	devices_t* devices = vm->config.userdata;
-	uint8_t device_id = buxn_device_id(address);
-	switch (device_id) {
-		case BUXN_DEVICE_SYSTEM:
-			return buxn_system_dei(vm, address);
-		case BUXN_DEVICE_CONSOLE:
-			return buxn_console_dei(vm, &devices->console, address);
-		case BUXN_DEVICE_SCREEN:
-			return buxn_screen_dei(vm, devices->screen, address);
-		case BUXN_DEVICE_AUDIO_0:
-		case BUXN_DEVICE_AUDIO_1:
-		case BUXN_DEVICE_AUDIO_2:
-		case BUXN_DEVICE_AUDIO_3:
-			return buxn_audio_dei(
-				vm,
-				devices->audio + (device_id - BUXN_DEVICE_AUDIO_0) / (BUXN_DEVICE_AUDIO_1 - BUXN_DEVICE_AUDIO_0),
-				vm->device + device_id,
-				buxn_device_port(address)
-			);
-		case BUXN_DEVICE_MOUSE:
-			return buxn_mouse_dei(vm, &devices->mouse, address);
-		case BUXN_DEVICE_CONTROLLER:
-			return buxn_controller_dei(vm, &devices->controller, address);
-		case BUXN_DEVICE_FILE_0:
-		case BUXN_DEVICE_FILE_1:
-			return buxn_file_dei(
-				vm,
-				devices->file + (device_id - BUXN_DEVICE_FILE_0) / (BUXN_DEVICE_FILE_1 - BUXN_DEVICE_FILE_0),
-				vm->device + device_id,
-				buxn_device_port(address)
-			);
-		case BUXN_DEVICE_DATETIME:
-			return buxn_datetime_dei(vm, address);
-		default:
-			return vm->device[address];
-	}
+	return buxn_port_table_dei(&devices->ports, vm, address);
 }
 
 void
 buxn_vm_deo(buxn_vm_t* vm, uint8_t address) {
 	devices_t* devices = vm->config.userdata;
-	uint8_t device_id = buxn_device_id(address);
-	switch (device_id) {
-		case BUXN_DEVICE_SYSTEM:
-			buxn_system_deo(vm, address);
-			break;
-		case BUXN_DEVICE_CONSOLE:
-			buxn_console_deo(vm, &devices->console, address);
-			break;
-		case BUXN_DEVICE_SCREEN:
-			buxn_screen_deo(vm, devices->screen, address);
-			break;
-		case BUXN_DEVICE_AUDIO_0:
-		case BUXN_DEVICE_AUDIO_1:
-		case BUXN_DEVICE_AUDIO_2:
-		case BUXN_DEVICE_AUDIO_3:
-			buxn_audio_deo(
-				vm,
-				devices->audio + (device_id - BUXN_DEVICE_AUDIO_0) / (BUXN_DEVICE_AUDIO_1 - BUXN_DEVICE_AUDIO_0),
-				vm->device + device_id,
-				buxn_device_port(address)
-			);
-			break;
-		case BUXN_DEVICE_MOUSE:
-			buxn_mouse_deo(vm, &devices->mouse, address);
-			break;
-		case BUXN_DEVICE_CONTROLLER:
-			buxn_controller_deo(vm, &devices->controller, address);
-			break;
-		case BUXN_DEVICE_FILE_0:
-		case BUXN_DEVICE_FILE_1:
-			buxn_file_deo(
-				vm,
-				devices->file + (device_id - BUXN_DEVICE_FILE_0) / (BUXN_DEVICE_FILE_1 - BUXN_DEVICE_FILE_0),
-				vm->device + device_id,
-				buxn_device_port(address)
-			);
-			break;
-	}
+	buxn_port_table_deo(&devices->ports, vm, address);
 }
 
 void
@@ -293,7 +486,7 @@ buxn_system_set_metadata(buxn_vm_t* vm, uint16_t address) {
 		return;
 	}
 
-	apply_metadata(metadata);
+	set_metadata(metadata);
 }
 
 void
@@ -302,12 +495,20 @@ buxn_system_theme_changed(buxn_vm_t* vm) {
 	buxn_screen_force_refresh(app.devices.screen);
 }
 
+// The screen drawn by the frame callback
+static buxn_screen_t*
+displayed_screen(void) {
+	return app.threaded
+		? app.vm_frames[app.displayed_frame].screen
+		: app.devices.screen;
+}
+
 static void
 get_draw_info(draw_info_t* out) {
 	int actual_width = sapp_width();
 	int actual_height = sapp_height();
-	int fb_width = app.devices.screen->width;
-	int fb_height = app.devices.screen->height;
+	int fb_width = displayed_screen()->width;
+	int fb_height = displayed_screen()->height;
 
 	float x_scale = (float)actual_width / (float)fb_width;
 	float y_scale = (float)actual_height / (float)fb_height;
@@ -363,6 +564,36 @@ buxn_console_handle_error(struct buxn_vm_s* vm, buxn_console_t* device, char c)
 	buxn_console_putc(BLOG_LEVEL_ERROR, &app.console_err_buf, c);
 }
 
+static void
+init_textures(int width, int height) {
+	if (app.composite_screen) {
+		init_composite_texture(&app.composite_texture, width, height);
+	} else {
+		buxn_screen_info_t screen_info = buxn_screen_info(width, height);
+		init_layer_texture(&app.background_texture, width, height, screen_info, "uxn.screen.background");
+		init_layer_texture(&app.foreground_texture, width, height, screen_info, "uxn.screen.foreground");
+	}
+	app.texture_width = width;
+	app.texture_height = height;
+}
+
+static void
+cleanup_textures(void) {
+	if (app.composite_screen) {
+		cleanup_composite_texture(&app.composite_texture);
+	} else {
+		cleanup_layer_texture(&app.foreground_texture);
+		cleanup_layer_texture(&app.background_texture);
+	}
+}
+
+static void
+resize_textures(int width, int height) {
+	cleanup_textures();
+	init_textures(width, height);
+	platform_resize_window(width, height);
+}
+
 buxn_screen_t*
 buxn_screen_request_resize(
 	struct buxn_vm_s* vm,
@@ -370,19 +601,21 @@ buxn_screen_request_resize(
 	uint16_t width, uint16_t height
 ) {
 	(void)vm;
-	cleanup_layer_texture(&app.background_texture);
-	cleanup_layer_texture(&app.foreground_texture);
-
 	BLOG_INFO("Received resize request to: %dx%d", width, height);
 
+	// On the VM thread, the textures follow the size of the published frames
+	if (!app.threaded) {
+		resize_textures(width, height);
+	}
+
 	buxn_screen_info_t screen_info = buxn_screen_info(width, height);
-	init_layer_texture(&app.background_texture, width, height, screen_info, "uxn.screen.background");
-	init_layer_texture(&app.foreground_texture, width, height, screen_info, "uxn.screen.foreground");
-	screen = realloc(screen, screen_info.screen_mem_size);
+	screen = realloc(
+		screen,
+		screen->packed ? screen_info.packed_screen_mem_size : screen_info.screen_mem_size
+	);
 	buxn_screen_resize(screen, width, height);
 	app.devices.screen = screen;
-
-	platform_resize_window(width, height);
+	buxn_port_table_register(&app.devices.ports, BUXN_DEVICE_SCREEN, &buxn_screen_ports, screen);
 
 	return screen;
 }
@@ -423,7 +656,7 @@ load_boot_rom(void) {
 	);
 
 	if (metadata.content_len != 0) {
-		apply_metadata(metadata);
+		set_metadata(metadata);
 	}
 
 	BLOG_DEBUG("Executing reset vector");
@@ -490,6 +723,298 @@ audio_callback(float* buffer, int num_frames, int num_channels) {
 	}
 }
 
+static void
+send_event(const buxn_replay_event_t* event) {
+	if (!app.threaded) {
+		buxn_replay_send(&app.replay, app.vm, event);
+		return;
+	}
+
+	unsigned head = atomic_load_explicit(&app.vm_events_head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&app.vm_events_tail, memory_order_acquire);
+	if (head - tail >= VM_EVENT_QUEUE_SIZE) {
+		BLOG_WARN("VM event queue is full, dropping an event");
+		return;
+	}
+
+	app.vm_events[head % VM_EVENT_QUEUE_SIZE] = *event;
+	atomic_store_explicit(&app.vm_events_head, head + 1, memory_order_release);
+	thread_signal_raise(app.vm_signal);
+}
+
+static void
+send_mouse_event(void) {
+	send_event(&(buxn_replay_event_t){
+		.type = BUXN_REPLAY_MOUSE,
+		.mouse = app.mouse,
+	});
+	app.mouse.scroll_x = app.mouse.scroll_y = 0;
+}
+
+static void
+send_controller_event(void) {
+	send_event(&(buxn_replay_event_t){
+		.type = BUXN_REPLAY_CONTROLLER,
+		.controller = app.controller,
+	});
+	app.controller.ch = 0;
+}
+
+static void
+receive_events(void) {
+	unsigned tail = atomic_load_explicit(&app.vm_events_tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&app.vm_events_head, memory_order_acquire);
+	for (; tail != head; ++tail) {
+		buxn_replay_send(&app.replay, app.vm, &app.vm_events[tail % VM_EVENT_QUEUE_SIZE]);
+	}
+	atomic_store_explicit(&app.vm_events_tail, tail, memory_order_release);
+}
+
+static void
+update_console(void) {
+	char ch[256];
+	int num_chars;
+	while (!app.stdin_closed && (num_chars = platform_poll_stdin(ch, sizeof(ch))) != 0) {
+		for (int i = 0; i < num_chars; ++i) {
+			buxn_replay_send(&app.replay, app.vm, &(buxn_replay_event_t){
+				.type = BUXN_REPLAY_CONSOLE,
+				.console = { .type = BUXN_CONSOLE_STDIN, .value = (uint8_t)ch[i] },
+			});
+		}
+
+		if (num_chars < 0) {
+			app.stdin_closed = true;
+			buxn_replay_send(&app.replay, app.vm, &(buxn_replay_event_t){
+				.type = BUXN_REPLAY_CONSOLE,
+				.console = { .type = BUXN_CONSOLE_END },
+			});
+		}
+	}
+}
+
+static void
+update_audio(void) {
+	if (app.should_submit_audio) { try_submit_audio(); }
+
+	for (int i = 0; i < BUXN_NUM_AUDIO_DEVICES; ++i) {
+		int num_finished = atomic_load_explicit(&app.audio_finished_count[i], memory_order_relaxed);
+		if (num_finished != app.audio_finished_ack[i]) {
+			buxn_replay_send(&app.replay, app.vm, &(buxn_replay_event_t){
+				.type = BUXN_REPLAY_AUDIO,
+				.audio_device_id = BUXN_DEVICE_AUDIO_0 + i,
+			});
+			app.audio_finished_ack[i] = num_finished;
+		}
+	}
+}
+
+static double
+measure_frame_time(bool vsync_aligned) {
+	uint64_t now = stm_now();
+	double time_diff = stm_us(stm_diff(now, app.last_frame));
+	app.last_frame = now;
+
+	// The measured time only adds jitter to callbacks paced by vsync: on a
+	// 60 Hz display, every callback runs the screen vector once instead of
+	// sometimes 0 or 2 times
+	if (vsync_aligned && fabs(time_diff - FRAME_TIME_US) < VSYNC_TOLERANCE_US) {
+		return FRAME_TIME_US;
+	} else {
+		return time_diff;
+	}
+}
+
+static void
+send_screen_event(void) {
+	buxn_replay_send(&app.replay, app.vm, &(buxn_replay_event_t){
+		.type = BUXN_REPLAY_SCREEN,
+	});
+	++app.num_screen_updates;
+}
+
+// Returns the number of times the screen vector ran
+static int
+update_screen(double time_diff) {
+	int num_updates = 0;
+	if (app.fast_forward) {
+		uint64_t start = stm_now();
+		while (
+			buxn_system_exit_code(app.vm) < 0
+			&& stm_us(stm_since(start)) < FAST_FORWARD_BUDGET_US
+		) {
+			send_screen_event();
+			++num_updates;
+		}
+
+		return num_updates;
+	}
+
+	app.frame_time_accumulator += time_diff;
+	while (app.frame_time_accumulator >= FRAME_TIME_US) {
+		// After a stall, running every missed vector back to back would only
+		// make the next frame late too
+		if (num_updates >= app.max_catch_up) {
+			app.frame_time_accumulator = fmod(app.frame_time_accumulator, FRAME_TIME_US);
+			break;
+		}
+
+		app.frame_time_accumulator -= FRAME_TIME_US;
+		send_screen_event();
+		++num_updates;
+	}
+
+	return num_updates;
+}
+
+static bool
+should_show_frame(int num_updates) {
+	if (num_updates == 0) { return false; }
+
+	// While catching up, the time to render goes to the screen vector instead
+	if (num_updates > 1 && app.num_skipped_frames < app.max_frame_skip) {
+		++app.num_skipped_frames;
+		return false;
+	}
+
+	app.num_skipped_frames = 0;
+	return true;
+}
+
+static size_t
+screen_mem_size(const buxn_screen_t* screen) {
+	buxn_screen_info_t screen_info = buxn_screen_info(screen->width, screen->height);
+	return screen->packed ? screen_info.packed_screen_mem_size : screen_info.screen_mem_size;
+}
+
+static void
+copy_screen_to_frame(vm_frame_t* vm_frame) {
+	size_t size = screen_mem_size(app.devices.screen);
+	if (vm_frame->size < size) {
+		// The size changes so buxn_screen_copy resizes it
+		vm_frame->screen = realloc(vm_frame->screen, size);
+		vm_frame->size = size;
+	}
+
+	buxn_screen_copy(vm_frame->screen, app.devices.screen);
+}
+
+static void
+publish_frame(void) {
+	vm_frame_t* vm_frame = &app.vm_frames[app.vm_frame];
+	copy_screen_to_frame(vm_frame);
+	buxn_system_palette(app.vm, vm_frame->palette);
+	vm_frame->number = ++app.vm_frame_number;
+
+	unsigned previous = atomic_exchange_explicit(
+		&app.vm_published_frame, app.vm_frame | VM_FRAME_FRESH,
+		memory_order_acq_rel
+	);
+	app.vm_frame = previous & ~VM_FRAME_FRESH;
+}
+
+// Returns whether a new frame was taken
+static bool
+receive_frame(void) {
+	unsigned published = atomic_load_explicit(&app.vm_published_frame, memory_order_relaxed);
+	if ((published & VM_FRAME_FRESH) == 0) { return false; }
+
+	published = atomic_exchange_explicit(
+		&app.vm_published_frame, app.displayed_frame,
+		memory_order_acq_rel
+	);
+	app.displayed_frame = published & ~VM_FRAME_FRESH;
+
+	vm_frame_t* vm_frame = &app.vm_frames[app.displayed_frame];
+	// The tiles changed in the frames which were never taken are not marked
+	// in this one
+	if (vm_frame->number != app.displayed_frame_number + 1) {
+		buxn_screen_force_refresh(vm_frame->screen);
+	}
+	app.displayed_frame_number = vm_frame->number;
+
+	return true;
+}
+
+static void
+vm_thread_entry(void* userdata) {
+	(void)userdata;
+
+	while (!atomic_load_explicit(&app.vm_should_stop, memory_order_acquire)) {
+		if (platform_update_dbg()) {
+			buxn_replay_send(&app.replay, app.vm, &(buxn_replay_event_t){
+				.type = BUXN_REPLAY_MOUSE,
+				.mouse = app.devices.mouse,
+			});
+		}
+
+		receive_events();
+		update_console();
+		update_audio();
+		if (should_show_frame(update_screen(measure_frame_time(false)))) {
+			publish_frame();
+		}
+		send_pending_metadata();
+
+		if (buxn_system_exit_code(app.vm) > 0) {
+			atomic_store_explicit(&app.vm_exited, true, memory_order_release);
+			break;
+		}
+
+		if (app.fast_forward) { continue; }
+
+		// Input events wake the thread up early
+		double time_left = FRAME_TIME_US - app.frame_time_accumulator
+			- stm_us(stm_since(app.last_frame));
+		thread_signal_wait(app.vm_signal, time_left > 0.0 ? (uint64_t)time_left : 0);
+	}
+}
+
+static void
+render_screen(buxn_screen_t* screen, const uint32_t vm_palette[4]) {
+	uint32_t palette[4];
+	memcpy(palette, vm_palette, sizeof(palette));
+
+	if (app.composite_screen) {
+		update_composite_texture(&app.composite_texture, screen, palette);
+		return;
+	}
+
+	if (buxn_screen_render(
+		screen,
+		BUXN_SCREEN_LAYER_BACKGROUND,
+		palette,
+		app.background_texture.cpu
+	)) {
+		sg_update_image(
+			app.background_texture.gpu,
+			&(sg_image_data) {
+				.subimage[0][0] = {
+					.ptr = app.background_texture.cpu,
+					.size = app.background_texture.size,
+				},
+			}
+		);
+	}
+
+	palette[0] = 0; // Foreground treats color0 as transparent
+	if (buxn_screen_render(
+		screen,
+		BUXN_SCREEN_LAYER_FOREGROUND,
+		palette,
+		app.foreground_texture.cpu
+	)) {
+		sg_update_image(
+			app.foreground_texture.gpu,
+			&(sg_image_data) {
+				.subimage[0][0] = {
+					.ptr = app.foreground_texture.cpu,
+					.size = app.foreground_texture.size,
+				},
+			}
+		);
+	}
+}
+
 static void
 init(void) {
 	app.devices = (devices_t){ 0 };
@@ -534,12 +1059,24 @@ init(void) {
 	BLOG_INFO("DPI scale: %f", sapp_dpi_scale());
 	BLOG_INFO("Default scale: %f", draw_scale);
 	buxn_screen_info_t screen_info = buxn_screen_info(width, height);
-	app.devices.screen = malloc(screen_info.screen_mem_size),
+	bool packed_screen = getenv("BUXN_SCREEN_PACKED") != NULL;
+	app.devices.screen = malloc(
+		packed_screen ? screen_info.packed_screen_mem_size : screen_info.screen_mem_size
+	);
 	memset(app.devices.screen, 0, sizeof(*app.devices.screen));
+	app.devices.screen->packed = packed_screen;
 	buxn_screen_resize(app.devices.screen, width, height);
 
-	init_layer_texture(&app.background_texture, width, height, screen_info, "uxn.screen.background");
-	init_layer_texture(&app.foreground_texture, width, height, screen_info, "uxn.screen.foreground");
+	app.composite_screen = getenv("BUXN_SCREEN_COMPOSITE") != NULL;
+	if (app.composite_screen) {
+		app.composite_pipeline = sgp_make_pipeline(&(sgp_pipeline_desc){
+			.blend_mode = SGP_BLENDMODE_NONE,
+			.color_format = SG_PIXELFORMAT_RGBA8,
+			.depth_format = SG_PIXELFORMAT_NONE,
+			.sample_count = 1,
+		});
+	}
+	init_textures(width, height);
 	app.sampler = sg_make_sampler(&(sg_sampler_desc){
 		.min_filter = SG_FILTER_NEAREST,
 		.mag_filter = SG_FILTER_NEAREST,
@@ -549,33 +1086,197 @@ init(void) {
 	});
 
 	// VM
-	app.vm = malloc(sizeof(buxn_vm_t) + BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS);
+	buxn_port_table_t* ports = &app.devices.ports;
+	buxn_port_table_init(ports);
+	buxn_port_table_register(ports, BUXN_DEVICE_SYSTEM, &buxn_system_ports, NULL);
+	buxn_port_table_register(ports, BUXN_DEVICE_CONSOLE, &buxn_console_ports, &app.devices.console);
+	buxn_port_table_register(ports, BUXN_DEVICE_SCREEN, &buxn_screen_ports, app.devices.screen);
+	for (int i = 0; i < BUXN_NUM_AUDIO_DEVICES; ++i) {
+		buxn_port_table_register(
+			ports,
+			BUXN_DEVICE_AUDIO_0 + i * (BUXN_DEVICE_AUDIO_1 - BUXN_DEVICE_AUDIO_0),
+			&buxn_audio_ports, &app.devices.audio[i]
+		);
+	}
+	buxn_port_table_register(ports, BUXN_DEVICE_CONTROLLER, &buxn_controller_ports, &app.devices.controller);
+	buxn_port_table_register(ports, BUXN_DEVICE_MOUSE, &buxn_mouse_ports, &app.devices.mouse);
+	buxn_port_table_register(ports, BUXN_DEVICE_FILE_0, &buxn_file_ports, &app.devices.file[0]);
+	buxn_port_table_register(ports, BUXN_DEVICE_FILE_1, &buxn_file_ports, &app.devices.file[1]);
+	buxn_port_table_register(ports, BUXN_DEVICE_DATETIME, &buxn_datetime_ports, NULL);
+
+	app.vm = buxn_vm_alloc(BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS);
 	app.vm->config = (buxn_vm_config_t){
 		.userdata = &app.devices,
 		.memory_size = BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS,
+		.noop_ports = &ports->noop_ports,
+		.zero_memory = buxn_vm_zero_memory,
 	};
 	buxn_vm_reset(app.vm, BUXN_VM_RESET_ALL);
 	platform_init_dbg(app.vm);
 
+	app.replay = (buxn_replay_t){
+		.console = &app.devices.console,
+		.mouse = &app.devices.mouse,
+		.controller = &app.devices.controller,
+		.screen_width = width,
+		.screen_height = height,
+	};
+	// Opt-in, every input is written to the given path to be replayed with
+	// buxn-cli
+	const char* record_path = getenv("BUXN_RECORD");
+	if (record_path != NULL) {
+		FILE* record_file = fopen(record_path, "wb");
+		if (record_file != NULL && buxn_replay_begin_record(&app.replay, record_file)) {
+			buxn_replay_capture(&app.replay, ports, BUXN_DEVICE_DATETIME);
+			for (int i = 0; i < BUXN_NUM_AUDIO_DEVICES; ++i) {
+				buxn_replay_capture(
+					&app.replay, ports,
+					BUXN_DEVICE_AUDIO_0 + i * (BUXN_DEVICE_AUDIO_1 - BUXN_DEVICE_AUDIO_0)
+				);
+			}
+			BLOG_INFO("Recording inputs to %s", record_path);
+		} else {
+			BLOG_ERROR("Could not record inputs to %s", record_path);
+			if (record_file != NULL) { fclose(record_file); }
+		}
+	}
+
+	// Opt-in, written to the given path on exit
+	app.profile_path = getenv("BUXN_PROFILE");
+	if (app.profile_path != NULL) {
+		app.vm->config.profile = calloc(1, sizeof(buxn_vm_profile_t));
+		const char* interval = getenv("BUXN_PROFILE_INTERVAL");
+		app.vm->config.profile->sample_interval = interval != NULL
+			? (uint32_t)strtoul(interval, NULL, 10)
+			: 1000;
+	}
+
+	// Opt-in, written to the given path on exit
+	app.coverage_path = getenv("BUXN_COVERAGE");
+	if (app.coverage_path != NULL) {
+		app.vm->config.coverage = calloc(1, sizeof(buxn_vm_coverage_t));
+		app.vm->config.coverage->record_branches = getenv("BUXN_COVERAGE_BRANCHES") != NULL;
+	}
+
+	// Opt-in, the file is mapped so it is readable even if the process dies
+	const char* trace_path = getenv("BUXN_TRACE");
+	if (trace_path != NULL) {
+		const char* size = getenv("BUXN_TRACE_SIZE");
+		uint32_t capacity = size != NULL ? (uint32_t)strtoul(size, NULL, 10) : 65536;
+		uint32_t rounded_capacity = 1;
+		while (rounded_capacity < capacity && rounded_capacity < (1u << 28)) {
+			rounded_capacity <<= 1;
+		}
+		app.vm->config.trace = buxn_vm_trace_map_file(
+			trace_path,
+			rounded_capacity,
+			getenv("BUXN_TRACE_TOS") != NULL ? BUXN_VM_TRACE_TOS : 0
+		);
+		if (app.vm->config.trace != NULL) {
+			BLOG_INFO("Tracing to %s", trace_path);
+		} else {
+			BLOG_ERROR("Could not map trace file %s", trace_path);
+		}
+	}
+
+	app.threaded = getenv("BUXN_VM_THREAD") != NULL;
+
 	if (!load_boot_rom()) {
 		BLOG_FATAL("Could not load boot rom");
 		sapp_quit();
 	}
 
-	app.last_frame = stm_now();
+	const char* max_catch_up = getenv("BUXN_FRAME_CATCH_UP");
+	app.max_catch_up = max_catch_up != NULL
+		? (int)strtol(max_catch_up, NULL, 10)
+		: DEFAULT_MAX_CATCH_UP;
+	if (app.max_catch_up < 1) { app.max_catch_up = 1; }
+	const char* max_frame_skip = getenv("BUXN_FRAME_SKIP");
+	app.max_frame_skip = max_frame_skip != NULL ? (int)strtol(max_frame_skip, NULL, 10) : 0;
+	app.fast_forward = getenv("BUXN_FAST_FORWARD") != NULL;
+
+	app.start_time = app.last_frame = stm_now();
 	app.frame_time_accumulator = FRAME_TIME_US;  // Render once
+
+	if (app.threaded) {
+		// Every frame starts as a copy of the screen after the reset vector,
+		// which may have resized it, and the first one is published
+		for (int i = 0; i < 3; ++i) {
+			vm_frame_t* vm_frame = &app.vm_frames[i];
+			vm_frame->size = screen_mem_size(app.devices.screen);
+			vm_frame->screen = calloc(1, vm_frame->size);
+		}
+		app.vm_frame = 0;
+		atomic_store_explicit(&app.vm_published_frame, 2, memory_order_relaxed);
+		publish_frame();
+		app.displayed_frame = 1;
+		copy_screen_to_frame(&app.vm_frames[app.displayed_frame]);
+
+		app.vm_signal = thread_signal_create();
+		app.vm_thread = thread_start(vm_thread_entry, NULL);
+		if (app.vm_thread == NULL) {
+			BLOG_FATAL("Could not start the VM thread");
+			sapp_quit();
+		}
+	}
 }
 
 static void
 cleanup(void) {
+	// The VM is only used by this thread afterward
+	if (app.vm_thread != NULL) {
+		atomic_store_explicit(&app.vm_should_stop, true, memory_order_release);
+		thread_signal_raise(app.vm_signal);
+		thread_join(app.vm_thread);
+	}
+	if (app.fast_forward) {
+		double seconds = stm_sec(stm_since(app.start_time));
+		BLOG_INFO(
+			"Ran %llu screen updates in %.3f s (%.1f updates/s)",
+			(unsigned long long)app.num_screen_updates,
+			seconds,
+			(double)app.num_screen_updates / seconds
+		);
+	}
+	if (app.vm_signal != NULL) { thread_signal_destroy(app.vm_signal); }
+	for (int i = 0; i < 3; ++i) {
+		free(app.vm_frames[i].screen);
+	}
+
 	free(app.devices.screen);
 	sg_destroy_sampler(app.sampler);
-	cleanup_layer_texture(&app.foreground_texture);
-	cleanup_layer_texture(&app.background_texture);
+	cleanup_textures();
+	if (app.composite_screen) {
+		sg_destroy_pipeline(app.composite_pipeline);
+	}
 
 	saudio_shutdown();
 
-	free(app.vm);
+	if (app.vm->config.profile != NULL) {
+		FILE* profile_file = fopen(app.profile_path, "wb");
+		if (profile_file != NULL) {
+			buxn_vm_profile_write(app.vm->config.profile, profile_file);
+			fclose(profile_file);
+			BLOG_INFO("Profile written to %s", app.profile_path);
+		} else {
+			BLOG_ERROR("Could not write profile to %s", app.profile_path);
+		}
+		free(app.vm->config.profile);
+	}
+	if (app.vm->config.coverage != NULL) {
+		FILE* coverage_file = fopen(app.coverage_path, "wb");
+		if (coverage_file != NULL) {
+			buxn_vm_coverage_write(app.vm->config.coverage, coverage_file);
+			fclose(coverage_file);
+			BLOG_INFO("Coverage written to %s", app.coverage_path);
+		} else {
+			BLOG_ERROR("Could not write coverage to %s", app.coverage_path);
+		}
+		free(app.vm->config.coverage);
+	}
+	buxn_vm_trace_unmap(app.vm->config.trace);
+	buxn_vm_free(app.vm);
+	if (app.replay.file != NULL) { fclose(app.replay.file); }
 
 	sgp_shutdown();
 	sg_shutdown();
@@ -587,85 +1288,36 @@ cleanup(void) {
 
 static void
 frame(void) {
-	// Exit
-	if (buxn_system_exit_code(app.vm) > 0) { sapp_quit(); }
-
-	if (platform_update_dbg()) { buxn_mouse_update(app.vm); }
+	if (app.threaded) {
+		if (atomic_load_explicit(&app.vm_exited, memory_order_acquire)) { sapp_quit(); }
 
-	// Console
-	char ch[256];
-	int num_chars;
-	while (!app.stdin_closed && (num_chars = platform_poll_stdin(ch, sizeof(ch))) != 0) {
-		for (int i = 0; i < num_chars; ++i) {
-			buxn_console_send_input(app.vm, &app.devices.console, ch[i]);
+		if (atomic_load_explicit(&app.has_pending_metadata, memory_order_acquire)) {
+			apply_metadata(&app.pending_metadata);
+			atomic_store_explicit(&app.has_pending_metadata, false, memory_order_release);
 		}
 
-		if (num_chars < 0) {
-			app.stdin_closed = true;
-			buxn_console_send_input_end(app.vm, &app.devices.console);
-		}
-	}
-
-	// Audio
-	if (app.should_submit_audio) { try_submit_audio(); }
-
-	for (int i = 0; i < BUXN_NUM_AUDIO_DEVICES; ++i) {
-		int num_finished = atomic_load_explicit(&app.audio_finished_count[i], memory_order_relaxed);
-		if (num_finished != app.audio_finished_ack[i]) {
-			buxn_audio_notify_finished(app.vm, BUXN_DEVICE_AUDIO_0 + i);
-			app.audio_finished_ack[i] = num_finished;
+		if (receive_frame()) {
+			vm_frame_t* vm_frame = &app.vm_frames[app.displayed_frame];
+			if (
+				vm_frame->screen->width != app.texture_width
+				|| vm_frame->screen->height != app.texture_height
+			) {
+				resize_textures(vm_frame->screen->width, vm_frame->screen->height);
+			}
+			render_screen(vm_frame->screen, vm_frame->palette);
 		}
-	}
-
-	// Screen
-	uint64_t now = stm_now();
-	double time_diff = stm_us(stm_diff(now, app.last_frame));
-	app.last_frame = now;
-	app.frame_time_accumulator += time_diff;
-
-	bool should_redraw = app.frame_time_accumulator >= FRAME_TIME_US;
-	while (app.frame_time_accumulator >= FRAME_TIME_US) {
-		app.frame_time_accumulator -= FRAME_TIME_US;
-		buxn_screen_update(app.vm);
-	}
+	} else {
+		// Exit
+		if (buxn_system_exit_code(app.vm) > 0) { sapp_quit(); }
 
-	if (should_redraw) {
-		uint32_t palette[4];
-		buxn_system_palette(app.vm, palette);
+		if (platform_update_dbg()) { send_mouse_event(); }
 
-		if (buxn_screen_render(
-			app.devices.screen,
-			BUXN_SCREEN_LAYER_BACKGROUND,
-			palette,
-			app.background_texture.cpu
-		)) {
-			sg_update_image(
-				app.background_texture.gpu,
-				&(sg_image_data) {
-					.subimage[0][0] = {
-						.ptr = app.background_texture.cpu,
-						.size = app.background_texture.size,
-					},
-				}
-			);
-		}
-
-		palette[0] = 0; // Foreground treats color0 as transparent
-		if (buxn_screen_render(
-			app.devices.screen,
-			BUXN_SCREEN_LAYER_FOREGROUND,
-			palette,
-			app.foreground_texture.cpu
-		)) {
-			sg_update_image(
-				app.foreground_texture.gpu,
-				&(sg_image_data) {
-					.subimage[0][0] = {
-						.ptr = app.foreground_texture.cpu,
-						.size = app.foreground_texture.size,
-					},
-				}
-			);
+		update_console();
+		update_audio();
+		if (should_show_frame(update_screen(measure_frame_time(true)))) {
+			uint32_t palette[4];
+			buxn_system_palette(app.vm, palette);
+			render_screen(app.devices.screen, palette);
 		}
 	}
 
@@ -683,11 +1335,16 @@ frame(void) {
 
 			sgp_set_sampler(0, app.sampler);
 
-			sgp_set_image(0, app.background_texture.gpu);
-			sgp_draw_filled_rect(draw_info.x_margin, draw_info.y_margin, draw_info.scaled_width, draw_info.scaled_height);
+			if (app.composite_screen) {
+				sgp_set_image(0, app.composite_texture.target);
+				sgp_draw_filled_rect(draw_info.x_margin, draw_info.y_margin, draw_info.scaled_width, draw_info.scaled_height);
+			} else {
+				sgp_set_image(0, app.background_texture.gpu);
+				sgp_draw_filled_rect(draw_info.x_margin, draw_info.y_margin, draw_info.scaled_width, draw_info.scaled_height);
 
-			sgp_set_image(0, app.foreground_texture.gpu);
-			sgp_draw_filled_rect(draw_info.x_margin, draw_info.y_margin, draw_info.scaled_width, draw_info.scaled_height);
+				sgp_set_image(0, app.foreground_texture.gpu);
+				sgp_draw_filled_rect(draw_info.x_margin, draw_info.y_margin, draw_info.scaled_width, draw_info.scaled_height);
+			}
 		}
 		sgp_flush();
 		sgp_end();
@@ -736,7 +1393,7 @@ process_touch(sapp_event_type type, const sapp_touchpoint* touch) {
 		case SAPP_EVENTTYPE_TOUCHES_MOVED:
 			if (has_first_touch && touch->identifier == first_touch) {
 				if (has_second_touch) {
-					buxn_mouse_set_button(&app.devices.mouse, 0, true);
+					buxn_mouse_set_button(&app.mouse, 0, true);
 				}
 
 				float touch_dx = touch->pos_x - last_drag_x;
@@ -749,11 +1406,11 @@ process_touch(sapp_event_type type, const sapp_touchpoint* touch) {
 				float mouse_dy = floorf(accum_drag_y);
 				accum_drag_x -= mouse_dx;
 				accum_drag_y -= mouse_dy;
-				float mouse_x = (float)app.devices.mouse.x + mouse_dx;
-				float mouse_y = (float)app.devices.mouse.y + mouse_dy;
-				app.devices.mouse.x = (uint16_t)clamp(mouse_x, 0.f, (float)app.devices.screen->width);
-				app.devices.mouse.y = (uint16_t)clamp(mouse_y, 0.f, (float)app.devices.screen->height);
-				buxn_mouse_update(app.vm);
+				float mouse_x = (float)app.mouse.x + mouse_dx;
+				float mouse_y = (float)app.mouse.y + mouse_dy;
+				app.mouse.x = (uint16_t)clamp(mouse_x, 0.f, (float)displayed_screen()->width);
+				app.mouse.y = (uint16_t)clamp(mouse_y, 0.f, (float)displayed_screen()->height);
+				send_mouse_event();
 			}
 			break;
 		case SAPP_EVENTTYPE_TOUCHES_ENDED:
@@ -762,13 +1419,13 @@ process_touch(sapp_event_type type, const sapp_touchpoint* touch) {
 				has_first_touch = false;
 			} else if (has_second_touch && touch->identifier == second_touch) {
 				has_second_touch = false;
-				if (!buxn_mouse_check_button(&app.devices.mouse, 0)) {
-					buxn_mouse_set_button(&app.devices.mouse, 0, true);
-					buxn_mouse_update(app.vm);
+				if (!buxn_mouse_check_button(&app.mouse, 0)) {
+					buxn_mouse_set_button(&app.mouse, 0, true);
+					send_mouse_event();
 				}
 
-				buxn_mouse_set_button(&app.devices.mouse, 0, false);
-				buxn_mouse_update(app.vm);
+				buxn_mouse_set_button(&app.mouse, 0, false);
+				send_mouse_event();
 			}
 			break;
 		default:
@@ -779,7 +1436,8 @@ process_touch(sapp_event_type type, const sapp_touchpoint* touch) {
 static void
 event(const sapp_event* event) {
 	bool update_mouse = false;
-	if (platform_update_dbg()) {
+	// The VM thread updates the debugger
+	if (!app.threaded && platform_update_dbg()) {
 		update_mouse = true;
 	}
 
@@ -803,7 +1461,7 @@ event(const sapp_event* event) {
 			}
 			if (button >= 0) {
 				buxn_mouse_set_button(
-					&app.devices.mouse,
+					&app.mouse,
 					button,
 					event->type == SAPP_EVENTTYPE_MOUSE_DOWN
 				);
@@ -811,8 +1469,8 @@ event(const sapp_event* event) {
 			}
 		} break;
 		case SAPP_EVENTTYPE_MOUSE_SCROLL:
-			app.devices.mouse.scroll_x = (int16_t)event->scroll_x;
-			app.devices.mouse.scroll_y = -(int16_t)event->scroll_y;
+			app.mouse.scroll_x = (int16_t)event->scroll_x;
+			app.mouse.scroll_y = -(int16_t)event->scroll_y;
 			update_mouse = true;
 			break;
 		case SAPP_EVENTTYPE_MOUSE_MOVE: {
@@ -822,8 +1480,8 @@ event(const sapp_event* event) {
 			float mouse_x = (float)(event->mouse_x - draw_info.x_margin) / draw_info.draw_scale;
 			float mouse_y = (float)(event->mouse_y - draw_info.y_margin) / draw_info.draw_scale;
 
-			app.devices.mouse.x = (uint16_t)clamp(mouse_x, 0.f, (float)app.devices.screen->width);
-			app.devices.mouse.y = (uint16_t)clamp(mouse_y, 0.f, (float)app.devices.screen->height);
+			app.mouse.x = (uint16_t)clamp(mouse_x, 0.f, (float)displayed_screen()->width);
+			app.mouse.y = (uint16_t)clamp(mouse_y, 0.f, (float)displayed_screen()->height);
 			update_mouse = true;
 		} break;
 		case SAPP_EVENTTYPE_TOUCHES_BEGAN:
@@ -889,10 +1547,12 @@ event(const sapp_event* event) {
 					break;
 			}
 			if (button >= 0) {
-				buxn_controller_send_button(app.vm, &app.devices.controller, 0, button, down);
+				buxn_controller_set_button(&app.controller, 0, button, down);
+				send_controller_event();
 			}
 			if (ch > 0 && down) {
-				buxn_controller_send_char(app.vm, &app.devices.controller, ch);
+				app.controller.ch = ch;
+				send_controller_event();
 			}
 		} break;
 		case SAPP_EVENTTYPE_CHAR: {
@@ -901,25 +1561,26 @@ event(const sapp_event* event) {
 				// Sync the modifiers in case we missed their release due to
 				// focus change
 				buxn_controller_set_button(
-					&app.devices.controller,
+					&app.controller,
 					0,
 					BUXN_CONTROLLER_BTN_A,
 					(event->modifiers & SAPP_MODIFIER_CTRL) != 0
 				);
 				buxn_controller_set_button(
-					&app.devices.controller,
+					&app.controller,
 					0,
 					BUXN_CONTROLLER_BTN_B,
 					(event->modifiers & SAPP_MODIFIER_ALT) != 0
 				);
 				buxn_controller_set_button(
-					&app.devices.controller,
+					&app.controller,
 					0,
 					BUXN_CONTROLLER_BTN_SELECT,
 					(event->modifiers & SAPP_MODIFIER_SHIFT) != 0
 				);
 				// Send the actual character
-				buxn_controller_send_char(app.vm, &app.devices.controller, ch);
+				app.controller.ch = (uint8_t)ch;
+				send_controller_event();
 			}
 		} break;
 		default:
@@ -927,11 +1588,10 @@ event(const sapp_event* event) {
 	}
 
 	if (update_mouse) {
-		buxn_mouse_update(app.vm);
-		app.devices.mouse.scroll_x = app.devices.mouse.scroll_y = 0;
+		send_mouse_event();
 	}
 
-	if (app.should_submit_audio) { try_submit_audio(); }
+	if (!app.threaded && app.should_submit_audio) { try_submit_audio(); }
 }
 
 sapp_desc
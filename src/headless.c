@@ -0,0 +1,726 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <physfs.h>
+#include <buxn/vm/vm.h>
+#include <buxn/vm/alloc.h>
+#include <buxn/devices/console.h>
+#include <buxn/devices/system.h>
+#include <buxn/devices/datetime.h>
+#include <buxn/devices/file.h>
+#include <buxn/devices/ports.h>
+#include <buxn/devices/screen.h>
+#include <buxn/devices/mouse.h>
+#include <buxn/devices/controller.h>
+#include <buxn/devices/audio.h>
+#include <buxn/devices/replay.h>
+#include "bflag.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#define FLAG_NUM_FRAMES "-num-frames="
+#define FLAG_FPS "-fps="
+#define FLAG_REALTIME "-realtime"
+#define FLAG_SIZE "-size="
+#define FLAG_REPLAY "-replay="
+#define FLAG_DUMP_FRAMES "-dump-frames="
+#define FLAG_DUMP_FORMAT "-dump-format="
+#define FLAG_DUMP_EVERY "-dump-every="
+#define FLAG_VIDEO "-video="
+#define FLAG_AUDIO "-audio="
+
+#define DEFAULT_WIDTH 512
+#define DEFAULT_HEIGHT 320
+
+typedef enum {
+	FRAME_FORMAT_QOI,
+	FRAME_FORMAT_PPM,
+} frame_format_t;
+
+typedef struct {
+	buxn_console_t console;
+	buxn_file_t file[BUXN_NUM_FILE_DEVICES];
+	buxn_mouse_t mouse;
+	buxn_controller_t controller;
+	buxn_audio_t audio[BUXN_NUM_AUDIO_DEVICES];
+	buxn_screen_t* screen;
+	buxn_port_table_t ports;
+
+	// Kept up to date with the dirty tiles of the screen
+	uint32_t* framebuffer;
+} vm_data_t;
+
+typedef struct {
+	FILE* file;
+	int width;
+	int height;
+	uint8_t* planes;
+} video_writer_t;
+
+typedef struct {
+	FILE* file;
+	uint32_t num_frames;
+} audio_writer_t;
+
+uint8_t
+buxn_vm_dei(buxn_vm_t* vm, uint8_t address) {
+	vm_data_t* devices = vm->config.userdata;
+	return buxn_port_table_dei(&devices->ports, vm, address);
+}
+
+void
+buxn_vm_deo(buxn_vm_t* vm, uint8_t address) {
+	vm_data_t* devices = vm->config.userdata;
+	buxn_port_table_deo(&devices->ports, vm, address);
+}
+
+void
+buxn_system_debug(buxn_vm_t* vm, uint8_t value) {
+	if (value == 0) { return; }
+
+	fprintf(stderr, "WST");
+	for (uint8_t i = 0; i < vm->wsp; ++i) {
+		fprintf(stderr, " %02hhX", vm->ws[i]);
+	}
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "RST");
+	for (uint8_t i = 0; i < vm->rsp; ++i) {
+		fprintf(stderr, " %02hhX", vm->rs[i]);
+	}
+	fprintf(stderr, "\n");
+}
+
+void
+buxn_system_set_metadata(buxn_vm_t* vm, uint16_t address) {
+	(void)vm;
+	(void)address;
+}
+
+void
+buxn_system_theme_changed(buxn_vm_t* vm) {
+	vm_data_t* devices = vm->config.userdata;
+	buxn_screen_force_refresh(devices->screen);
+}
+
+void
+buxn_console_handle_write(struct buxn_vm_s* vm, buxn_console_t* device, char c) {
+	(void)vm;
+	(void)device;
+	fputc(c, stdout);
+	fflush(stdout);
+}
+
+void
+buxn_console_handle_error(struct buxn_vm_s* vm, buxn_console_t* device, char c) {
+	(void)vm;
+	(void)device;
+	fputc(c, stderr);
+	fflush(stdout);
+}
+
+buxn_screen_t*
+buxn_screen_request_resize(
+	struct buxn_vm_s* vm,
+	buxn_screen_t* screen,
+	uint16_t width, uint16_t height
+) {
+	vm_data_t* devices = vm->config.userdata;
+	buxn_screen_info_t screen_info = buxn_screen_info(width, height);
+	screen = realloc(screen, screen_info.screen_mem_size);
+	buxn_screen_resize(screen, width, height);
+	devices->screen = screen;
+	devices->framebuffer = realloc(devices->framebuffer, screen_info.target_mem_size);
+	buxn_port_table_register(&devices->ports, BUXN_DEVICE_SCREEN, &buxn_screen_ports, screen);
+	return screen;
+}
+
+void
+buxn_audio_send(buxn_vm_t* vm, const buxn_audio_message_t* message) {
+	// There is no audio thread, samples are rendered after each frame
+	(void)vm;
+	buxn_audio_receive(message);
+}
+
+static void
+write_u16le(FILE* file, uint16_t value) {
+	uint8_t bytes[2] = { (uint8_t)value, (uint8_t)(value >> 8) };
+	fwrite(bytes, sizeof(bytes), 1, file);
+}
+
+static void
+write_u32le(FILE* file, uint32_t value) {
+	uint8_t bytes[4] = {
+		(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24),
+	};
+	fwrite(bytes, sizeof(bytes), 1, file);
+}
+
+static void
+write_u32be(FILE* file, uint32_t value) {
+	uint8_t bytes[4] = {
+		(uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value,
+	};
+	fwrite(bytes, sizeof(bytes), 1, file);
+}
+
+// Pixels are 0xAABBGGRR like the palette from buxn_system_palette
+
+static bool
+write_ppm(const char* path, const uint32_t* pixels, int width, int height) {
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) { return false; }
+
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	for (int i = 0; i < width * height; ++i) {
+		uint8_t rgb[3] = {
+			(uint8_t)pixels[i], (uint8_t)(pixels[i] >> 8), (uint8_t)(pixels[i] >> 16),
+		};
+		fwrite(rgb, sizeof(rgb), 1, file);
+	}
+
+	return fclose(file) == 0;
+}
+
+// See: https://qoiformat.org/qoi-specification.pdf
+static bool
+write_qoi(const char* path, const uint32_t* pixels, int width, int height) {
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) { return false; }
+
+	fwrite("qoif", 4, 1, file);
+	write_u32be(file, (uint32_t)width);
+	write_u32be(file, (uint32_t)height);
+	fputc(3, file);  // RGB
+	fputc(0, file);  // sRGB
+
+	uint32_t index[64] = { 0 };
+	uint32_t prev = 0xff000000;
+	int run = 0;
+	int num_pixels = width * height;
+	for (int i = 0; i < num_pixels; ++i) {
+		uint32_t pixel = pixels[i];
+		if (pixel == prev) {
+			++run;
+			if (run == 62 || i == num_pixels - 1) {
+				fputc(0xc0 | (run - 1), file);
+				run = 0;
+			}
+			continue;
+		}
+
+		if (run > 0) {
+			fputc(0xc0 | (run - 1), file);
+			run = 0;
+		}
+
+		uint8_t r = (uint8_t)pixel;
+		uint8_t g = (uint8_t)(pixel >> 8);
+		uint8_t b = (uint8_t)(pixel >> 16);
+		uint8_t a = (uint8_t)(pixel >> 24);
+		int hash = (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+		if (index[hash] == pixel) {
+			fputc(hash, file);
+		} else {
+			index[hash] = pixel;
+
+			int8_t dr = (int8_t)(r - (uint8_t)prev);
+			int8_t dg = (int8_t)(g - (uint8_t)(prev >> 8));
+			int8_t db = (int8_t)(b - (uint8_t)(prev >> 16));
+			int8_t dr_dg = (int8_t)(dr - dg);
+			int8_t db_dg = (int8_t)(db - dg);
+			if (
+				dr >= -2 && dr <= 1
+				&& dg >= -2 && dg <= 1
+				&& db >= -2 && db <= 1
+			) {
+				fputc(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2), file);
+			} else if (
+				dg >= -32 && dg <= 31
+				&& dr_dg >= -8 && dr_dg <= 7
+				&& db_dg >= -8 && db_dg <= 7
+			) {
+				fputc(0x80 | (dg + 32), file);
+				fputc(((dr_dg + 8) << 4) | (db_dg + 8), file);
+			} else {
+				uint8_t rgb[4] = { 0xfe, r, g, b };
+				fwrite(rgb, sizeof(rgb), 1, file);
+			}
+		}
+		prev = pixel;
+	}
+
+	static const uint8_t padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	fwrite(padding, sizeof(padding), 1, file);
+
+	return fclose(file) == 0;
+}
+
+static bool
+begin_video(video_writer_t* video, const char* path, int width, int height, int fps) {
+	video->file = fopen(path, "wb");
+	if (video->file == NULL) { return false; }
+
+	video->width = width;
+	video->height = height;
+	video->planes = malloc((size_t)width * (size_t)height * 3);
+	// 4:4:4 so every pixel keeps its color
+	fprintf(video->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+	return true;
+}
+
+static void
+write_video_frame(video_writer_t* video, const uint32_t* pixels) {
+	size_t num_pixels = (size_t)video->width * (size_t)video->height;
+	uint8_t* y_plane = video->planes;
+	uint8_t* u_plane = y_plane + num_pixels;
+	uint8_t* v_plane = u_plane + num_pixels;
+	for (size_t i = 0; i < num_pixels; ++i) {
+		int r = (int)(pixels[i] & 0xff);
+		int g = (int)((pixels[i] >> 8) & 0xff);
+		int b = (int)((pixels[i] >> 16) & 0xff);
+		// BT.601, limited range
+		y_plane[i] = (uint8_t)((( 66 * r + 129 * g +  25 * b + 128) >> 8) +  16);
+		u_plane[i] = (uint8_t)(((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128);
+		v_plane[i] = (uint8_t)(((112 * r -  94 * g -  18 * b + 128) >> 8) + 128);
+	}
+
+	fwrite("FRAME\n", 6, 1, video->file);
+	fwrite(video->planes, num_pixels * 3, 1, video->file);
+}
+
+static bool
+end_video(video_writer_t* video) {
+	free(video->planes);
+	video->planes = NULL;
+	bool success = fclose(video->file) == 0;
+	video->file = NULL;
+	return success;
+}
+
+static bool
+begin_audio(audio_writer_t* audio, const char* path) {
+	audio->file = fopen(path, "wb");
+	if (audio->file == NULL) { return false; }
+
+	// Sizes are written at the end
+	audio->num_frames = 0;
+	uint16_t block_align = BUXN_AUDIO_PREFERRED_NUM_CHANNELS * sizeof(int16_t);
+	fwrite("RIFF", 4, 1, audio->file);
+	write_u32le(audio->file, 0);
+	fwrite("WAVEfmt ", 8, 1, audio->file);
+	write_u32le(audio->file, 16);
+	write_u16le(audio->file, 1);  // PCM
+	write_u16le(audio->file, BUXN_AUDIO_PREFERRED_NUM_CHANNELS);
+	write_u32le(audio->file, BUXN_AUDIO_PREFERRED_SAMPLE_RATE);
+	write_u32le(audio->file, BUXN_AUDIO_PREFERRED_SAMPLE_RATE * block_align);
+	write_u16le(audio->file, block_align);
+	write_u16le(audio->file, 16);
+	fwrite("data", 4, 1, audio->file);
+	write_u32le(audio->file, 0);
+	return true;
+}
+
+static void
+write_audio(audio_writer_t* audio, const float* samples, int num_frames) {
+	for (int i = 0; i < num_frames * BUXN_AUDIO_PREFERRED_NUM_CHANNELS; ++i) {
+		float sample = samples[i];
+		if (sample > 1.f) { sample = 1.f; }
+		if (sample < -1.f) { sample = -1.f; }
+		write_u16le(audio->file, (uint16_t)(int16_t)(sample * 32767.f));
+	}
+	audio->num_frames += (uint32_t)num_frames;
+}
+
+static bool
+end_audio(audio_writer_t* audio) {
+	uint32_t data_size = audio->num_frames * BUXN_AUDIO_PREFERRED_NUM_CHANNELS * sizeof(int16_t);
+	fseek(audio->file, 4, SEEK_SET);
+	write_u32le(audio->file, 36 + data_size);
+	fseek(audio->file, 40, SEEK_SET);
+	write_u32le(audio->file, data_size);
+	bool success = fclose(audio->file) == 0;
+	audio->file = NULL;
+	return success;
+}
+
+static double
+now_ms(void) {
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+}
+
+static void
+sleep_ms(double duration) {
+	if (duration <= 0.0) { return; }
+
+#ifdef _WIN32
+	Sleep((DWORD)duration);
+#else
+	struct timespec time = {
+		.tv_sec = (time_t)(duration / 1000.0),
+		.tv_nsec = (long)((duration - (double)(time_t)(duration / 1000.0) * 1000.0) * 1000000.0),
+	};
+	nanosleep(&time, NULL);
+#endif
+}
+
+static bool
+parse_int_flag(const char* flag_name, const char* value, int min, int* out) {
+	errno = 0;
+	char* end;
+	long number = strtol(value, &end, 10);
+	if (errno != 0 || end == value || *end != '\0' || number < min || number > INT32_MAX) {
+		fprintf(stderr, "Invalid value for %s: %s\n", flag_name, value);
+		return false;
+	}
+
+	*out = (int)number;
+	return true;
+}
+
+static bool
+parse_size_flag(const char* value, int* width, int* height) {
+	char* end;
+	long w = strtol(value, &end, 10);
+	if (end == value || *end != 'x') { goto invalid; }
+
+	const char* height_str = end + 1;
+	long h = strtol(height_str, &end, 10);
+	if (end == height_str || *end != '\0') { goto invalid; }
+	if (w <= 0 || w > UINT16_MAX || h <= 0 || h > UINT16_MAX) { goto invalid; }
+
+	*width = (int)w;
+	*height = (int)h;
+	return true;
+invalid:
+	fprintf(stderr, "Invalid value for %s: %s\n", FLAG_SIZE, value);
+	return false;
+}
+
+int
+main(int argc, const char* argv[]) {
+	int num_frames = 600;
+	int fps = 60;
+	bool realtime = false;
+	int width = DEFAULT_WIDTH;
+	int height = DEFAULT_HEIGHT;
+	const char* replay_path = NULL;
+	const char* dump_prefix = NULL;
+	frame_format_t dump_format = FRAME_FORMAT_QOI;
+	int dump_every = 1;
+	const char* video_path = NULL;
+	const char* audio_path = NULL;
+	int rom_arg = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* flag_value;
+		const char* arg = argv[i];
+
+		if ((flag_value = parse_flag(arg, "--help")) != NULL) {
+			fprintf(stderr,
+				"Usage: buxn-headless [options] <rom> [args]...\n"
+				"Run a ROM with a screen, audio, mouse and controller but no window.\n"
+				"\n"
+				"--help                  Print this message.\n"
+				"-num-frames=<n>         (Optional) Stop after this many frames.\n"
+				"                        0 runs until the ROM exits.\n"
+				"                        This defaults to 600.\n"
+				"-fps=<n>                (Optional) Frames per second of the ROM's time.\n"
+				"                        This defaults to 60.\n"
+				"-realtime               (Optional) Wait between frames instead of running\n"
+				"                        as fast as possible.\n"
+				"-size=<w>x<h>           (Optional) Size of the screen.\n"
+				"                        This defaults to 512x320.\n"
+				"-replay=<file>          (Optional) Play the inputs recorded with BUXN_RECORD.\n"
+				"                        Frames and screen size follow the recording.\n"
+				"-dump-frames=<prefix>   (Optional) Write frames to <prefix><frame>.<format>.\n"
+				"-dump-format=qoi|ppm    (Optional) Format of the frames.\n"
+				"                        This defaults to qoi.\n"
+				"-dump-every=<n>         (Optional) Only write every n-th frame and video frame.\n"
+				"                        This defaults to 1.\n"
+				"-video=<file>           (Optional) Write frames to this file as Y4M.\n"
+				"-audio=<file>           (Optional) Write audio to this file as WAV.\n"
+			);
+			return 0;
+		} else if ((flag_value = parse_flag(arg, FLAG_NUM_FRAMES)) != NULL) {
+			if (!parse_int_flag(FLAG_NUM_FRAMES, flag_value, 0, &num_frames)) { return 1; }
+		} else if ((flag_value = parse_flag(arg, FLAG_FPS)) != NULL) {
+			if (!parse_int_flag(FLAG_FPS, flag_value, 1, &fps)) { return 1; }
+		} else if ((flag_value = parse_flag(arg, FLAG_REALTIME)) != NULL) {
+			realtime = true;
+		} else if ((flag_value = parse_flag(arg, FLAG_SIZE)) != NULL) {
+			if (!parse_size_flag(flag_value, &width, &height)) { return 1; }
+		} else if ((flag_value = parse_flag(arg, FLAG_REPLAY)) != NULL) {
+			replay_path = flag_value;
+		} else if ((flag_value = parse_flag(arg, FLAG_DUMP_FRAMES)) != NULL) {
+			dump_prefix = flag_value;
+		} else if ((flag_value = parse_flag(arg, FLAG_DUMP_FORMAT)) != NULL) {
+			if (strcmp(flag_value, "qoi") == 0) {
+				dump_format = FRAME_FORMAT_QOI;
+			} else if (strcmp(flag_value, "ppm") == 0) {
+				dump_format = FRAME_FORMAT_PPM;
+			} else {
+				fprintf(stderr, "Invalid value for %s: %s\n", FLAG_DUMP_FORMAT, flag_value);
+				return 1;
+			}
+		} else if ((flag_value = parse_flag(arg, FLAG_DUMP_EVERY)) != NULL) {
+			if (!parse_int_flag(FLAG_DUMP_EVERY, flag_value, 1, &dump_every)) { return 1; }
+		} else if ((flag_value = parse_flag(arg, FLAG_VIDEO)) != NULL) {
+			video_path = flag_value;
+		} else if ((flag_value = parse_flag(arg, FLAG_AUDIO)) != NULL) {
+			audio_path = flag_value;
+		} else {
+			rom_arg = i;
+			break;
+		}
+	}
+
+	if (rom_arg == 0) {
+		fprintf(stderr, "Please specify a ROM\n");
+		return 1;
+	}
+
+	FILE* rom_file = fopen(argv[rom_arg], "rb");
+	if (rom_file == NULL) {
+		perror("Error while opening rom file");
+		return 1;
+	}
+
+	PHYSFS_init(argv[0]);
+	PHYSFS_mount(".", "", 1);
+	PHYSFS_setWriteDir(".");
+
+	int exit_code = 1;
+	vm_data_t devices = { 0 };
+	video_writer_t video = { 0 };
+	audio_writer_t audio = { 0 };
+	buxn_replay_t replay = {
+		.console = &devices.console,
+		.mouse = &devices.mouse,
+		.controller = &devices.controller,
+	};
+	buxn_vm_t* vm = NULL;
+	float* audio_buffer = NULL;
+	float* device_buffer = NULL;
+
+	if (replay_path != NULL) {
+		FILE* replay_file = fopen(replay_path, "rb");
+		if (replay_file == NULL || !buxn_replay_begin_play(&replay, replay_file)) {
+			fprintf(stderr, "Could not read replay from %s\n", replay_path);
+			if (replay_file != NULL) { fclose(replay_file); }
+			goto end;
+		}
+
+		if (replay.screen_width == 0) {
+			fprintf(stderr, "%s was not recorded with a screen\n", replay_path);
+			goto end;
+		}
+		width = replay.screen_width;
+		height = replay.screen_height;
+	}
+
+	buxn_screen_info_t screen_info = buxn_screen_info(width, height);
+	devices.screen = calloc(1, screen_info.screen_mem_size);
+	buxn_screen_resize(devices.screen, width, height);
+	devices.framebuffer = malloc(screen_info.target_mem_size);
+
+	buxn_port_table_t* ports = &devices.ports;
+	buxn_port_table_init(ports);
+	buxn_port_table_register(ports, BUXN_DEVICE_SYSTEM, &buxn_system_ports, NULL);
+	buxn_port_table_register(ports, BUXN_DEVICE_CONSOLE, &buxn_console_ports, &devices.console);
+	buxn_port_table_register(ports, BUXN_DEVICE_SCREEN, &buxn_screen_ports, devices.screen);
+	for (int i = 0; i < BUXN_NUM_AUDIO_DEVICES; ++i) {
+		devices.audio[i].sample_frequency = BUXN_AUDIO_PREFERRED_SAMPLE_RATE;
+		buxn_port_table_register(
+			ports,
+			BUXN_DEVICE_AUDIO_0 + i * (BUXN_DEVICE_AUDIO_1 - BUXN_DEVICE_AUDIO_0),
+			&buxn_audio_ports, &devices.audio[i]
+		);
+	}
+	buxn_port_table_register(ports, BUXN_DEVICE_CONTROLLER, &buxn_controller_ports, &devices.controller);
+	buxn_port_table_register(ports, BUXN_DEVICE_MOUSE, &buxn_mouse_ports, &devices.mouse);
+	buxn_port_table_register(ports, BUXN_DEVICE_FILE_0, &buxn_file_ports, &devices.file[0]);
+	buxn_port_table_register(ports, BUXN_DEVICE_FILE_1, &buxn_file_ports, &devices.file[1]);
+	buxn_port_table_register(ports, BUXN_DEVICE_DATETIME, &buxn_datetime_ports, NULL);
+	if (replay.mode == BUXN_REPLAY_PLAY) {
+		for (int i = 0; i < BUXN_NUM_AUDIO_DEVICES; ++i) {
+			buxn_replay_capture(
+				&replay, ports,
+				BUXN_DEVICE_AUDIO_0 + i * (BUXN_DEVICE_AUDIO_1 - BUXN_DEVICE_AUDIO_0)
+			);
+		}
+		buxn_replay_capture(&replay, ports, BUXN_DEVICE_DATETIME);
+	}
+
+	if (video_path != NULL && !begin_video(&video, video_path, width, height, fps)) {
+		fprintf(stderr, "Could not open video file %s: %s\n", video_path, strerror(errno));
+		goto end;
+	}
+
+	if (audio_path != NULL && !begin_audio(&audio, audio_path)) {
+		fprintf(stderr, "Could not open audio file %s: %s\n", audio_path, strerror(errno));
+		goto end;
+	}
+
+	vm = buxn_vm_alloc(BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS);
+	vm->config = (buxn_vm_config_t){
+		.userdata = &devices,
+		.memory_size = BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS,
+		.noop_ports = &ports->noop_ports,
+		.zero_memory = buxn_vm_zero_memory,
+	};
+	buxn_vm_reset(vm, BUXN_VM_RESET_ALL);
+
+	{
+		uint8_t* read_pos = &vm->memory[BUXN_RESET_VECTOR];
+		while (read_pos < vm->memory + vm->config.memory_size) {
+			size_t num_bytes = fread(read_pos, 1, 1024, rom_file);
+			if (num_bytes == 0) { break; }
+			read_pos += num_bytes;
+		}
+	}
+
+	double start_time = now_ms();
+	int argc_rom = argc - rom_arg - 1;
+	const char** argv_rom = argv + rom_arg + 1;
+	buxn_console_init(vm, &devices.console, argc_rom, argv_rom);
+	buxn_vm_execute(vm, BUXN_RESET_VECTOR);
+	if (buxn_system_exit_code(vm) < 0) {
+		buxn_console_send_args(vm, &devices.console);
+	}
+
+	size_t max_audio_samples = (BUXN_AUDIO_PREFERRED_SAMPLE_RATE / fps + 1) * BUXN_AUDIO_PREFERRED_NUM_CHANNELS;
+	audio_buffer = malloc(sizeof(float) * max_audio_samples);
+	device_buffer = malloc(sizeof(float) * max_audio_samples);
+	char dump_path[1024];
+	int frame = 0;
+	for (; (num_frames == 0 || frame < num_frames) && buxn_system_exit_code(vm) < 0; ++frame) {
+		// Send every event up to the next screen vector
+		if (replay.mode == BUXN_REPLAY_PLAY) {
+			buxn_replay_event_t event;
+			bool has_frame = false;
+			while (
+				!has_frame
+				&& buxn_system_exit_code(vm) < 0
+				&& buxn_replay_next(&replay, &event)
+			) {
+				buxn_replay_send(&replay, vm, &event);
+				has_frame = event.type == BUXN_REPLAY_SCREEN;
+			}
+			if (!has_frame) { break; }
+		} else {
+			buxn_replay_send(&replay, vm, &(buxn_replay_event_t){
+				.type = BUXN_REPLAY_SCREEN,
+			});
+		}
+
+		// Audio of the time between this frame and the next one
+		int num_audio_frames = (int)(
+			(uint64_t)(frame + 1) * BUXN_AUDIO_PREFERRED_SAMPLE_RATE / (uint64_t)fps
+			- (uint64_t)frame * BUXN_AUDIO_PREFERRED_SAMPLE_RATE / (uint64_t)fps
+		);
+		int num_samples = num_audio_frames * BUXN_AUDIO_PREFERRED_NUM_CHANNELS;
+		memset(audio_buffer, 0, sizeof(float) * num_samples);
+		for (int i = 0; i < BUXN_NUM_AUDIO_DEVICES; ++i) {
+			memset(device_buffer, 0, sizeof(float) * num_samples);
+			buxn_audio_state_t state = buxn_audio_render(
+				&devices.audio[i],
+				device_buffer,
+				num_audio_frames,
+				BUXN_AUDIO_PREFERRED_NUM_CHANNELS
+			);
+			for (int j = 0; j < num_samples; ++j) {
+				audio_buffer[j] += device_buffer[j];
+			}
+
+			// A replay already has the audio vectors
+			if (state == BUXN_AUDIO_FINISHED && replay.mode != BUXN_REPLAY_PLAY) {
+				buxn_replay_send(&replay, vm, &(buxn_replay_event_t){
+					.type = BUXN_REPLAY_AUDIO,
+					.audio_device_id = BUXN_DEVICE_AUDIO_0 + i * (BUXN_DEVICE_AUDIO_1 - BUXN_DEVICE_AUDIO_0),
+				});
+			}
+		}
+		if (audio.file != NULL) {
+			write_audio(&audio, audio_buffer, num_audio_frames);
+		}
+
+		if (
+			(dump_prefix != NULL || video.file != NULL)
+			&& frame % dump_every == 0
+		) {
+			uint32_t palette[4];
+			buxn_system_palette(vm, palette);
+			buxn_screen_render(devices.screen, BUXN_SCREEN_LAYER_COMPOSITE, palette, devices.framebuffer);
+
+			if (dump_prefix != NULL) {
+				const char* extension = dump_format == FRAME_FORMAT_QOI ? "qoi" : "ppm";
+				snprintf(dump_path, sizeof(dump_path), "%s%06d.%s", dump_prefix, frame, extension);
+				bool written = dump_format == FRAME_FORMAT_QOI
+					? write_qoi(dump_path, devices.framebuffer, devices.screen->width, devices.screen->height)
+					: write_ppm(dump_path, devices.framebuffer, devices.screen->width, devices.screen->height);
+				if (!written) {
+					fprintf(stderr, "Could not write frame %s: %s\n", dump_path, strerror(errno));
+					goto end;
+				}
+			}
+
+			if (video.file != NULL) {
+				// Y4M can't change size midway
+				if (devices.screen->width != video.width || devices.screen->height != video.height) {
+					fprintf(stderr, "Screen was resized, video stopped at frame %d\n", frame);
+					end_video(&video);
+				} else {
+					write_video_frame(&video, devices.framebuffer);
+				}
+			}
+		}
+
+		if (realtime) {
+			sleep_ms(start_time + (double)(frame + 1) * 1000.0 / (double)fps - now_ms());
+		}
+	}
+
+	double elapsed_ms = now_ms() - start_time;
+	fprintf(
+		stderr,
+		"Ran %d frames in %.3f ms (%.1f frames/s)\n",
+		frame, elapsed_ms, elapsed_ms > 0.0 ? (double)frame * 1000.0 / elapsed_ms : 0.0
+	);
+	if (replay.num_mismatches > 0) {
+		fprintf(stderr, "%u inputs did not match the recording\n", replay.num_mismatches);
+	}
+
+	exit_code = buxn_system_exit_code(vm);
+	if (exit_code < 0) { exit_code = 0; }
+end:
+	if (audio.file != NULL && !end_audio(&audio)) {
+		fprintf(stderr, "Error while writing audio file: %s\n", strerror(errno));
+		exit_code = 1;
+	}
+	if (video.file != NULL && !end_video(&video)) {
+		fprintf(stderr, "Error while writing video file: %s\n", strerror(errno));
+		exit_code = 1;
+	}
+	if (replay.file != NULL) { fclose(replay.file); }
+	if (vm != NULL) { buxn_vm_free(vm); }
+	free(device_buffer);
+	free(audio_buffer);
+	free(devices.framebuffer);
+	free(devices.screen);
+	fclose(rom_file);
+	PHYSFS_deinit();
+	return exit_code;
+}
+
+#define BLIB_IMPLEMENTATION
+#include <blog.h>
+#include <bserial.h>
@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <barena.h>
+#include <barray.h>
+#include <buxn/vm/profile.h>
+#include <buxn/dbg/symtab.h>
+#define BSERIAL_STDIO
+#include <bserial.h>
+#include "bflag.h"
+
+#define FLAG_OUTPUT "-output="
+#define FLAG_LINES "-lines="
+
+// Long enough for BUXN_VM_PROFILE_MAX_STACK_DEPTH frames of long names
+#define MAX_FOLDED_LEN 4096
+
+typedef struct {
+	const char* filename;
+	char* content;
+	int size;
+} source_t;
+
+typedef struct {
+	char* stack;
+	uint64_t count;
+} folded_t;
+
+typedef struct {
+	const char* filename;
+	int line;
+	int byte;  // Any byte on the line
+	uint64_t count;
+} line_t;
+
+typedef struct {
+	barena_t arena;
+	const buxn_dbg_symtab_t* symtab;
+	barray(source_t) sources;
+	// Index of the innermost enclosing label or opcode symbol, -1 for none
+	int32_t label_at[BUXN_MEMORY_BANK_SIZE];
+	int32_t opcode_at[BUXN_MEMORY_BANK_SIZE];
+	// Read from the source
+	const char* label_names[BUXN_MEMORY_BANK_SIZE];
+} prof_t;
+
+static const source_t*
+get_source(prof_t* ctx, const char* filename) {
+	for (size_t i = 0; i < barray_len(ctx->sources); ++i) {
+		if (strcmp(ctx->sources[i].filename, filename) == 0) {
+			return &ctx->sources[i];
+		}
+	}
+
+	source_t source = { .filename = filename };
+	FILE* source_file = fopen(filename, "rb");
+	if (source_file != NULL) {
+		fseek(source_file, 0, SEEK_END);
+		long file_size = ftell(source_file);
+		if (file_size > 0) {
+			fseek(source_file, 0, SEEK_SET);
+			source.content = barena_memalign(&ctx->arena, file_size, _Alignof(char));
+			if (fread(source.content, file_size, 1, source_file) == 1) {
+				source.size = (int)file_size;
+			}
+		}
+		fclose(source_file);
+	}
+
+	barray_push(ctx->sources, source, NULL);
+	return &ctx->sources[barray_len(ctx->sources) - 1];
+}
+
+static bool
+is_routine_label(prof_t* ctx, const buxn_dbg_sym_t* sym) {
+	// Sublabels (&name) are part of the routine defined by the previous label
+	const source_t* source = get_source(ctx, sym->region.filename);
+	int start = sym->region.range.start.byte;
+	return source->size == 0
+		|| start < 0
+		|| start >= source->size
+		|| source->content[start] != '&';
+}
+
+static void
+index_symtab(prof_t* ctx) {
+	const buxn_dbg_symtab_t* symtab = ctx->symtab;
+	for (uint32_t i = 0; i < BUXN_MEMORY_BANK_SIZE; ++i) {
+		ctx->label_at[i] = -1;
+		ctx->opcode_at[i] = -1;
+	}
+
+	for (uint32_t i = 0; i < symtab->num_symbols; ++i) {
+		const buxn_dbg_sym_t* sym = &symtab->symbols[i];
+		if (sym->type == BUXN_DBG_SYM_OPCODE) {
+			for (uint32_t addr = sym->addr_min; addr <= sym->addr_max; ++addr) {
+				ctx->opcode_at[addr] = (int32_t)i;
+			}
+		} else if (sym->type == BUXN_DBG_SYM_LABEL && is_routine_label(ctx, sym)) {
+			ctx->label_at[sym->addr_min] = (int32_t)i;
+		}
+	}
+
+	// A label covers everything until the next one
+	int32_t label = -1;
+	for (uint32_t addr = 0; addr < BUXN_MEMORY_BANK_SIZE; ++addr) {
+		if (ctx->label_at[addr] >= 0) {
+			label = ctx->label_at[addr];
+		} else {
+			ctx->label_at[addr] = label;
+		}
+	}
+}
+
+static const char*
+label_name(prof_t* ctx, uint16_t addr) {
+	// Cached by the address of the label so names can be compared as pointers
+	int32_t label = ctx->label_at[addr];
+	if (label >= 0) { addr = ctx->symtab->symbols[label].addr_min; }
+	if (ctx->label_names[addr] != NULL) { return ctx->label_names[addr]; }
+
+	char* name;
+	const source_t* source = label >= 0
+		? get_source(ctx, ctx->symtab->symbols[label].region.filename)
+		: NULL;
+	if (source != NULL && source->size > 0) {
+		const buxn_dbg_sym_t* sym = &ctx->symtab->symbols[label];
+		int start = sym->region.range.start.byte;
+		int end = sym->region.range.end.byte;
+		start = start < 0 ? 0 : start;
+		end = end > source->size ? source->size : end;
+		end = end < start ? start : end;
+		// Drop the rune
+		if (start < end && source->content[start] == '@') { ++start; }
+
+		int len = end - start;
+		name = barena_memalign(&ctx->arena, len + 1, _Alignof(char));
+		memcpy(name, source->content + start, len);
+		name[len] = '\0';
+	} else {
+		name = barena_memalign(&ctx->arena, sizeof("0000"), _Alignof(char));
+		snprintf(name, sizeof("0000"), "%04x", addr);
+	}
+
+	ctx->label_names[addr] = name;
+	return name;
+}
+
+static int
+sort_folded(const void* lhs, const void* rhs) {
+	const folded_t* lhs_folded = lhs;
+	const folded_t* rhs_folded = rhs;
+	return strcmp(lhs_folded->stack, rhs_folded->stack);
+}
+
+static int
+sort_line(const void* lhs, const void* rhs) {
+	const line_t* lhs_line = lhs;
+	const line_t* rhs_line = rhs;
+	if (lhs_line->count != rhs_line->count) {
+		return lhs_line->count > rhs_line->count ? -1 : 1;
+	}
+
+	int cmp = strcmp(lhs_line->filename, rhs_line->filename);
+	return cmp != 0 ? cmp : lhs_line->line - rhs_line->line;
+}
+
+static void
+add_folded(prof_t* ctx, barray(folded_t)* folded, const uint16_t* frames, uint8_t depth, uint64_t count) {
+	char stack[MAX_FOLDED_LEN];
+	size_t len = 0;
+	for (uint8_t i = 0; i < depth && len < sizeof(stack); ++i) {
+		const char* name = label_name(ctx, frames[i]);
+		// Recursion into the same routine is collapsed
+		if (i > 0 && name == label_name(ctx, frames[i - 1])) { continue; }
+
+		len += snprintf(stack + len, sizeof(stack) - len, "%s%s", len > 0 ? ";" : "", name);
+	}
+	len = len < sizeof(stack) ? len : sizeof(stack) - 1;
+
+	folded_t entry = {
+		.stack = barena_memalign(&ctx->arena, len + 1, _Alignof(char)),
+		.count = count,
+	};
+	memcpy(entry.stack, stack, len + 1);
+	barray_push(*folded, entry, NULL);
+}
+
+static void
+write_folded(prof_t* ctx, const buxn_vm_profile_t* profile, FILE* out) {
+	barray(folded_t) folded = NULL;
+
+	bool has_stacks = false;
+	for (int i = 0; i < BUXN_VM_PROFILE_MAX_STACKS; ++i) {
+		const buxn_vm_stack_sample_t* sample = &profile->stacks[i];
+		if (sample->count == 0) { continue; }
+
+		add_folded(ctx, &folded, sample->frames, sample->depth, sample->count);
+		has_stacks = true;
+	}
+
+	// Without samples, each routine is a root with its own instruction count
+	if (!has_stacks) {
+		for (uint32_t addr = 0; addr < BUXN_MEMORY_BANK_SIZE; ++addr) {
+			if (profile->pc_counts[addr] == 0) { continue; }
+
+			uint16_t frame = (uint16_t)addr;
+			add_folded(ctx, &folded, &frame, 1, profile->pc_counts[addr]);
+		}
+	}
+
+	// Merge identical stacks
+	size_t len = barray_len(folded);
+	if (len > 0) {
+		qsort(folded, len, sizeof(folded[0]), sort_folded);
+	}
+	for (size_t i = 0; i < len;) {
+		uint64_t count = 0;
+		size_t j = i;
+		for (; j < len && strcmp(folded[j].stack, folded[i].stack) == 0; ++j) {
+			count += folded[j].count;
+		}
+		fprintf(out, "%s %" PRIu64 "\n", folded[i].stack, count);
+		i = j;
+	}
+
+	barray_free(NULL, folded);
+}
+
+static void
+write_lines(prof_t* ctx, const buxn_vm_profile_t* profile, FILE* out) {
+	barray(line_t) lines = NULL;
+	uint64_t total = 0;
+
+	for (uint32_t addr = 0; addr < BUXN_MEMORY_BANK_SIZE; ++addr) {
+		uint64_t count = profile->pc_counts[addr];
+		if (count == 0) { continue; }
+		total += count;
+
+		int32_t opcode = ctx->opcode_at[addr];
+		if (opcode < 0) { continue; }
+
+		const buxn_asm_source_region_t* region = &ctx->symtab->symbols[opcode].region;
+		bool found = false;
+		for (size_t i = 0; i < barray_len(lines); ++i) {
+			if (
+				lines[i].line == region->range.start.line
+				&& strcmp(lines[i].filename, region->filename) == 0
+			) {
+				lines[i].count += count;
+				found = true;
+				break;
+			}
+		}
+
+		if (!found) {
+			line_t line = {
+				.filename = region->filename,
+				.line = region->range.start.line,
+				.byte = region->range.start.byte,
+				.count = count,
+			};
+			barray_push(lines, line, NULL);
+		}
+	}
+
+	size_t len = barray_len(lines);
+	if (len > 0) {
+		qsort(lines, len, sizeof(lines[0]), sort_line);
+	}
+	for (size_t i = 0; i < len; ++i) {
+		const line_t* line = &lines[i];
+		fprintf(
+			out,
+			"%s:%d: %" PRIu64 " %.2f%%",
+			line->filename, line->line, line->count,
+			(double)line->count * 100.0 / (double)total
+		);
+
+		const source_t* source = get_source(ctx, line->filename);
+		if (line->byte >= 0 && line->byte < source->size) {
+			int start = line->byte;
+			while (start > 0 && source->content[start - 1] != '\n') { --start; }
+			while (start < source->size && (source->content[start] == ' ' || source->content[start] == '\t')) {
+				++start;
+			}
+			int end = line->byte;
+			while (end < source->size && source->content[end] != '\n' && source->content[end] != '\r') {
+				++end;
+			}
+			fprintf(out, " | %.*s", end - start, source->content + start);
+		}
+
+		fprintf(out, "\n");
+	}
+
+	barray_free(NULL, lines);
+}
+
+int
+main(int argc, const char* argv[]) {
+	const char* output_filename = NULL;
+	const char* lines_filename = NULL;
+	const char* profile_filename = NULL;
+	const char* dbg_filename = NULL;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* flag_value;
+		const char* arg = argv[i];
+
+		if ((flag_value = parse_flag(arg, "--help")) != NULL) {
+			fprintf(stderr,
+				"Usage: buxn-prof [options] <profile> <input.rom.dbg>\n"
+				"Symbolize a profile written through BUXN_PROFILE.\n"
+				"\n"
+				"--help             Print this message.\n"
+				"-output=<file>     (Optional) Write folded stacks to this file.\n"
+				"                   This defaults to stdout.\n"
+				"-lines=<file>      (Optional) Write a per source line report to this file.\n"
+			);
+			return 0;
+		} else if ((flag_value = parse_flag(arg, FLAG_OUTPUT)) != NULL) {
+			if (output_filename != NULL) {
+				fprintf(stderr, "%s can only be specified once\n", FLAG_OUTPUT);
+				return 1;
+			}
+			output_filename = flag_value;
+		} else if ((flag_value = parse_flag(arg, FLAG_LINES)) != NULL) {
+			if (lines_filename != NULL) {
+				fprintf(stderr, "%s can only be specified once\n", FLAG_LINES);
+				return 1;
+			}
+			lines_filename = flag_value;
+		} else if (profile_filename == NULL) {
+			profile_filename = arg;
+		} else if (dbg_filename == NULL) {
+			dbg_filename = arg;
+		} else {
+			fprintf(stderr, "Too many arguments\n");
+			return 1;
+		}
+	}
+
+	if (profile_filename == NULL || dbg_filename == NULL) {
+		fprintf(stderr, "Please specify a profile and a debug file\n");
+		return 1;
+	}
+
+	int exit_code = 1;
+	barena_pool_t pool;
+	barena_pool_init(&pool, 1);
+
+	prof_t* ctx = calloc(1, sizeof(prof_t));
+	barena_init(&ctx->arena, &pool);
+	buxn_vm_profile_t* profile = calloc(1, sizeof(buxn_vm_profile_t));
+
+	{
+		FILE* profile_file = fopen(profile_filename, "rb");
+		if (profile_file == NULL) {
+			fprintf(stderr, "Could not open profile: %s\n", strerror(errno));
+			goto end;
+		}
+
+		bool success = buxn_vm_profile_read(profile, profile_file);
+		fclose(profile_file);
+		if (!success) {
+			fprintf(stderr, "Error while reading profile\n");
+			goto end;
+		}
+	}
+
+	{
+		FILE* dbg_file = fopen(dbg_filename, "rb");
+		if (dbg_file == NULL) {
+			fprintf(stderr, "Could not open debug file: %s\n", strerror(errno));
+			goto end;
+		}
+
+		bserial_stdio_in_t stdio_in;
+		buxn_dbg_symtab_reader_opts_t reader_opts = {
+			.input = bserial_stdio_init_in(&stdio_in, dbg_file),
+		};
+		buxn_dbg_symtab_reader_t* reader = buxn_dbg_make_symtab_reader(
+			barena_malloc(&ctx->arena, buxn_dbg_symtab_reader_mem_size(&reader_opts)),
+			&reader_opts
+		);
+
+		buxn_dbg_symtab_t* symtab = NULL;
+		if (buxn_dbg_read_symtab_header(reader) == BUXN_DBG_SYMTAB_OK) {
+			symtab = barena_malloc(&ctx->arena, buxn_dbg_symtab_mem_size(reader));
+			if (buxn_dbg_read_symtab(reader, symtab) != BUXN_DBG_SYMTAB_OK) {
+				symtab = NULL;
+			}
+		}
+		fclose(dbg_file);
+
+		if (symtab == NULL) {
+			fprintf(stderr, "Error while reading debug file\n");
+			goto end;
+		}
+		ctx->symtab = symtab;
+	}
+
+	index_symtab(ctx);
+
+	{
+		FILE* out = output_filename != NULL ? fopen(output_filename, "wb") : stdout;
+		if (out == NULL) {
+			fprintf(stderr, "Could not open output file: %s\n", strerror(errno));
+			goto end;
+		}
+		write_folded(ctx, profile, out);
+		if (out != stdout && fclose(out) != 0) {
+			fprintf(stderr, "Error while writing output file: %s\n", strerror(errno));
+			goto end;
+		}
+	}
+
+	if (lines_filename != NULL) {
+		FILE* out = fopen(lines_filename, "wb");
+		if (out == NULL) {
+			fprintf(stderr, "Could not open lines file: %s\n", strerror(errno));
+			goto end;
+		}
+		write_lines(ctx, profile, out);
+		if (fclose(out) != 0) {
+			fprintf(stderr, "Error while writing lines file: %s\n", strerror(errno));
+			goto end;
+		}
+	}
+
+	if (profile->num_dropped_samples > 0) {
+		fprintf(stderr, "%" PRIu64 " sample(s) were dropped\n", profile->num_dropped_samples);
+	}
+
+	exit_code = 0;
+end:
+	free(profile);
+	barray_free(NULL, ctx->sources);
+	barena_reset(&ctx->arena);
+	free(ctx);
+	barena_pool_cleanup(&pool);
+	return exit_code;
+}
+
+#define BLIB_IMPLEMENTATION
+#include <barena.h>
+#include <bserial.h>
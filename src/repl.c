@@ -8,17 +8,20 @@
 #include <utf8proc.h>
 #include <physfs.h>
 #include <buxn/vm/vm.h>
+#include <buxn/vm/alloc.h>
 #include <buxn/asm/asm.h>
 #include <buxn/asm/chess.h>
 #include <buxn/devices/console.h>
 #include <buxn/devices/system.h>
 #include <buxn/devices/datetime.h>
 #include <buxn/devices/file.h>
+#include <buxn/devices/ports.h>
 #include "repl.rc"
 
 typedef struct {
 	buxn_console_t console;
 	buxn_file_t file[BUXN_NUM_FILE_DEVICES];
+	buxn_port_table_t ports;
 
 	buxn_vm_t* vm;
 	buxn_chess_vm_state_t print_stack_state;
@@ -165,10 +168,19 @@ main(int argc, const char* argv[]) {
 	barena_pool_init(&arena_pool, 1);
 
 	buxn_repl_t repl = { 0 };
-	repl.vm = malloc(sizeof(buxn_vm_t) + BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS);
+	buxn_port_table_init(&repl.ports);
+	buxn_port_table_register(&repl.ports, BUXN_DEVICE_SYSTEM, &buxn_system_ports, NULL);
+	buxn_port_table_register(&repl.ports, BUXN_DEVICE_CONSOLE, &buxn_console_ports, &repl.console);
+	buxn_port_table_register(&repl.ports, BUXN_DEVICE_DATETIME, &buxn_datetime_ports, NULL);
+	buxn_port_table_register(&repl.ports, BUXN_DEVICE_FILE_0, &buxn_file_ports, &repl.file[0]);
+	buxn_port_table_register(&repl.ports, BUXN_DEVICE_FILE_1, &buxn_file_ports, &repl.file[1]);
+
+	repl.vm = buxn_vm_alloc(BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS);
 	repl.vm->config = (buxn_vm_config_t){
 		.userdata = &repl,
 		.memory_size = BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS,
+		.noop_ports = &repl.ports.noop_ports,
+		.zero_memory = buxn_vm_zero_memory,
 	};
 	buxn_vm_reset(repl.vm, BUXN_VM_RESET_ALL);
 
@@ -218,7 +230,7 @@ main(int argc, const char* argv[]) {
 	barena_reset(&arena_a);
 	barena_reset(&arena_b);
 
-	free(repl.vm);
+	buxn_vm_free(repl.vm);
 	barena_pool_cleanup(&arena_pool);
 
 	PHYSFS_deinit();
@@ -230,48 +242,13 @@ main(int argc, const char* argv[]) {
 uint8_t
 buxn_vm_dei(buxn_vm_t* vm, uint8_t address) {
 	buxn_repl_t* repl = vm->config.userdata;
-	uint8_t device_id = buxn_device_id(address);
-	switch (device_id) {
-		case BUXN_DEVICE_SYSTEM:
-			return buxn_system_dei(vm, address);
-		case BUXN_DEVICE_CONSOLE:
-			return buxn_console_dei(vm, &repl->console, address);
-		case BUXN_DEVICE_DATETIME:
-			return buxn_datetime_dei(vm, address);
-		case BUXN_DEVICE_FILE_0:
-		case BUXN_DEVICE_FILE_1:
-			return buxn_file_dei(
-				vm,
-				repl->file + (device_id - BUXN_DEVICE_FILE_0) / (BUXN_DEVICE_FILE_1 - BUXN_DEVICE_FILE_0),
-				vm->device + device_id,
-				buxn_device_port(address)
-			);
-		default:
-			return vm->device[address];
-	}
+	return buxn_port_table_dei(&repl->ports, vm, address);
 }
 
 void
 buxn_vm_deo(buxn_vm_t* vm, uint8_t address) {
 	buxn_repl_t* repl = vm->config.userdata;
-	uint8_t device_id = buxn_device_id(address);
-	switch (device_id) {
-		case BUXN_DEVICE_SYSTEM:
-			buxn_system_deo(vm, address);
-			break;
-		case BUXN_DEVICE_CONSOLE:
-			buxn_console_deo(vm, &repl->console, address);
-			break;
-		case BUXN_DEVICE_FILE_0:
-		case BUXN_DEVICE_FILE_1:
-			buxn_file_deo(
-				vm,
-				repl->file + (device_id - BUXN_DEVICE_FILE_0) / (BUXN_DEVICE_FILE_1 - BUXN_DEVICE_FILE_0),
-				vm->device + device_id,
-				buxn_device_port(address)
-			);
-			break;
-	}
+	buxn_port_table_deo(&repl->ports, vm, address);
 }
 
 void
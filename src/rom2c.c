@@ -0,0 +1,837 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <barena.h>
+#include <bmacro.h>
+#include <buxn/vm/vm.h>
+#include <buxn/vm/opcodes.h>
+#include <buxn/dbg/symtab.h>
+#define BSERIAL_STDIO
+#include <bserial.h>
+
+// Translate a rom into C with one function per routine.
+//
+// Routines are discovered by walking the control flow from the reset vector,
+// from vectors assigned with `;label .Device/vector DEO2` and from label
+// references in the .dbg file when there is one.
+// The target of every JSI and of every `LIT2 xxxx JSR2` starts a new routine
+// which is called directly.
+//
+// The uxn stacks stay in vm memory so control can leave translated code at
+// any point and continue in the interpreter.
+// This happens for computed jumps to addresses which are not known to the
+// translator and when code is overwritten.
+// See: doc/rom2c.md
+
+#define DEFINE_OPCODE_NAME(NAME, VALUE) \
+	[VALUE] = BSTRINGIFY(NAME),
+
+#define OP_BRK 0x00
+#define OP_JCI 0x20
+#define OP_JMI 0x40
+#define OP_JSI 0x60
+#define OP_LIT 0x80
+#define OP_LIT2 0xa0
+
+static const char* opcode_names[256] = {
+	BUXN_OPCODE_DISPATCH(DEFINE_OPCODE_NAME)
+};
+
+typedef struct {
+	uint16_t addr;
+	uint8_t size;
+	// For `LIT xx JMP` and friends, this is the jump
+	uint8_t opcode;
+	bool has_target;
+	uint16_t target;
+	bool is_call;
+	bool is_static_jump;
+	bool falls_through;
+} node_t;
+
+typedef struct {
+	uint8_t memory[BUXN_MEMORY_BANK_SIZE];
+	uint32_t rom_end;
+
+	// Addresses which may be the target of a store
+	bool written[BUXN_MEMORY_BANK_SIZE];
+	// Bytes whose value is baked into the generated code
+	bool code[BUXN_MEMORY_BANK_SIZE];
+
+	bool is_root[BUXN_MEMORY_BANK_SIZE];
+	uint16_t roots[BUXN_MEMORY_BANK_SIZE];
+	uint32_t num_roots;
+	// Which routine is returned for an address by buxn_rom2c_lookup
+	int32_t owner[BUXN_MEMORY_BANK_SIZE];
+
+	// Current routine
+	bool reached[BUXN_MEMORY_BANK_SIZE];
+	bool is_label[BUXN_MEMORY_BANK_SIZE];
+	uint16_t worklist[BUXN_MEMORY_BANK_SIZE];
+	uint32_t worklist_size;
+} rom2c_t;
+
+static uint16_t
+load2(const rom2c_t* ctx, uint16_t addr) {
+	return buxn_vm_load2(ctx->memory, addr, BUXN_MEM_ADDR_MASK);
+}
+
+static bool
+decode(const rom2c_t* ctx, uint16_t addr, node_t* node) {
+	if (addr < BUXN_RESET_VECTOR || addr >= ctx->rom_end) { return false; }
+
+	uint8_t opcode = ctx->memory[addr];
+	*node = (node_t){
+		.addr = addr,
+		.size = 1,
+		.opcode = opcode,
+		.falls_through = true,
+	};
+
+	switch (opcode) {
+		case OP_BRK:
+			node->falls_through = false;
+			break;
+		case OP_JCI:
+		case OP_JMI:
+		case OP_JSI:
+			node->size = 3;
+			node->has_target = true;
+			node->target = (uint16_t)(addr + 3 + load2(ctx, addr + 1));
+			node->is_call = opcode == OP_JSI;
+			node->falls_through = opcode != OP_JMI;
+			break;
+		case OP_LIT:
+		case OP_LIT2: {
+			uint8_t operand_size = opcode == OP_LIT2 ? 2 : 1;
+			uint16_t jump_addr = addr + 1 + operand_size;
+			uint8_t jump = ctx->memory[jump_addr];
+			// A jump right after a literal of the same size has a static target
+			uint8_t size_flag = opcode == OP_LIT2 ? 0x20 : 0x00;
+			if (
+				jump_addr < ctx->rom_end
+				&& (jump == (0x0c | size_flag) || jump == (0x0d | size_flag) || jump == (0x0e | size_flag))
+			) {
+				node->size = operand_size + 2;
+				node->opcode = jump;
+				node->has_target = true;
+				node->target = opcode == OP_LIT2
+					? load2(ctx, addr + 1)
+					: (uint16_t)(addr + node->size + (int8_t)ctx->memory[addr + 1]);
+				node->is_static_jump = true;
+				node->is_call = (jump & 0x1f) == 0x0e;
+				node->falls_through = (jump & 0x1f) != 0x0c;
+			} else {
+				node->size = operand_size + 1;
+			}
+		} break;
+		case 0xc0: // LITr
+			node->size = 2;
+			break;
+		case 0xe0: // LIT2r
+			node->size = 3;
+			break;
+		default:
+			// JMP
+			node->falls_through = (opcode & 0x1f) != 0x0c;
+			break;
+	}
+
+	return addr + node->size <= ctx->rom_end;
+}
+
+static void
+add_root(rom2c_t* ctx, uint16_t addr) {
+	node_t node;
+	if (ctx->is_root[addr] || !decode(ctx, addr, &node)) { return; }
+
+	ctx->is_root[addr] = true;
+	ctx->roots[ctx->num_roots++] = addr;
+}
+
+static void
+enqueue(rom2c_t* ctx, uint16_t addr) {
+	node_t node;
+	if (ctx->reached[addr] || !decode(ctx, addr, &node)) { return; }
+
+	ctx->reached[addr] = true;
+	ctx->worklist[ctx->worklist_size++] = addr;
+}
+
+// Control can come back to the instruction after these through
+// buxn_rom2c_lookup
+static bool
+needs_continuation(const node_t* node) {
+	if (node->is_call) { return true; }
+	if (node->is_static_jump || node->size > 1) { return false; }
+
+	uint8_t base = node->opcode & 0x1f;
+	return base == 0x0e // JSR
+		|| base == 0x13 // STR
+		|| base == 0x15 // STA
+		|| base == 0x17; // DEO
+}
+
+static void
+walk(rom2c_t* ctx, uint16_t entry) {
+	memset(ctx->reached, 0, sizeof(ctx->reached));
+	memset(ctx->is_label, 0, sizeof(ctx->is_label));
+	ctx->worklist_size = 0;
+
+	enqueue(ctx, entry);
+	ctx->is_label[entry] = true;
+	while (ctx->worklist_size > 0) {
+		node_t node;
+		decode(ctx, ctx->worklist[--ctx->worklist_size], &node);
+
+		if (node.falls_through) {
+			uint16_t next = node.addr + node.size;
+			enqueue(ctx, next);
+			if (needs_continuation(&node)) { ctx->is_label[next] = true; }
+		}
+
+		if (node.has_target) {
+			if (node.is_call) {
+				add_root(ctx, node.target);
+			} else {
+				enqueue(ctx, node.target);
+				ctx->is_label[node.target] = true;
+			}
+		}
+	}
+
+	// Fallthrough becomes a jump when the next instruction is emitted elsewhere
+	uint32_t expected = 0;
+	for (uint32_t addr = BUXN_RESET_VECTOR; addr < ctx->rom_end; ++addr) {
+		if (!ctx->reached[addr]) { continue; }
+
+		if (expected != 0 && expected != addr) {
+			ctx->is_label[expected] = true;
+		}
+
+		node_t node;
+		decode(ctx, (uint16_t)addr, &node);
+		expected = node.falls_through ? addr + node.size : 0;
+	}
+	if (expected != 0) { ctx->is_label[expected] = true; }
+}
+
+// Find addresses which are stored to through a constant address
+static void
+collect_written(rom2c_t* ctx) {
+	for (uint32_t addr = BUXN_RESET_VECTOR; addr < ctx->rom_end; ++addr) {
+		if (!ctx->reached[addr]) { continue; }
+
+		uint8_t opcode = ctx->memory[addr];
+		if (opcode == OP_LIT2 || opcode == 0xe0) {
+			// `;label` can be used with STA
+			ctx->written[load2(ctx, (uint16_t)(addr + 1))] = true;
+		} else if (opcode == OP_LIT || opcode == 0xc0) {
+			// `,label STR`
+			uint8_t next = ctx->memory[(uint16_t)(addr + 2)];
+			if ((next & 0x1f) == 0x12 || (next & 0x1f) == 0x13) {
+				uint16_t target = (uint16_t)(addr + 3 + (int8_t)ctx->memory[(uint16_t)(addr + 1)]);
+				ctx->written[target] = true;
+			}
+		}
+	}
+}
+
+static bool
+is_volatile(const rom2c_t* ctx, uint16_t addr, uint8_t size) {
+	for (uint8_t i = 0; i < size; ++i) {
+		uint16_t byte = addr + i;
+		// A short store covers the next byte too
+		if (ctx->written[byte] || ctx->written[(uint16_t)(byte - 1)]) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+find_vectors(rom2c_t* ctx) {
+	// `;label .Device/vector DEO2`
+	for (uint32_t addr = BUXN_RESET_VECTOR; addr + 6 <= ctx->rom_end; ++addr) {
+		const uint8_t* bytes = &ctx->memory[addr];
+		if (
+			bytes[0] == OP_LIT2
+			&& bytes[3] == OP_LIT
+			&& buxn_device_port(bytes[4]) == 0
+			&& bytes[5] == 0x37 // DEO2
+		) {
+			add_root(ctx, load2(ctx, (uint16_t)(addr + 1)));
+		}
+	}
+}
+
+static void
+use_symtab(rom2c_t* ctx, const buxn_dbg_symtab_t* symtab) {
+	static bool is_opcode[BUXN_MEMORY_BANK_SIZE];
+	for (uint32_t i = 0; i < symtab->num_symbols; ++i) {
+		const buxn_dbg_sym_t* sym = &symtab->symbols[i];
+		if (sym->type == BUXN_DBG_SYM_OPCODE) {
+			is_opcode[sym->addr_min] = true;
+		} else if (sym->type == BUXN_DBG_SYM_LABEL) {
+			// Labels inside of code are usually there to be written to
+			ctx->written[sym->addr_min] = true;
+		}
+	}
+
+	for (uint32_t i = 0; i < symtab->num_symbols; ++i) {
+		const buxn_dbg_sym_t* sym = &symtab->symbols[i];
+		if (sym->type != BUXN_DBG_SYM_LABEL_REF || sym->addr_max != sym->addr_min + 1) {
+			continue;
+		}
+
+		// Operands of immediate jumps are relative
+		uint16_t prev = sym->addr_min - 1;
+		uint8_t prev_opcode = ctx->memory[prev];
+		if (
+			is_opcode[prev]
+			&& (prev_opcode == OP_JCI || prev_opcode == OP_JMI || prev_opcode == OP_JSI)
+		) {
+			continue;
+		}
+
+		uint16_t target = load2(ctx, sym->addr_min);
+		if (is_opcode[target]) { add_root(ctx, target); }
+	}
+}
+
+static void
+emit_save(FILE* out, const char* indent) {
+	fprintf(out, "%svm->wsp = wsp;\n", indent);
+	fprintf(out, "%svm->rsp = rsp;\n", indent);
+}
+
+static void
+emit_load(FILE* out, const char* indent) {
+	fprintf(out, "%swsp = vm->wsp;\n", indent);
+	fprintf(out, "%srsp = vm->rsp;\n", indent);
+}
+
+static void
+emit_goto(const rom2c_t* ctx, FILE* out, const char* indent, uint16_t target) {
+	if (ctx->reached[target]) {
+		fprintf(out, "%sgoto L_%04x;\n", indent, target);
+	} else {
+		emit_save(out, indent);
+		fprintf(out, "%sreturn 0x%04x;\n", indent, target);
+	}
+}
+
+static void
+emit_call(
+	const rom2c_t* ctx,
+	FILE* out,
+	const char* target_expr,
+	bool is_static,
+	uint16_t ret
+) {
+	emit_save(out, "\t\t");
+	if (is_static) {
+		fprintf(out, "\t\tif (depth >= BUXN_ROM2C_MAX_DEPTH) { return %s; }\n", target_expr);
+		fprintf(out, "\t\tuint32_t next = buxn_rom2c_fn_%s(vm, %s, depth + 1);\n", target_expr + 2, target_expr);
+	} else {
+		fprintf(out, "\t\tbuxn_rom2c_fn_t fn = buxn_rom2c_lookup(target);\n");
+		fprintf(out, "\t\tif (fn == NULL || depth >= BUXN_ROM2C_MAX_DEPTH) { return target; }\n");
+		fprintf(out, "\t\tuint32_t next = fn(vm, target, depth + 1);\n");
+	}
+	emit_load(out, "\t\t");
+	if (ctx->reached[ret]) {
+		fprintf(out, "\t\tif (next == 0x%04x) { goto L_%04x; }\n", ret, ret);
+	}
+	fprintf(out, "\t\tif (next > 0xffff) { return next; }\n");
+	fprintf(out, "\t\tpc = (uint16_t)next;\n");
+	fprintf(out, "\t\tgoto dispatch;\n");
+}
+
+static void
+emit_op(rom2c_t* ctx, FILE* out, const node_t* node) {
+	uint8_t opcode = node->opcode;
+	uint16_t next = node->addr + node->size;
+	bool keep = (opcode & 0x80) > 0;
+	bool ret = (opcode & 0x40) > 0;
+	int size = (opcode & 0x20) ? 2 : 1;
+	const char* stack = ret ? "vm->rs" : "vm->ws";
+	const char* ptr = ret ? "&rsp" : "&wsp";
+	const char* pop_ptr = keep ? "&kp" : ptr;
+	const char* other_stack = ret ? "vm->ws" : "vm->rs";
+	const char* other_ptr = ret ? "&wsp" : "&rsp";
+
+	if (keep) { fprintf(out, "\t\tuint8_t kp = %s;\n", ptr + 1); }
+
+#define POP(VAR, SIZE) \
+	fprintf(out, "\t\tuint16_t " VAR " = buxn_rom2c_pop(%s, %s, %d);\n", stack, pop_ptr, SIZE)
+#define PUSH(EXPR, SIZE) \
+	fprintf(out, "\t\tbuxn_rom2c_push(%s, %s, %d, %s);\n", stack, ptr, SIZE, EXPR)
+#define BIN_OP(EXPR) \
+	POP("b", size); \
+	POP("a", size); \
+	PUSH(EXPR, size);
+#define CMP_OP(EXPR) \
+	POP("b", size); \
+	POP("a", size); \
+	PUSH(EXPR, 1);
+#define RELATIVE(VAR) \
+	if (size == 2) { \
+		fprintf(out, "\t\tuint16_t target = " VAR ";\n"); \
+	} else { \
+		fprintf(out, "\t\tuint16_t target = (uint16_t)(0x%04x + (int8_t)" VAR ");\n", next); \
+	}
+#define STORE(ADDR_EXPR, ADDR_MASK) \
+	fprintf( \
+		out, \
+		"\t\tif (buxn_rom2c_mem_store(vm, %s, %s, %d, b)) {\n", \
+		ADDR_EXPR, ADDR_MASK, size \
+	); \
+	emit_save(out, "\t\t\t"); \
+	fprintf(out, "\t\t\treturn 0x%04x | BUXN_ROM2C_VALIDATE;\n", next); \
+	fprintf(out, "\t\t}\n");
+
+	char rel_addr[64];
+	snprintf(rel_addr, sizeof(rel_addr), "(uint16_t)(0x%04x + (int8_t)a)", next);
+	char load_expr[128];
+
+	switch (opcode & 0x1f) {
+		case 0x01: // INC
+			POP("a", size);
+			PUSH("a + 1", size);
+			break;
+		case 0x02: // POP
+			fprintf(out, "\t\t(void)buxn_rom2c_pop(%s, %s, %d);\n", stack, pop_ptr, size);
+			break;
+		case 0x03: // NIP
+			POP("b", size);
+			fprintf(out, "\t\t(void)buxn_rom2c_pop(%s, %s, %d);\n", stack, pop_ptr, size);
+			PUSH("b", size);
+			break;
+		case 0x04: // SWP
+			POP("b", size);
+			POP("a", size);
+			PUSH("b", size);
+			PUSH("a", size);
+			break;
+		case 0x05: // ROT
+			POP("c", size);
+			POP("b", size);
+			POP("a", size);
+			PUSH("b", size);
+			PUSH("c", size);
+			PUSH("a", size);
+			break;
+		case 0x06: // DUP
+			POP("a", size);
+			PUSH("a", size);
+			PUSH("a", size);
+			break;
+		case 0x07: // OVR
+			POP("b", size);
+			POP("a", size);
+			PUSH("a", size);
+			PUSH("b", size);
+			PUSH("a", size);
+			break;
+		case 0x08: CMP_OP("a == b") break;
+		case 0x09: CMP_OP("a != b") break;
+		case 0x0a: CMP_OP("a > b") break;
+		case 0x0b: CMP_OP("a < b") break;
+		case 0x0c: // JMP
+			POP("a", size);
+			RELATIVE("a");
+			fprintf(out, "\t\tpc = target;\n");
+			fprintf(out, "\t\tgoto dispatch;\n");
+			break;
+		case 0x0d: // JCN
+			POP("b", size);
+			POP("a", 1);
+			RELATIVE("b");
+			fprintf(out, "\t\tif (a != 0) {\n");
+			fprintf(out, "\t\t\tpc = target;\n");
+			fprintf(out, "\t\t\tgoto dispatch;\n");
+			fprintf(out, "\t\t}\n");
+			break;
+		case 0x0e: // JSR
+			fprintf(out, "\t\tbuxn_rom2c_push(%s, %s, 2, 0x%04x);\n", other_stack, other_ptr, next);
+			POP("a", size);
+			RELATIVE("a");
+			emit_call(ctx, out, "target", false, next);
+			break;
+		case 0x0f: // STH
+			POP("a", size);
+			fprintf(out, "\t\tbuxn_rom2c_push(%s, %s, %d, a);\n", other_stack, other_ptr, size);
+			break;
+		case 0x10: // LDZ
+			POP("a", 1);
+			snprintf(load_expr, sizeof(load_expr), "buxn_rom2c_mem_load(vm->memory, a, 0xff, %d)", size);
+			PUSH(load_expr, size);
+			break;
+		case 0x11: // STZ
+			POP("a", 1);
+			POP("b", size);
+			// The zero page is never translated
+			fprintf(out, "\t\t(void)buxn_rom2c_mem_store(vm, a, 0xff, %d, b);\n", size);
+			break;
+		case 0x12: // LDR
+			POP("a", 1);
+			snprintf(load_expr, sizeof(load_expr), "buxn_rom2c_mem_load(vm->memory, %s, 0xffff, %d)", rel_addr, size);
+			PUSH(load_expr, size);
+			break;
+		case 0x13: // STR
+			POP("a", 1);
+			POP("b", size);
+			STORE(rel_addr, "0xffff");
+			break;
+		case 0x14: // LDA
+			POP("a", 2);
+			snprintf(load_expr, sizeof(load_expr), "buxn_rom2c_mem_load(vm->memory, a, 0xffff, %d)", size);
+			PUSH(load_expr, size);
+			break;
+		case 0x15: // STA
+			POP("a", 2);
+			POP("b", size);
+			STORE("a", "0xffff");
+			break;
+		case 0x16: // DEI
+			POP("a", 1);
+			emit_save(out, "\t\t");
+			fprintf(out, "\t\tuint16_t b = buxn_rom2c_dei(vm, (uint8_t)a, %d);\n", size);
+			emit_load(out, "\t\t");
+			PUSH("b", size);
+			break;
+		case 0x17: // DEO
+			POP("a", 1);
+			POP("b", size);
+			emit_save(out, "\t\t");
+			fprintf(out, "\t\tbool may_write = buxn_rom2c_deo(vm, (uint8_t)a, %d, b);\n", size);
+			emit_load(out, "\t\t");
+			fprintf(out, "\t\tif (may_write) { return 0x%04x | BUXN_ROM2C_VALIDATE; }\n", next);
+			break;
+		case 0x18: BIN_OP("a + b") break;
+		case 0x19: BIN_OP("a - b") break;
+		case 0x1a: BIN_OP("(uint32_t)a * b") break;
+		case 0x1b: BIN_OP("b != 0 ? a / b : 0") break;
+		case 0x1c: BIN_OP("a & b") break;
+		case 0x1d: BIN_OP("a | b") break;
+		case 0x1e: BIN_OP("a ^ b") break;
+		case 0x1f: // SFT
+			POP("b", 1);
+			POP("a", size);
+			PUSH("(a >> (b & 0x0f)) << ((b & 0xf0) >> 4)", size);
+			break;
+	}
+
+#undef POP
+#undef PUSH
+#undef BIN_OP
+#undef CMP_OP
+#undef RELATIVE
+#undef STORE
+}
+
+static void
+emit_node(rom2c_t* ctx, FILE* out, const node_t* node) {
+	uint8_t opcode = ctx->memory[node->addr];
+	uint16_t next = node->addr + node->size;
+
+	// The opcode byte is always baked in
+	ctx->code[node->addr] = true;
+
+	if (ctx->is_label[node->addr]) {
+		fprintf(out, "L_%04x:\n", node->addr);
+	}
+
+	fprintf(out, "\t// %04x: %s", node->addr, opcode_names[opcode]);
+	for (uint8_t i = 1; i < node->size; ++i) {
+		fprintf(out, " %02x", ctx->memory[node->addr + i]);
+	}
+	if (node->is_static_jump) {
+		fprintf(out, " (%s)", opcode_names[node->opcode]);
+	}
+	fprintf(out, "\n");
+
+	fprintf(out, "\t{\n");
+	if (node->is_static_jump) {
+		for (uint8_t i = 1; i < node->size; ++i) {
+			ctx->code[node->addr + i] = true;
+		}
+
+		char target_expr[8];
+		snprintf(target_expr, sizeof(target_expr), "0x%04x", node->target);
+		switch (node->opcode & 0x1f) {
+			case 0x0c: // JMP
+				emit_goto(ctx, out, "\t\t", node->target);
+				break;
+			case 0x0d: // JCN
+				fprintf(out, "\t\tif (buxn_rom2c_pop(vm->ws, &wsp, 1) != 0) {\n");
+				emit_goto(ctx, out, "\t\t\t", node->target);
+				fprintf(out, "\t\t}\n");
+				break;
+			case 0x0e: // JSR
+				fprintf(out, "\t\tbuxn_rom2c_push(vm->rs, &rsp, 2, 0x%04x);\n", next);
+				if (ctx->is_root[node->target]) {
+					emit_call(ctx, out, target_expr, true, next);
+				} else {
+					emit_save(out, "\t\t");
+					fprintf(out, "\t\treturn 0x%04x;\n", node->target);
+				}
+				break;
+		}
+	} else if (opcode == OP_BRK) {
+		emit_save(out, "\t\t");
+		fprintf(out, "\t\treturn BUXN_ROM2C_BRK;\n");
+	} else if (opcode == OP_JCI || opcode == OP_JMI || opcode == OP_JSI) {
+		ctx->code[node->addr + 1] = true;
+		ctx->code[node->addr + 2] = true;
+
+		char target_expr[8];
+		snprintf(target_expr, sizeof(target_expr), "0x%04x", node->target);
+		if (opcode == OP_JCI) {
+			fprintf(out, "\t\tif (buxn_rom2c_pop(vm->ws, &wsp, 1) != 0) {\n");
+			emit_goto(ctx, out, "\t\t\t", node->target);
+			fprintf(out, "\t\t}\n");
+		} else if (opcode == OP_JMI) {
+			emit_goto(ctx, out, "\t\t", node->target);
+		} else {
+			fprintf(out, "\t\tbuxn_rom2c_push(vm->rs, &rsp, 2, 0x%04x);\n", next);
+			if (ctx->is_root[node->target]) {
+				emit_call(ctx, out, target_expr, true, next);
+			} else {
+				emit_save(out, "\t\t");
+				fprintf(out, "\t\treturn 0x%04x;\n", node->target);
+			}
+		}
+	} else if ((opcode & 0x1f) == 0) {
+		// LIT
+		uint8_t size = (opcode & 0x20) ? 2 : 1;
+		const char* stack = (opcode & 0x40) ? "vm->rs, &rsp" : "vm->ws, &wsp";
+		uint16_t operand = node->addr + 1;
+		if (is_volatile(ctx, operand, size)) {
+			// Read from memory since it is used as a variable
+			fprintf(
+				out,
+				"\t\tbuxn_rom2c_push(%s, %d, buxn_rom2c_mem_load(vm->memory, 0x%04x, 0xffff, %d));\n",
+				stack, size, operand, size
+			);
+		} else {
+			for (uint8_t i = 0; i < size; ++i) {
+				ctx->code[operand + i] = true;
+			}
+			uint16_t value = size == 2 ? load2(ctx, operand) : ctx->memory[operand];
+			fprintf(out, "\t\tbuxn_rom2c_push(%s, %d, 0x%0*x);\n", stack, size, size * 2, value);
+		}
+	} else {
+		emit_op(ctx, out, node);
+	}
+	fprintf(out, "\t}\n");
+}
+
+static void
+emit_routine(rom2c_t* ctx, FILE* out, int32_t index) {
+	uint16_t entry = ctx->roots[index];
+	walk(ctx, entry);
+
+	fprintf(out, "static uint32_t\n");
+	fprintf(out, "buxn_rom2c_fn_%04x(buxn_vm_t* vm, uint16_t pc, uint32_t depth) {\n", entry);
+	fprintf(out, "\tuint8_t wsp = vm->wsp;\n");
+	fprintf(out, "\tuint8_t rsp = vm->rsp;\n");
+	fprintf(out, "\t(void)depth;\n");
+	fprintf(out, "\tgoto dispatch;\n");
+	fprintf(out, "\n");
+	node_t node;
+	uint32_t expected = 0;
+	for (uint32_t addr = BUXN_RESET_VECTOR; addr < ctx->rom_end; ++addr) {
+		if (!ctx->reached[addr]) { continue; }
+
+		if (expected != 0 && expected != addr) {
+			fprintf(out, "\t{\n");
+			emit_goto(ctx, out, "\t\t", (uint16_t)expected);
+			fprintf(out, "\t}\n");
+		}
+
+		decode(ctx, (uint16_t)addr, &node);
+		emit_node(ctx, out, &node);
+		expected = node.falls_through ? addr + node.size : 0;
+	}
+	if (expected != 0) {
+		fprintf(out, "\t{\n");
+		emit_goto(ctx, out, "\t\t", (uint16_t)expected);
+		fprintf(out, "\t}\n");
+	}
+
+
+	// Also the way back in after a call
+	fprintf(out, "\n");
+	fprintf(out, "dispatch:\n");
+	fprintf(out, "\tswitch (pc) {\n");
+	for (uint32_t addr = BUXN_RESET_VECTOR; addr < ctx->rom_end; ++addr) {
+		if (!(ctx->reached[addr] && ctx->is_label[addr])) { continue; }
+
+		fprintf(out, "\t\tcase 0x%04x: goto L_%04x;\n", addr, addr);
+		if (ctx->owner[addr] < 0) { ctx->owner[addr] = index; }
+	}
+	fprintf(out, "\t\tdefault:\n");
+	emit_save(out, "\t\t\t");
+	fprintf(out, "\t\t\treturn pc;\n");
+	fprintf(out, "\t}\n");
+	fprintf(out, "}\n\n");
+}
+
+static void
+emit_file(rom2c_t* ctx, FILE* out, const char* rom_path) {
+	uint32_t rom_size = ctx->rom_end - BUXN_RESET_VECTOR;
+
+	fprintf(out, "// Generated by buxn-rom2c from %s\n", rom_path);
+	fprintf(out, "#include <buxn/vm/rom2c.h>\n");
+	fprintf(out, "\n");
+
+	for (uint32_t i = 0; i < ctx->num_roots; ++i) {
+		fprintf(out, "static uint32_t\n");
+		fprintf(out, "buxn_rom2c_fn_%04x(buxn_vm_t* vm, uint16_t pc, uint32_t depth);\n\n", ctx->roots[i]);
+	}
+
+	for (uint32_t i = 0; i < ctx->num_roots; ++i) {
+		emit_routine(ctx, out, (int32_t)i);
+	}
+
+	fprintf(out, "buxn_rom2c_fn_t\n");
+	fprintf(out, "buxn_rom2c_lookup(uint16_t pc) {\n");
+	fprintf(out, "\tswitch (pc) {\n");
+	for (uint32_t addr = 0; addr < BUXN_MEMORY_BANK_SIZE; ++addr) {
+		if (ctx->owner[addr] < 0) { continue; }
+
+		fprintf(out, "\t\tcase 0x%04x: return buxn_rom2c_fn_%04x;\n", addr, ctx->roots[ctx->owner[addr]]);
+	}
+	fprintf(out, "\t\tdefault: return NULL;\n");
+	fprintf(out, "\t}\n");
+	fprintf(out, "}\n\n");
+
+	fprintf(out, "const uint32_t buxn_rom2c_rom_size = %u;\n\n", rom_size);
+
+	fprintf(out, "const uint8_t buxn_rom2c_rom[] = {");
+	for (uint32_t i = 0; i < rom_size; ++i) {
+		fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n\t" : " ", ctx->memory[BUXN_RESET_VECTOR + i]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "const uint8_t buxn_rom2c_code_map[BUXN_MEMORY_BANK_SIZE / 8] = {");
+	uint32_t map_size = (ctx->rom_end + 7) / 8;
+	for (uint32_t i = 0; i < map_size; ++i) {
+		uint8_t bits = 0;
+		for (uint32_t bit = 0; bit < 8; ++bit) {
+			uint32_t addr = i * 8 + bit;
+			if (addr < BUXN_MEMORY_BANK_SIZE && ctx->code[addr]) { bits |= 1 << bit; }
+		}
+		fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n\t" : " ", bits);
+	}
+	fprintf(out, "\n};\n");
+}
+
+int
+main(int argc, const char* argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: buxn-rom2c <input.rom> <output.c>\n");
+		return 1;
+	}
+
+	int exit_code = 1;
+	barena_pool_t pool;
+	barena_pool_init(&pool, 1);
+	barena_t arena;
+	barena_init(&arena, &pool);
+
+	rom2c_t* ctx = calloc(1, sizeof(rom2c_t));
+	for (uint32_t i = 0; i < BUXN_MEMORY_BANK_SIZE; ++i) {
+		ctx->owner[i] = -1;
+	}
+
+	{
+		FILE* rom_file = fopen(argv[1], "rb");
+		if (rom_file == NULL) {
+			fprintf(stderr, "Could not open rom file: %s\n", strerror(errno));
+			goto end;
+		}
+
+		size_t rom_size = fread(
+			ctx->memory + BUXN_RESET_VECTOR,
+			1, BUXN_MEMORY_BANK_SIZE - BUXN_RESET_VECTOR,
+			rom_file
+		);
+		fclose(rom_file);
+		if (rom_size == 0) {
+			fprintf(stderr, "Rom file is empty\n");
+			goto end;
+		}
+		ctx->rom_end = BUXN_RESET_VECTOR + (uint32_t)rom_size;
+	}
+
+	add_root(ctx, BUXN_RESET_VECTOR);
+	find_vectors(ctx);
+
+	// The debug file is optional
+	{
+		size_t len = strlen(argv[1]) + 5;
+		char* dbg_filename = barena_malloc(&arena, len);
+		snprintf(dbg_filename, len, "%s.dbg", argv[1]);
+		FILE* dbg_file = fopen(dbg_filename, "rb");
+		if (dbg_file != NULL) {
+			bserial_stdio_in_t stdio_in;
+			buxn_dbg_symtab_reader_opts_t reader_opts = {
+				.input = bserial_stdio_init_in(&stdio_in, dbg_file),
+			};
+			buxn_dbg_symtab_reader_t* reader = buxn_dbg_make_symtab_reader(
+				barena_malloc(&arena, buxn_dbg_symtab_reader_mem_size(&reader_opts)),
+				&reader_opts
+			);
+
+			buxn_dbg_symtab_t* symtab = NULL;
+			if (buxn_dbg_read_symtab_header(reader) == BUXN_DBG_SYMTAB_OK) {
+				symtab = barena_malloc(&arena, buxn_dbg_symtab_mem_size(reader));
+				if (buxn_dbg_read_symtab(reader, symtab) != BUXN_DBG_SYMTAB_OK) {
+					symtab = NULL;
+				}
+			}
+			fclose(dbg_file);
+
+			if (symtab == NULL) {
+				fprintf(stderr, "Error while reading debug file\n");
+				goto end;
+			}
+			use_symtab(ctx, symtab);
+		}
+	}
+
+	// Discover all routines first since the literals which must be read from
+	// memory depend on the whole program
+	for (uint32_t i = 0; i < ctx->num_roots; ++i) {
+		walk(ctx, ctx->roots[i]);
+		collect_written(ctx);
+	}
+
+	FILE* out = fopen(argv[2], "wb");
+	if (out == NULL) {
+		fprintf(stderr, "Could not open output file: %s\n", strerror(errno));
+		goto end;
+	}
+	emit_file(ctx, out, argv[1]);
+	if (fclose(out) != 0) {
+		fprintf(stderr, "Error while writing output file: %s\n", strerror(errno));
+		goto end;
+	}
+
+	fprintf(stderr, "Translated %u routine(s)\n", ctx->num_roots);
+	exit_code = 0;
+end:
+	free(ctx);
+	barena_reset(&arena);
+	barena_pool_cleanup(&pool);
+	return exit_code;
+}
+
+#define BLIB_IMPLEMENTATION
+#include <barena.h>
+#include <bserial.h>
@@ -0,0 +1,172 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "thread.h"
+#include <stdlib.h>
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+struct thread_s {
+	HANDLE handle;
+	void (*entry)(void* userdata);
+	void* userdata;
+};
+
+struct thread_signal_s {
+	HANDLE event;
+};
+
+static DWORD WINAPI
+thread_entry(LPVOID param) {
+	thread_t* thread = param;
+	thread->entry(thread->userdata);
+	return 0;
+}
+
+thread_t*
+thread_start(void (*entry)(void* userdata), void* userdata) {
+	thread_t* thread = malloc(sizeof(thread_t));
+	thread->entry = entry;
+	thread->userdata = userdata;
+	thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+	if (thread->handle == NULL) {
+		free(thread);
+		return NULL;
+	}
+
+	return thread;
+}
+
+void
+thread_join(thread_t* thread) {
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+	free(thread);
+}
+
+thread_signal_t*
+thread_signal_create(void) {
+	thread_signal_t* signal = malloc(sizeof(thread_signal_t));
+	// Auto-reset: a wait consumes the raise
+	signal->event = CreateEventA(NULL, FALSE, FALSE, NULL);
+	return signal;
+}
+
+void
+thread_signal_destroy(thread_signal_t* signal) {
+	CloseHandle(signal->event);
+	free(signal);
+}
+
+void
+thread_signal_raise(thread_signal_t* signal) {
+	SetEvent(signal->event);
+}
+
+bool
+thread_signal_wait(thread_signal_t* signal, uint64_t timeout_us) {
+	DWORD timeout_ms = (DWORD)((timeout_us + 999) / 1000);
+	return WaitForSingleObject(signal->event, timeout_ms) == WAIT_OBJECT_0;
+}
+
+#else
+
+#include <pthread.h>
+#include <time.h>
+
+struct thread_s {
+	pthread_t handle;
+	void (*entry)(void* userdata);
+	void* userdata;
+};
+
+struct thread_signal_s {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool raised;
+};
+
+static void*
+thread_entry(void* param) {
+	thread_t* thread = param;
+	thread->entry(thread->userdata);
+	return NULL;
+}
+
+thread_t*
+thread_start(void (*entry)(void* userdata), void* userdata) {
+	thread_t* thread = malloc(sizeof(thread_t));
+	thread->entry = entry;
+	thread->userdata = userdata;
+	if (pthread_create(&thread->handle, NULL, thread_entry, thread) != 0) {
+		free(thread);
+		return NULL;
+	}
+
+	return thread;
+}
+
+void
+thread_join(thread_t* thread) {
+	pthread_join(thread->handle, NULL);
+	free(thread);
+}
+
+thread_signal_t*
+thread_signal_create(void) {
+	thread_signal_t* signal = malloc(sizeof(thread_signal_t));
+	pthread_mutex_init(&signal->mutex, NULL);
+	// Timeouts are measured on the monotonic clock so changing the time of
+	// the system does not affect them
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&signal->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	signal->raised = false;
+	return signal;
+}
+
+void
+thread_signal_destroy(thread_signal_t* signal) {
+	pthread_cond_destroy(&signal->cond);
+	pthread_mutex_destroy(&signal->mutex);
+	free(signal);
+}
+
+void
+thread_signal_raise(thread_signal_t* signal) {
+	pthread_mutex_lock(&signal->mutex);
+	signal->raised = true;
+	pthread_cond_signal(&signal->cond);
+	pthread_mutex_unlock(&signal->mutex);
+}
+
+bool
+thread_signal_wait(thread_signal_t* signal, uint64_t timeout_us) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += (time_t)(timeout_us / 1000000);
+	deadline.tv_nsec += (long)(timeout_us % 1000000) * 1000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&signal->mutex);
+	while (!signal->raised) {
+		if (pthread_cond_timedwait(&signal->cond, &signal->mutex, &deadline) != 0) {
+			break;
+		}
+	}
+	bool raised = signal->raised;
+	signal->raised = false;
+	pthread_mutex_unlock(&signal->mutex);
+	return raised;
+}
+
+#endif
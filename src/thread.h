@@ -0,0 +1,32 @@
+#ifndef BUXN_THREAD_H
+#define BUXN_THREAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct thread_s thread_t;
+
+// Wakes up a waiting thread, a raise without a waiter is kept until the next
+// wait
+typedef struct thread_signal_s thread_signal_t;
+
+thread_t*
+thread_start(void (*entry)(void* userdata), void* userdata);
+
+void
+thread_join(thread_t* thread);
+
+thread_signal_t*
+thread_signal_create(void);
+
+void
+thread_signal_destroy(thread_signal_t* signal);
+
+void
+thread_signal_raise(thread_signal_t* signal);
+
+// Returns whether the signal was raised before the timeout
+bool
+thread_signal_wait(thread_signal_t* signal, uint64_t timeout_us);
+
+#endif
@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <barena.h>
+#include <barray.h>
+#include <buxn/vm/trace.h>
+#include <buxn/vm/opcodes.h>
+#include <buxn/dbg/symtab.h>
+#define BSERIAL_STDIO
+#include <bserial.h>
+#include "bflag.h"
+
+#define FLAG_OUTPUT "-output="
+#define FLAG_LAST "-last="
+
+#define STRINGIFY(X) STRINGIFY_1(X)
+#define STRINGIFY_1(X) #X
+
+#define DEFINE_OPCODE_NAME(NAME, VALUE) \
+	[VALUE] = STRINGIFY(NAME),
+
+static const char* opcode_names[256] = {
+	BUXN_OPCODE_DISPATCH(DEFINE_OPCODE_NAME)
+};
+
+typedef struct {
+	const char* filename;
+	char* content;
+	int size;
+} source_t;
+
+typedef struct {
+	barena_t arena;
+	const buxn_dbg_symtab_t* symtab;
+	barray(source_t) sources;
+	// Index of the innermost enclosing label or opcode symbol, -1 for none
+	int32_t routine_at[BUXN_MEMORY_BANK_SIZE];
+	int32_t sublabel_at[BUXN_MEMORY_BANK_SIZE];
+	int32_t opcode_at[BUXN_MEMORY_BANK_SIZE];
+} trace_ctx_t;
+
+static const source_t*
+get_source(trace_ctx_t* ctx, const char* filename) {
+	for (size_t i = 0; i < barray_len(ctx->sources); ++i) {
+		if (strcmp(ctx->sources[i].filename, filename) == 0) {
+			return &ctx->sources[i];
+		}
+	}
+
+	source_t source = { .filename = filename };
+	FILE* source_file = fopen(filename, "rb");
+	if (source_file != NULL) {
+		fseek(source_file, 0, SEEK_END);
+		long file_size = ftell(source_file);
+		if (file_size > 0) {
+			fseek(source_file, 0, SEEK_SET);
+			source.content = barena_memalign(&ctx->arena, file_size, _Alignof(char));
+			if (fread(source.content, file_size, 1, source_file) == 1) {
+				source.size = (int)file_size;
+			}
+		}
+		fclose(source_file);
+	}
+
+	barray_push(ctx->sources, source, NULL);
+	return &ctx->sources[barray_len(ctx->sources) - 1];
+}
+
+// Returns the length of the name of a label as written in the source, without
+// its rune.
+// Returns 0 when the source could not be read.
+static int
+get_label_name(trace_ctx_t* ctx, int32_t label, const char** name) {
+	const buxn_dbg_sym_t* sym = &ctx->symtab->symbols[label];
+	const source_t* source = get_source(ctx, sym->region.filename);
+	int start = sym->region.range.start.byte;
+	int end = sym->region.range.end.byte;
+	if (source->size == 0 || start < 0 || end > source->size || end <= start) {
+		*name = NULL;
+		return 0;
+	}
+
+	if (source->content[start] == '@' || source->content[start] == '&') { ++start; }
+	*name = source->content + start;
+	return end - start;
+}
+
+static void
+index_symtab(trace_ctx_t* ctx) {
+	const buxn_dbg_symtab_t* symtab = ctx->symtab;
+	for (uint32_t i = 0; i < BUXN_MEMORY_BANK_SIZE; ++i) {
+		ctx->routine_at[i] = -1;
+		ctx->sublabel_at[i] = -1;
+		ctx->opcode_at[i] = -1;
+	}
+
+	for (uint32_t i = 0; i < symtab->num_symbols; ++i) {
+		const buxn_dbg_sym_t* sym = &symtab->symbols[i];
+		if (sym->type == BUXN_DBG_SYM_OPCODE) {
+			for (uint32_t addr = sym->addr_min; addr <= sym->addr_max; ++addr) {
+				ctx->opcode_at[addr] = (int32_t)i;
+			}
+		} else if (sym->type == BUXN_DBG_SYM_LABEL) {
+			const source_t* source = get_source(ctx, sym->region.filename);
+			int start = sym->region.range.start.byte;
+			bool is_sublabel = source->size > 0
+				&& start >= 0
+				&& start < source->size
+				&& source->content[start] == '&';
+			if (is_sublabel) {
+				ctx->sublabel_at[sym->addr_min] = (int32_t)i;
+			} else {
+				ctx->routine_at[sym->addr_min] = (int32_t)i;
+			}
+		}
+	}
+
+	// A label covers everything until the next one.
+	// A sublabel ends with the routine that contains it.
+	int32_t routine = -1;
+	int32_t sublabel = -1;
+	for (uint32_t addr = 0; addr < BUXN_MEMORY_BANK_SIZE; ++addr) {
+		if (ctx->routine_at[addr] >= 0) {
+			routine = ctx->routine_at[addr];
+			sublabel = -1;
+		} else {
+			ctx->routine_at[addr] = routine;
+		}
+
+		if (ctx->sublabel_at[addr] >= 0) {
+			sublabel = ctx->sublabel_at[addr];
+		} else {
+			ctx->sublabel_at[addr] = sublabel;
+		}
+	}
+}
+
+static void
+write_location(trace_ctx_t* ctx, uint16_t pc, FILE* out) {
+	int32_t routine = ctx->routine_at[pc];
+	int32_t sublabel = ctx->sublabel_at[pc];
+	int32_t label = sublabel >= 0 ? sublabel : routine;
+	if (label >= 0) {
+		const char* name;
+		int len;
+		fprintf(out, " ");
+		if (routine >= 0 && (len = get_label_name(ctx, routine, &name)) > 0) {
+			fprintf(out, "%.*s", len, name);
+		} else if (routine >= 0) {
+			fprintf(out, "%04x", ctx->symtab->symbols[routine].addr_min);
+		}
+		if (sublabel >= 0 && (len = get_label_name(ctx, sublabel, &name)) > 0) {
+			fprintf(out, "/%.*s", len, name);
+		}
+
+		uint16_t offset = pc - ctx->symtab->symbols[label].addr_min;
+		if (offset > 0) { fprintf(out, "+%d", offset); }
+	}
+
+	int32_t opcode = ctx->opcode_at[pc];
+	if (opcode >= 0) {
+		const buxn_asm_source_region_t* region = &ctx->symtab->symbols[opcode].region;
+		fprintf(out, " %s:%d", region->filename, region->range.start.line);
+	}
+}
+
+static void
+write_records(
+	trace_ctx_t* ctx,
+	const buxn_vm_trace_t* trace,
+	const buxn_vm_trace_record_t* records,
+	uint32_t num_records,
+	uint64_t first_index,
+	FILE* out
+) {
+	for (uint32_t i = 0; i < num_records; ++i) {
+		const buxn_vm_trace_record_t* record = &records[i];
+		fprintf(
+			out,
+			"%" PRIu64 " %04x %-6s ws:%02x rs:%02x",
+			first_index + i, record->pc, opcode_names[record->opcode], record->wsp, record->rsp
+		);
+		if ((trace->flags & BUXN_VM_TRACE_TOS) > 0) {
+			fprintf(out, " tos:%04x", record->tos);
+		}
+		if (ctx->symtab != NULL) {
+			write_location(ctx, record->pc, out);
+		}
+		fprintf(out, "\n");
+	}
+}
+
+int
+main(int argc, const char* argv[]) {
+	const char* output_filename = NULL;
+	const char* trace_filename = NULL;
+	const char* dbg_filename = NULL;
+	uint32_t max_records = UINT32_MAX;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* flag_value;
+		const char* arg = argv[i];
+
+		if ((flag_value = parse_flag(arg, "--help")) != NULL) {
+			fprintf(stderr,
+				"Usage: buxn-trace [options] <trace> [input.rom.dbg]\n"
+				"Decode a trace written through BUXN_TRACE.\n"
+				"\n"
+				"--help             Print this message.\n"
+				"-output=<file>     (Optional) Write the decoded trace to this file.\n"
+				"                   This defaults to stdout.\n"
+				"-last=<n>          (Optional) Only decode the last n instructions.\n"
+			);
+			return 0;
+		} else if ((flag_value = parse_flag(arg, FLAG_OUTPUT)) != NULL) {
+			if (output_filename != NULL) {
+				fprintf(stderr, "%s can only be specified once\n", FLAG_OUTPUT);
+				return 1;
+			}
+			output_filename = flag_value;
+		} else if ((flag_value = parse_flag(arg, FLAG_LAST)) != NULL) {
+			errno = 0;
+			char* end;
+			unsigned long value = strtoul(flag_value, &end, 10);
+			if (errno != 0 || *end != '\0' || value == 0) {
+				fprintf(stderr, "Invalid value for %s\n", FLAG_LAST);
+				return 1;
+			}
+			max_records = value < UINT32_MAX ? (uint32_t)value : UINT32_MAX;
+		} else if (trace_filename == NULL) {
+			trace_filename = arg;
+		} else if (dbg_filename == NULL) {
+			dbg_filename = arg;
+		} else {
+			fprintf(stderr, "Too many arguments\n");
+			return 1;
+		}
+	}
+
+	if (trace_filename == NULL) {
+		fprintf(stderr, "Please specify a trace\n");
+		return 1;
+	}
+
+	int exit_code = 1;
+	barena_pool_t pool;
+	barena_pool_init(&pool, 1);
+
+	trace_ctx_t* ctx = calloc(1, sizeof(trace_ctx_t));
+	barena_init(&ctx->arena, &pool);
+	buxn_vm_trace_t* trace = NULL;
+	buxn_vm_trace_record_t* records = NULL;
+
+	{
+		FILE* trace_file = fopen(trace_filename, "rb");
+		if (trace_file == NULL) {
+			fprintf(stderr, "Could not open trace: %s\n", strerror(errno));
+			goto end;
+		}
+
+		// The VM may still be writing to it, only the header is trusted
+		fseek(trace_file, 0, SEEK_END);
+		long file_size = ftell(trace_file);
+		fseek(trace_file, 0, SEEK_SET);
+		if (file_size > 0) {
+			trace = malloc((size_t)file_size);
+			if (fread(trace, (size_t)file_size, 1, trace_file) != 1) {
+				free(trace);
+				trace = NULL;
+			}
+		}
+		fclose(trace_file);
+
+		if (trace == NULL || !buxn_vm_trace_is_valid(trace, (size_t)file_size)) {
+			fprintf(stderr, "Error while reading trace\n");
+			goto end;
+		}
+	}
+
+	if (dbg_filename != NULL) {
+		FILE* dbg_file = fopen(dbg_filename, "rb");
+		if (dbg_file == NULL) {
+			fprintf(stderr, "Could not open debug file: %s\n", strerror(errno));
+			goto end;
+		}
+
+		bserial_stdio_in_t stdio_in;
+		buxn_dbg_symtab_reader_opts_t reader_opts = {
+			.input = bserial_stdio_init_in(&stdio_in, dbg_file),
+		};
+		buxn_dbg_symtab_reader_t* reader = buxn_dbg_make_symtab_reader(
+			barena_malloc(&ctx->arena, buxn_dbg_symtab_reader_mem_size(&reader_opts)),
+			&reader_opts
+		);
+
+		buxn_dbg_symtab_t* symtab = NULL;
+		if (buxn_dbg_read_symtab_header(reader) == BUXN_DBG_SYMTAB_OK) {
+			symtab = barena_malloc(&ctx->arena, buxn_dbg_symtab_mem_size(reader));
+			if (buxn_dbg_read_symtab(reader, symtab) != BUXN_DBG_SYMTAB_OK) {
+				symtab = NULL;
+			}
+		}
+		fclose(dbg_file);
+
+		if (symtab == NULL) {
+			fprintf(stderr, "Error while reading debug file\n");
+			goto end;
+		}
+		ctx->symtab = symtab;
+		index_symtab(ctx);
+	}
+
+	{
+		records = malloc(sizeof(buxn_vm_trace_record_t) * trace->capacity);
+		uint64_t first_index;
+		uint32_t num_records = buxn_vm_trace_copy(trace, records, &first_index);
+		if (num_records > max_records) {
+			first_index += num_records - max_records;
+			memmove(records, records + (num_records - max_records), sizeof(records[0]) * max_records);
+			num_records = max_records;
+		}
+
+		FILE* out = output_filename != NULL ? fopen(output_filename, "wb") : stdout;
+		if (out == NULL) {
+			fprintf(stderr, "Could not open output file: %s\n", strerror(errno));
+			goto end;
+		}
+		write_records(ctx, trace, records, num_records, first_index, out);
+		if (out != stdout && fclose(out) != 0) {
+			fprintf(stderr, "Error while writing output file: %s\n", strerror(errno));
+			goto end;
+		}
+	}
+
+	exit_code = 0;
+end:
+	free(records);
+	free(trace);
+	barray_free(NULL, ctx->sources);
+	barena_reset(&ctx->arena);
+	free(ctx);
+	barena_pool_cleanup(&pool);
+	return exit_code;
+}
+
+#define BLIB_IMPLEMENTATION
+#include <barena.h>
+#include <bserial.h>
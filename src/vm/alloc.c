@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include <buxn/vm/alloc.h>
+#include <buxn/vm/vm.h>
+#include <string.h>
+
+#if defined(_WIN32)
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+static size_t
+buxn_vm_page_size(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+}
+
+static void*
+buxn_vm_map(size_t size) {
+	// Committed pages are still only backed by physical memory when touched
+	return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+static void
+buxn_vm_unmap(void* ptr, size_t size) {
+	(void)size;
+	VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+static int
+buxn_vm_discard(void* ptr, size_t size) {
+	if (!VirtualFree(ptr, size, MEM_DECOMMIT)) { return -1; }
+	return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != NULL ? 0 : -1;
+}
+
+#elif defined(__unix__) || defined(__APPLE__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+static size_t
+buxn_vm_page_size(void) {
+	return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void*
+buxn_vm_map(size_t size) {
+	void* ptr = mmap(
+		NULL, size,
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+		-1, 0
+	);
+	return ptr != MAP_FAILED ? ptr : NULL;
+}
+
+static void
+buxn_vm_unmap(void* ptr, size_t size) {
+	munmap(ptr, size);
+}
+
+static int
+buxn_vm_discard(void* ptr, size_t size) {
+#if defined(__linux__)
+	// Private anonymous pages read back as zero after this
+	return madvise(ptr, size, MADV_DONTNEED);
+#else
+	// MADV_DONTNEED does not zero pages everywhere, replace the mapping instead
+	void* remapped = mmap(
+		ptr, size,
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+		-1, 0
+	);
+	return remapped == ptr ? 0 : -1;
+#endif
+}
+
+#else
+
+#include <stdlib.h>
+
+#define BUXN_VM_ALLOC_FALLBACK
+
+#endif
+
+#ifndef BUXN_VM_ALLOC_FALLBACK
+
+static inline size_t
+buxn_vm_alloc_size(uint32_t memory_size) {
+	return sizeof(buxn_vm_t) + memory_size;
+}
+
+buxn_vm_t*
+buxn_vm_alloc(uint32_t memory_size) {
+	// Fresh mappings are already zeroed
+	buxn_vm_t* vm = buxn_vm_map(buxn_vm_alloc_size(memory_size));
+	if (vm == NULL) { return NULL; }
+
+	vm->config.memory_size = memory_size;
+	return vm;
+}
+
+void
+buxn_vm_free(buxn_vm_t* vm) {
+	if (vm == NULL) { return; }
+
+	buxn_vm_unmap(vm, buxn_vm_alloc_size(vm->config.memory_size));
+}
+
+void
+buxn_vm_zero_memory(buxn_vm_t* vm, uint32_t addr, uint32_t size) {
+	uintptr_t page_mask = (uintptr_t)buxn_vm_page_size() - 1;
+	uint8_t* start = vm->memory + addr;
+	uint8_t* end = start + size;
+	uint8_t* first_page = (uint8_t*)(((uintptr_t)start + page_mask) & ~page_mask);
+	uint8_t* last_page = (uint8_t*)((uintptr_t)end & ~page_mask);
+
+	if (
+		first_page >= last_page
+		|| buxn_vm_discard(first_page, (size_t)(last_page - first_page)) != 0
+	) {
+		memset(start, 0, size);
+		return;
+	}
+
+	// Partial pages at both ends are shared with other data
+	memset(start, 0, (size_t)(first_page - start));
+	memset(last_page, 0, (size_t)(end - last_page));
+}
+
+#else
+
+buxn_vm_t*
+buxn_vm_alloc(uint32_t memory_size) {
+	buxn_vm_t* vm = calloc(1, sizeof(buxn_vm_t) + memory_size);
+	if (vm == NULL) { return NULL; }
+
+	vm->config.memory_size = memory_size;
+	return vm;
+}
+
+void
+buxn_vm_free(buxn_vm_t* vm) {
+	free(vm);
+}
+
+void
+buxn_vm_zero_memory(buxn_vm_t* vm, uint32_t addr, uint32_t size) {
+	memset(vm->memory + addr, 0, size);
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include <buxn/vm/coverage.h>
+
+static void
+buxn_vm_coverage_write_ranges(const uint8_t* bits, const char* name, FILE* file) {
+	uint32_t addr = 0;
+	while (addr < BUXN_MEMORY_BANK_SIZE) {
+		if (!buxn_vm_bit_test(bits, addr)) {
+			++addr;
+			continue;
+		}
+
+		uint32_t start = addr;
+		while (addr < BUXN_MEMORY_BANK_SIZE && buxn_vm_bit_test(bits, addr)) { ++addr; }
+		fprintf(file, "%s %04x %04x\n", name, start, addr - 1);
+	}
+}
+
+static void
+buxn_vm_coverage_set_range(uint8_t* bits, uint32_t start, uint32_t end) {
+	for (uint32_t addr = start; addr <= end; ++addr) {
+		buxn_vm_bit_set(bits, addr);
+	}
+}
+
+bool
+buxn_vm_coverage_write(const buxn_vm_coverage_t* coverage, FILE* file) {
+	buxn_vm_coverage_write_ranges(coverage->executed, "executed", file);
+	buxn_vm_coverage_write_ranges(coverage->branch_taken, "taken", file);
+	buxn_vm_coverage_write_ranges(coverage->branch_not_taken, "not-taken", file);
+
+	return !ferror(file);
+}
+
+bool
+buxn_vm_coverage_read(buxn_vm_coverage_t* coverage, FILE* file) {
+	char line[256];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		unsigned int start, end;
+		uint8_t* bits;
+		if (sscanf(line, "executed %x %x", &start, &end) == 2) {
+			bits = coverage->executed;
+		} else if (sscanf(line, "taken %x %x", &start, &end) == 2) {
+			bits = coverage->branch_taken;
+		} else if (sscanf(line, "not-taken %x %x", &start, &end) == 2) {
+			bits = coverage->branch_not_taken;
+		} else {
+			return false;
+		}
+
+		if (start > end || end >= BUXN_MEMORY_BANK_SIZE) { return false; }
+		buxn_vm_coverage_set_range(bits, start, end);
+	}
+
+	return !ferror(file);
+}
@@ -6,6 +6,7 @@
 	do { \
 		wsp = vm->wsp; \
 		rsp = vm->rsp; \
+		BUXN_TOS_FILL(); \
 	} while (0)
 
 #define BUXN_SAVE_STATE() \
@@ -19,6 +20,138 @@
 #define BUXN_VM_HOOK()
 #endif
 
+#ifndef BUXN_VM_CODE_CACHE
+#define BUXN_VM_CODE_CACHE 0
+#endif
+
+// Fusion of common instruction sequences, requires the code cache
+#ifndef BUXN_VM_FUSION
+#define BUXN_VM_FUSION 0
+#endif
+
+// Stop after a given number of opcodes or when System/state is set
+#ifndef BUXN_VM_BUDGET
+#define BUXN_VM_BUDGET 0
+#endif
+
+// Count opcodes and calls into vm->config.profile
+#ifndef BUXN_VM_PROFILE
+#define BUXN_VM_PROFILE 0
+#endif
+
+// Record every opcode into vm->config.trace
+#ifndef BUXN_VM_TRACE
+#define BUXN_VM_TRACE 0
+#endif
+
+// Mark executed addresses and branches in vm->config.coverage
+#ifndef BUXN_VM_COVERAGE
+#define BUXN_VM_COVERAGE 0
+#endif
+
+// Only call the hook where vm->config.hook_filter asks for
+#ifndef BUXN_VM_HOOK_FILTER
+#define BUXN_VM_HOOK_FILTER 0
+#endif
+
+// Cache the top of the working stack in a local, applies to all variants
+#ifndef BUXN_VM_TOS_CACHE
+#define BUXN_VM_TOS_CACHE 0
+#endif
+
+// The following are redefined on every inclusion depending on the variant
+#undef BUXN_DISPATCH
+#undef BUXN_LIT_OPERAND1
+#undef BUXN_LIT_OPERAND2
+#undef BUXN_JMI_TARGET
+#undef BUXN_MEM_WRITTEN
+#undef BUXN_DECODE_FUSION
+#undef BUXN_BUDGET_CHECK
+#undef BUXN_HALT_CHECK
+#undef BUXN_EXIT
+#undef BUXN_PROFILE_OPCODE
+#undef BUXN_PROFILE_CALL
+#undef BUXN_TRACE_OPCODE
+#undef BUXN_TRACE_TOS
+#undef BUXN_COVERAGE_OPCODE
+#undef BUXN_COVERAGE_BRANCH
+
+#if BUXN_VM_BUDGET
+#define BUXN_BUDGET_CHECK() \
+	do { \
+		if (budget == 0) { \
+			vm->pc = pc; \
+			BUXN_SAVE_STATE(); \
+			return BUXN_VM_BUDGET_EXHAUSTED; \
+		} \
+		--budget; \
+	} while (0)
+// Like the reference implementation, a write to System/state stops the VM
+#define BUXN_HALT_CHECK() \
+	do { \
+		if (dev[0x0f] != 0) { \
+			vm->pc = pc; \
+			BUXN_SAVE_STATE(); \
+			return BUXN_VM_HALTED; \
+		} \
+	} while (0)
+#define BUXN_EXIT(STATUS) return STATUS
+#else
+#define BUXN_BUDGET_CHECK()
+#define BUXN_HALT_CHECK()
+#define BUXN_EXIT(STATUS) return
+#endif
+
+#if BUXN_VM_PROFILE
+#define BUXN_PROFILE_OPCODE() \
+	do { \
+		profile->pc_counts[pc] += 1; \
+		profile->opcode_counts[mem[pc]] += 1; \
+		if ( \
+			profile->sample_interval > 0 \
+			&& ++profile->sample_clock >= profile->sample_interval \
+		) { \
+			profile->sample_clock = 0; \
+			buxn_vm_profile_record_stack(profile, mem, rs, rsp, pc); \
+		} \
+	} while (0)
+#define BUXN_PROFILE_CALL(FROM, TO) \
+	buxn_vm_profile_record_call(profile, (uint16_t)(FROM), (uint16_t)(TO))
+#else
+#define BUXN_PROFILE_OPCODE()
+#define BUXN_PROFILE_CALL(FROM, TO)
+#endif
+
+#if BUXN_VM_TRACE
+// The cached top is refilled before this
+#if BUXN_VM_TOS_CACHE
+#define BUXN_TRACE_TOS() tos
+#else
+#define BUXN_TRACE_TOS() \
+	(uint16_t)(((uint16_t)ws[(uint8_t)(wsp - 2)] << 8) | ws[(uint8_t)(wsp - 1)])
+#endif
+#define BUXN_TRACE_OPCODE() \
+	buxn_vm_trace_record(trace, pc, mem[pc], wsp, rsp, trace_tos ? BUXN_TRACE_TOS() : 0)
+#else
+#define BUXN_TRACE_OPCODE()
+#endif
+
+#if BUXN_VM_COVERAGE
+#define BUXN_COVERAGE_OPCODE() buxn_vm_bit_set(coverage->executed, pc)
+#define BUXN_COVERAGE_BRANCH(ADDR, TAKEN) \
+	do { \
+		if (coverage_branches) { \
+			buxn_vm_bit_set( \
+				(TAKEN) ? coverage->branch_taken : coverage->branch_not_taken, \
+				(uint16_t)(ADDR) \
+			); \
+		} \
+	} while (0)
+#else
+#define BUXN_COVERAGE_OPCODE()
+#define BUXN_COVERAGE_BRANCH(ADDR, TAKEN)
+#endif
+
 #if defined(__GNUC__) || defined(__clang__)
 // Dispatch using computed goto
 
@@ -33,11 +166,98 @@
 #define BUXN_END_DISPATCH() }
 #define BUXN_NEXT_OPCODE() \
 	do { \
+		BUXN_TOS_REFILL(); \
+		BUXN_BUDGET_CHECK(); \
+		BUXN_PROFILE_OPCODE(); \
+		BUXN_TRACE_OPCODE(); \
+		BUXN_COVERAGE_OPCODE(); \
 		BUXN_VM_HOOK() \
-		uint8_t opcode = mem[pc++]; \
-		goto *dispatch_table[opcode]; \
+		BUXN_DISPATCH(); \
 	} while (0)
 
+#if BUXN_VM_CODE_CACHE
+// Dispatch through the pre-decoded handler.
+// An invalidated entry points to a handler which decodes it.
+#define BUXN_DISPATCH() \
+	cached_op = &cached_ops[pc++]; \
+	goto *cached_op->handler
+#else
+#define BUXN_DISPATCH() \
+	uint8_t opcode = mem[pc++]; \
+	goto *dispatch_table[opcode]
+#endif
+
+// Immediate operands and jump targets are resolved once at decode time.
+// pc points past the opcode being decoded.
+#define BUXN_DECODE_OPCODE() \
+	do { \
+		uint8_t opcode = mem[(uint16_t)(pc - 1)]; \
+		cached_op->handler = dispatch_table[opcode]; \
+		switch (opcode) { \
+			case 0x20: /* JCI */ \
+			case 0x40: /* JMI */ \
+			case 0x60: /* JSI */ \
+				cached_op->operand = (uint16_t)(pc + 2 + BUXN_UOP_LOAD2(pc)); \
+				break; \
+			case 0x80: /* LIT */ \
+			case 0xc0: /* LITr */ \
+				cached_op->operand = BUXN_UOP_LOAD1(pc); \
+				break; \
+			case 0xa0: /* LIT2 */ \
+			case 0xe0: /* LIT2r */ \
+				cached_op->operand = BUXN_UOP_LOAD2(pc); \
+				break; \
+		} \
+		BUXN_DECODE_FUSION(opcode); \
+		goto *cached_op->handler; \
+	} while (0)
+
+#if BUXN_VM_FUSION
+// Replace the handler of the first instruction in a known sequence with a
+// fused one.
+// The operand is kept for LIT and LIT2, jump sequences use the target instead.
+#define BUXN_DECODE_FUSION(OPCODE) \
+	do { \
+		const void* fused_handler = NULL; \
+		switch (OPCODE) { \
+			case 0x80: /* LIT */ \
+				fused_handler = fused_lit_table[BUXN_UOP_LOAD1(pc + 1)]; \
+				break; \
+			case 0xa0: /* LIT2 */ \
+				fused_handler = fused_lit2_table[BUXN_UOP_LOAD1(pc + 2)]; \
+				break; \
+			case 0x08: /* EQU */ \
+			case 0x09: /* NEQ */ \
+			case 0x0a: /* GTH */ \
+			case 0x0b: /* LTH */ \
+			case 0x28: /* EQU2 */ \
+			case 0x29: /* NEQ2 */ \
+			case 0x2a: /* GTH2 */ \
+			case 0x2b: /* LTH2 */ \
+				if (BUXN_UOP_LOAD1(pc) == 0x20 /* JCI */) { \
+					fused_handler = fused_jci_table[OPCODE]; \
+					cached_op->operand = (uint16_t)(pc + 3 + BUXN_UOP_LOAD2(pc + 1)); \
+				} \
+				break; \
+			case 0x26: /* DUP2 */ \
+				/* DUP2 #0000 EQU2 ?target */ \
+				if ( \
+					BUXN_UOP_LOAD1(pc) == 0xa0 /* LIT2 */ \
+					&& BUXN_UOP_LOAD2(pc + 1) == 0x0000 \
+					&& BUXN_UOP_LOAD1(pc + 3) == 0x28 /* EQU2 */ \
+					&& BUXN_UOP_LOAD1(pc + 4) == 0x20 /* JCI */ \
+				) { \
+					fused_handler = &&BUXN_FUSED_DUP2_ZERO_EQU2_JCI; \
+					cached_op->operand = (uint16_t)(pc + 7 + BUXN_UOP_LOAD2(pc + 5)); \
+				} \
+				break; \
+		} \
+		if (fused_handler != NULL) { cached_op->handler = fused_handler; } \
+	} while (0)
+#else
+#define BUXN_DECODE_FUSION(OPCODE)
+#endif
+
 #else
 // Dispatch using switched goto
 
@@ -45,6 +265,11 @@
 #define BUXN_END_DISPATCH() }
 #define BUXN_NEXT_OPCODE() \
 	do { \
+		BUXN_TOS_REFILL(); \
+		BUXN_BUDGET_CHECK(); \
+		BUXN_PROFILE_OPCODE(); \
+		BUXN_TRACE_OPCODE(); \
+		BUXN_COVERAGE_OPCODE(); \
 		BUXN_VM_HOOK() \
 		uint8_t opcode = mem[pc++]; \
 		switch (opcode) { \
@@ -55,6 +280,35 @@
 
 #endif
 
+#if BUXN_VM_CODE_CACHE
+#define BUXN_LIT_OPERAND1() (cached_op->operand)
+#define BUXN_LIT_OPERAND2() (cached_op->operand)
+#define BUXN_JMI_TARGET() (cached_op->operand)
+// A write can land inside an instruction (or fused sequence) starting up to
+// BUXN_VM_MAX_OP_SIZE - 1 bytes before it
+#define BUXN_MEM_WRITTEN(ADDR) \
+	do { \
+		uint16_t written_addr = (uint16_t)(ADDR); \
+		for (uint16_t i = 0; i < BUXN_VM_MAX_OP_SIZE; ++i) { \
+			cached_ops[(uint16_t)(written_addr - i)].handler = miss_handler; \
+		} \
+	} while (0)
+#else
+#define BUXN_LIT_OPERAND1() BUXN_UOP_LOAD1(pc)
+#define BUXN_LIT_OPERAND2() BUXN_UOP_LOAD2(pc)
+#define BUXN_JMI_TARGET() ((uint16_t)(pc + 2 + BUXN_UOP_LOAD2(pc)))
+// The code cache may be used by a later buxn_vm_execute
+#define BUXN_MEM_WRITTEN(ADDR) \
+	do { \
+		if (code_cache != NULL) { \
+			uint16_t written_addr = (uint16_t)(ADDR); \
+			for (uint16_t i = 0; i < BUXN_VM_MAX_OP_SIZE; ++i) { \
+				code_cache->ops[(uint16_t)(written_addr - i)].handler = code_cache->miss_handler; \
+			} \
+		} \
+	} while (0)
+#endif
+
 #define BUXN_SELECT(WHICH, LEFT, RIGHT) BUXN_CONCAT(BUXN_SELECT_, WHICH)(LEFT, RIGHT)
 #define BUXN_SELECT_0(LEFT, RIGHT) LEFT
 #define BUXN_SELECT_1(LEFT, RIGHT) RIGHT
@@ -66,8 +320,8 @@
 	BUXN_IMPL_MONO_OPCODE(BUXN_OPCODE_NAME(BASE, 0, 0, 1),             BUXN_CONCAT(BUXN_POLY_OP_, BASE)(0, 0, 1)) \
 	BUXN_IMPL_MONO_OPCODE(BUXN_OPCODE_NAME(BASE, 0, 1, 0),             BUXN_CONCAT(BUXN_POLY_OP_, BASE)(0, 1, 0)) \
 	BUXN_IMPL_MONO_OPCODE(BUXN_OPCODE_NAME(BASE, 0, 1, 1),             BUXN_CONCAT(BUXN_POLY_OP_, BASE)(0, 1, 1)) \
-	BUXN_IMPL_MONO_OPCODE(BUXN_OPCODE_NAME(BASE, 1, 0, 0), kwsp = wsp; BUXN_CONCAT(BUXN_POLY_OP_, BASE)(1, 0, 0)) \
-	BUXN_IMPL_MONO_OPCODE(BUXN_OPCODE_NAME(BASE, 1, 0, 1), kwsp = wsp; BUXN_CONCAT(BUXN_POLY_OP_, BASE)(1, 0, 1)) \
+	BUXN_IMPL_MONO_OPCODE(BUXN_OPCODE_NAME(BASE, 1, 0, 0), BUXN_KEEP_WS(); BUXN_CONCAT(BUXN_POLY_OP_, BASE)(1, 0, 0)) \
+	BUXN_IMPL_MONO_OPCODE(BUXN_OPCODE_NAME(BASE, 1, 0, 1), BUXN_KEEP_WS(); BUXN_CONCAT(BUXN_POLY_OP_, BASE)(1, 0, 1)) \
 	BUXN_IMPL_MONO_OPCODE(BUXN_OPCODE_NAME(BASE, 1, 1, 0), krsp = rsp; BUXN_CONCAT(BUXN_POLY_OP_, BASE)(1, 1, 0)) \
 	BUXN_IMPL_MONO_OPCODE(BUXN_OPCODE_NAME(BASE, 1, 1, 1), krsp = rsp; BUXN_CONCAT(BUXN_POLY_OP_, BASE)(1, 1, 1))
 #define BUXN_STRINGIFY(X) BUXN_STRINGIFY_1(X)
@@ -81,8 +335,13 @@
 		BUXN_MAYBE_PICK(K, K_), \
 		BUXN_MAYBE_PICK(R, R_) \
 	)
+#if BUXN_VM_TOS_CACHE
+#define BUXN_UOP_POP()    BUXN_UOP_POP1T()
+#define BUXN_UOP_POP2()   BUXN_UOP_POP2T()
+#else
 #define BUXN_UOP_POP()    BUXN_UOP_POP1X(ws, wsp)
 #define BUXN_UOP_POP2()   BUXN_UOP_POP2X(ws, wsp)
+#endif
 #define BUXN_UOP_POPR()   BUXN_UOP_POP1X(rs, rsp)
 #define BUXN_UOP_POP2R()  BUXN_UOP_POP2X(rs, rsp)
 #define BUXN_UOP_POPK()   BUXN_UOP_POP1X(ws, kwsp)
@@ -100,8 +359,13 @@
 		BUXN_MAYBE_PICK(2, S_), \
 		BUXN_MAYBE_PICK(R, R_), \
 	)
+#if BUXN_VM_TOS_CACHE
+#define BUXN_UOP_PUSH(VALUE)   BUXN_UOP_PUSH1T(VALUE)
+#define BUXN_UOP_PUSH2(VALUE)  BUXN_UOP_PUSH2T(VALUE)
+#else
 #define BUXN_UOP_PUSH(VALUE)   BUXN_UOP_PUSH1X(ws, wsp, VALUE)
 #define BUXN_UOP_PUSH2(VALUE)  BUXN_UOP_PUSH2X(ws, wsp, VALUE)
+#endif
 #define BUXN_UOP_PUSHR(VALUE)  BUXN_UOP_PUSH1X(rs, rsp, VALUE)
 #define BUXN_UOP_PUSH2R(VALUE) BUXN_UOP_PUSH2X(rs, rsp, VALUE)
 #define BUXN_UOP_PUSH1X(STACK, PTR, VALUE) STACK[PTR++] = (uint8_t)(VALUE & 0xff)
@@ -112,6 +376,63 @@
 		PTR += 2; \
 	} while (0)
 
+#if BUXN_VM_TOS_CACHE
+// The top tos_size bytes of the working stack are kept in `tos`, the low byte
+// being the topmost one.
+// Pushes also write through to ws so it always holds the same bytes as
+// without the cache, even the popped ones which a stack wrap can read back.
+// There is nothing to spill before device I/O, hooks or BRK.
+// tos_size is always 2 between opcodes so it is a constant to the compiler and
+// all the branches below are resolved at compile time.
+// A pop leaves the cache partially empty and it is only refilled at the end of
+// the opcode so e.g: ADD2 only reads 2 bytes from ws instead of 4.
+#define BUXN_UOP_POP1T() \
+	(wsp -= 1, \
+	 tos_size > 0 \
+		? (tos_popped = tos & 0xff, tos >>= 8, tos_size -= 1, tos_popped) \
+		: ws[wsp])
+#define BUXN_UOP_POP2T() \
+	(wsp -= 2, \
+	 tos_size == 2 \
+		? (tos_size = 0, tos) \
+		: tos_size == 1 \
+			? (tos_size = 0, (uint16_t)(((uint16_t)ws[wsp] << 8) | (tos & 0xff))) \
+			: BUXN_UOP_LOAD2_GEN(ws, wsp, 0xff))
+#define BUXN_UOP_PUSH1T(VALUE) \
+	do { \
+		tos = (uint16_t)((tos << 8) | ((VALUE) & 0xff)); \
+		ws[wsp] = (uint8_t)(tos & 0xff); \
+		if (tos_size < 2) { tos_size += 1; } \
+		wsp += 1; \
+	} while (0)
+#define BUXN_UOP_PUSH2T(VALUE) \
+	do { \
+		tos = (uint16_t)(VALUE); \
+		ws[wsp] = (uint8_t)(tos >> 8); \
+		ws[(uint8_t)(wsp + 1)] = (uint8_t)(tos & 0xff); \
+		tos_size = 2; \
+		wsp += 2; \
+	} while (0)
+#define BUXN_TOS_FILL() \
+	do { \
+		tos = BUXN_UOP_LOAD2_GEN(ws, (uint8_t)(wsp - 2), 0xff); \
+		tos_size = 2; \
+	} while (0)
+#define BUXN_TOS_REFILL() \
+	do { \
+		if (tos_size == 0) { \
+			tos = BUXN_UOP_LOAD2_GEN(ws, (uint8_t)(wsp - 2), 0xff); \
+		} else if (tos_size == 1) { \
+			tos = (uint16_t)(((uint16_t)ws[(uint8_t)(wsp - 2)] << 8) | (tos & 0xff)); \
+		} \
+		tos_size = 2; \
+	} while (0)
+#else
+#define BUXN_TOS_FILL()
+#define BUXN_TOS_REFILL()
+#endif
+#define BUXN_KEEP_WS() kwsp = wsp
+
 #define BUXN_SIMPLE_POLY_OP(NAME, K_, R_, S_) \
 	BUXN_CONCAT4(BUXN_POLY_OP_, NAME, _IMPL,)( \
 		BUXN_POLY_POP(K_, R_, S_), \
@@ -148,7 +469,11 @@
 	(((uint16_t)BUXN_UOP_LOAD1_GEN(SRC, ADDR    , ADDR_MASK) << 8) \
 	|((uint16_t)BUXN_UOP_LOAD1_GEN(SRC, ADDR + 1, ADDR_MASK)     ))
 #define BUXN_UOP_STORE1_GEN(DST, ADDR, ADDR_MASK, VALUE) \
-	DST[(ADDR) & ADDR_MASK] = (uint8_t)VALUE
+	do { \
+		DST[(ADDR) & ADDR_MASK] = (uint8_t)VALUE; \
+		dirty_pages[((ADDR) & ADDR_MASK) >> BUXN_VM_PAGE_SHIFT] = 1; \
+		BUXN_MEM_WRITTEN((ADDR) & ADDR_MASK); \
+	} while (0)
 #define BUXN_UOP_STORE2_GEN(DST, ADDR, ADDR_MASK, VALUE) \
 	do { \
 		BUXN_UOP_STORE1_GEN(DST, ADDR    , ADDR_MASK, (uint8_t)((VALUE >> 8) & 0xff)); \
@@ -163,17 +488,28 @@
 	|(uint16_t)(BUXN_UOP_DEV_IN1(ADDR + 1)     ))
 
 #define BUXN_POLY_DEV_OUT(S_) BUXN_SELECT(S_, BUXN_UOP_DEV_OUT1, BUXN_UOP_DEV_OUT2)
-#define BUXN_UOP_DEV_OUT1(ADDR, VALUE) \
+#define BUXN_UOP_DEV_OUT1(ADDR) buxn_vm_deo(vm, (uint8_t)ADDR)
+#define BUXN_UOP_DEV_OUT2(ADDR) \
 	do { \
-		dev[(ADDR) & 0xff] = (uint8_t)VALUE; \
 		buxn_vm_deo(vm, (uint8_t)ADDR); \
+		buxn_vm_deo(vm, (uint8_t)(ADDR + 1)); \
 	} while (0)
-#define BUXN_UOP_DEV_OUT2(ADDR, VALUE) \
+
+// Ports without side effects are accessed directly
+#define BUXN_POLY_DEV_NOOP(S_) BUXN_SELECT(S_, BUXN_UOP_DEV_NOOP1, BUXN_UOP_DEV_NOOP2)
+#define BUXN_UOP_DEV_NOOP1(DIR, ADDR) \
+	(noop_ports != NULL && noop_ports->DIR[(ADDR) & 0xff])
+#define BUXN_UOP_DEV_NOOP2(DIR, ADDR) \
+	(BUXN_UOP_DEV_NOOP1(DIR, ADDR) && BUXN_UOP_DEV_NOOP1(DIR, ADDR + 1))
+#define BUXN_POLY_DEV_LOAD(S_) BUXN_SELECT(S_, BUXN_UOP_DEV_LOAD1, BUXN_UOP_DEV_LOAD2)
+#define BUXN_UOP_DEV_LOAD1(ADDR) BUXN_UOP_LOAD1_GEN(dev, ADDR, 0xff)
+#define BUXN_UOP_DEV_LOAD2(ADDR) BUXN_UOP_LOAD2_GEN(dev, ADDR, 0xff)
+#define BUXN_POLY_DEV_STORE(S_) BUXN_SELECT(S_, BUXN_UOP_DEV_STORE1, BUXN_UOP_DEV_STORE2)
+#define BUXN_UOP_DEV_STORE1(ADDR, VALUE) dev[(ADDR) & 0xff] = (uint8_t)VALUE
+#define BUXN_UOP_DEV_STORE2(ADDR, VALUE) \
 	do { \
 		dev[(ADDR    ) & 0xff] = (uint8_t)(VALUE >> 8); \
 		dev[(ADDR + 1) & 0xff] = (uint8_t)VALUE; \
-		buxn_vm_deo(vm, (uint8_t)ADDR); \
-		buxn_vm_deo(vm, (uint8_t)(ADDR + 1)); \
 	} while (0)
 
 // Polymorphic opcodes parameterized over polymorphic uops
@@ -277,6 +613,7 @@
 	{ \
 		b = BUXN_POLY_POP(K_, R_, S_)(); \
 		a = BUXN_POLY_POP(K_, R_, 0)(); \
+		BUXN_COVERAGE_BRANCH(pc - 1, a != 0); \
 		if (a != 0) { \
 			BUXN_POLY_JMP(S_)(b); \
 		} \
@@ -287,6 +624,7 @@
 	{ \
 		BUXN_POLY_PUSH(BUXN_NOT(R_), 1)(pc); \
 		a = BUXN_POLY_POP(K_, R_, S_)(); \
+		BUXN_PROFILE_CALL(pc - 1, BUXN_SELECT(S_, BUXN_PC_REL(a), a)); \
 		BUXN_POLY_JMP(S_)(a); \
 	}
 
@@ -352,9 +690,13 @@
 #define BUXN_POLY_OP_DEI(K_, R_, S_) \
 	{ \
 		a = BUXN_POLY_POP(K_, R_, 0)(); \
-		BUXN_SAVE_STATE(); \
-		b = BUXN_POLY_DEV_IN(S_)(a); \
-		BUXN_LOAD_STATE(); \
+		if (BUXN_POLY_DEV_NOOP(S_)(dei, a)) { \
+			b = BUXN_POLY_DEV_LOAD(S_)(a); \
+		} else { \
+			BUXN_SAVE_STATE(); \
+			b = BUXN_POLY_DEV_IN(S_)(a); \
+			BUXN_LOAD_STATE(); \
+		} \
 		BUXN_POLY_PUSH(R_, S_)(b); \
 	}
 
@@ -363,9 +705,13 @@
 	{ \
 		a = BUXN_POLY_POP(K_, R_, 0)(); \
 		b = BUXN_POLY_POP(K_, R_, S_)(); \
-		BUXN_SAVE_STATE(); \
-		BUXN_POLY_DEV_OUT(S_)(a, b); \
-		BUXN_LOAD_STATE(); \
+		BUXN_POLY_DEV_STORE(S_)(a, b); \
+		if (!BUXN_POLY_DEV_NOOP(S_)(deo, a)) { \
+			BUXN_SAVE_STATE(); \
+			BUXN_POLY_DEV_OUT(S_)(a); \
+			BUXN_LOAD_STATE(); \
+		} \
+		BUXN_HALT_CHECK(); \
 	}
 
 // a b -- a BIN_OP b
@@ -401,6 +747,113 @@
 		BUXN_POLY_PUSH(R_, S_)(c); \
 	}
 
+// Immediate opcodes
+
+// cond8 --
+#define BUXN_OP_JCI() \
+	{ \
+		a = BUXN_UOP_POP(); \
+		BUXN_COVERAGE_BRANCH(pc - 1, a != 0); \
+		if (a != 0) { \
+			pc = BUXN_JMI_TARGET(); \
+		} else { \
+			pc += 2; \
+		} \
+	}
+
+// -- a
+#define BUXN_OP_LIT(VALUE) \
+	{ \
+		a = VALUE; \
+		pc += 1; \
+		BUXN_UOP_PUSH(a); \
+	}
+
+// -- a
+#define BUXN_OP_LIT2(VALUE) \
+	{ \
+		a = VALUE; \
+		pc += 2; \
+		BUXN_UOP_PUSH2(a); \
+	}
+
+// Fused sequences chain the implementation of each member opcode.
+// pc is advanced past every opcode in between so that relative addressing
+// and jumps behave exactly as if they were executed one by one.
+// Only the last opcode in a sequence may write to memory or a device.
+
+// LIT <byte> followed by an opcode
+#define BUXN_FUSED_LIT_OPS(X) \
+	X(SWP, 0x04, 0) \
+	X(EQU, 0x08, 0) \
+	X(NEQ, 0x09, 0) \
+	X(GTH, 0x0a, 0) \
+	X(LTH, 0x0b, 0) \
+	X(LDZ, 0x10, 0) \
+	X(LDZ, 0x10, 1) \
+	X(STZ, 0x11, 0) \
+	X(STZ, 0x11, 1) \
+	X(DEI, 0x16, 0) \
+	X(DEI, 0x16, 1) \
+	X(DEO, 0x17, 0) \
+	X(DEO, 0x17, 1) \
+	X(ADD, 0x18, 0) \
+	X(SUB, 0x19, 0) \
+	X(AND, 0x1c, 0)
+
+// LIT2 <short> followed by an opcode
+#define BUXN_FUSED_LIT2_OPS(X) \
+	X(EQU, 0x08, 1) \
+	X(NEQ, 0x09, 1) \
+	X(GTH, 0x0a, 1) \
+	X(LTH, 0x0b, 1) \
+	X(LDA, 0x14, 0) \
+	X(LDA, 0x14, 1) \
+	X(STA, 0x15, 0) \
+	X(STA, 0x15, 1) \
+	X(ADD, 0x18, 1) \
+	X(SUB, 0x19, 1) \
+	X(AND, 0x1c, 1)
+
+// A comparison followed by JCI
+#define BUXN_FUSED_JCI_OPS(X) \
+	X(EQU, 0x08, 0) \
+	X(NEQ, 0x09, 0) \
+	X(GTH, 0x0a, 0) \
+	X(LTH, 0x0b, 0) \
+	X(EQU, 0x08, 1) \
+	X(NEQ, 0x09, 1) \
+	X(GTH, 0x0a, 1) \
+	X(LTH, 0x0b, 1)
+
+#define BUXN_FUSED_NAME(PREFIX, NAME, S_) BUXN_CONCAT(PREFIX, BUXN_OPCODE_NAME(NAME, 0, 0, S_))
+
+#define BUXN_FUSED_LIT_TABLE_ENTRY(NAME, BASE, S_) \
+	[BUXN_OPCODE_VALUE(BASE, 0, 0, S_)] = &&BUXN_FUSED_NAME(BUXN_FUSED_LIT_, NAME, S_),
+#define BUXN_FUSED_LIT2_TABLE_ENTRY(NAME, BASE, S_) \
+	[BUXN_OPCODE_VALUE(BASE, 0, 0, S_)] = &&BUXN_FUSED_NAME(BUXN_FUSED_LIT2_, NAME, S_),
+#define BUXN_FUSED_JCI_TABLE_ENTRY(NAME, BASE, S_) \
+	[BUXN_OPCODE_VALUE(BASE, 0, 0, S_)] = &&BUXN_FUSED_NAME(BUXN_FUSED_JCI_, NAME, S_),
+
+#define BUXN_IMPL_FUSED_LIT(NAME, BASE, S_) \
+	BUXN_IMPL_MONO_OPCODE(BUXN_FUSED_NAME(BUXN_FUSED_LIT_, NAME, S_), { \
+		BUXN_OP_LIT(BUXN_LIT_OPERAND1()) \
+		pc += 1; \
+		BUXN_CONCAT(BUXN_POLY_OP_, NAME)(0, 0, S_) \
+	})
+#define BUXN_IMPL_FUSED_LIT2(NAME, BASE, S_) \
+	BUXN_IMPL_MONO_OPCODE(BUXN_FUSED_NAME(BUXN_FUSED_LIT2_, NAME, S_), { \
+		BUXN_OP_LIT2(BUXN_LIT_OPERAND2()) \
+		pc += 1; \
+		BUXN_CONCAT(BUXN_POLY_OP_, NAME)(0, 0, S_) \
+	})
+#define BUXN_IMPL_FUSED_JCI(NAME, BASE, S_) \
+	BUXN_IMPL_MONO_OPCODE(BUXN_FUSED_NAME(BUXN_FUSED_JCI_, NAME, S_), { \
+		BUXN_CONCAT(BUXN_POLY_OP_, NAME)(0, 0, S_) \
+		pc += 1; \
+		BUXN_OP_JCI() \
+	})
+
 #if defined(__clang__)
 #define BUXN_WARNING_PUSH() _Pragma("clang diagnostic push")
 #define BUXN_WARNING_POP() _Pragma("clang diagnostic pop")
@@ -425,22 +878,78 @@ BUXN_WARNING_PUSH()
 #if defined(__clang__) || defined(__GNUC__)
 __attribute__((unused))
 #endif
+#if BUXN_VM_BUDGET
+static buxn_vm_status_t
+BUXN_VM_EXECUTE(buxn_vm_t* vm, uint16_t pc, const buxn_vm_hook_t hook, uint32_t budget) {
+#else
 static void
 BUXN_VM_EXECUTE(buxn_vm_t* vm, uint16_t pc, const buxn_vm_hook_t hook) {
+#endif
 	(void)hook;
 
 	uint8_t* restrict const ws = vm->ws;
 	uint8_t* restrict const rs = vm->rs;
 	uint8_t* restrict const mem = vm->memory;
 	uint8_t* restrict const dev = vm->device;
+	uint8_t* restrict const dirty_pages = vm->dirty_pages;
 	uint8_t wsp, rsp;
 	uint8_t kwsp, krsp;
 	uint16_t a, b, c;  // Temporary variables following stack notation
+	const buxn_vm_noop_ports_t* const noop_ports = vm->config.noop_ports;
+#if BUXN_VM_PROFILE
+	buxn_vm_profile_t* restrict const profile = vm->config.profile;
+#endif
+#if BUXN_VM_TRACE
+	buxn_vm_trace_t* restrict const trace = vm->config.trace;
+	const bool trace_tos = (trace->flags & BUXN_VM_TRACE_TOS) > 0;
+#endif
+#if BUXN_VM_COVERAGE
+	buxn_vm_coverage_t* restrict const coverage = vm->config.coverage;
+	const bool coverage_branches = coverage->record_branches;
+#endif
+#if BUXN_VM_HOOK_FILTER
+	const buxn_vm_hook_filter_t* const hook_filter = vm->config.hook_filter;
+	bool hook_entry = true;
+#endif
+#if BUXN_VM_TOS_CACHE
+	uint16_t tos, tos_popped;
+	uint8_t tos_size;
+#endif
+#if BUXN_VM_CODE_CACHE
+	buxn_vm_code_cache_t* cache = vm->config.code_cache;
+	buxn_vm_cached_op_t* restrict const cached_ops = cache->ops;
+	buxn_vm_cached_op_t* cached_op;
+	const void* const miss_handler = &&BUXN_CACHE_MISS;
+#if BUXN_VM_FUSION
+	static const void* fused_lit_table[256] = {
+		BUXN_FUSED_LIT_OPS(BUXN_FUSED_LIT_TABLE_ENTRY)
+	};
+	static const void* fused_lit2_table[256] = {
+		BUXN_FUSED_LIT2_OPS(BUXN_FUSED_LIT2_TABLE_ENTRY)
+	};
+	static const void* fused_jci_table[256] = {
+		BUXN_FUSED_JCI_OPS(BUXN_FUSED_JCI_TABLE_ENTRY)
+	};
+#endif
+	if (cache->miss_handler != miss_handler) {
+		// A fresh cache is zero-initialized
+		for (uint32_t i = 0; i < BUXN_MEMORY_BANK_SIZE; ++i) {
+			cached_ops[i].handler = miss_handler;
+		}
+		cache->miss_handler = miss_handler;
+	}
+#else
+	buxn_vm_code_cache_t* const code_cache = vm->config.code_cache;
+#endif
 	BUXN_LOAD_STATE();
 
 	BUXN_BEGIN_DISPATCH()
 
-		BUXN_IMPL_MONO_OPCODE(BRK, { BUXN_SAVE_STATE(); return; })
+#if BUXN_VM_CODE_CACHE
+		BUXN_CACHE_MISS: BUXN_DECODE_OPCODE();
+#endif
+
+		BUXN_IMPL_MONO_OPCODE(BRK, { BUXN_SAVE_STATE(); BUXN_EXIT(BUXN_VM_FINISHED); })
 		BUXN_IMPL_POLY_OPCODE(INC)
 		BUXN_IMPL_POLY_OPCODE(POP)
 		BUXN_IMPL_POLY_OPCODE(NIP)
@@ -472,49 +981,45 @@ BUXN_VM_EXECUTE(buxn_vm_t* vm, uint16_t pc, const buxn_vm_hook_t hook) {
 		BUXN_IMPL_POLY_OPCODE(ORA)
 		BUXN_IMPL_POLY_OPCODE(EOR)
 		BUXN_IMPL_POLY_OPCODE(SFT)
-		BUXN_IMPL_MONO_OPCODE(JCI, {
-			// cond8 --
-			a = BUXN_UOP_POP();
-			if (a != 0) {
-				b = BUXN_UOP_LOAD2(pc);
-				pc += (b + 2);
-			} else {
-				pc += 2;
-			}
-		})
+		BUXN_IMPL_MONO_OPCODE(JCI, BUXN_OP_JCI())
 		BUXN_IMPL_MONO_OPCODE(JMI, {
 			// --
-			a = BUXN_UOP_LOAD2(pc);
-			pc += (a + 2);
+			pc = BUXN_JMI_TARGET();
 		})
 		BUXN_IMPL_MONO_OPCODE(JSI, {
 			// --
 			BUXN_UOP_PUSH2R(pc + 2);
-			a = BUXN_UOP_LOAD2(pc);
-			pc += (a + 2);
-		})
-		// -- a
-		BUXN_IMPL_MONO_OPCODE(LIT, {
-			a = BUXN_UOP_LOAD1(pc);
-			pc += 1;
-			BUXN_UOP_PUSH(a);
-		})
-		BUXN_IMPL_MONO_OPCODE(LIT2, {
-			a = BUXN_UOP_LOAD2(pc);
-			pc += 2;
-			BUXN_UOP_PUSH2(a);
+			BUXN_PROFILE_CALL(pc - 1, BUXN_JMI_TARGET());
+			pc = BUXN_JMI_TARGET();
 		})
+		BUXN_IMPL_MONO_OPCODE(LIT, BUXN_OP_LIT(BUXN_LIT_OPERAND1()))
+		BUXN_IMPL_MONO_OPCODE(LIT2, BUXN_OP_LIT2(BUXN_LIT_OPERAND2()))
 		BUXN_IMPL_MONO_OPCODE(LITr, {
-			a = BUXN_UOP_LOAD1(pc);
+			a = BUXN_LIT_OPERAND1();
 			pc += 1;
 			BUXN_UOP_PUSHR(a);
 		})
 		BUXN_IMPL_MONO_OPCODE(LIT2r, {
-			a = BUXN_UOP_LOAD2(pc);
+			a = BUXN_LIT_OPERAND2();
 			pc += 2;
 			BUXN_UOP_PUSH2R(a);
 		})
 
+#if BUXN_VM_FUSION
+		BUXN_FUSED_LIT_OPS(BUXN_IMPL_FUSED_LIT)
+		BUXN_FUSED_LIT2_OPS(BUXN_IMPL_FUSED_LIT2)
+		BUXN_FUSED_JCI_OPS(BUXN_IMPL_FUSED_JCI)
+		BUXN_IMPL_MONO_OPCODE(BUXN_FUSED_DUP2_ZERO_EQU2_JCI, {
+			BUXN_POLY_OP_DUP(0, 0, 1)
+			pc += 1;
+			BUXN_OP_LIT2(0)
+			pc += 1;
+			BUXN_POLY_OP_EQU(0, 0, 1)
+			pc += 1;
+			BUXN_OP_JCI()
+		})
+#endif
+
 	BUXN_END_DISPATCH()
 }
 
@@ -0,0 +1,1738 @@
+#define _GNU_SOURCE
+#include <buxn/vm/jit.h>
+#include <buxn/vm/vm.h>
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(__COSMOPOLITAN__)
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Compiled code is a sequence of basic blocks.
+// A block is compiled on first entry and runs until the first unconditional
+// control transfer, BRK, DEO or the instruction limit.
+// Conditional jumps leave the block through an out-of-line stub.
+//
+// Within a block, the top of the working stack is kept in a virtual stack of
+// registers and constants.
+// It is written back to memory before anything which can observe it: leaving
+// the block, calling into a device or running out of registers.
+// The return stack is always accessed in memory.
+//
+// Pinned registers:
+//
+// * rbx: buxn_vm_t*
+// * rbp: buxn_vm_jit_t*
+// * r12: jit->entries
+// * r13: jit->code_map
+// * r14: rsp (the uxn return stack pointer)
+// * r15: wsp
+//
+// Stack pointers are only ever updated with 8-bit arithmetic so they wrap
+// around and the upper bits are always zero.
+// rax, rcx and rdx are scratch, the remaining caller-saved registers hold
+// virtual stack values.
+
+#define BUXN_JIT_CODE_SIZE (8 * 1024 * 1024)
+#define BUXN_JIT_MAX_BLOCK_OPS 64
+#define BUXN_JIT_VSTACK_SIZE 8
+// Upper bound on the machine code for one instruction or stub
+#define BUXN_JIT_OP_RESERVE 1024
+#define BUXN_JIT_STUB_RESERVE 512
+#define BUXN_JIT_BLOCK_RESERVE \
+	(BUXN_JIT_MAX_BLOCK_OPS * (BUXN_JIT_OP_RESERVE + BUXN_JIT_STUB_RESERVE))
+
+// Bits in code_map
+#define BUXN_JIT_CODE        (1 << 0)
+#define BUXN_JIT_LIT_OPERAND (1 << 1)
+
+// Returned by compiled code in the upper 16 bits, the lower 16 bits is pc
+#define BUXN_JIT_EXIT_MISS       0
+#define BUXN_JIT_EXIT_BRK        1
+#define BUXN_JIT_EXIT_CODE_WRITE 2
+#define BUXN_JIT_EXIT_VALIDATE   3
+
+#define BUXN_JIT_WS 0
+#define BUXN_JIT_RS 1
+
+enum {
+	BUXN_JIT_RAX = 0,
+	BUXN_JIT_RCX,
+	BUXN_JIT_RDX,
+	BUXN_JIT_RBX,
+	BUXN_JIT_RSP,
+	BUXN_JIT_RBP,
+	BUXN_JIT_RSI,
+	BUXN_JIT_RDI,
+	BUXN_JIT_R8,
+	BUXN_JIT_R9,
+	BUXN_JIT_R10,
+	BUXN_JIT_R11,
+	BUXN_JIT_R12,
+	BUXN_JIT_R13,
+	BUXN_JIT_R14,
+	BUXN_JIT_R15,
+	BUXN_JIT_NO_INDEX = 0xff,
+};
+
+// Condition codes
+#define BUXN_JIT_CC_B  0x2
+#define BUXN_JIT_CC_E  0x4
+#define BUXN_JIT_CC_NE 0x5
+#define BUXN_JIT_CC_A  0x7
+
+// Flags for instruction encoding
+#define BUXN_JIT_REX_W    (1 << 0)
+// The reg field refers to a byte register
+#define BUXN_JIT_BYTE_REG (1 << 1)
+// The r/m field refers to a byte register
+#define BUXN_JIT_BYTE_RM  (1 << 2)
+
+#define BUXN_JIT_OPCODE(...) \
+	(const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ })
+
+#define BUXN_JIT_MEM(BASE, INDEX, DISP) \
+	((buxn_jit_mem_t){ .base = BASE, .index = INDEX, .scale = 0, .disp = (int32_t)(DISP) })
+
+#define BUXN_JIT_VM_OFFSET(FIELD) ((int32_t)offsetof(buxn_vm_t, FIELD))
+#define BUXN_JIT_CTX_OFFSET(FIELD) ((int32_t)offsetof(buxn_vm_jit_t, FIELD))
+
+typedef uint32_t (*buxn_jit_enter_fn_t)(
+	buxn_vm_jit_t* jit,
+	buxn_vm_t* vm,
+	const void* entry
+);
+
+typedef struct {
+	uint8_t base;
+	uint8_t index;
+	uint8_t scale;
+	int32_t disp;
+} buxn_jit_mem_t;
+
+typedef enum {
+	BUXN_JIT_IMM,
+	BUXN_JIT_REG,
+} buxn_jit_value_kind_t;
+
+typedef struct {
+	uint8_t kind;
+	uint8_t size;
+	uint8_t reg;
+	uint16_t imm;
+} buxn_jit_value_t;
+
+typedef enum {
+	// Jump to an absolute address
+	BUXN_JIT_STUB_JUMP,
+	// Jump to pc + (int8_t)operand
+	BUXN_JIT_STUB_JUMP_REL,
+	// Exit after a store to compiled code
+	BUXN_JIT_STUB_CODE_WRITE,
+} buxn_jit_stub_type_t;
+
+typedef struct {
+	uint32_t patch_pos;
+	uint8_t type;
+	uint16_t pc;
+	buxn_jit_value_t operand;
+	uint8_t vstack_len;
+	buxn_jit_value_t vstack[BUXN_JIT_VSTACK_SIZE];
+} buxn_jit_stub_t;
+
+typedef struct {
+	uint16_t start;
+	uint16_t size;
+} buxn_jit_block_t;
+
+struct buxn_vm_jit_s {
+	buxn_vm_t* vm;
+	uint32_t hit_addr;
+
+	uint8_t* code;
+	// Either PROT_READ | PROT_WRITE while compiling or PROT_READ | PROT_EXEC
+	int code_prot;
+	uint32_t code_pos;
+	uint32_t code_start;
+	uint32_t leave_pos;
+	buxn_jit_enter_fn_t enter;
+
+	// Compiler state
+	buxn_jit_value_t vstack[BUXN_JIT_VSTACK_SIZE];
+	uint8_t vstack_len;
+	// Entries below this index have not been consumed by the current keep op
+	uint8_t peek_len;
+	// Bytes consumed by the current keep op
+	uint8_t keep_depth[2];
+	uint8_t refcount[16];
+	uint32_t num_stubs;
+	buxn_jit_stub_t stubs[BUXN_JIT_MAX_BLOCK_OPS];
+
+	uint32_t num_blocks;
+	buxn_jit_block_t blocks[BUXN_MEMORY_BANK_SIZE];
+	const void* entries[BUXN_MEMORY_BANK_SIZE];
+	uint8_t code_map[BUXN_MEMORY_BANK_SIZE];
+	// LIT operands which were written to are loaded from memory
+	uint8_t volatile_map[BUXN_MEMORY_BANK_SIZE];
+	// Copy of compiled bytes to detect writes from outside the VM
+	uint8_t shadow[BUXN_MEMORY_BANK_SIZE];
+};
+
+static const uint8_t buxn_jit_reg_pool[] = {
+	BUXN_JIT_RSI,
+	BUXN_JIT_RDI,
+	BUXN_JIT_R8,
+	BUXN_JIT_R9,
+	BUXN_JIT_R10,
+	BUXN_JIT_R11,
+};
+
+// Encoding
+
+static inline void
+buxn_jit_emit8(buxn_vm_jit_t* jit, uint8_t byte) {
+	jit->code[jit->code_pos++] = byte;
+}
+
+static inline void
+buxn_jit_emit32(buxn_vm_jit_t* jit, uint32_t value) {
+	memcpy(jit->code + jit->code_pos, &value, sizeof(value));
+	jit->code_pos += sizeof(value);
+}
+
+static inline void
+buxn_jit_emit64(buxn_vm_jit_t* jit, uint64_t value) {
+	memcpy(jit->code + jit->code_pos, &value, sizeof(value));
+	jit->code_pos += sizeof(value);
+}
+
+static void
+buxn_jit_emit_rex(buxn_vm_jit_t* jit, int flags, uint8_t reg, uint8_t index, uint8_t base) {
+	uint8_t rex = 0x40
+		| ((flags & BUXN_JIT_REX_W) ? 0x08 : 0x00)
+		| ((reg & 8) >> 1)
+		| ((index & 8) >> 2)
+		| ((base & 8) >> 3);
+	// spl, bpl, sil and dil are only accessible with a REX prefix
+	bool needs_rex = rex != 0x40
+		|| ((flags & BUXN_JIT_BYTE_REG) && reg >= 4 && reg < 8)
+		|| ((flags & BUXN_JIT_BYTE_RM) && base >= 4 && base < 8);
+	if (needs_rex) { buxn_jit_emit8(jit, rex); }
+}
+
+static void
+buxn_jit_emit_opcode(buxn_vm_jit_t* jit, const uint8_t* opcode, size_t len) {
+	for (size_t i = 0; i < len; ++i) { buxn_jit_emit8(jit, opcode[i]); }
+}
+
+// Register to register
+static void
+buxn_jit_emit_rr(
+	buxn_vm_jit_t* jit,
+	int flags,
+	const uint8_t* opcode, size_t len,
+	uint8_t reg,
+	uint8_t rm
+) {
+	buxn_jit_emit_rex(jit, flags, reg, 0, rm);
+	buxn_jit_emit_opcode(jit, opcode, len);
+	buxn_jit_emit8(jit, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// Register and memory, always with a 32-bit displacement
+static void
+buxn_jit_emit_rm(
+	buxn_vm_jit_t* jit,
+	int flags,
+	const uint8_t* opcode, size_t len,
+	uint8_t reg,
+	buxn_jit_mem_t mem
+) {
+	uint8_t index = mem.index != BUXN_JIT_NO_INDEX ? mem.index : 0;
+	buxn_jit_emit_rex(jit, flags, reg, index, mem.base);
+	buxn_jit_emit_opcode(jit, opcode, len);
+	if (mem.index == BUXN_JIT_NO_INDEX && (mem.base & 7) != BUXN_JIT_RSP) {
+		buxn_jit_emit8(jit, 0x80 | ((reg & 7) << 3) | (mem.base & 7));
+	} else {
+		buxn_jit_emit8(jit, 0x84 | ((reg & 7) << 3));
+		uint8_t index_bits = mem.index != BUXN_JIT_NO_INDEX ? (index & 7) : BUXN_JIT_RSP;
+		buxn_jit_emit8(jit, (mem.scale << 6) | (index_bits << 3) | (mem.base & 7));
+	}
+	buxn_jit_emit32(jit, (uint32_t)mem.disp);
+}
+
+static void
+buxn_jit_emit_mov_ri(buxn_vm_jit_t* jit, uint8_t dst, uint32_t imm) {
+	buxn_jit_emit_rex(jit, 0, 0, 0, dst);
+	buxn_jit_emit8(jit, 0xb8 + (dst & 7));
+	buxn_jit_emit32(jit, imm);
+}
+
+static void
+buxn_jit_emit_mov_rr(buxn_vm_jit_t* jit, uint8_t dst, uint8_t src) {
+	if (dst == src) { return; }
+	buxn_jit_emit_rr(jit, 0, BUXN_JIT_OPCODE(0x89), src, dst);
+}
+
+static void
+buxn_jit_emit_mov_value(buxn_vm_jit_t* jit, uint8_t dst, buxn_jit_value_t value) {
+	if (value.kind == BUXN_JIT_IMM) {
+		buxn_jit_emit_mov_ri(jit, dst, value.imm);
+	} else {
+		buxn_jit_emit_mov_rr(jit, dst, value.reg);
+	}
+}
+
+// ALU instructions share their encoding: OPCODE r/m32, r32 and 0x81 /EXT imm32
+#define BUXN_JIT_ALU_ADD 0x01, 0
+#define BUXN_JIT_ALU_OR  0x09, 1
+#define BUXN_JIT_ALU_AND 0x21, 4
+#define BUXN_JIT_ALU_SUB 0x29, 5
+#define BUXN_JIT_ALU_XOR 0x31, 6
+#define BUXN_JIT_ALU_CMP 0x39, 7
+
+static void
+buxn_jit_emit_alu_ri(buxn_vm_jit_t* jit, uint8_t opcode, uint8_t ext, uint8_t dst, uint32_t imm) {
+	(void)opcode;
+	buxn_jit_emit_rr(jit, 0, BUXN_JIT_OPCODE(0x81), ext, dst);
+	buxn_jit_emit32(jit, imm);
+}
+
+static void
+buxn_jit_emit_alu_rr(buxn_vm_jit_t* jit, uint8_t opcode, uint8_t ext, uint8_t dst, uint8_t src) {
+	(void)ext;
+	buxn_jit_emit_rr(jit, 0, &opcode, 1, src, dst);
+}
+
+static void
+buxn_jit_emit_alu_value(
+	buxn_vm_jit_t* jit,
+	uint8_t opcode, uint8_t ext,
+	uint8_t dst,
+	buxn_jit_value_t src
+) {
+	if (src.kind == BUXN_JIT_IMM) {
+		buxn_jit_emit_alu_ri(jit, opcode, ext, dst, src.imm);
+	} else {
+		buxn_jit_emit_alu_rr(jit, opcode, ext, dst, src.reg);
+	}
+}
+
+#define BUXN_JIT_SHIFT_SHL 4
+#define BUXN_JIT_SHIFT_SHR 5
+
+static void
+buxn_jit_emit_shift_ri(buxn_vm_jit_t* jit, uint8_t ext, uint8_t dst, uint8_t amount) {
+	buxn_jit_emit_rr(jit, 0, BUXN_JIT_OPCODE(0xc1), ext, dst);
+	buxn_jit_emit8(jit, amount);
+}
+
+static void
+buxn_jit_emit_shift_cl(buxn_vm_jit_t* jit, uint8_t ext, uint8_t dst) {
+	buxn_jit_emit_rr(jit, 0, BUXN_JIT_OPCODE(0xd3), ext, dst);
+}
+
+// Zero-extend the lower SIZE bytes of a register
+static void
+buxn_jit_emit_movzx(buxn_vm_jit_t* jit, uint8_t size, uint8_t dst, uint8_t src) {
+	if (size == 1) {
+		buxn_jit_emit_rr(jit, BUXN_JIT_BYTE_RM, BUXN_JIT_OPCODE(0x0f, 0xb6), dst, src);
+	} else {
+		buxn_jit_emit_rr(jit, 0, BUXN_JIT_OPCODE(0x0f, 0xb7), dst, src);
+	}
+}
+
+static void
+buxn_jit_emit_movsx8(buxn_vm_jit_t* jit, uint8_t dst, uint8_t src) {
+	buxn_jit_emit_rr(jit, BUXN_JIT_BYTE_RM, BUXN_JIT_OPCODE(0x0f, 0xbe), dst, src);
+}
+
+static void
+buxn_jit_emit_load8(buxn_vm_jit_t* jit, uint8_t dst, buxn_jit_mem_t mem) {
+	buxn_jit_emit_rm(jit, 0, BUXN_JIT_OPCODE(0x0f, 0xb6), dst, mem);
+}
+
+static void
+buxn_jit_emit_store8(buxn_vm_jit_t* jit, buxn_jit_mem_t mem, uint8_t src) {
+	buxn_jit_emit_rm(jit, BUXN_JIT_BYTE_REG, BUXN_JIT_OPCODE(0x88), src, mem);
+}
+
+static void
+buxn_jit_emit_store8_imm(buxn_vm_jit_t* jit, buxn_jit_mem_t mem, uint8_t imm) {
+	buxn_jit_emit_rm(jit, 0, BUXN_JIT_OPCODE(0xc6), 0, mem);
+	buxn_jit_emit8(jit, imm);
+}
+
+static void
+buxn_jit_emit_lea(buxn_vm_jit_t* jit, uint8_t dst, uint8_t base, int32_t disp) {
+	buxn_jit_emit_rm(jit, 0, BUXN_JIT_OPCODE(0x8d), dst, BUXN_JIT_MEM(base, BUXN_JIT_NO_INDEX, disp));
+}
+
+static void
+buxn_jit_emit_test(buxn_vm_jit_t* jit, uint8_t reg) {
+	buxn_jit_emit_rr(jit, 0, BUXN_JIT_OPCODE(0x85), reg, reg);
+}
+
+static void
+buxn_jit_emit_add8(buxn_vm_jit_t* jit, uint8_t reg, int8_t amount) {
+	buxn_jit_emit_rr(jit, BUXN_JIT_BYTE_RM, BUXN_JIT_OPCODE(0x80), 0, reg);
+	buxn_jit_emit8(jit, (uint8_t)amount);
+}
+
+static void
+buxn_jit_emit_call(buxn_vm_jit_t* jit, uint64_t addr) {
+	// mov rax, imm64
+	buxn_jit_emit8(jit, 0x48);
+	buxn_jit_emit8(jit, 0xb8);
+	buxn_jit_emit64(jit, addr);
+	// call rax
+	buxn_jit_emit8(jit, 0xff);
+	buxn_jit_emit8(jit, 0xd0);
+}
+
+// Returns the position of the rel32 field
+static uint32_t
+buxn_jit_emit_jcc(buxn_vm_jit_t* jit, uint8_t cc) {
+	buxn_jit_emit8(jit, 0x0f);
+	buxn_jit_emit8(jit, 0x80 | cc);
+	uint32_t patch_pos = jit->code_pos;
+	buxn_jit_emit32(jit, 0);
+	return patch_pos;
+}
+
+static uint32_t
+buxn_jit_emit_jmp(buxn_vm_jit_t* jit) {
+	buxn_jit_emit8(jit, 0xe9);
+	uint32_t patch_pos = jit->code_pos;
+	buxn_jit_emit32(jit, 0);
+	return patch_pos;
+}
+
+static void
+buxn_jit_patch(buxn_vm_jit_t* jit, uint32_t patch_pos, uint32_t target_pos) {
+	uint32_t rel = target_pos - (patch_pos + 4);
+	memcpy(jit->code + patch_pos, &rel, sizeof(rel));
+}
+
+// Exits
+
+static void
+buxn_jit_emit_leave(buxn_vm_jit_t* jit, uint16_t pc, uint32_t reason) {
+	buxn_jit_emit_mov_ri(jit, BUXN_JIT_RAX, (uint32_t)pc | (reason << 16));
+	buxn_jit_patch(jit, buxn_jit_emit_jmp(jit), jit->leave_pos);
+}
+
+// Jump to the block at eax or leave if it is not compiled yet
+static void
+buxn_jit_emit_chain(buxn_vm_jit_t* jit) {
+	// mov rdx, [r12 + rax * 8]
+	buxn_jit_emit_rm(
+		jit,
+		BUXN_JIT_REX_W,
+		BUXN_JIT_OPCODE(0x8b),
+		BUXN_JIT_RDX,
+		(buxn_jit_mem_t){
+			.base = BUXN_JIT_R12,
+			.index = BUXN_JIT_RAX,
+			.scale = 3,
+			.disp = 0,
+		}
+	);
+	buxn_jit_emit_rr(jit, BUXN_JIT_REX_W, BUXN_JIT_OPCODE(0x85), BUXN_JIT_RDX, BUXN_JIT_RDX);
+	buxn_jit_patch(jit, buxn_jit_emit_jcc(jit, BUXN_JIT_CC_E), jit->leave_pos);
+	// jmp rdx
+	buxn_jit_emit8(jit, 0xff);
+	buxn_jit_emit8(jit, 0xe2);
+}
+
+static void
+buxn_jit_emit_jump_to(buxn_vm_jit_t* jit, uint16_t pc) {
+	// Blocks are only ever discarded all at once so a direct jump stays valid
+	const uint8_t* entry = jit->entries[pc];
+	if (entry != NULL) {
+		buxn_jit_patch(jit, buxn_jit_emit_jmp(jit), (uint32_t)(entry - jit->code));
+	} else {
+		buxn_jit_emit_mov_ri(jit, BUXN_JIT_RAX, pc);
+		buxn_jit_emit_chain(jit);
+	}
+}
+
+// Virtual stack
+
+static inline uint8_t
+buxn_jit_sp_reg(int stack) {
+	return stack == BUXN_JIT_WS ? BUXN_JIT_R15 : BUXN_JIT_R14;
+}
+
+static inline int32_t
+buxn_jit_stack_offset(int stack) {
+	return stack == BUXN_JIT_WS ? BUXN_JIT_VM_OFFSET(ws) : BUXN_JIT_VM_OFFSET(rs);
+}
+
+static inline buxn_jit_value_t
+buxn_jit_imm(uint8_t size, uint16_t imm) {
+	return (buxn_jit_value_t){
+		.kind = BUXN_JIT_IMM,
+		.size = size,
+		.imm = size == 1 ? (imm & 0xff) : imm,
+	};
+}
+
+static inline buxn_jit_value_t
+buxn_jit_reg(uint8_t size, uint8_t reg) {
+	return (buxn_jit_value_t){ .kind = BUXN_JIT_REG, .size = size, .reg = reg };
+}
+
+static void
+buxn_jit_release(buxn_vm_jit_t* jit, buxn_jit_value_t value) {
+	if (value.kind == BUXN_JIT_REG) { --jit->refcount[value.reg]; }
+}
+
+// Write a value at the top of a stack in memory
+static void
+buxn_jit_emit_push_bytes(buxn_vm_jit_t* jit, int stack, buxn_jit_value_t value) {
+	uint8_t sp = buxn_jit_sp_reg(stack);
+	buxn_jit_mem_t top = BUXN_JIT_MEM(BUXN_JIT_RBX, sp, buxn_jit_stack_offset(stack));
+	if (value.size == 2) {
+		if (value.kind == BUXN_JIT_IMM) {
+			buxn_jit_emit_store8_imm(jit, top, value.imm >> 8);
+		} else {
+			buxn_jit_emit_mov_rr(jit, BUXN_JIT_RAX, value.reg);
+			buxn_jit_emit_shift_ri(jit, BUXN_JIT_SHIFT_SHR, BUXN_JIT_RAX, 8);
+			buxn_jit_emit_store8(jit, top, BUXN_JIT_RAX);
+		}
+		buxn_jit_emit_add8(jit, sp, 1);
+	}
+
+	if (value.kind == BUXN_JIT_IMM) {
+		buxn_jit_emit_store8_imm(jit, top, value.imm & 0xff);
+	} else {
+		buxn_jit_emit_store8(jit, top, value.reg);
+	}
+	buxn_jit_emit_add8(jit, sp, 1);
+}
+
+static void
+buxn_jit_emit_flush(buxn_vm_jit_t* jit, const buxn_jit_value_t* values, uint8_t count) {
+	for (uint8_t i = 0; i < count; ++i) {
+		buxn_jit_emit_push_bytes(jit, BUXN_JIT_WS, values[i]);
+	}
+}
+
+static void
+buxn_jit_flush(buxn_vm_jit_t* jit) {
+	buxn_jit_emit_flush(jit, jit->vstack, jit->vstack_len);
+	for (uint8_t i = 0; i < jit->vstack_len; ++i) {
+		buxn_jit_release(jit, jit->vstack[i]);
+	}
+	jit->vstack_len = 0;
+	jit->peek_len = 0;
+}
+
+// Write the bottom entry of the virtual stack to memory
+static void
+buxn_jit_spill(buxn_vm_jit_t* jit) {
+	buxn_jit_emit_push_bytes(jit, BUXN_JIT_WS, jit->vstack[0]);
+	buxn_jit_release(jit, jit->vstack[0]);
+	memmove(&jit->vstack[0], &jit->vstack[1], sizeof(jit->vstack[0]) * (jit->vstack_len - 1));
+	jit->vstack_len -= 1;
+	if (jit->peek_len > 0) { jit->peek_len -= 1; }
+}
+
+static uint8_t
+buxn_jit_alloc_reg(buxn_vm_jit_t* jit) {
+	for (;;) {
+		for (size_t i = 0; i < sizeof(buxn_jit_reg_pool); ++i) {
+			uint8_t reg = buxn_jit_reg_pool[i];
+			if (jit->refcount[reg] == 0) {
+				jit->refcount[reg] = 1;
+				return reg;
+			}
+		}
+
+		// Every register is at most held by the virtual stack and the 3
+		// operands of the current instruction
+		buxn_jit_spill(jit);
+	}
+}
+
+// Take exclusive ownership of a value in a register so it can be modified
+static uint8_t
+buxn_jit_own(buxn_vm_jit_t* jit, buxn_jit_value_t value) {
+	if (value.kind == BUXN_JIT_REG && jit->refcount[value.reg] == 1) {
+		return value.reg;
+	}
+
+	uint8_t reg = buxn_jit_alloc_reg(jit);
+	buxn_jit_emit_mov_value(jit, reg, value);
+	buxn_jit_release(jit, value);
+	return reg;
+}
+
+static uint8_t
+buxn_jit_vstack_bytes(buxn_vm_jit_t* jit) {
+	uint8_t bytes = 0;
+	for (uint8_t i = 0; i < jit->vstack_len; ++i) {
+		bytes += jit->vstack[i].size;
+	}
+	return bytes;
+}
+
+// Load a byte at sp + OFFSET
+static void
+buxn_jit_emit_load_stack_byte(buxn_vm_jit_t* jit, int stack, uint8_t dst, int offset) {
+	uint8_t sp = buxn_jit_sp_reg(stack);
+	if (offset == 0) {
+		buxn_jit_emit_load8(jit, dst, BUXN_JIT_MEM(BUXN_JIT_RBX, sp, buxn_jit_stack_offset(stack)));
+	} else {
+		buxn_jit_emit_lea(jit, BUXN_JIT_RAX, sp, offset);
+		buxn_jit_emit_movzx(jit, 1, BUXN_JIT_RAX, BUXN_JIT_RAX);
+		buxn_jit_emit_load8(
+			jit,
+			dst,
+			BUXN_JIT_MEM(BUXN_JIT_RBX, BUXN_JIT_RAX, buxn_jit_stack_offset(stack))
+		);
+	}
+}
+
+static void
+buxn_jit_emit_load_stack(buxn_vm_jit_t* jit, int stack, uint8_t size, uint8_t dst, int offset) {
+	buxn_jit_emit_load_stack_byte(jit, stack, dst, offset);
+	if (size == 2) {
+		buxn_jit_emit_shift_ri(jit, BUXN_JIT_SHIFT_SHL, dst, 8);
+		buxn_jit_emit_load_stack_byte(jit, stack, BUXN_JIT_RAX, offset + 1);
+		buxn_jit_emit_alu_rr(jit, BUXN_JIT_ALU_OR, dst, BUXN_JIT_RAX);
+	}
+}
+
+static buxn_jit_value_t
+buxn_jit_pop(buxn_vm_jit_t* jit, int stack, uint8_t size, bool keep) {
+	if (stack == BUXN_JIT_RS) {
+		uint8_t reg = buxn_jit_alloc_reg(jit);
+		if (keep) {
+			jit->keep_depth[stack] += size;
+			buxn_jit_emit_load_stack(jit, stack, size, reg, -jit->keep_depth[stack]);
+		} else {
+			buxn_jit_emit_add8(jit, buxn_jit_sp_reg(stack), -(int8_t)size);
+			buxn_jit_emit_load_stack(jit, stack, size, reg, 0);
+		}
+		return buxn_jit_reg(size, reg);
+	}
+
+	if (keep) {
+		if (jit->peek_len > 0) {
+			buxn_jit_value_t value = jit->vstack[jit->peek_len - 1];
+			if (value.size == size) {
+				jit->peek_len -= 1;
+				jit->keep_depth[stack] += size;
+				if (value.kind == BUXN_JIT_REG) { ++jit->refcount[value.reg]; }
+				return value;
+			}
+
+			buxn_jit_flush(jit);
+		}
+
+		// Allocate first since spilling moves the top of the stack in memory
+		uint8_t reg = buxn_jit_alloc_reg(jit);
+		jit->keep_depth[stack] += size;
+		int offset = -(int)jit->keep_depth[stack] + (int)buxn_jit_vstack_bytes(jit);
+		buxn_jit_emit_load_stack(jit, stack, size, reg, offset);
+		return buxn_jit_reg(size, reg);
+	} else {
+		if (jit->vstack_len > 0) {
+			buxn_jit_value_t* top = &jit->vstack[jit->vstack_len - 1];
+			if (top->size == size) {
+				jit->vstack_len -= 1;
+				return *top;
+			} else if (size == 1 && top->kind == BUXN_JIT_IMM) {
+				buxn_jit_value_t value = buxn_jit_imm(1, top->imm & 0xff);
+				*top = buxn_jit_imm(1, top->imm >> 8);
+				return value;
+			} else if (
+				size == 2
+				&& top->kind == BUXN_JIT_IMM
+				&& jit->vstack_len >= 2
+				&& top[-1].kind == BUXN_JIT_IMM
+				&& top[-1].size == 1
+			) {
+				buxn_jit_value_t value = buxn_jit_imm(2, (top[-1].imm << 8) | top->imm);
+				jit->vstack_len -= 2;
+				return value;
+			}
+
+			buxn_jit_flush(jit);
+		}
+
+		uint8_t reg = buxn_jit_alloc_reg(jit);
+		buxn_jit_emit_add8(jit, buxn_jit_sp_reg(stack), -(int8_t)size);
+		buxn_jit_emit_load_stack(jit, stack, size, reg, 0);
+		return buxn_jit_reg(size, reg);
+	}
+}
+
+static void
+buxn_jit_push(buxn_vm_jit_t* jit, int stack, buxn_jit_value_t value) {
+	if (stack == BUXN_JIT_RS) {
+		buxn_jit_emit_push_bytes(jit, stack, value);
+		buxn_jit_release(jit, value);
+	} else {
+		if (jit->vstack_len == BUXN_JIT_VSTACK_SIZE) { buxn_jit_spill(jit); }
+		jit->vstack[jit->vstack_len++] = value;
+	}
+}
+
+static buxn_jit_stub_t*
+buxn_jit_add_stub(buxn_vm_jit_t* jit, uint8_t type, uint32_t patch_pos) {
+	buxn_jit_stub_t* stub = &jit->stubs[jit->num_stubs++];
+	stub->type = type;
+	stub->patch_pos = patch_pos;
+	stub->vstack_len = jit->vstack_len;
+	memcpy(stub->vstack, jit->vstack, sizeof(jit->vstack[0]) * jit->vstack_len);
+	return stub;
+}
+
+static void
+buxn_jit_emit_stub(buxn_vm_jit_t* jit, const buxn_jit_stub_t* stub) {
+	buxn_jit_patch(jit, stub->patch_pos, jit->code_pos);
+	switch ((buxn_jit_stub_type_t)stub->type) {
+		case BUXN_JIT_STUB_JUMP:
+			buxn_jit_emit_flush(jit, stub->vstack, stub->vstack_len);
+			if (stub->operand.kind == BUXN_JIT_IMM) {
+				buxn_jit_emit_jump_to(jit, stub->operand.imm);
+			} else {
+				buxn_jit_emit_mov_rr(jit, BUXN_JIT_RAX, stub->operand.reg);
+				buxn_jit_emit_chain(jit);
+			}
+			break;
+		case BUXN_JIT_STUB_JUMP_REL:
+			buxn_jit_emit_flush(jit, stub->vstack, stub->vstack_len);
+			buxn_jit_emit_movsx8(jit, BUXN_JIT_RAX, stub->operand.reg);
+			buxn_jit_emit_alu_ri(jit, BUXN_JIT_ALU_ADD, BUXN_JIT_RAX, stub->pc);
+			buxn_jit_emit_movzx(jit, 2, BUXN_JIT_RAX, BUXN_JIT_RAX);
+			buxn_jit_emit_chain(jit);
+			break;
+		case BUXN_JIT_STUB_CODE_WRITE:
+			// mov [rbp + hit_addr], addr
+			buxn_jit_emit_mov_value(jit, BUXN_JIT_RAX, stub->operand);
+			buxn_jit_emit_rm(
+				jit,
+				0,
+				BUXN_JIT_OPCODE(0x89),
+				BUXN_JIT_RAX,
+				BUXN_JIT_MEM(BUXN_JIT_RBP, BUXN_JIT_NO_INDEX, BUXN_JIT_CTX_OFFSET(hit_addr))
+			);
+			buxn_jit_emit_flush(jit, stub->vstack, stub->vstack_len);
+			buxn_jit_emit_leave(jit, stub->pc, BUXN_JIT_EXIT_CODE_WRITE);
+			break;
+	}
+}
+
+// Instructions
+
+static void
+buxn_jit_mark(buxn_vm_jit_t* jit, uint16_t addr, uint8_t flag) {
+	jit->code_map[addr] |= flag;
+	jit->shadow[addr] = jit->vm->memory[addr];
+}
+
+// Jump to a value: absolute for a short and relative to pc for a byte
+static void
+buxn_jit_jump(buxn_vm_jit_t* jit, uint16_t pc, buxn_jit_value_t target) {
+	buxn_jit_flush(jit);
+	if (target.kind == BUXN_JIT_IMM) {
+		uint16_t addr = target.size == 2 ? target.imm : (uint16_t)(pc + (int8_t)target.imm);
+		buxn_jit_emit_jump_to(jit, addr);
+	} else {
+		if (target.size == 2) {
+			buxn_jit_emit_mov_rr(jit, BUXN_JIT_RAX, target.reg);
+		} else {
+			buxn_jit_emit_movsx8(jit, BUXN_JIT_RAX, target.reg);
+			buxn_jit_emit_alu_ri(jit, BUXN_JIT_ALU_ADD, BUXN_JIT_RAX, pc);
+			buxn_jit_emit_movzx(jit, 2, BUXN_JIT_RAX, BUXN_JIT_RAX);
+		}
+		buxn_jit_release(jit, target);
+		buxn_jit_emit_chain(jit);
+	}
+}
+
+// Leave the block through a stub if COND is not zero
+static void
+buxn_jit_branch(buxn_vm_jit_t* jit, uint16_t pc, buxn_jit_value_t cond, buxn_jit_value_t target) {
+	buxn_jit_emit_test(jit, cond.reg);
+	uint32_t patch_pos = buxn_jit_emit_jcc(jit, BUXN_JIT_CC_NE);
+	buxn_jit_release(jit, cond);
+
+	buxn_jit_stub_t* stub;
+	if (target.kind == BUXN_JIT_IMM) {
+		stub = buxn_jit_add_stub(jit, BUXN_JIT_STUB_JUMP, patch_pos);
+		uint16_t addr = target.size == 2 ? target.imm : (uint16_t)(pc + (int8_t)target.imm);
+		stub->operand = buxn_jit_imm(2, addr);
+	} else {
+		stub = buxn_jit_add_stub(
+			jit,
+			target.size == 2 ? BUXN_JIT_STUB_JUMP : BUXN_JIT_STUB_JUMP_REL,
+			patch_pos
+		);
+		stub->operand = target;
+		stub->pc = pc;
+	}
+	// The register stays valid until the stub runs
+	buxn_jit_release(jit, target);
+}
+
+// Compute the effective address of LDR/STR
+static buxn_jit_value_t
+buxn_jit_rel_addr(buxn_vm_jit_t* jit, uint16_t pc, buxn_jit_value_t offset) {
+	if (offset.kind == BUXN_JIT_IMM) {
+		return buxn_jit_imm(2, (uint16_t)(pc + (int8_t)offset.imm));
+	}
+
+	uint8_t reg = buxn_jit_own(jit, offset);
+	buxn_jit_emit_movsx8(jit, reg, reg);
+	buxn_jit_emit_alu_ri(jit, BUXN_JIT_ALU_ADD, reg, pc);
+	buxn_jit_emit_movzx(jit, 2, reg, reg);
+	return buxn_jit_reg(2, reg);
+}
+
+// Address of the second byte of a short access.
+// Returns the memory operand relative to BASE + DISP.
+static buxn_jit_mem_t
+buxn_jit_next_addr(
+	buxn_vm_jit_t* jit,
+	buxn_jit_value_t addr,
+	uint16_t mask,
+	uint8_t base,
+	int32_t disp
+) {
+	if (addr.kind == BUXN_JIT_IMM) {
+		return BUXN_JIT_MEM(base, BUXN_JIT_NO_INDEX, disp + ((addr.imm + 1) & mask));
+	} else {
+		buxn_jit_emit_lea(jit, BUXN_JIT_RCX, addr.reg, 1);
+		buxn_jit_emit_movzx(jit, mask == 0xff ? 1 : 2, BUXN_JIT_RCX, BUXN_JIT_RCX);
+		return BUXN_JIT_MEM(base, BUXN_JIT_RCX, disp);
+	}
+}
+
+static buxn_jit_mem_t
+buxn_jit_addr(buxn_jit_value_t addr, uint8_t base, int32_t disp) {
+	if (addr.kind == BUXN_JIT_IMM) {
+		return BUXN_JIT_MEM(base, BUXN_JIT_NO_INDEX, disp + addr.imm);
+	} else {
+		return BUXN_JIT_MEM(base, addr.reg, disp);
+	}
+}
+
+static buxn_jit_value_t
+buxn_jit_load(buxn_vm_jit_t* jit, buxn_jit_value_t addr, uint8_t size, uint16_t mask) {
+	int32_t disp = BUXN_JIT_VM_OFFSET(memory);
+	uint8_t reg = buxn_jit_alloc_reg(jit);
+	buxn_jit_emit_load8(jit, reg, buxn_jit_addr(addr, BUXN_JIT_RBX, disp));
+	if (size == 2) {
+		buxn_jit_mem_t next = buxn_jit_next_addr(jit, addr, mask, BUXN_JIT_RBX, disp);
+		buxn_jit_emit_load8(jit, BUXN_JIT_RAX, next);
+		buxn_jit_emit_shift_ri(jit, BUXN_JIT_SHIFT_SHL, reg, 8);
+		buxn_jit_emit_alu_rr(jit, BUXN_JIT_ALU_OR, reg, BUXN_JIT_RAX);
+	}
+	buxn_jit_release(jit, addr);
+	return buxn_jit_reg(size, reg);
+}
+
+// Flag the pages written by a store for buxn_vm_restore
+static void
+buxn_jit_mark_dirty(buxn_vm_jit_t* jit, buxn_jit_value_t addr, uint8_t size, uint16_t mask) {
+	int32_t disp = BUXN_JIT_VM_OFFSET(dirty_pages);
+	if (mask == 0xff) {
+		// The zero page is in the first page
+		buxn_jit_emit_store8_imm(jit, BUXN_JIT_MEM(BUXN_JIT_RBX, BUXN_JIT_NO_INDEX, disp), 1);
+	} else if (addr.kind == BUXN_JIT_IMM) {
+		uint16_t first = addr.imm & mask;
+		uint16_t second = (addr.imm + 1) & mask;
+		buxn_jit_emit_store8_imm(
+			jit,
+			BUXN_JIT_MEM(BUXN_JIT_RBX, BUXN_JIT_NO_INDEX, disp + (first >> BUXN_VM_PAGE_SHIFT)),
+			1
+		);
+		if (size == 2 && (second >> BUXN_VM_PAGE_SHIFT) != (first >> BUXN_VM_PAGE_SHIFT)) {
+			buxn_jit_emit_store8_imm(
+				jit,
+				BUXN_JIT_MEM(BUXN_JIT_RBX, BUXN_JIT_NO_INDEX, disp + (second >> BUXN_VM_PAGE_SHIFT)),
+				1
+			);
+		}
+	} else {
+		buxn_jit_emit_mov_rr(jit, BUXN_JIT_RAX, addr.reg);
+		buxn_jit_emit_shift_ri(jit, BUXN_JIT_SHIFT_SHR, BUXN_JIT_RAX, BUXN_VM_PAGE_SHIFT);
+		buxn_jit_emit_store8_imm(jit, BUXN_JIT_MEM(BUXN_JIT_RBX, BUXN_JIT_RAX, disp), 1);
+		if (size == 2) {
+			buxn_jit_emit_lea(jit, BUXN_JIT_RAX, addr.reg, 1);
+			buxn_jit_emit_movzx(jit, 2, BUXN_JIT_RAX, BUXN_JIT_RAX);
+			buxn_jit_emit_shift_ri(jit, BUXN_JIT_SHIFT_SHR, BUXN_JIT_RAX, BUXN_VM_PAGE_SHIFT);
+			buxn_jit_emit_store8_imm(jit, BUXN_JIT_MEM(BUXN_JIT_RBX, BUXN_JIT_RAX, disp), 1);
+		}
+	}
+}
+
+static void
+buxn_jit_store(
+	buxn_vm_jit_t* jit,
+	uint16_t next_pc,
+	buxn_jit_value_t addr,
+	buxn_jit_value_t value,
+	uint16_t mask
+) {
+	int32_t disp = BUXN_JIT_VM_OFFSET(memory);
+	buxn_jit_mem_t first = buxn_jit_addr(addr, BUXN_JIT_RBX, disp);
+	if (value.size == 2) {
+		buxn_jit_mem_t second = buxn_jit_next_addr(jit, addr, mask, BUXN_JIT_RBX, disp);
+		if (value.kind == BUXN_JIT_IMM) {
+			buxn_jit_emit_store8_imm(jit, first, value.imm >> 8);
+			buxn_jit_emit_store8_imm(jit, second, value.imm & 0xff);
+		} else {
+			buxn_jit_emit_mov_rr(jit, BUXN_JIT_RAX, value.reg);
+			buxn_jit_emit_shift_ri(jit, BUXN_JIT_SHIFT_SHR, BUXN_JIT_RAX, 8);
+			buxn_jit_emit_store8(jit, first, BUXN_JIT_RAX);
+			buxn_jit_emit_store8(jit, second, value.reg);
+		}
+	} else {
+		if (value.kind == BUXN_JIT_IMM) {
+			buxn_jit_emit_store8_imm(jit, first, value.imm);
+		} else {
+			buxn_jit_emit_store8(jit, first, value.reg);
+		}
+	}
+	buxn_jit_release(jit, value);
+	buxn_jit_mark_dirty(jit, addr, value.size, mask);
+
+	// Check whether compiled code was overwritten
+	buxn_jit_emit_load8(jit, BUXN_JIT_RAX, buxn_jit_addr(addr, BUXN_JIT_R13, 0));
+	if (value.size == 2) {
+		buxn_jit_mem_t second = buxn_jit_next_addr(jit, addr, mask, BUXN_JIT_R13, 0);
+		// or al, byte [second]
+		buxn_jit_emit_rm(jit, 0, BUXN_JIT_OPCODE(0x0a), BUXN_JIT_RAX, second);
+	}
+	buxn_jit_emit_test(jit, BUXN_JIT_RAX);
+	uint32_t patch_pos = buxn_jit_emit_jcc(jit, BUXN_JIT_CC_NE);
+	buxn_jit_stub_t* stub = buxn_jit_add_stub(jit, BUXN_JIT_STUB_CODE_WRITE, patch_pos);
+	stub->operand = addr;
+	stub->pc = next_pc;
+	buxn_jit_release(jit, addr);
+}
+
+static void
+buxn_jit_sync_state(buxn_vm_jit_t* jit) {
+	buxn_jit_emit_store8(
+		jit,
+		BUXN_JIT_MEM(BUXN_JIT_RBX, BUXN_JIT_NO_INDEX, BUXN_JIT_VM_OFFSET(wsp)),
+		BUXN_JIT_R15
+	);
+	buxn_jit_emit_store8(
+		jit,
+		BUXN_JIT_MEM(BUXN_JIT_RBX, BUXN_JIT_NO_INDEX, BUXN_JIT_VM_OFFSET(rsp)),
+		BUXN_JIT_R14
+	);
+}
+
+// Devices may change the stack pointers
+static void
+buxn_jit_reload_state(buxn_vm_jit_t* jit) {
+	buxn_jit_emit_load8(
+		jit,
+		BUXN_JIT_R15,
+		BUXN_JIT_MEM(BUXN_JIT_RBX, BUXN_JIT_NO_INDEX, BUXN_JIT_VM_OFFSET(wsp))
+	);
+	buxn_jit_emit_load8(
+		jit,
+		BUXN_JIT_R14,
+		BUXN_JIT_MEM(BUXN_JIT_RBX, BUXN_JIT_NO_INDEX, BUXN_JIT_VM_OFFSET(rsp))
+	);
+}
+
+// Spill slot at [rsp] reserved by the enter trampoline
+static buxn_jit_mem_t
+buxn_jit_scratch(int32_t offset) {
+	return BUXN_JIT_MEM(BUXN_JIT_RSP, BUXN_JIT_NO_INDEX, offset);
+}
+
+// Call a device handler with the port in esi and the previous one in [rsp]
+static void
+buxn_jit_emit_device_call(buxn_vm_jit_t* jit, uint64_t fn, bool next_port) {
+	if (next_port) {
+		buxn_jit_emit_rm(jit, 0, BUXN_JIT_OPCODE(0x8b), BUXN_JIT_RSI, buxn_jit_scratch(0));
+		buxn_jit_emit_lea(jit, BUXN_JIT_RSI, BUXN_JIT_RSI, 1);
+		buxn_jit_emit_movzx(jit, 1, BUXN_JIT_RSI, BUXN_JIT_RSI);
+	} else {
+		buxn_jit_emit_rm(jit, 0, BUXN_JIT_OPCODE(0x89), BUXN_JIT_RSI, buxn_jit_scratch(0));
+	}
+	// mov rdi, rbx
+	buxn_jit_emit_rr(jit, BUXN_JIT_REX_W, BUXN_JIT_OPCODE(0x89), BUXN_JIT_RBX, BUXN_JIT_RDI);
+	buxn_jit_emit_call(jit, fn);
+}
+
+static void
+buxn_jit_dei(buxn_vm_jit_t* jit, int stack, uint8_t size, bool keep) {
+	buxn_jit_value_t port = buxn_jit_pop(jit, stack, 1, keep);
+	buxn_jit_flush(jit);
+	buxn_jit_sync_state(jit);
+	buxn_jit_emit_mov_value(jit, BUXN_JIT_RSI, port);
+	buxn_jit_release(jit, port);
+
+	uint8_t (*dei)(buxn_vm_t* vm, uint8_t address) = buxn_vm_dei;
+	uint64_t fn;
+	memcpy(&fn, &dei, sizeof(fn));
+	buxn_jit_emit_device_call(jit, fn, false);
+	buxn_jit_emit_movzx(jit, 1, BUXN_JIT_RAX, BUXN_JIT_RAX);
+	if (size == 2) {
+		buxn_jit_emit_rm(jit, 0, BUXN_JIT_OPCODE(0x89), BUXN_JIT_RAX, buxn_jit_scratch(4));
+		buxn_jit_emit_device_call(jit, fn, true);
+		buxn_jit_emit_movzx(jit, 1, BUXN_JIT_RAX, BUXN_JIT_RAX);
+		buxn_jit_emit_rm(jit, 0, BUXN_JIT_OPCODE(0x8b), BUXN_JIT_RCX, buxn_jit_scratch(4));
+		buxn_jit_emit_shift_ri(jit, BUXN_JIT_SHIFT_SHL, BUXN_JIT_RCX, 8);
+		buxn_jit_emit_alu_rr(jit, BUXN_JIT_ALU_OR, BUXN_JIT_RAX, BUXN_JIT_RCX);
+	}
+	buxn_jit_reload_state(jit);
+
+	uint8_t reg = buxn_jit_alloc_reg(jit);
+	buxn_jit_emit_mov_rr(jit, reg, BUXN_JIT_RAX);
+	buxn_jit_push(jit, stack, buxn_jit_reg(size, reg));
+}
+
+static bool
+buxn_jit_port_may_write_memory(uint8_t port) {
+	uint8_t device = buxn_device_id(port);
+	return device == BUXN_DEVICE_FILE_0
+		|| device == BUXN_DEVICE_FILE_1
+		// System/expansion
+		|| port == 0x02
+		|| port == 0x03;
+}
+
+// Returns whether the block must end
+static bool
+buxn_jit_deo(buxn_vm_jit_t* jit, uint16_t pc, int stack, uint8_t size, bool keep) {
+	buxn_jit_value_t port = buxn_jit_pop(jit, stack, 1, keep);
+	buxn_jit_value_t value = buxn_jit_pop(jit, stack, size, keep);
+
+	// Ports without side effects only need the store
+	const buxn_vm_noop_ports_t* noop_ports = jit->vm->config.noop_ports;
+	bool noop = port.kind == BUXN_JIT_IMM
+		&& noop_ports != NULL
+		&& noop_ports->deo[(uint8_t)port.imm]
+		&& (size == 1 || noop_ports->deo[(uint8_t)(port.imm + 1)]);
+
+	buxn_jit_flush(jit);
+	if (!noop) { buxn_jit_sync_state(jit); }
+
+	int32_t disp = BUXN_JIT_VM_OFFSET(device);
+	buxn_jit_mem_t first = buxn_jit_addr(port, BUXN_JIT_RBX, disp);
+	if (size == 2) {
+		buxn_jit_mem_t second = buxn_jit_next_addr(jit, port, 0xff, BUXN_JIT_RBX, disp);
+		if (value.kind == BUXN_JIT_IMM) {
+			buxn_jit_emit_store8_imm(jit, first, value.imm >> 8);
+			buxn_jit_emit_store8_imm(jit, second, value.imm & 0xff);
+		} else {
+			buxn_jit_emit_mov_rr(jit, BUXN_JIT_RAX, value.reg);
+			buxn_jit_emit_shift_ri(jit, BUXN_JIT_SHIFT_SHR, BUXN_JIT_RAX, 8);
+			buxn_jit_emit_store8(jit, first, BUXN_JIT_RAX);
+			buxn_jit_emit_store8(jit, second, value.reg);
+		}
+	} else {
+		if (value.kind == BUXN_JIT_IMM) {
+			buxn_jit_emit_store8_imm(jit, first, value.imm);
+		} else {
+			buxn_jit_emit_store8(jit, first, value.reg);
+		}
+	}
+	buxn_jit_release(jit, value);
+	if (noop) {
+		buxn_jit_release(jit, port);
+		return false;
+	}
+
+	buxn_jit_emit_mov_value(jit, BUXN_JIT_RSI, port);
+	buxn_jit_release(jit, port);
+	void (*deo)(buxn_vm_t* vm, uint8_t address) = buxn_vm_deo;
+	uint64_t fn;
+	memcpy(&fn, &deo, sizeof(fn));
+	buxn_jit_emit_device_call(jit, fn, false);
+	if (size == 2) { buxn_jit_emit_device_call(jit, fn, true); }
+	buxn_jit_reload_state(jit);
+
+	// Compiled code must be validated again if the device could write to
+	// memory
+	bool may_write_memory = port.kind == BUXN_JIT_REG
+		|| buxn_jit_port_may_write_memory((uint8_t)port.imm)
+		|| (size == 2 && buxn_jit_port_may_write_memory((uint8_t)(port.imm + 1)));
+	if (may_write_memory) {
+		buxn_jit_emit_leave(jit, pc, BUXN_JIT_EXIT_VALIDATE);
+		return true;
+	} else {
+		return false;
+	}
+}
+
+typedef enum {
+	BUXN_JIT_OP_ADD,
+	BUXN_JIT_OP_SUB,
+	BUXN_JIT_OP_MUL,
+	BUXN_JIT_OP_DIV,
+	BUXN_JIT_OP_AND,
+	BUXN_JIT_OP_ORA,
+	BUXN_JIT_OP_EOR,
+} buxn_jit_bin_op_t;
+
+static uint16_t
+buxn_jit_fold_bin_op(buxn_jit_bin_op_t op, uint16_t a, uint16_t b) {
+	switch (op) {
+		case BUXN_JIT_OP_ADD: return a + b;
+		case BUXN_JIT_OP_SUB: return a - b;
+		case BUXN_JIT_OP_MUL: return a * b;
+		case BUXN_JIT_OP_DIV: return b != 0 ? a / b : 0;
+		case BUXN_JIT_OP_AND: return a & b;
+		case BUXN_JIT_OP_ORA: return a | b;
+		case BUXN_JIT_OP_EOR: return a ^ b;
+	}
+	return 0;
+}
+
+static void
+buxn_jit_bin_op(buxn_vm_jit_t* jit, buxn_jit_bin_op_t op, int stack, uint8_t size, bool keep) {
+	buxn_jit_value_t b = buxn_jit_pop(jit, stack, size, keep);
+	buxn_jit_value_t a = buxn_jit_pop(jit, stack, size, keep);
+	if (a.kind == BUXN_JIT_IMM && b.kind == BUXN_JIT_IMM) {
+		buxn_jit_push(jit, stack, buxn_jit_imm(size, buxn_jit_fold_bin_op(op, a.imm, b.imm)));
+		return;
+	}
+
+	if (op == BUXN_JIT_OP_DIV) {
+		if (b.kind == BUXN_JIT_IMM && b.imm == 0) {
+			buxn_jit_release(jit, a);
+			buxn_jit_push(jit, stack, buxn_jit_imm(size, 0));
+			return;
+		}
+
+		// Allocate first since spilling clobbers rax
+		uint8_t reg = buxn_jit_alloc_reg(jit);
+		buxn_jit_emit_mov_value(jit, BUXN_JIT_RAX, a);
+		buxn_jit_emit_mov_value(jit, BUXN_JIT_RCX, b);
+		buxn_jit_release(jit, a);
+		buxn_jit_release(jit, b);
+		buxn_jit_emit_alu_rr(jit, BUXN_JIT_ALU_XOR, BUXN_JIT_RDX, BUXN_JIT_RDX);
+		uint32_t zero_patch = 0;
+		if (b.kind != BUXN_JIT_IMM) {
+			buxn_jit_emit_test(jit, BUXN_JIT_RCX);
+			zero_patch = buxn_jit_emit_jcc(jit, BUXN_JIT_CC_E);
+		}
+		// div ecx
+		buxn_jit_emit_rr(jit, 0, BUXN_JIT_OPCODE(0xf7), 6, BUXN_JIT_RCX);
+		if (b.kind != BUXN_JIT_IMM) {
+			uint32_t done_patch = buxn_jit_emit_jmp(jit);
+			buxn_jit_patch(jit, zero_patch, jit->code_pos);
+			buxn_jit_emit_alu_rr(jit, BUXN_JIT_ALU_XOR, BUXN_JIT_RAX, BUXN_JIT_RAX);
+			buxn_jit_patch(jit, done_patch, jit->code_pos);
+		}
+		buxn_jit_emit_mov_rr(jit, reg, BUXN_JIT_RAX);
+		buxn_jit_push(jit, stack, buxn_jit_reg(size, reg));
+		return;
+	}
+
+	uint8_t reg = buxn_jit_own(jit, a);
+	switch (op) {
+		case BUXN_JIT_OP_ADD: buxn_jit_emit_alu_value(jit, BUXN_JIT_ALU_ADD, reg, b); break;
+		case BUXN_JIT_OP_SUB: buxn_jit_emit_alu_value(jit, BUXN_JIT_ALU_SUB, reg, b); break;
+		case BUXN_JIT_OP_AND: buxn_jit_emit_alu_value(jit, BUXN_JIT_ALU_AND, reg, b); break;
+		case BUXN_JIT_OP_ORA: buxn_jit_emit_alu_value(jit, BUXN_JIT_ALU_OR, reg, b); break;
+		case BUXN_JIT_OP_EOR: buxn_jit_emit_alu_value(jit, BUXN_JIT_ALU_XOR, reg, b); break;
+		case BUXN_JIT_OP_MUL:
+			if (b.kind == BUXN_JIT_IMM) {
+				// imul reg, reg, imm32
+				buxn_jit_emit_rr(jit, 0, BUXN_JIT_OPCODE(0x69), reg, reg);
+				buxn_jit_emit32(jit, b.imm);
+			} else {
+				buxn_jit_emit_rr(jit, 0, BUXN_JIT_OPCODE(0x0f, 0xaf), reg, b.reg);
+			}
+			break;
+		case BUXN_JIT_OP_DIV: break;
+	}
+	if (op == BUXN_JIT_OP_ADD || op == BUXN_JIT_OP_SUB || op == BUXN_JIT_OP_MUL) {
+		buxn_jit_emit_movzx(jit, size, reg, reg);
+	}
+	buxn_jit_release(jit, b);
+	buxn_jit_push(jit, stack, buxn_jit_reg(size, reg));
+}
+
+static void
+buxn_jit_cmp_op(buxn_vm_jit_t* jit, uint8_t cc, int stack, uint8_t size, bool keep) {
+	buxn_jit_value_t b = buxn_jit_pop(jit, stack, size, keep);
+	buxn_jit_value_t a = buxn_jit_pop(jit, stack, size, keep);
+	if (a.kind == BUXN_JIT_IMM && b.kind == BUXN_JIT_IMM) {
+		bool result = false;
+		switch (cc) {
+			case BUXN_JIT_CC_E: result = a.imm == b.imm; break;
+			case BUXN_JIT_CC_NE: result = a.imm != b.imm; break;
+			case BUXN_JIT_CC_A: result = a.imm > b.imm; break;
+			case BUXN_JIT_CC_B: result = a.imm < b.imm; break;
+		}
+		buxn_jit_push(jit, stack, buxn_jit_imm(1, result));
+		return;
+	}
+
+	// Allocate before comparing since spilling clobbers the flags
+	uint8_t reg = buxn_jit_alloc_reg(jit);
+	if (a.kind == BUXN_JIT_IMM) {
+		buxn_jit_emit_mov_ri(jit, BUXN_JIT_RAX, a.imm);
+		buxn_jit_emit_alu_value(jit, BUXN_JIT_ALU_CMP, BUXN_JIT_RAX, b);
+	} else {
+		buxn_jit_emit_alu_value(jit, BUXN_JIT_ALU_CMP, a.reg, b);
+	}
+	buxn_jit_release(jit, a);
+	buxn_jit_release(jit, b);
+	// setcc reg8
+	buxn_jit_emit_rr(jit, BUXN_JIT_BYTE_RM, BUXN_JIT_OPCODE(0x0f, 0x90 | cc), 0, reg);
+	buxn_jit_emit_movzx(jit, 1, reg, reg);
+	buxn_jit_push(jit, stack, buxn_jit_reg(1, reg));
+}
+
+static void
+buxn_jit_sft(buxn_vm_jit_t* jit, int stack, uint8_t size, bool keep) {
+	buxn_jit_value_t b = buxn_jit_pop(jit, stack, 1, keep);
+	buxn_jit_value_t a = buxn_jit_pop(jit, stack, size, keep);
+	if (b.kind == BUXN_JIT_IMM) {
+		uint8_t right = b.imm & 0x0f;
+		uint8_t left = (b.imm & 0xf0) >> 4;
+		if (a.kind == BUXN_JIT_IMM) {
+			buxn_jit_push(jit, stack, buxn_jit_imm(size, (uint16_t)((a.imm >> right) << left)));
+			return;
+		}
+
+		uint8_t reg = buxn_jit_own(jit, a);
+		if (right > 0) { buxn_jit_emit_shift_ri(jit, BUXN_JIT_SHIFT_SHR, reg, right); }
+		if (left > 0) {
+			buxn_jit_emit_shift_ri(jit, BUXN_JIT_SHIFT_SHL, reg, left);
+			buxn_jit_emit_movzx(jit, size, reg, reg);
+		}
+		buxn_jit_push(jit, stack, buxn_jit_reg(size, reg));
+		return;
+	}
+
+	uint8_t reg = buxn_jit_alloc_reg(jit);
+	buxn_jit_emit_mov_value(jit, BUXN_JIT_RAX, a);
+	buxn_jit_emit_mov_rr(jit, BUXN_JIT_RCX, b.reg);
+	buxn_jit_emit_alu_ri(jit, BUXN_JIT_ALU_AND, BUXN_JIT_RCX, 0x0f);
+	buxn_jit_emit_shift_cl(jit, BUXN_JIT_SHIFT_SHR, BUXN_JIT_RAX);
+	buxn_jit_emit_mov_rr(jit, BUXN_JIT_RCX, b.reg);
+	buxn_jit_emit_shift_ri(jit, BUXN_JIT_SHIFT_SHR, BUXN_JIT_RCX, 4);
+	buxn_jit_emit_shift_cl(jit, BUXN_JIT_SHIFT_SHL, BUXN_JIT_RAX);
+	buxn_jit_release(jit, a);
+	buxn_jit_release(jit, b);
+	buxn_jit_emit_movzx(jit, size, reg, BUXN_JIT_RAX);
+	buxn_jit_push(jit, stack, buxn_jit_reg(size, reg));
+}
+
+static buxn_jit_value_t
+buxn_jit_lit(buxn_vm_jit_t* jit, uint16_t addr, uint8_t size) {
+	uint16_t second = (uint16_t)(addr + 1);
+	bool is_volatile = jit->volatile_map[addr]
+		|| (size == 2 && jit->volatile_map[second]);
+	if (is_volatile) {
+		return buxn_jit_load(jit, buxn_jit_imm(2, addr), size, 0xffff);
+	} else {
+		buxn_jit_mark(jit, addr, BUXN_JIT_LIT_OPERAND);
+		if (size == 1) {
+			return buxn_jit_imm(1, jit->vm->memory[addr]);
+		} else {
+			buxn_jit_mark(jit, second, BUXN_JIT_LIT_OPERAND);
+			uint16_t value = ((uint16_t)jit->vm->memory[addr] << 8)
+				| (uint16_t)jit->vm->memory[second];
+			return buxn_jit_imm(2, value);
+		}
+	}
+}
+
+// Returns whether the block ends after this instruction
+static bool
+buxn_jit_compile_op(buxn_vm_jit_t* jit, uint16_t* pc_ptr) {
+	const uint8_t* mem = jit->vm->memory;
+	uint16_t pc = *pc_ptr;
+	uint8_t opcode = mem[pc];
+	buxn_jit_mark(jit, pc, BUXN_JIT_CODE);
+	pc += 1;
+	*pc_ptr = pc;
+
+	jit->peek_len = jit->vstack_len;
+	jit->keep_depth[BUXN_JIT_WS] = 0;
+	jit->keep_depth[BUXN_JIT_RS] = 0;
+
+	bool keep = (opcode & 0x80) != 0;
+	int stack = (opcode & 0x40) != 0 ? BUXN_JIT_RS : BUXN_JIT_WS;
+	int other_stack = stack == BUXN_JIT_WS ? BUXN_JIT_RS : BUXN_JIT_WS;
+	uint8_t size = (opcode & 0x20) != 0 ? 2 : 1;
+
+	switch (opcode & 0x1f) {
+		case 0x00: {
+			switch (opcode) {
+				case 0x00: /* BRK */
+					buxn_jit_flush(jit);
+					buxn_jit_emit_leave(jit, pc, BUXN_JIT_EXIT_BRK);
+					return true;
+				case 0x20: /* JCI */
+				case 0x40: /* JMI */
+				case 0x60: /* JSI */ {
+					buxn_jit_mark(jit, pc, BUXN_JIT_CODE);
+					buxn_jit_mark(jit, (uint16_t)(pc + 1), BUXN_JIT_CODE);
+					uint16_t next_pc = (uint16_t)(pc + 2);
+					uint16_t target = (uint16_t)(next_pc + buxn_vm_load2(mem, pc, BUXN_MEM_ADDR_MASK));
+					*pc_ptr = next_pc;
+					if (opcode == 0x20) {
+						buxn_jit_value_t cond = buxn_jit_pop(jit, BUXN_JIT_WS, 1, false);
+						if (cond.kind == BUXN_JIT_IMM) {
+							if (cond.imm == 0) { return false; }
+							buxn_jit_jump(jit, next_pc, buxn_jit_imm(2, target));
+							return true;
+						} else {
+							buxn_jit_branch(jit, next_pc, cond, buxn_jit_imm(2, target));
+							return false;
+						}
+					} else {
+						if (opcode == 0x60) {
+							buxn_jit_push(jit, BUXN_JIT_RS, buxn_jit_imm(2, next_pc));
+						}
+						buxn_jit_jump(jit, next_pc, buxn_jit_imm(2, target));
+						return true;
+					}
+				}
+				default: /* LIT */ {
+					buxn_jit_push(jit, stack, buxn_jit_lit(jit, pc, size));
+					*pc_ptr = (uint16_t)(pc + size);
+					return false;
+				}
+			}
+		}
+		case 0x01: /* INC */ {
+			buxn_jit_value_t a = buxn_jit_pop(jit, stack, size, keep);
+			if (a.kind == BUXN_JIT_IMM) {
+				buxn_jit_push(jit, stack, buxn_jit_imm(size, a.imm + 1));
+			} else {
+				uint8_t reg = buxn_jit_own(jit, a);
+				buxn_jit_emit_alu_ri(jit, BUXN_JIT_ALU_ADD, reg, 1);
+				buxn_jit_emit_movzx(jit, size, reg, reg);
+				buxn_jit_push(jit, stack, buxn_jit_reg(size, reg));
+			}
+			return false;
+		}
+		case 0x02: /* POP */ {
+			buxn_jit_release(jit, buxn_jit_pop(jit, stack, size, keep));
+			return false;
+		}
+		case 0x03: /* NIP */ {
+			buxn_jit_value_t b = buxn_jit_pop(jit, stack, size, keep);
+			buxn_jit_release(jit, buxn_jit_pop(jit, stack, size, keep));
+			buxn_jit_push(jit, stack, b);
+			return false;
+		}
+		case 0x04: /* SWP */ {
+			buxn_jit_value_t b = buxn_jit_pop(jit, stack, size, keep);
+			buxn_jit_value_t a = buxn_jit_pop(jit, stack, size, keep);
+			buxn_jit_push(jit, stack, b);
+			buxn_jit_push(jit, stack, a);
+			return false;
+		}
+		case 0x05: /* ROT */ {
+			buxn_jit_value_t c = buxn_jit_pop(jit, stack, size, keep);
+			buxn_jit_value_t b = buxn_jit_pop(jit, stack, size, keep);
+			buxn_jit_value_t a = buxn_jit_pop(jit, stack, size, keep);
+			buxn_jit_push(jit, stack, b);
+			buxn_jit_push(jit, stack, c);
+			buxn_jit_push(jit, stack, a);
+			return false;
+		}
+		case 0x06: /* DUP */ {
+			buxn_jit_value_t a = buxn_jit_pop(jit, stack, size, keep);
+			if (a.kind == BUXN_JIT_REG) { ++jit->refcount[a.reg]; }
+			buxn_jit_push(jit, stack, a);
+			buxn_jit_push(jit, stack, a);
+			return false;
+		}
+		case 0x07: /* OVR */ {
+			buxn_jit_value_t b = buxn_jit_pop(jit, stack, size, keep);
+			buxn_jit_value_t a = buxn_jit_pop(jit, stack, size, keep);
+			if (a.kind == BUXN_JIT_REG) { ++jit->refcount[a.reg]; }
+			buxn_jit_push(jit, stack, a);
+			buxn_jit_push(jit, stack, b);
+			buxn_jit_push(jit, stack, a);
+			return false;
+		}
+		case 0x08: /* EQU */
+			buxn_jit_cmp_op(jit, BUXN_JIT_CC_E, stack, size, keep);
+			return false;
+		case 0x09: /* NEQ */
+			buxn_jit_cmp_op(jit, BUXN_JIT_CC_NE, stack, size, keep);
+			return false;
+		case 0x0a: /* GTH */
+			buxn_jit_cmp_op(jit, BUXN_JIT_CC_A, stack, size, keep);
+			return false;
+		case 0x0b: /* LTH */
+			buxn_jit_cmp_op(jit, BUXN_JIT_CC_B, stack, size, keep);
+			return false;
+		case 0x0c: /* JMP */ {
+			buxn_jit_jump(jit, pc, buxn_jit_pop(jit, stack, size, keep));
+			return true;
+		}
+		case 0x0d: /* JCN */ {
+			buxn_jit_value_t target = buxn_jit_pop(jit, stack, size, keep);
+			buxn_jit_value_t cond = buxn_jit_pop(jit, stack, 1, keep);
+			if (cond.kind == BUXN_JIT_IMM) {
+				if (cond.imm == 0) {
+					buxn_jit_release(jit, target);
+					return false;
+				}
+				buxn_jit_jump(jit, pc, target);
+				return true;
+			} else {
+				buxn_jit_branch(jit, pc, cond, target);
+				return false;
+			}
+		}
+		case 0x0e: /* JSR */ {
+			buxn_jit_push(jit, other_stack, buxn_jit_imm(2, pc));
+			buxn_jit_jump(jit, pc, buxn_jit_pop(jit, stack, size, keep));
+			return true;
+		}
+		case 0x0f: /* STH */ {
+			buxn_jit_push(jit, other_stack, buxn_jit_pop(jit, stack, size, keep));
+			return false;
+		}
+		case 0x10: /* LDZ */ {
+			buxn_jit_value_t addr = buxn_jit_pop(jit, stack, 1, keep);
+			buxn_jit_push(jit, stack, buxn_jit_load(jit, addr, size, 0xff));
+			return false;
+		}
+		case 0x11: /* STZ */ {
+			buxn_jit_value_t addr = buxn_jit_pop(jit, stack, 1, keep);
+			buxn_jit_value_t value = buxn_jit_pop(jit, stack, size, keep);
+			buxn_jit_store(jit, pc, addr, value, 0xff);
+			return false;
+		}
+		case 0x12: /* LDR */ {
+			buxn_jit_value_t addr = buxn_jit_rel_addr(jit, pc, buxn_jit_pop(jit, stack, 1, keep));
+			buxn_jit_push(jit, stack, buxn_jit_load(jit, addr, size, 0xffff));
+			return false;
+		}
+		case 0x13: /* STR */ {
+			buxn_jit_value_t addr = buxn_jit_rel_addr(jit, pc, buxn_jit_pop(jit, stack, 1, keep));
+			buxn_jit_value_t value = buxn_jit_pop(jit, stack, size, keep);
+			buxn_jit_store(jit, pc, addr, value, 0xffff);
+			return false;
+		}
+		case 0x14: /* LDA */ {
+			buxn_jit_value_t addr = buxn_jit_pop(jit, stack, 2, keep);
+			buxn_jit_push(jit, stack, buxn_jit_load(jit, addr, size, 0xffff));
+			return false;
+		}
+		case 0x15: /* STA */ {
+			buxn_jit_value_t addr = buxn_jit_pop(jit, stack, 2, keep);
+			buxn_jit_value_t value = buxn_jit_pop(jit, stack, size, keep);
+			buxn_jit_store(jit, pc, addr, value, 0xffff);
+			return false;
+		}
+		case 0x16: /* DEI */
+			buxn_jit_dei(jit, stack, size, keep);
+			return false;
+		case 0x17: /* DEO */
+			return buxn_jit_deo(jit, pc, stack, size, keep);
+		case 0x18: /* ADD */
+			buxn_jit_bin_op(jit, BUXN_JIT_OP_ADD, stack, size, keep);
+			return false;
+		case 0x19: /* SUB */
+			buxn_jit_bin_op(jit, BUXN_JIT_OP_SUB, stack, size, keep);
+			return false;
+		case 0x1a: /* MUL */
+			buxn_jit_bin_op(jit, BUXN_JIT_OP_MUL, stack, size, keep);
+			return false;
+		case 0x1b: /* DIV */
+			buxn_jit_bin_op(jit, BUXN_JIT_OP_DIV, stack, size, keep);
+			return false;
+		case 0x1c: /* AND */
+			buxn_jit_bin_op(jit, BUXN_JIT_OP_AND, stack, size, keep);
+			return false;
+		case 0x1d: /* ORA */
+			buxn_jit_bin_op(jit, BUXN_JIT_OP_ORA, stack, size, keep);
+			return false;
+		case 0x1e: /* EOR */
+			buxn_jit_bin_op(jit, BUXN_JIT_OP_EOR, stack, size, keep);
+			return false;
+		case 0x1f: /* SFT */
+			buxn_jit_sft(jit, stack, size, keep);
+			return false;
+	}
+
+	return true;
+}
+
+// Blocks
+
+static void
+buxn_jit_flush_blocks(buxn_vm_jit_t* jit) {
+	for (uint32_t i = 0; i < jit->num_blocks; ++i) {
+		buxn_jit_block_t block = jit->blocks[i];
+		jit->entries[block.start] = NULL;
+		for (uint16_t j = 0; j < block.size; ++j) {
+			jit->code_map[(uint16_t)(block.start + j)] = 0;
+		}
+	}
+	jit->num_blocks = 0;
+	jit->code_pos = jit->code_start;
+}
+
+// Discard everything if compiled memory was changed from outside of the VM
+static void
+buxn_jit_validate(buxn_vm_jit_t* jit) {
+	const uint8_t* mem = jit->vm->memory;
+	for (uint32_t i = 0; i < jit->num_blocks; ++i) {
+		buxn_jit_block_t block = jit->blocks[i];
+		for (uint16_t j = 0; j < block.size; ++j) {
+			uint16_t addr = (uint16_t)(block.start + j);
+			if (jit->code_map[addr] != 0 && mem[addr] != jit->shadow[addr]) {
+				buxn_jit_flush_blocks(jit);
+				return;
+			}
+		}
+	}
+}
+
+static void
+buxn_jit_handle_code_write(buxn_vm_jit_t* jit) {
+	// A short store covers the next byte, wrapping around in the zero page
+	uint16_t addr = (uint16_t)jit->hit_addr;
+	uint16_t candidates[] = {
+		addr,
+		(uint16_t)(addr + 1),
+		(uint16_t)((addr & 0xff00) | ((addr + 1) & 0x00ff)),
+	};
+	for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+		if ((jit->code_map[candidates[i]] & BUXN_JIT_LIT_OPERAND) != 0) {
+			jit->volatile_map[candidates[i]] = 1;
+		}
+	}
+
+	buxn_jit_flush_blocks(jit);
+}
+
+static const void*
+buxn_jit_compile(buxn_vm_jit_t* jit, uint16_t start) {
+	if (jit->code_pos + BUXN_JIT_BLOCK_RESERVE > BUXN_JIT_CODE_SIZE) { return NULL; }
+
+	jit->vstack_len = 0;
+	jit->num_stubs = 0;
+	memset(jit->refcount, 0, sizeof(jit->refcount));
+
+	const void* entry = jit->code + jit->code_pos;
+	uint16_t pc = start;
+	bool ended = false;
+	for (int i = 0; i < BUXN_JIT_MAX_BLOCK_OPS && !ended; ++i) {
+		ended = buxn_jit_compile_op(jit, &pc);
+	}
+	if (!ended) {
+		buxn_jit_flush(jit);
+		buxn_jit_emit_jump_to(jit, pc);
+	}
+
+	for (uint32_t i = 0; i < jit->num_stubs; ++i) {
+		buxn_jit_emit_stub(jit, &jit->stubs[i]);
+	}
+
+	jit->blocks[jit->num_blocks++] = (buxn_jit_block_t){
+		.start = start,
+		.size = (uint16_t)(pc - start),
+	};
+	jit->entries[start] = entry;
+	return entry;
+}
+
+// Code is never writable and executable at the same time
+static bool
+buxn_jit_protect(buxn_vm_jit_t* jit, int prot) {
+	if (jit->code_prot == prot) { return true; }
+	if (mprotect(jit->code, BUXN_JIT_CODE_SIZE, prot) != 0) { return false; }
+
+	jit->code_prot = prot;
+	return true;
+}
+
+// Returns NULL if the code cannot be made writable
+static const void*
+buxn_jit_compile_entry(buxn_vm_jit_t* jit, uint16_t pc) {
+	if (!buxn_jit_protect(jit, PROT_READ | PROT_WRITE)) { return NULL; }
+
+	const void* entry = buxn_jit_compile(jit, pc);
+	if (entry == NULL) {
+		// Out of code space
+		buxn_jit_flush_blocks(jit);
+		entry = buxn_jit_compile(jit, pc);
+	}
+
+	return entry;
+}
+
+static void
+buxn_jit_emit_trampolines(buxn_vm_jit_t* jit) {
+	static const uint8_t callee_saved[] = {
+		BUXN_JIT_RBX, BUXN_JIT_RBP, BUXN_JIT_R12, BUXN_JIT_R13, BUXN_JIT_R14, BUXN_JIT_R15,
+	};
+
+	// uint32_t enter(buxn_vm_jit_t* jit, buxn_vm_t* vm, const void* entry)
+	for (size_t i = 0; i < sizeof(callee_saved); ++i) {
+		buxn_jit_emit_rex(jit, 0, 0, 0, callee_saved[i]);
+		buxn_jit_emit8(jit, 0x50 + (callee_saved[i] & 7));
+	}
+	// sub rsp, 8 to align the stack and reserve a scratch slot
+	buxn_jit_emit_rr(jit, BUXN_JIT_REX_W, BUXN_JIT_OPCODE(0x83), 5, BUXN_JIT_RSP);
+	buxn_jit_emit8(jit, 8);
+	// mov rbp, rdi; mov rbx, rsi
+	buxn_jit_emit_rr(jit, BUXN_JIT_REX_W, BUXN_JIT_OPCODE(0x89), BUXN_JIT_RDI, BUXN_JIT_RBP);
+	buxn_jit_emit_rr(jit, BUXN_JIT_REX_W, BUXN_JIT_OPCODE(0x89), BUXN_JIT_RSI, BUXN_JIT_RBX);
+	// lea r12, [rbp + entries]; lea r13, [rbp + code_map]
+	buxn_jit_emit_rm(
+		jit,
+		BUXN_JIT_REX_W,
+		BUXN_JIT_OPCODE(0x8d),
+		BUXN_JIT_R12,
+		BUXN_JIT_MEM(BUXN_JIT_RBP, BUXN_JIT_NO_INDEX, BUXN_JIT_CTX_OFFSET(entries))
+	);
+	buxn_jit_emit_rm(
+		jit,
+		BUXN_JIT_REX_W,
+		BUXN_JIT_OPCODE(0x8d),
+		BUXN_JIT_R13,
+		BUXN_JIT_MEM(BUXN_JIT_RBP, BUXN_JIT_NO_INDEX, BUXN_JIT_CTX_OFFSET(code_map))
+	);
+	buxn_jit_reload_state(jit);
+	// jmp rdx
+	buxn_jit_emit8(jit, 0xff);
+	buxn_jit_emit8(jit, 0xe2);
+
+	// leave: eax holds the exit code
+	jit->leave_pos = jit->code_pos;
+	buxn_jit_sync_state(jit);
+	// add rsp, 8
+	buxn_jit_emit_rr(jit, BUXN_JIT_REX_W, BUXN_JIT_OPCODE(0x83), 0, BUXN_JIT_RSP);
+	buxn_jit_emit8(jit, 8);
+	for (size_t i = sizeof(callee_saved); i > 0; --i) {
+		buxn_jit_emit_rex(jit, 0, 0, 0, callee_saved[i - 1]);
+		buxn_jit_emit8(jit, 0x58 + (callee_saved[i - 1] & 7));
+	}
+	// ret
+	buxn_jit_emit8(jit, 0xc3);
+
+	jit->code_start = jit->code_pos;
+}
+
+buxn_vm_jit_t*
+buxn_vm_jit_init(struct buxn_vm_s* vm) {
+	buxn_vm_jit_t* jit = mmap(
+		NULL, sizeof(buxn_vm_jit_t),
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS,
+		-1, 0
+	);
+	if (jit == MAP_FAILED) { return NULL; }
+
+	uint8_t* code = mmap(
+		NULL, BUXN_JIT_CODE_SIZE,
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS,
+		-1, 0
+	);
+	if (code == MAP_FAILED) {
+		munmap(jit, sizeof(buxn_vm_jit_t));
+		return NULL;
+	}
+
+	// Anonymous mappings are zero-filled
+	jit->vm = vm;
+	jit->code = code;
+	jit->code_prot = PROT_READ | PROT_WRITE;
+	buxn_jit_emit_trampolines(jit);
+	const void* enter = jit->code;
+	memcpy(&jit->enter, &enter, sizeof(enter));
+
+	// Fail early when executable memory is not allowed (e.g: SELinux
+	// execmem) so the caller uses the interpreter instead
+	if (!buxn_jit_protect(jit, PROT_READ | PROT_EXEC)) {
+		buxn_vm_jit_cleanup(jit);
+		return NULL;
+	}
+
+	return jit;
+}
+
+void
+buxn_vm_jit_cleanup(buxn_vm_jit_t* jit) {
+	munmap(jit->code, BUXN_JIT_CODE_SIZE);
+	munmap(jit, sizeof(buxn_vm_jit_t));
+}
+
+void
+buxn_vm_jit_execute(buxn_vm_jit_t* jit, uint16_t pc) {
+	buxn_vm_t* vm = jit->vm;
+	if (pc == 0) { return; }
+
+	if (vm->config.hook.fn != NULL) {
+		buxn_vm_execute(vm, pc);
+		return;
+	}
+
+	buxn_jit_validate(jit);
+	for (;;) {
+		const void* entry = jit->entries[pc];
+		if (entry == NULL) { entry = buxn_jit_compile_entry(jit, pc); }
+		if (entry == NULL || !buxn_jit_protect(jit, PROT_READ | PROT_EXEC)) {
+			// The state was synced on exit so the interpreter can continue
+			if (vm->config.code_cache != NULL) {
+				buxn_vm_mem_invalidate(vm, 0, BUXN_MEMORY_BANK_SIZE);
+			}
+			buxn_vm_execute_from(vm, pc);
+			return;
+		}
+
+		uint32_t result = jit->enter(jit, vm, entry);
+		pc = (uint16_t)result;
+		switch (result >> 16) {
+			case BUXN_JIT_EXIT_MISS:
+				break;
+			case BUXN_JIT_EXIT_BRK:
+				// The interpreter shares the memory
+				if (vm->config.code_cache != NULL) {
+					buxn_vm_mem_invalidate(vm, 0, BUXN_MEMORY_BANK_SIZE);
+				}
+				return;
+			case BUXN_JIT_EXIT_CODE_WRITE:
+				buxn_jit_handle_code_write(jit);
+				break;
+			case BUXN_JIT_EXIT_VALIDATE:
+				buxn_jit_validate(jit);
+				break;
+		}
+	}
+}
+
+#else
+
+buxn_vm_jit_t*
+buxn_vm_jit_init(struct buxn_vm_s* vm) {
+	(void)vm;
+	return NULL;
+}
+
+void
+buxn_vm_jit_cleanup(buxn_vm_jit_t* jit) {
+	(void)jit;
+}
+
+void
+buxn_vm_jit_execute(buxn_vm_jit_t* jit, uint16_t pc) {
+	(void)jit;
+	(void)pc;
+}
+
+#endif
@@ -0,0 +1,122 @@
+#include <buxn/vm/profile.h>
+#include <buxn/vm/opcodes.h>
+#include <inttypes.h>
+
+#define BUXN_STRINGIFY(X) BUXN_STRINGIFY_1(X)
+#define BUXN_STRINGIFY_1(X) #X
+
+#define DEFINE_OPCODE_NAME(NAME, VALUE) \
+	[VALUE] = BUXN_STRINGIFY(NAME),
+
+static const char* buxn_vm_profile_opcode_names[256] = {
+	BUXN_OPCODE_DISPATCH(DEFINE_OPCODE_NAME)
+};
+
+static bool
+buxn_vm_profile_read_stack(buxn_vm_profile_t* profile, const char* frames_str, uint64_t count) {
+	uint16_t frames[BUXN_VM_PROFILE_MAX_STACK_DEPTH];
+	uint8_t depth = 0;
+	unsigned int addr;
+	int offset;
+	while (sscanf(frames_str, " %x%n", &addr, &offset) == 1) {
+		if (depth >= BUXN_VM_PROFILE_MAX_STACK_DEPTH || addr >= BUXN_MEMORY_BANK_SIZE) {
+			return false;
+		}
+		frames[depth++] = (uint16_t)addr;
+		frames_str += offset;
+	}
+	if (depth == 0) { return false; }
+
+	buxn_vm_stack_sample_t* sample = buxn_vm_profile_stack(profile, frames, depth);
+	if (sample != NULL) {
+		sample->count += count;
+	} else {
+		profile->num_dropped_samples += count;
+	}
+	return true;
+}
+
+bool
+buxn_vm_profile_write(const buxn_vm_profile_t* profile, FILE* file) {
+	for (int i = 0; i < 256; ++i) {
+		if (profile->opcode_counts[i] == 0) { continue; }
+
+		fprintf(
+			file,
+			"opcode %02x %s %" PRIu64 "\n",
+			i, buxn_vm_profile_opcode_names[i], profile->opcode_counts[i]
+		);
+	}
+
+	for (uint32_t i = 0; i < BUXN_MEMORY_BANK_SIZE; ++i) {
+		if (profile->pc_counts[i] == 0) { continue; }
+
+		fprintf(file, "pc %04x %" PRIu64 "\n", i, profile->pc_counts[i]);
+	}
+
+	for (int i = 0; i < BUXN_VM_PROFILE_MAX_CALL_EDGES; ++i) {
+		const buxn_vm_call_edge_t* edge = &profile->call_edges[i];
+		if (edge->count == 0) { continue; }
+
+		fprintf(file, "call %04x %04x %" PRIu64 "\n", edge->from, edge->to, edge->count);
+	}
+
+	if (profile->num_dropped_calls > 0) {
+		fprintf(file, "dropped-calls %" PRIu64 "\n", profile->num_dropped_calls);
+	}
+
+	for (int i = 0; i < BUXN_VM_PROFILE_MAX_STACKS; ++i) {
+		const buxn_vm_stack_sample_t* sample = &profile->stacks[i];
+		if (sample->count == 0) { continue; }
+
+		fprintf(file, "stack %" PRIu64, sample->count);
+		for (uint8_t j = 0; j < sample->depth; ++j) {
+			fprintf(file, " %04x", sample->frames[j]);
+		}
+		fprintf(file, "\n");
+	}
+
+	if (profile->num_dropped_samples > 0) {
+		fprintf(file, "dropped-samples %" PRIu64 "\n", profile->num_dropped_samples);
+	}
+
+	return !ferror(file);
+}
+
+bool
+buxn_vm_profile_read(buxn_vm_profile_t* profile, FILE* file) {
+	char line[256];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		unsigned int a, b;
+		uint64_t count;
+		char name[16];
+		int offset;
+		if (sscanf(line, "opcode %x %15s %" SCNu64, &a, name, &count) == 3 && a < 256) {
+			profile->opcode_counts[a] += count;
+		} else if (sscanf(line, "pc %x %" SCNu64, &a, &count) == 2 && a < BUXN_MEMORY_BANK_SIZE) {
+			profile->pc_counts[a] += count;
+		} else if (
+			sscanf(line, "call %x %x %" SCNu64, &a, &b, &count) == 3
+			&& a < BUXN_MEMORY_BANK_SIZE && b < BUXN_MEMORY_BANK_SIZE
+		) {
+			buxn_vm_call_edge_t* edge = buxn_vm_profile_call_edge(profile, (uint16_t)a, (uint16_t)b);
+			if (edge != NULL) {
+				edge->count += count;
+			} else {
+				profile->num_dropped_calls += count;
+			}
+		} else if (sscanf(line, "dropped-calls %" SCNu64, &count) == 1) {
+			profile->num_dropped_calls += count;
+		} else if (sscanf(line, "stack %" SCNu64 "%n", &count, &offset) == 1) {
+			if (!buxn_vm_profile_read_stack(profile, line + offset, count)) {
+				return false;
+			}
+		} else if (sscanf(line, "dropped-samples %" SCNu64, &count) == 1) {
+			profile->num_dropped_samples += count;
+		} else {
+			return false;
+		}
+	}
+
+	return !ferror(file);
+}
@@ -0,0 +1,59 @@
+#include <buxn/vm/rom2c.h>
+#include <string.h>
+
+static void
+buxn_rom2c_interpret(buxn_vm_t* vm, uint16_t pc) {
+	// Nested vectors triggered from within are also interpreted
+	buxn_vm_native_fn_t native = vm->config.native;
+	vm->config.native = NULL;
+	// A computed jump can land on 0
+	buxn_vm_execute_from(vm, pc);
+	vm->config.native = native;
+}
+
+// Translated code is only valid while the bytes it was generated from are
+// left untouched
+static bool
+buxn_rom2c_validate(buxn_vm_t* vm) {
+	uint32_t end = BUXN_RESET_VECTOR + buxn_rom2c_rom_size;
+	for (uint32_t addr = BUXN_RESET_VECTOR; addr < end; ++addr) {
+		uint8_t bits = buxn_rom2c_code_map[addr >> 3];
+		if (bits == 0) {
+			addr |= 7;
+			continue;
+		}
+
+		if (
+			((bits >> (addr & 7)) & 1)
+			&& vm->memory[addr] != buxn_rom2c_rom[addr - BUXN_RESET_VECTOR]
+		) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void
+buxn_rom2c_load_rom(buxn_vm_t* vm) {
+	memcpy(vm->memory + BUXN_RESET_VECTOR, buxn_rom2c_rom, buxn_rom2c_rom_size);
+}
+
+void
+buxn_rom2c_execute(buxn_vm_t* vm, uint16_t pc) {
+	if (pc == 0) { return; }
+
+	bool valid = buxn_rom2c_validate(vm);
+	while (true) {
+		buxn_rom2c_fn_t fn = valid ? buxn_rom2c_lookup(pc) : NULL;
+		if (fn == NULL) {
+			buxn_rom2c_interpret(vm, pc);
+			return;
+		}
+
+		uint32_t next = fn(vm, pc, 0);
+		if ((next & BUXN_ROM2C_BRK) > 0) { return; }
+		if ((next & BUXN_ROM2C_VALIDATE) > 0) { valid = buxn_rom2c_validate(vm); }
+		pc = (uint16_t)next;
+	}
+}
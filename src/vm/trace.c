@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include <buxn/vm/trace.h>
+#include <string.h>
+
+size_t
+buxn_vm_trace_mem_size(uint32_t capacity) {
+	return sizeof(buxn_vm_trace_t) + sizeof(buxn_vm_trace_record_t) * (size_t)capacity;
+}
+
+buxn_vm_trace_t*
+buxn_vm_trace_init(void* mem, uint32_t capacity, uint16_t flags) {
+	memset(mem, 0, buxn_vm_trace_mem_size(capacity));
+	buxn_vm_trace_t* trace = mem;
+	trace->magic = BUXN_VM_TRACE_MAGIC;
+	trace->version = BUXN_VM_TRACE_VERSION;
+	trace->flags = flags;
+	trace->capacity = capacity;
+	atomic_init(&trace->head, 0);
+	return trace;
+}
+
+bool
+buxn_vm_trace_is_valid(const buxn_vm_trace_t* trace, size_t size) {
+	return size >= sizeof(buxn_vm_trace_t)
+		&& trace->magic == BUXN_VM_TRACE_MAGIC
+		&& trace->version == BUXN_VM_TRACE_VERSION
+		&& trace->capacity > 0
+		&& (trace->capacity & (trace->capacity - 1)) == 0
+		&& size >= buxn_vm_trace_mem_size(trace->capacity);
+}
+
+uint32_t
+buxn_vm_trace_copy(
+	const buxn_vm_trace_t* trace,
+	buxn_vm_trace_record_t* records,
+	uint64_t* first_index
+) {
+	uint32_t capacity = trace->capacity;
+	uint32_t mask = capacity - 1;
+	uint64_t end = atomic_load_explicit(&trace->head, memory_order_acquire);
+	// The slot after the newest record may be in the middle of being written
+	uint64_t start = end >= capacity ? end - capacity + 1 : 0;
+	for (uint64_t i = start; i < end; ++i) {
+		records[i - start] = trace->records[i & mask];
+	}
+
+	// Records written during the copy replaced the oldest ones
+	atomic_thread_fence(memory_order_acquire);
+	uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+	uint64_t valid_start = head >= capacity ? head - capacity + 1 : 0;
+	if (valid_start > start) {
+		uint64_t num_dropped = valid_start < end ? valid_start - start : end - start;
+		memmove(records, records + num_dropped, sizeof(records[0]) * (end - start - num_dropped));
+		start += num_dropped;
+	}
+
+	if (first_index != NULL) { *first_index = start; }
+	return (uint32_t)(end - start);
+}
+
+#if defined(_WIN32)
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+buxn_vm_trace_t*
+buxn_vm_trace_map_file(const char* path, uint32_t capacity, uint16_t flags) {
+	size_t size = buxn_vm_trace_mem_size(capacity);
+	HANDLE file = CreateFileA(
+		path,
+		GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL,
+		CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL
+	);
+	if (file == INVALID_HANDLE_VALUE) { return NULL; }
+
+	HANDLE mapping = CreateFileMappingA(
+		file, NULL, PAGE_READWRITE,
+		(DWORD)((uint64_t)size >> 32), (DWORD)size,
+		NULL
+	);
+	CloseHandle(file);
+	if (mapping == NULL) { return NULL; }
+
+	// The view keeps the mapping alive
+	void* mem = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	CloseHandle(mapping);
+	if (mem == NULL) { return NULL; }
+
+	return buxn_vm_trace_init(mem, capacity, flags);
+}
+
+void
+buxn_vm_trace_unmap(buxn_vm_trace_t* trace) {
+	if (trace == NULL) { return; }
+
+	UnmapViewOfFile(trace);
+}
+
+#elif defined(__unix__) || defined(__APPLE__)
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+buxn_vm_trace_t*
+buxn_vm_trace_map_file(const char* path, uint32_t capacity, uint16_t flags) {
+	size_t size = buxn_vm_trace_mem_size(capacity);
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) { return NULL; }
+
+	if (ftruncate(fd, (off_t)size) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	// The mapping keeps the file open
+	void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) { return NULL; }
+
+	return buxn_vm_trace_init(mem, capacity, flags);
+}
+
+void
+buxn_vm_trace_unmap(buxn_vm_trace_t* trace) {
+	if (trace == NULL) { return; }
+
+	munmap(trace, buxn_vm_trace_mem_size(trace->capacity));
+}
+
+#else
+
+buxn_vm_trace_t*
+buxn_vm_trace_map_file(const char* path, uint32_t capacity, uint16_t flags) {
+	(void)path;
+	(void)capacity;
+	(void)flags;
+	return NULL;
+}
+
+void
+buxn_vm_trace_unmap(buxn_vm_trace_t* trace) {
+	(void)trace;
+}
+
+#endif
@@ -1,4 +1,7 @@
 #include <buxn/vm/vm.h>
+#include <buxn/vm/profile.h>
+#include <buxn/vm/trace.h>
+#include <buxn/vm/coverage.h>
 #include <stdbool.h>
 #include <string.h>
 
@@ -8,6 +11,53 @@ buxn_vm_execute_without_hook(buxn_vm_t* vm, uint16_t pc, const buxn_vm_hook_t ho
 static void
 buxn_vm_execute_with_hook(buxn_vm_t* vm, uint16_t pc, const buxn_vm_hook_t hook);
 
+static void
+buxn_vm_execute_filtered(buxn_vm_t* vm, uint16_t pc, const buxn_vm_hook_t hook);
+
+static void
+buxn_vm_execute_profiled(buxn_vm_t* vm, uint16_t pc, const buxn_vm_hook_t hook);
+
+static void
+buxn_vm_execute_traced(buxn_vm_t* vm, uint16_t pc, const buxn_vm_hook_t hook);
+
+static void
+buxn_vm_execute_covered(buxn_vm_t* vm, uint16_t pc, const buxn_vm_hook_t hook);
+
+static buxn_vm_status_t
+buxn_vm_execute_budgeted(buxn_vm_t* vm, uint16_t pc, const buxn_vm_hook_t hook, uint32_t budget);
+
+#if defined(__GNUC__) || defined(__clang__)
+// The code cache stores label addresses so it requires computed goto
+#define BUXN_VM_HAS_CODE_CACHE 1
+
+static void
+buxn_vm_execute_cached(buxn_vm_t* vm, uint16_t pc, const buxn_vm_hook_t hook);
+#else
+#define BUXN_VM_HAS_CODE_CACHE 0
+#endif
+
+// Build with -DBUXN_VM_ENABLE_FUSION=0 to only cache single instructions
+#ifndef BUXN_VM_ENABLE_FUSION
+#define BUXN_VM_ENABLE_FUSION 1
+#endif
+
+// Build with -DBUXN_VM_ENABLE_TOS_CACHE=1 to keep the top of the working stack
+// in a local.
+// The stack memory stays bit-exact, including when it wraps.
+#ifndef BUXN_VM_ENABLE_TOS_CACHE
+#define BUXN_VM_ENABLE_TOS_CACHE 0
+#endif
+
+#define BUXN_VM_TOS_CACHE BUXN_VM_ENABLE_TOS_CACHE
+
+#if BUXN_VM_ENABLE_FUSION
+// The longest fused sequence is `DUP2 #0000 EQU2 ?target`
+#define BUXN_VM_MAX_OP_SIZE 8
+#else
+// Instructions are at most 3 bytes long: opcode and a 2 byte operand
+#define BUXN_VM_MAX_OP_SIZE 3
+#endif
+
 void
 buxn_vm_reset(buxn_vm_t* vm, uint8_t reset_flags) {
 	if ((reset_flags & BUXN_VM_RESET_STACK) > 0) {
@@ -23,10 +73,97 @@ buxn_vm_reset(buxn_vm_t* vm, uint8_t reset_flags) {
 
 	if ((reset_flags & BUXN_VM_RESET_ZERO_PAGE) > 0) {
 		memset(vm->memory, 0, BUXN_RESET_VECTOR);
+		buxn_vm_mem_invalidate(vm, 0, BUXN_RESET_VECTOR);
 	}
 
 	if ((reset_flags & BUXN_VM_RESET_HIGH_MEM) > 0) {
-		memset(vm->memory + BUXN_RESET_VECTOR, 0, vm->config.memory_size - BUXN_RESET_VECTOR);
+		uint32_t size = vm->config.memory_size - BUXN_RESET_VECTOR;
+		if (vm->config.zero_memory != NULL) {
+			vm->config.zero_memory(vm, BUXN_RESET_VECTOR, size);
+		} else {
+			memset(vm->memory + BUXN_RESET_VECTOR, 0, size);
+		}
+		buxn_vm_mem_invalidate(vm, BUXN_RESET_VECTOR, size);
+	}
+}
+
+static void
+buxn_vm_code_cache_invalidate(buxn_vm_t* vm, uint32_t addr, uint32_t size) {
+	buxn_vm_code_cache_t* cache = vm->config.code_cache;
+	if (cache == NULL || size == 0 || addr >= BUXN_MEMORY_BANK_SIZE) { return; }
+
+	// Only the first bank can be executed
+	uint32_t end = addr + size;
+	end = end <= BUXN_MEMORY_BANK_SIZE ? end : BUXN_MEMORY_BANK_SIZE;
+	for (uint32_t i = addr; i < end; ++i) {
+		cache->ops[i].handler = cache->miss_handler;
+	}
+
+	// Instructions starting before the range may have their operand inside it
+	for (uint16_t i = 1; i < BUXN_VM_MAX_OP_SIZE; ++i) {
+		cache->ops[(uint16_t)(addr - i)].handler = cache->miss_handler;
+	}
+}
+
+void
+buxn_vm_mem_invalidate(buxn_vm_t* vm, uint32_t addr, uint32_t size) {
+	uint32_t memory_size = vm->config.memory_size;
+	if (size == 0 || addr >= memory_size) { return; }
+
+	uint32_t end = addr + size;
+	end = end <= memory_size ? end : memory_size;
+	uint32_t first_page = addr >> BUXN_VM_PAGE_SHIFT;
+	uint32_t last_page = (end - 1) >> BUXN_VM_PAGE_SHIFT;
+	memset(vm->dirty_pages + first_page, 1, last_page - first_page + 1);
+
+	buxn_vm_code_cache_invalidate(vm, addr, size);
+}
+
+void
+buxn_vm_snapshot(buxn_vm_t* vm, buxn_vm_snapshot_t* snapshot) {
+	snapshot->pc = vm->pc;
+	snapshot->wsp = vm->wsp;
+	snapshot->rsp = vm->rsp;
+	memcpy(snapshot->ws, vm->ws, sizeof(vm->ws));
+	memcpy(snapshot->rs, vm->rs, sizeof(vm->rs));
+	memcpy(snapshot->device, vm->device, sizeof(vm->device));
+	memcpy(snapshot->memory, vm->memory, vm->config.memory_size);
+	memset(vm->dirty_pages, 0, sizeof(vm->dirty_pages));
+}
+
+void
+buxn_vm_restore(buxn_vm_t* vm, const buxn_vm_snapshot_t* snapshot, uint8_t restore_flags) {
+	if ((restore_flags & BUXN_VM_RESET_STACK) > 0) {
+		vm->pc = snapshot->pc;
+		vm->wsp = snapshot->wsp;
+		vm->rsp = snapshot->rsp;
+		memcpy(vm->ws, snapshot->ws, sizeof(vm->ws));
+		memcpy(vm->rs, snapshot->rs, sizeof(vm->rs));
+	}
+
+	if ((restore_flags & BUXN_VM_RESET_DEVICE) > 0) {
+		memcpy(vm->device, snapshot->device, sizeof(vm->device));
+	}
+
+	uint32_t memory_size = vm->config.memory_size;
+	uint32_t start = (restore_flags & BUXN_VM_RESET_ZERO_PAGE) > 0 ? 0 : BUXN_RESET_VECTOR;
+	uint32_t end = (restore_flags & BUXN_VM_RESET_HIGH_MEM) > 0 ? memory_size : BUXN_RESET_VECTOR;
+	for (uint32_t page_start = 0; page_start < end; page_start += BUXN_VM_PAGE_SIZE) {
+		uint32_t page = page_start >> BUXN_VM_PAGE_SHIFT;
+		if (!vm->dirty_pages[page]) { continue; }
+
+		uint32_t page_end = page_start + BUXN_VM_PAGE_SIZE;
+		page_end = page_end <= memory_size ? page_end : memory_size;
+		uint32_t copy_start = page_start >= start ? page_start : start;
+		uint32_t copy_end = page_end <= end ? page_end : end;
+		if (copy_start >= copy_end) { continue; }
+
+		memcpy(vm->memory + copy_start, snapshot->memory + copy_start, copy_end - copy_start);
+		buxn_vm_code_cache_invalidate(vm, copy_start, copy_end - copy_start);
+		// The first page also holds the zero page which may have been left out
+		if (copy_start == page_start && copy_end == page_end) {
+			vm->dirty_pages[page] = 0;
+		}
 	}
 }
 
@@ -34,15 +171,88 @@ void
 buxn_vm_execute(buxn_vm_t* vm, uint16_t pc) {
 	if (pc == 0) { return; }
 
+	buxn_vm_execute_from(vm, pc);
+}
+
+void
+buxn_vm_execute_from(buxn_vm_t* vm, uint16_t pc) {
 	// Creating 2 separate versions is the only way to have optimized opcode
 	// dispatch when no debug hook is attached
-	if (vm->config.hook.fn != NULL) {
+	if (vm->config.hook.fn != NULL && vm->config.hook_filter != NULL) {
+		buxn_vm_execute_filtered(vm, pc, vm->config.hook);
+	} else if (vm->config.hook.fn != NULL) {
 		buxn_vm_execute_with_hook(vm, pc, vm->config.hook);
+	} else if (vm->config.trace != NULL) {
+		buxn_vm_execute_traced(vm, pc, vm->config.hook);
+	} else if (vm->config.profile != NULL) {
+		buxn_vm_execute_profiled(vm, pc, vm->config.hook);
+	} else if (vm->config.coverage != NULL) {
+		buxn_vm_execute_covered(vm, pc, vm->config.hook);
+	} else if (vm->config.native != NULL) {
+		vm->config.native(vm, pc);
+#if BUXN_VM_HAS_CODE_CACHE
+	} else if (vm->config.code_cache != NULL) {
+		buxn_vm_execute_cached(vm, pc, vm->config.hook);
+#endif
 	} else {
 		buxn_vm_execute_without_hook(vm, pc, vm->config.hook);
 	}
 }
 
+buxn_vm_status_t
+buxn_vm_execute_budget(buxn_vm_t* vm, uint16_t vector, uint32_t max_instructions) {
+	if (vector == 0) { return BUXN_VM_FINISHED; }
+
+	return buxn_vm_execute_budgeted(vm, vector, vm->config.hook, max_instructions);
+}
+
+buxn_vm_status_t
+buxn_vm_resume_budget(buxn_vm_t* vm, uint32_t max_instructions) {
+	// Code can jump into the zero page so pc can be 0
+	return buxn_vm_execute_budgeted(vm, vm->pc, vm->config.hook, max_instructions);
+}
+
+// Requires the state to be saved
+static bool
+buxn_vm_hook_filter_match(buxn_vm_t* vm, const buxn_vm_hook_filter_t* filter, uint16_t pc) {
+	if (filter->all || buxn_vm_bit_test(filter->exec, pc)) { return true; }
+
+	uint8_t opcode = vm->memory[pc];
+	if (filter->opcodes[opcode] == BUXN_VM_HOOK_FILTER_ALWAYS) { return true; }
+	if (filter->opcodes[opcode] != BUXN_VM_HOOK_FILTER_WATCH) { return false; }
+
+	// The target is still on the stack, the keep flag does not matter
+	bool return_stack = (opcode & 0x40) > 0;
+	bool short_mode = (opcode & 0x20) > 0;
+	const uint8_t* stack = return_stack ? vm->rs : vm->ws;
+	uint8_t sp = return_stack ? vm->rsp : vm->wsp;
+	uint8_t stack_top = stack[(uint8_t)(sp - 1)];
+	uint16_t addr;
+	switch (opcode & 0x1f) {
+		case 0x10:  // LDZ
+		case 0x11:  // STZ
+			addr = stack_top;
+			break;
+		case 0x12:  // LDR
+		case 0x13:  // STR
+			addr = (uint16_t)((int32_t)pc + 1 + (int32_t)(int8_t)stack_top);
+			break;
+		case 0x14:  // LDA
+		case 0x15:  // STA
+			addr = (uint16_t)(((uint16_t)stack[(uint8_t)(sp - 2)] << 8) | stack_top);
+			break;
+		case 0x16:  // DEI
+		case 0x17:  // DEO
+			return buxn_vm_bit_test(filter->dev_ports, stack_top)
+				|| (short_mode && buxn_vm_bit_test(filter->dev_ports, (uint8_t)(stack_top + 1)));
+		default:
+			return false;
+	}
+
+	return buxn_vm_bit_test(filter->mem_pages, addr >> BUXN_VM_HOOK_FILTER_PAGE_SHIFT)
+		|| (short_mode && buxn_vm_bit_test(filter->mem_pages, (uint16_t)(addr + 1) >> BUXN_VM_HOOK_FILTER_PAGE_SHIFT));
+}
+
 #define BUXN_VM_HOOK()
 #define BUXN_VM_EXECUTE buxn_vm_execute_without_hook
 #include "exec.h"
@@ -51,5 +261,100 @@ buxn_vm_execute(buxn_vm_t* vm, uint16_t pc) {
 #undef BUXN_VM_EXECUTE
 
 #define BUXN_VM_EXECUTE buxn_vm_execute_with_hook
-#define BUXN_VM_HOOK() BUXN_SAVE_STATE(); hook.fn(vm, pc, hook.userdata);
+#define BUXN_VM_HOOK() BUXN_SAVE_STATE(); hook.fn(vm, pc, hook.userdata); BUXN_TOS_FILL();
+#include "exec.h"
+
+#undef BUXN_VM_HOOK
+#undef BUXN_VM_EXECUTE
+#undef BUXN_VM_HOOK_FILTER
+
+// Most opcodes only cost a lookup in the exec bitmap and the opcode table
+#define BUXN_VM_EXECUTE buxn_vm_execute_filtered
+#define BUXN_VM_HOOK() \
+	if ( \
+		hook_entry \
+		|| hook_filter->all \
+		|| hook_filter->opcodes[mem[pc]] \
+		|| buxn_vm_bit_test(hook_filter->exec, pc) \
+	) { \
+		BUXN_SAVE_STATE(); \
+		if (hook_entry || buxn_vm_hook_filter_match(vm, hook_filter, pc)) { \
+			hook.fn(vm, pc, hook.userdata); \
+		} \
+		hook_entry = false; \
+		BUXN_TOS_FILL(); \
+	}
+#define BUXN_VM_HOOK_FILTER 1
+#include "exec.h"
+#undef BUXN_VM_HOOK_FILTER
+
+#if BUXN_VM_HAS_CODE_CACHE
+#undef BUXN_VM_HOOK
+#undef BUXN_VM_EXECUTE
+#undef BUXN_VM_CODE_CACHE
+#undef BUXN_VM_FUSION
+
+#define BUXN_VM_EXECUTE buxn_vm_execute_cached
+#define BUXN_VM_HOOK()
+#define BUXN_VM_CODE_CACHE 1
+#define BUXN_VM_FUSION BUXN_VM_ENABLE_FUSION
+#include "exec.h"
+#endif
+
+#undef BUXN_VM_HOOK
+#undef BUXN_VM_EXECUTE
+#undef BUXN_VM_CODE_CACHE
+#undef BUXN_VM_FUSION
+#undef BUXN_VM_PROFILE
+
+// Counters are updated inline, without going through the hook
+#define BUXN_VM_EXECUTE buxn_vm_execute_profiled
+#define BUXN_VM_HOOK()
+#define BUXN_VM_CODE_CACHE 0
+#define BUXN_VM_FUSION 0
+#define BUXN_VM_PROFILE 1
+#include "exec.h"
+
+#undef BUXN_VM_HOOK
+#undef BUXN_VM_EXECUTE
+#undef BUXN_VM_PROFILE
+#undef BUXN_VM_TRACE
+
+// Like the profiler, every opcode goes through the plain dispatch
+#define BUXN_VM_EXECUTE buxn_vm_execute_traced
+#define BUXN_VM_HOOK()
+#define BUXN_VM_PROFILE 0
+#define BUXN_VM_TRACE 1
+#include "exec.h"
+
+#undef BUXN_VM_HOOK
+#undef BUXN_VM_EXECUTE
+#undef BUXN_VM_TRACE
+#undef BUXN_VM_COVERAGE
+
+// Cheap enough to be left on when running tests
+#define BUXN_VM_EXECUTE buxn_vm_execute_covered
+#define BUXN_VM_HOOK()
+#define BUXN_VM_TRACE 0
+#define BUXN_VM_COVERAGE 1
+#include "exec.h"
+
+#undef BUXN_VM_HOOK
+#undef BUXN_VM_EXECUTE
+#undef BUXN_VM_PROFILE
+#undef BUXN_VM_TRACE
+#undef BUXN_VM_COVERAGE
+#undef BUXN_VM_BUDGET
+
+// Already slowed down by the counter so the hook is checked at runtime
+#define BUXN_VM_EXECUTE buxn_vm_execute_budgeted
+#define BUXN_VM_HOOK() \
+	if (hook.fn != NULL) { \
+		BUXN_SAVE_STATE(); \
+		hook.fn(vm, pc, hook.userdata); \
+		BUXN_TOS_FILL(); \
+	}
+#define BUXN_VM_CODE_CACHE 0
+#define BUXN_VM_FUSION 0
+#define BUXN_VM_BUDGET 1
 #include "exec.h"
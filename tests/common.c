@@ -1,6 +1,8 @@
 #include "common.h"
 #include <buxn/vm/vm.h>
 #include <buxn/devices/system.h>
+#include <buxn/devices/screen.h>
+#include <buxn/devices/audio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <blog.h>
@@ -206,6 +208,10 @@ buxn_chess_deo(
 uint8_t
 buxn_vm_dei(buxn_vm_t* vm, uint8_t address) {
 	buxn_test_devices_t* devices = vm->config.userdata;
+	if (devices->ports != NULL) {
+		return buxn_port_table_dei(devices->ports, vm, address);
+	}
+
 	uint8_t device_id = buxn_device_id(address);
 	switch (device_id) {
 		case BUXN_DEVICE_SYSTEM:
@@ -222,6 +228,11 @@ buxn_vm_dei(buxn_vm_t* vm, uint8_t address) {
 void
 buxn_vm_deo(buxn_vm_t* vm, uint8_t address) {
 	buxn_test_devices_t* devices = vm->config.userdata;
+	if (devices->ports != NULL) {
+		buxn_port_table_deo(devices->ports, vm, address);
+		return;
+	}
+
 	uint8_t device_id = buxn_device_id(address);
 	switch (device_id) {
 		case BUXN_DEVICE_SYSTEM:
@@ -268,3 +279,21 @@ buxn_console_handle_error(struct buxn_vm_s* vm, buxn_console_t* device, char c)
 	(void)device;
 	fputc(c, stderr);
 }
+
+buxn_screen_t*
+buxn_screen_request_resize(
+	struct buxn_vm_s* vm,
+	buxn_screen_t* screen,
+	uint16_t width, uint16_t height
+) {
+	(void)vm;
+	(void)width;
+	(void)height;
+	return screen;
+}
+
+void
+buxn_audio_send(struct buxn_vm_s* vm, const buxn_audio_message_t* message) {
+	(void)vm;
+	(void)message;
+}
@@ -7,6 +7,7 @@
 #include <buxn/asm/chess.h>
 #include <buxn/devices/console.h>
 #include <buxn/devices/mouse.h>
+#include <buxn/devices/ports.h>
 
 typedef struct {
 	const char* name;
@@ -30,6 +31,8 @@ struct buxn_asm_ctx_s {
 typedef struct {
 	buxn_console_t console;
 	buxn_mouse_t mouse;
+	// Used in place of the devices above when set
+	buxn_port_table_t* ports;
 
 	void (*system_dbg)(struct buxn_vm_s* vm, uint8_t value);
 } buxn_test_devices_t;
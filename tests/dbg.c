@@ -300,6 +300,54 @@ BTEST(dbg, mem_exec_brkp) {
 	ASSERT_END_EXEC();
 }
 
+BTEST(dbg, mem_exec_brkp_filtered) {
+	buxn_vm_t* vm = fixture.vm;
+	vm->config.hook_filter = buxn_dbg_vm_hook_filter(fixture.dbg);
+	BTEST_ASSERT(load_file(vm, "door.tal"));
+	run_vm_async(vm);
+
+	ASSERT_BEGIN_EXEC(BUXN_RESET_VECTOR);
+
+	ASSERT_BEGIN_BREAK(BUXN_DBG_BRKP_NONE);
+	{
+		dbg_command((buxn_dbg_cmd_t){
+			.type = BUXN_DBG_CMD_BRKP_SET,
+			.brkp_set = {
+				.id = 0,
+				.brkp = {
+					.addr = 0x0102,  // INCk
+					.mask = BUXN_DBG_BRKP_EXEC | BUXN_DBG_BRKP_PAUSE | BUXN_DBG_BRKP_MEM,
+				},
+			},
+		});
+
+		dbg_command((buxn_dbg_cmd_t){
+			.type = BUXN_DBG_CMD_RESUME,
+		});
+	}
+	ASSERT_END_BREAK();
+
+	ASSERT_BEGIN_BREAK(0);
+	{
+		uint16_t pc;
+		dbg_command((buxn_dbg_cmd_t){
+			.type = BUXN_DBG_CMD_INFO,
+			.info = {
+				.type = BUXN_DBG_INFO_PC,
+				.pc = &pc,
+			},
+		});
+		BTEST_ASSERT_EQ(SHORT_HEX_FMT, pc, 0x0102);
+
+		dbg_command((buxn_dbg_cmd_t){
+			.type = BUXN_DBG_CMD_RESUME,
+		});
+	}
+	ASSERT_END_BREAK();
+
+	ASSERT_END_EXEC();
+}
+
 BTEST(dbg, mem_exec_brkp_no_pause) {
 	buxn_vm_t* vm = fixture.vm;
 	BTEST_ASSERT(load_file(vm, "door.tal"));
@@ -0,0 +1,77 @@
+#include <btest.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include <buxn/vm/vm.h>
+#include <buxn/vm/rom2c.h>
+
+// The translation of rom2c.tal is generated at build time and linked in
+
+static struct {
+	buxn_vm_t* interpreted;
+	buxn_vm_t* translated;
+	buxn_test_devices_t devices[2];
+} fixture;
+
+static buxn_vm_t*
+create_vm(buxn_test_devices_t* devices, buxn_vm_native_fn_t native) {
+	buxn_vm_t* vm = malloc(sizeof(buxn_vm_t) + BUXN_MEMORY_BANK_SIZE);
+	devices->system_dbg = NULL;
+	devices->ports = NULL;
+	vm->config = (buxn_vm_config_t){
+		.memory_size = BUXN_MEMORY_BANK_SIZE,
+		.userdata = devices,
+		.native = native,
+	};
+	buxn_vm_reset(vm, BUXN_VM_RESET_ALL);
+	buxn_console_init(vm, &devices->console, 0, NULL);
+	return vm;
+}
+
+static void
+init_per_test(void) {
+	fixture.interpreted = create_vm(&fixture.devices[0], NULL);
+	fixture.translated = create_vm(&fixture.devices[1], buxn_rom2c_execute);
+}
+
+static void
+cleanup_per_test(void) {
+	free(fixture.interpreted);
+	free(fixture.translated);
+}
+
+static btest_suite_t rom2c = {
+	.name = "rom2c",
+
+	.init_per_test = init_per_test,
+	.cleanup_per_test = cleanup_per_test,
+};
+
+static void
+run(buxn_vm_t* vm) {
+	buxn_rom2c_load_rom(vm);
+	buxn_vm_execute(vm, BUXN_RESET_VECTOR);
+
+	uint16_t vector = buxn_vm_load2(vm->device, BUXN_DEVICE_CONSOLE, 0xff);
+	buxn_vm_execute(vm, vector);
+	buxn_vm_execute(vm, vector);
+}
+
+BTEST(rom2c, matches_interpreter) {
+	buxn_vm_t* interpreted = fixture.interpreted;
+	buxn_vm_t* translated = fixture.translated;
+	run(interpreted);
+	run(translated);
+
+	// The fixture leaves a short on the stack and writes to a device
+	BTEST_EXPECT_EQUAL("%d", interpreted->wsp, 2);
+	BTEST_EXPECT_EQUAL("%d", interpreted->device[0xf0], 0x42);
+
+	BTEST_EXPECT_EQUAL("%d", translated->wsp, interpreted->wsp);
+	BTEST_EXPECT_EQUAL("%d", translated->rsp, interpreted->rsp);
+	// Only what is on the stacks is observable, popped bytes may differ
+	BTEST_EXPECT(memcmp(translated->ws, interpreted->ws, interpreted->wsp) == 0);
+	BTEST_EXPECT(memcmp(translated->rs, interpreted->rs, interpreted->rsp) == 0);
+	BTEST_EXPECT(memcmp(translated->device, interpreted->device, BUXN_DEVICE_MEM_SIZE) == 0);
+	BTEST_EXPECT(memcmp(translated->memory, interpreted->memory, BUXN_MEMORY_BANK_SIZE) == 0);
+}
@@ -0,0 +1,429 @@
+#include <btest.h>
+#include <barena.h>
+#include <string.h>
+#include <buxn/vm/vm.h>
+#include <buxn/devices/screen.h>
+
+#define WIDTH 37
+#define HEIGHT 29
+
+static struct {
+	barena_pool_t pool;
+	barena_t arena;
+	buxn_vm_t* vm;
+	buxn_screen_t* screen;
+	buxn_screen_t* expected;
+	buxn_screen_t* packed;
+	uint32_t rng;
+} fixture;
+
+static void
+init_per_suite(void) {
+	barena_pool_init(&fixture.pool, 1);
+}
+
+static void
+cleanup_per_suite(void) {
+	barena_pool_cleanup(&fixture.pool);
+}
+
+static buxn_screen_t*
+make_screen(bool packed) {
+	buxn_screen_info_t info = buxn_screen_info(WIDTH, HEIGHT);
+	size_t mem_size = packed ? info.packed_screen_mem_size : info.screen_mem_size;
+	buxn_screen_t* screen = barena_memalign(&fixture.arena, mem_size, _Alignof(buxn_screen_t));
+	memset(screen, 0, sizeof(*screen));
+	screen->packed = packed;
+	buxn_screen_resize(screen, WIDTH, HEIGHT);
+	return screen;
+}
+
+static void
+init_per_test(void) {
+	barena_init(&fixture.arena, &fixture.pool);
+	fixture.vm = barena_memalign(
+		&fixture.arena,
+		sizeof(buxn_vm_t) + BUXN_MEMORY_BANK_SIZE,
+		_Alignof(buxn_vm_t)
+	);
+	fixture.vm->config = (buxn_vm_config_t){
+		.memory_size = BUXN_MEMORY_BANK_SIZE,
+	};
+	buxn_vm_reset(fixture.vm, BUXN_VM_RESET_ALL);
+	fixture.screen = make_screen(false);
+	fixture.expected = make_screen(false);
+	fixture.packed = make_screen(true);
+	fixture.rng = 0x12345678;
+}
+
+static void
+cleanup_per_test(void) {
+	barena_reset(&fixture.arena);
+}
+
+static btest_suite_t screen = {
+	.name = "screen",
+
+	.init_per_suite = init_per_suite,
+	.cleanup_per_suite = cleanup_per_suite,
+
+	.init_per_test = init_per_test,
+	.cleanup_per_test = cleanup_per_test,
+};
+
+static uint8_t
+random_byte(void) {
+	fixture.rng = fixture.rng * 1664525u + 1013904223u;
+	return (uint8_t)(fixture.rng >> 24);
+}
+
+static const uint8_t BUXN_BLENDING_REFERENCE[4][16] = {
+	{0, 0, 0, 0, 1, 0, 1, 1, 2, 2, 0, 2, 3, 3, 3, 0},
+	{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3},
+	{1, 2, 3, 1, 1, 2, 3, 1, 1, 2, 3, 1, 1, 2, 3, 1},
+	{2, 3, 1, 2, 2, 3, 1, 2, 2, 3, 1, 2, 2, 3, 1, 2}
+};
+
+// The per-pixel sprite drawing of the upstream screen device
+static void
+reference_sprite(buxn_vm_t* vm, buxn_screen_t* device) {
+	int ctrl = vm->device[0x2f];
+	int blend = ctrl & 0xf, opaque = blend % 5;
+	int fx = ctrl & 0x10 ? -1 : 1, fy = ctrl & 0x20 ? -1 : 1;
+	int qfx = fx > 0 ? 7 : 0, qfy = fy < 0 ? 7 : 0;
+	int dxy = fy * device->rDX, dyx = fx * device->rDY;
+	int wmar = device->width + 8, wmar2 = device->width + 16;
+	int hmar2 = device->height + 16;
+	int i, ax, ay, qx, qy, x = device->rX, y = device->rY;
+	uint8_t* layer = ctrl & 0x40 ? device->fg : device->bg;
+	int addr_incr = device->rMA << (ctrl & 0x80 ? 2 : 1);
+	for(i = 0; i <= device->rML; i++, x += dyx, y += dxy, device->rA += addr_incr) {
+		uint16_t xmar = x + 8, ymar = y + 8;
+		uint16_t xmar2 = x + 16, ymar2 = y + 16;
+		if(xmar < wmar && ymar2 < hmar2) {
+			uint8_t *sprite = &vm->memory[device->rA];
+			int by = ymar2 * wmar2;
+			for(ay = ymar * wmar2, qy = qfy; ay < by; ay += wmar2, qy += fy) {
+				int ch1 = sprite[qy], bx = xmar2 + ay;
+				int ch2 = ctrl & 0x80 ? sprite[qy + 8] << 1 : 0;
+				for(ax = xmar + ay, qx = qfx; ax < bx; ax++, qx -= fx) {
+					int color = ((ch1 >> qx) & 1) | ((ch2 >> qx) & 2);
+					if(opaque || color) {
+						layer[ax] = BUXN_BLENDING_REFERENCE[color][blend];
+					}
+				}
+			}
+		}
+	}
+	if(device->rMX) device->rX += device->rDX * fx;
+	if(device->rMY) device->rY += device->rDY * fy;
+}
+
+static void
+set_port2(uint8_t port, int value) {
+	fixture.vm->device[port] = (uint8_t)(value >> 8);
+	fixture.vm->device[port + 1] = (uint8_t)value;
+	buxn_screen_deo(fixture.vm, fixture.screen, port + 1);
+	buxn_screen_deo(fixture.vm, fixture.expected, port + 1);
+}
+
+static void
+set_port(uint8_t port, uint8_t value) {
+	fixture.vm->device[port] = value;
+	buxn_screen_deo(fixture.vm, fixture.screen, port);
+	buxn_screen_deo(fixture.vm, fixture.expected, port);
+}
+
+static bool
+same_layers(void) {
+	size_t length = (WIDTH + 16) * (HEIGHT + 16) * 2;
+	return memcmp(fixture.screen->bg, fixture.expected->bg, length) == 0
+		&& fixture.screen->rX == fixture.expected->rX
+		&& fixture.screen->rY == fixture.expected->rY
+		&& fixture.screen->rA == fixture.expected->rA;
+}
+
+BTEST(screen, sprite) {
+	static const int positions[] = { -9, -8, -5, 0, 3, 8, 21, 28, 29, 33, 36, 37, 40 };
+	static const int num_positions = sizeof(positions) / sizeof(positions[0]);
+
+	size_t length = (WIDTH + 16) * (HEIGHT + 16);
+	for (size_t i = 0; i < length; ++i) {
+		uint8_t color = random_byte() & 0x3;
+		fixture.screen->bg[i] = fixture.expected->bg[i] = color;
+		fixture.screen->fg[i] = fixture.expected->fg[i] = color ^ 0x1;
+	}
+	for (int i = 0; i < 0x100; ++i) {
+		fixture.vm->memory[0x1000 + i] = random_byte();
+	}
+
+	for (int ctrl = 0; ctrl < 0x100; ++ctrl) {
+		for (int py = 0; py < num_positions; ++py) {
+			for (int px = 0; px < num_positions; ++px) {
+				set_port2(0x28, positions[px]);
+				set_port2(0x2a, positions[py]);
+				set_port2(0x2c, 0x1000 + ((ctrl * 7 + px) & 0x7f));
+				set_port(0x26, 0x00);
+
+				fixture.vm->device[0x2f] = (uint8_t)ctrl;
+				buxn_screen_deo(fixture.vm, fixture.screen, 0x2f);
+				reference_sprite(fixture.vm, fixture.expected);
+				BTEST_ASSERT(same_layers());
+			}
+		}
+	}
+}
+
+BTEST(screen, sprite_auto) {
+	for (int i = 0; i < 0x200; ++i) {
+		fixture.vm->memory[0x2000 + i] = random_byte();
+	}
+
+	for (int ctrl = 0; ctrl < 0x100; ctrl += 3) {
+		for (int auto_mode = 0; auto_mode < 0x80; auto_mode += 0x11) {
+			set_port2(0x28, (ctrl % 11) * 4 - 9);
+			set_port2(0x2a, (ctrl % 7) * 5 - 9);
+			set_port2(0x2c, 0x2000 + ctrl);
+			// Length, auto address and both auto axes
+			set_port(0x26, (uint8_t)(auto_mode | 0x07));
+
+			for (int repeat = 0; repeat < 3; ++repeat) {
+				fixture.vm->device[0x2f] = (uint8_t)ctrl;
+				buxn_screen_deo(fixture.vm, fixture.screen, 0x2f);
+				reference_sprite(fixture.vm, fixture.expected);
+				BTEST_ASSERT(same_layers());
+			}
+		}
+	}
+}
+
+static uint8_t
+layer_pixel(const buxn_screen_t* screen, const uint8_t* layer, int x, int y) {
+	if (screen->packed) {
+		int row_size = BUXN_SCREEN_PACKED_ROW_SIZE(screen->width);
+		return (layer[(y + 8) * row_size + (x + 8) / 4] >> ((x + 8) % 4 * 2)) & 3;
+	} else {
+		return layer[(y + 8) * (screen->width + 16) + x + 8];
+	}
+}
+
+static bool
+same_pixels(const buxn_screen_t* lhs, const buxn_screen_t* rhs) {
+	// Including the margin
+	for (int y = -8; y < HEIGHT + 8; ++y) {
+		for (int x = -8; x < WIDTH + 8; ++x) {
+			if (
+				layer_pixel(lhs, lhs->bg, x, y) != layer_pixel(rhs, rhs->bg, x, y)
+				|| layer_pixel(lhs, lhs->fg, x, y) != layer_pixel(rhs, rhs->fg, x, y)
+			) {
+				return false;
+			}
+		}
+	}
+	return lhs->rX == rhs->rX && lhs->rY == rhs->rY && lhs->rA == rhs->rA;
+}
+
+static void
+deo_both(uint8_t port, uint8_t value) {
+	fixture.vm->device[port] = value;
+	buxn_screen_deo(fixture.vm, fixture.screen, port);
+	buxn_screen_deo(fixture.vm, fixture.packed, port);
+}
+
+static void
+deo2_both(uint8_t port, int value) {
+	fixture.vm->device[port] = (uint8_t)(value >> 8);
+	deo_both(port + 1, (uint8_t)value);
+}
+
+BTEST(screen, packed) {
+	static uint32_t targets[2][WIDTH * HEIGHT];
+	static uint32_t packed_targets[2][WIDTH * HEIGHT];
+	uint32_t palette[4] = { 0xff000000, 0xffffffff, 0xff77ddcc, 0xffff6622 };
+
+	for (int i = 0; i < 0x100; ++i) {
+		fixture.vm->memory[0x1000 + i] = random_byte();
+	}
+
+	for (int i = 0; i < 4000; ++i) {
+		uint8_t op = random_byte();
+		deo_both(0x26, random_byte() & 0x37);
+		if (op & 0x80) {
+			// Sprites can be partially or fully off screen
+			deo2_both(0x28, random_byte() % (WIDTH + 24) - 16);
+			deo2_both(0x2a, random_byte() % (HEIGHT + 24) - 16);
+			deo2_both(0x2c, 0x1000 + (random_byte() & 0x7f));
+			deo_both(0x2f, random_byte());
+		} else {
+			// Pixels and fills stay within the margin
+			deo2_both(0x28, random_byte() % (WIDTH + 15) - 8);
+			deo2_both(0x2a, random_byte() % (HEIGHT + 15) - 8);
+			deo_both(0x2e, random_byte() & 0xf3);
+		}
+		BTEST_ASSERT(same_pixels(fixture.screen, fixture.packed));
+
+		if ((i % 16) == 0) {
+			for (int layer = 0; layer < 2; ++layer) {
+				bool rendered = buxn_screen_render(fixture.screen, layer, palette, targets[layer]);
+				bool packed_rendered = buxn_screen_render(fixture.packed, layer, palette, packed_targets[layer]);
+				BTEST_ASSERT(rendered == packed_rendered);
+			}
+			BTEST_ASSERT(memcmp(targets, packed_targets, sizeof(targets)) == 0);
+		}
+	}
+
+	// Nothing was missed by rendering only the changed tiles
+	for (int layer = 0; layer < 2; ++layer) {
+		buxn_screen_render(fixture.screen, layer, palette, targets[layer]);
+		buxn_screen_render(fixture.packed, layer, palette, packed_targets[layer]);
+	}
+	buxn_screen_force_refresh(fixture.screen);
+	buxn_screen_force_refresh(fixture.packed);
+	static uint32_t full_target[WIDTH * HEIGHT];
+	for (int layer = 0; layer < 2; ++layer) {
+		buxn_screen_render(fixture.screen, layer, palette, full_target);
+		BTEST_ASSERT(memcmp(targets[layer], full_target, sizeof(full_target)) == 0);
+		buxn_screen_render(fixture.packed, layer, palette, full_target);
+		BTEST_ASSERT(memcmp(packed_targets[layer], full_target, sizeof(full_target)) == 0);
+	}
+}
+
+static void
+draw_sprite(int x, int y) {
+	fixture.vm->device[0x28] = (uint8_t)(x >> 8);
+	fixture.vm->device[0x29] = (uint8_t)x;
+	buxn_screen_deo(fixture.vm, fixture.screen, 0x29);
+	fixture.vm->device[0x2a] = (uint8_t)(y >> 8);
+	fixture.vm->device[0x2b] = (uint8_t)y;
+	buxn_screen_deo(fixture.vm, fixture.screen, 0x2b);
+	fixture.vm->device[0x2f] = 0x01;
+	buxn_screen_deo(fixture.vm, fixture.screen, 0x2f);
+}
+
+static bool
+rect_equal(buxn_screen_rect_t rect, int x1, int y1, int x2, int y2) {
+	return rect.x1 == x1 && rect.y1 == y1 && rect.x2 == x2 && rect.y2 == y2;
+}
+
+BTEST(screen, dirty_tiles) {
+	static uint32_t target[WIDTH * HEIGHT];
+	uint32_t palette[4] = { 0xff000000, 0xffffffff, 0xff77ddcc, 0xffff6622 };
+	buxn_screen_rect_t spans[BUXN_SCREEN_MAX_SPANS(HEIGHT)];
+
+	// Everything is dirty after a resize
+	BTEST_ASSERT(buxn_screen_render_spans(fixture.screen, BUXN_SCREEN_LAYER_BACKGROUND, palette, target, spans) == 1);
+	BTEST_EXPECT(rect_equal(spans[0], 0, 0, WIDTH, HEIGHT));
+	BTEST_EXPECT(buxn_screen_render_spans(fixture.screen, BUXN_SCREEN_LAYER_BACKGROUND, palette, target, spans) == 0);
+	BTEST_EXPECT(buxn_screen_render(fixture.screen, BUXN_SCREEN_LAYER_FOREGROUND, palette, target));
+
+	// Two corners are two spans, the rest of the target is left alone
+	memset(fixture.vm->memory + 0x1000, 0xff, 8);
+	fixture.vm->device[0x2c] = 0x10;
+	fixture.vm->device[0x2d] = 0x00;
+	buxn_screen_deo(fixture.vm, fixture.screen, 0x2d);
+	for (int i = 0; i < WIDTH * HEIGHT; ++i) { target[i] = 0xdeadbeef; }
+	draw_sprite(0, 0);
+	draw_sprite(WIDTH - 8, HEIGHT - 8);
+	BTEST_ASSERT(buxn_screen_render_spans(fixture.screen, BUXN_SCREEN_LAYER_BACKGROUND, palette, target, spans) == 2);
+	BTEST_EXPECT(rect_equal(spans[0], 0, 0, 8, 8));
+	BTEST_EXPECT(rect_equal(spans[1], 24, 16, WIDTH, HEIGHT));
+	for (int y = 0; y < HEIGHT; ++y) {
+		for (int x = 0; x < WIDTH; ++x) {
+			bool in_span = (x < 8 && y < 8) || (x >= 24 && y >= 16);
+			BTEST_EXPECT((target[y * WIDTH + x] == 0xdeadbeef) == !in_span);
+		}
+	}
+	BTEST_EXPECT(buxn_screen_render_spans(fixture.screen, BUXN_SCREEN_LAYER_FOREGROUND, palette, target, spans) == 0);
+
+	// Adjacent rows of tiles are merged
+	draw_sprite(0, 4);
+	draw_sprite(16, 8);
+	BTEST_ASSERT(buxn_screen_render_spans(fixture.screen, BUXN_SCREEN_LAYER_BACKGROUND, palette, target, spans) == 1);
+	BTEST_EXPECT(rect_equal(spans[0], 0, 0, 24, 16));
+
+	// Off screen
+	draw_sprite(-8, 4);
+	draw_sprite(WIDTH, 0);
+	BTEST_EXPECT(buxn_screen_render_spans(fixture.screen, BUXN_SCREEN_LAYER_BACKGROUND, palette, target, spans) == 0);
+}
+
+static uint32_t
+reference_color(const buxn_screen_t* screen, buxn_screen_layer_type_t layer, const uint32_t* palette, int x, int y) {
+	uint8_t bg = layer_pixel(screen, screen->bg, x, y);
+	uint8_t fg = layer_pixel(screen, screen->fg, x, y);
+	switch (layer) {
+		case BUXN_SCREEN_LAYER_BACKGROUND: return palette[bg];
+		case BUXN_SCREEN_LAYER_FOREGROUND: return palette[fg];
+		default: return palette[fg != 0 ? fg : bg];
+	}
+}
+
+BTEST(screen, render) {
+	static uint32_t target[WIDTH * HEIGHT];
+	uint32_t palette[4] = { 0x00000000, 0xffffffff, 0xff77ddcc, 0xffff6622 };
+	buxn_screen_t* screens[] = { fixture.screen, fixture.packed };
+
+	for (int i = 0; i < 0x100; ++i) {
+		fixture.vm->memory[0x1000 + i] = random_byte();
+	}
+
+	for (int i = 0; i < 200; ++i) {
+		deo_both(0x26, random_byte() & 0x37);
+		deo2_both(0x28, random_byte() % (WIDTH + 8) - 8);
+		deo2_both(0x2a, random_byte() % (HEIGHT + 8) - 8);
+		deo2_both(0x2c, 0x1000 + (random_byte() & 0x7f));
+		deo_both(0x2f, random_byte());
+
+		buxn_screen_layer_type_t layer = (buxn_screen_layer_type_t)(i % 3);
+		for (int j = 0; j < 2; ++j) {
+			buxn_screen_force_refresh(screens[j]);
+			buxn_screen_render(screens[j], layer, palette, target);
+			for (int y = 0; y < HEIGHT; ++y) {
+				for (int x = 0; x < WIDTH; ++x) {
+					BTEST_ASSERT(target[y * WIDTH + x] == reference_color(screens[j], layer, palette, x, y));
+				}
+			}
+		}
+	}
+}
+
+BTEST(screen, copy) {
+	static uint32_t target[WIDTH * HEIGHT];
+	static uint32_t expected_target[WIDTH * HEIGHT];
+	uint32_t palette[4] = { 0xff000000, 0xffffffff, 0xff77ddcc, 0xffff6622 };
+	buxn_screen_rect_t spans[BUXN_SCREEN_MAX_SPANS(HEIGHT)];
+
+	// Start from a copy of another size which was already rendered
+	buxn_screen_info_t info = buxn_screen_info(8, 8);
+	buxn_screen_t* copy = barena_memalign(
+		&fixture.arena,
+		buxn_screen_info(WIDTH, HEIGHT).screen_mem_size,
+		_Alignof(buxn_screen_t)
+	);
+	memset(copy, 0, info.screen_mem_size);
+	buxn_screen_resize(copy, 8, 8);
+	buxn_screen_render(copy, BUXN_SCREEN_LAYER_COMPOSITE, palette, target);
+
+	memset(fixture.vm->memory + 0x1000, 0xff, 8);
+	fixture.vm->device[0x2c] = 0x10;
+	fixture.vm->device[0x2d] = 0x00;
+	buxn_screen_deo(fixture.vm, fixture.screen, 0x2d);
+	draw_sprite(0, 0);
+	buxn_screen_copy(copy, fixture.screen);
+	BTEST_ASSERT(copy->width == WIDTH && copy->height == HEIGHT);
+	BTEST_EXPECT(buxn_screen_render_spans(fixture.screen, BUXN_SCREEN_LAYER_COMPOSITE, palette, target, spans) == 0);
+
+	// Changes of copies which were not rendered add up
+	draw_sprite(WIDTH - 8, HEIGHT - 8);
+	buxn_screen_copy(copy, fixture.screen);
+	BTEST_ASSERT(buxn_screen_render_spans(copy, BUXN_SCREEN_LAYER_COMPOSITE, palette, target, spans) == 1);
+	BTEST_EXPECT(rect_equal(spans[0], 0, 0, WIDTH, HEIGHT));
+	buxn_screen_force_refresh(fixture.screen);
+	buxn_screen_render(fixture.screen, BUXN_SCREEN_LAYER_COMPOSITE, palette, expected_target);
+	BTEST_EXPECT(memcmp(target, expected_target, sizeof(target)) == 0);
+
+	draw_sprite(8, 8);
+	buxn_screen_copy(copy, fixture.screen);
+	BTEST_ASSERT(buxn_screen_render_spans(copy, BUXN_SCREEN_LAYER_COMPOSITE, palette, target, spans) == 1);
+	BTEST_EXPECT(rect_equal(spans[0], 8, 8, 16, 16));
+}
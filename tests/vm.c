@@ -1,9 +1,17 @@
 #include <btest.h>
 #include <barena.h>
 #include <string.h>
+#include <stdlib.h>
 #include "common.h"
 #include <buxn/vm/vm.h>
+#include <buxn/vm/alloc.h>
+#include <buxn/vm/jit.h>
+#include <buxn/vm/profile.h>
+#include <buxn/vm/trace.h>
+#include <buxn/vm/coverage.h>
 #include <buxn/devices/system.h>
+#include <buxn/devices/ports.h>
+#include <buxn/devices/replay.h>
 #include "resources.h"
 
 static struct {
@@ -32,6 +40,7 @@ init_per_test(void) {
 		_Alignof(buxn_vm_t)
 	);
 	fixture.devices.system_dbg = NULL;
+	fixture.devices.ports = NULL;
 	fixture.vm->config = (buxn_vm_config_t){
 		.memory_size = BUXN_MEMORY_BANK_SIZE,
 		.userdata = &fixture.devices,
@@ -71,3 +80,858 @@ BTEST(vm, opctest) {
 	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
 	BTEST_ASSERT(buxn_system_exit_code(fixture.vm) <= 0);
 }
+
+BTEST(vm, opctest_cached) {
+	buxn_asm_ctx_t basm = {
+		.arena = &fixture.arena,
+		.vfs = (buxn_vfs_entry_t[]) {
+			{ .name = "opctest.tal", .content = XINCBIN_GET(opctest_tal) },
+			{ 0 },
+		}
+	};
+
+	BTEST_ASSERT(buxn_asm(&basm, "opctest.tal"));
+
+	buxn_vm_code_cache_t* cache = calloc(1, sizeof(buxn_vm_code_cache_t));
+	fixture.vm->config.code_cache = cache;
+	buxn_vm_mem_invalidate(fixture.vm, BUXN_RESET_VECTOR, basm.rom_size);
+
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	free(cache);
+	BTEST_ASSERT(buxn_system_exit_code(fixture.vm) <= 0);
+}
+
+static const char self_modifying_code_tal[] =
+	"|00 @sum $1 @diff $1 @before $2 @after $2 @is-zero $1 @not-zero $1\n"
+	"|100\n"
+	"#05 #03 apply .sum STZ\n"
+	"[ LIT SUB ] ;apply/op STA\n"
+	"#05 #03 apply .diff STZ\n"
+	"load .before STZ2\n"
+	"#1234 ;load/value STA2\n"
+	"load .after STZ2\n"
+	"#0000 zero? .is-zero STZ\n"
+	"[ LIT NEQ2 ] ;zero?/op STA\n"
+	"#0000 zero? .not-zero STZ\n"
+	"BRK\n"
+	"@apply [ &op ADD ] JMP2r\n"
+	"@load [ LIT2 &value 0000 ] JMP2r\n"
+	"@zero? DUP2 #0000 [ &op EQU2 ] ?&yes POP2 #00 JMP2r &yes POP2 #01 JMP2r\n";
+
+BTEST(vm, self_modifying_code) {
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(&basm, self_modifying_code_tal));
+
+	buxn_vm_code_cache_t* cache = calloc(1, sizeof(buxn_vm_code_cache_t));
+	for (int i = 0; i < 2; ++i) {
+		// Run twice so the second run starts with a warm cache
+		fixture.vm->config.code_cache = cache;
+		buxn_vm_reset(fixture.vm, BUXN_VM_RESET_ALL);
+		memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+		buxn_vm_mem_invalidate(fixture.vm, BUXN_RESET_VECTOR, basm.rom_size);
+		buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+
+		BTEST_EXPECT(fixture.vm->memory[0] == 0x08);
+		BTEST_EXPECT(fixture.vm->memory[1] == 0x02);
+		BTEST_EXPECT(buxn_vm_mem_load2(fixture.vm, 2) == 0x0000);
+		BTEST_EXPECT(buxn_vm_mem_load2(fixture.vm, 4) == 0x1234);
+		BTEST_EXPECT(fixture.vm->memory[6] == 0x01);
+		BTEST_EXPECT(fixture.vm->memory[7] == 0x00);
+	}
+	free(cache);
+}
+
+static void
+noop_hook(buxn_vm_t* vm, uint16_t pc, void* userdata) {
+	(void)vm;
+	(void)pc;
+	(void)userdata;
+}
+
+BTEST(vm, uncached_code_write) {
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(
+		&basm,
+		"|00 @result $1\n"
+		"|100 #05 #03 apply .result STZ BRK\n"
+		"@apply [ &op ADD ] JMP2r\n"
+		"@to-sub [ LIT SUB ] ;apply/op STA BRK\n"
+		"@to-add [ LIT ADD ] ;apply/op STA BRK\n"
+	));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+	uint16_t to_sub_addr = BUXN_RESET_VECTOR + 13;
+	uint16_t to_add_addr = BUXN_RESET_VECTOR + 20;
+	BTEST_ASSERT(fixture.vm->memory[to_sub_addr + 1] == 0x19 /* SUB */);
+	BTEST_ASSERT(fixture.vm->memory[to_add_addr + 1] == 0x18 /* ADD */);
+
+	buxn_vm_code_cache_t* cache = calloc(1, sizeof(buxn_vm_code_cache_t));
+	fixture.vm->config.code_cache = cache;
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(fixture.vm->memory[0] == 0x08);
+
+	// Patched while the cache is not used
+	BTEST_EXPECT(buxn_vm_execute_budget(fixture.vm, to_sub_addr, 100) == BUXN_VM_FINISHED);
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(fixture.vm->memory[0] == 0x02);
+
+	fixture.vm->config.hook = (buxn_vm_hook_t){ .fn = noop_hook };
+	buxn_vm_execute(fixture.vm, to_add_addr);
+	fixture.vm->config.hook = (buxn_vm_hook_t){ 0 };
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(fixture.vm->memory[0] == 0x08);
+
+	free(cache);
+}
+
+BTEST(vm, jit_opctest) {
+	buxn_vm_jit_t* jit = buxn_vm_jit_init(fixture.vm);
+	// Unsupported platform
+	if (jit == NULL) { return; }
+
+	buxn_asm_ctx_t basm = {
+		.arena = &fixture.arena,
+		.vfs = (buxn_vfs_entry_t[]) {
+			{ .name = "opctest.tal", .content = XINCBIN_GET(opctest_tal) },
+			{ 0 },
+		}
+	};
+
+	BTEST_ASSERT(buxn_asm(&basm, "opctest.tal"));
+
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+	buxn_vm_jit_execute(jit, BUXN_RESET_VECTOR);
+	buxn_vm_jit_cleanup(jit);
+	BTEST_ASSERT(buxn_system_exit_code(fixture.vm) <= 0);
+}
+
+BTEST(vm, jit_self_modifying_code) {
+	buxn_vm_jit_t* jit = buxn_vm_jit_init(fixture.vm);
+	if (jit == NULL) { return; }
+
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(&basm, self_modifying_code_tal));
+
+	for (int i = 0; i < 2; ++i) {
+		// The second run starts with code compiled from the modified rom
+		buxn_vm_reset(fixture.vm, BUXN_VM_RESET_ALL);
+		memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+		buxn_vm_jit_execute(jit, BUXN_RESET_VECTOR);
+
+		BTEST_EXPECT(fixture.vm->memory[0] == 0x08);
+		BTEST_EXPECT(fixture.vm->memory[1] == 0x02);
+		BTEST_EXPECT(buxn_vm_mem_load2(fixture.vm, 2) == 0x0000);
+		BTEST_EXPECT(buxn_vm_mem_load2(fixture.vm, 4) == 0x1234);
+		BTEST_EXPECT(fixture.vm->memory[6] == 0x01);
+		BTEST_EXPECT(fixture.vm->memory[7] == 0x00);
+		BTEST_EXPECT(fixture.vm->wsp == 0);
+		BTEST_EXPECT(fixture.vm->rsp == 0);
+	}
+	buxn_vm_jit_cleanup(jit);
+}
+
+BTEST(vm, jit_external_write) {
+	buxn_vm_jit_t* jit = buxn_vm_jit_init(fixture.vm);
+	if (jit == NULL) { return; }
+
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(
+		&basm,
+		"|00 @result $1\n"
+		"|100 #05 #03 apply .result STZ BRK\n"
+		"@apply ADD JMP2r\n"
+	));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+
+	buxn_vm_jit_execute(jit, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(fixture.vm->memory[0] == 0x08);
+
+	// Patch the compiled routine from outside of the VM
+	uint16_t apply_addr = BUXN_RESET_VECTOR + 11;
+	BTEST_ASSERT(fixture.vm->memory[apply_addr] == 0x18 /* ADD */);
+	fixture.vm->memory[apply_addr] = 0x19 /* SUB */;
+	buxn_vm_jit_execute(jit, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(fixture.vm->memory[0] == 0x02);
+
+	buxn_vm_jit_cleanup(jit);
+}
+
+static void
+record_native_pc(buxn_vm_t* vm, uint16_t pc) {
+	buxn_vm_mem_store2(vm, 0, pc);
+}
+
+BTEST(vm, native) {
+	fixture.vm->config.native = record_native_pc;
+	buxn_vm_execute(fixture.vm, 0x1234);
+	BTEST_EXPECT(buxn_vm_mem_load2(fixture.vm, 0) == 0x1234);
+
+	// Nothing to run
+	buxn_vm_execute(fixture.vm, 0);
+	BTEST_EXPECT(buxn_vm_mem_load2(fixture.vm, 0) == 0x1234);
+}
+
+static const char budget_tal[] =
+	"|00 @System/vector $2 &expansion $2 &wst $1 &rst $1 &metadata $2 &r $2 &g $2 &b $2 &debug $1 &state $1\n"
+	"|100\n"
+	"#0000 &loop INC2 DUP2 #0100 NEQ2 ?&loop\n"
+	"#01 .System/state DEO\n"
+	"#ff\n"
+	"BRK\n";
+
+BTEST(vm, execute_budget) {
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(&basm, budget_tal));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+
+	// LIT2 then 5 opcodes per iteration
+	BTEST_EXPECT(buxn_vm_execute_budget(fixture.vm, BUXN_RESET_VECTOR, 11) == BUXN_VM_BUDGET_EXHAUSTED);
+	BTEST_EXPECT(fixture.vm->pc == BUXN_RESET_VECTOR + 3);
+	BTEST_EXPECT(fixture.vm->wsp == 2);
+	BTEST_EXPECT(buxn_vm_load2(fixture.vm->ws, 0, 0xff) == 0x0002);
+
+	// Resume
+	buxn_vm_status_t status;
+	int num_slices = 1;
+	while ((status = buxn_vm_resume_budget(fixture.vm, 100)) == BUXN_VM_BUDGET_EXHAUSTED) {
+		++num_slices;
+	}
+	BTEST_EXPECT(num_slices == 13);
+	BTEST_EXPECT(status == BUXN_VM_HALTED);
+	BTEST_EXPECT(buxn_system_exit_code(fixture.vm) == 1);
+	BTEST_EXPECT(fixture.vm->wsp == 2);
+	BTEST_EXPECT(buxn_vm_load2(fixture.vm->ws, 0, 0xff) == 0x0100);
+
+	// The rest of the vector
+	BTEST_EXPECT(buxn_vm_resume_budget(fixture.vm, 0) == BUXN_VM_BUDGET_EXHAUSTED);
+	fixture.vm->device[0x0f] = 0;
+	BTEST_EXPECT(buxn_vm_resume_budget(fixture.vm, 100) == BUXN_VM_FINISHED);
+	BTEST_EXPECT(fixture.vm->wsp == 3);
+	BTEST_EXPECT(fixture.vm->ws[2] == 0xff);
+}
+
+BTEST(vm, resume_budget_at_zero) {
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	// Write INC INC into the zero page and jump to it, BRK follows
+	BTEST_ASSERT(buxn_asm_str(&basm, "|100 #0101 #00 STZ2 #05 #0000 JMP2\n"));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+
+	BTEST_EXPECT(buxn_vm_execute_budget(fixture.vm, BUXN_RESET_VECTOR, 6) == BUXN_VM_BUDGET_EXHAUSTED);
+	BTEST_EXPECT(fixture.vm->pc == 0);
+	BTEST_EXPECT(fixture.vm->wsp == 1);
+
+	BTEST_EXPECT(buxn_vm_resume_budget(fixture.vm, 100) == BUXN_VM_FINISHED);
+	BTEST_EXPECT(fixture.vm->wsp == 1);
+	BTEST_EXPECT(fixture.vm->ws[0] == 0x07);
+
+	// A vector of 0 is still not run
+	BTEST_EXPECT(buxn_vm_execute_budget(fixture.vm, 0, 100) == BUXN_VM_FINISHED);
+	BTEST_EXPECT(fixture.vm->ws[0] == 0x07);
+}
+
+BTEST(vm, stack_wrap) {
+	// Popped bytes stay in the stack memory and are read back once it wraps
+	char src[1024] = "|100 #1234 POP2";
+	for (int i = 0; i < 127; ++i) { strcat(src, " POP2"); }
+	strcat(src, " #00 STZ2\n");
+
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(&basm, src));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(fixture.vm->wsp == 0);
+	BTEST_EXPECT(fixture.vm->memory[0] == 0x12);
+	BTEST_EXPECT(fixture.vm->memory[1] == 0x34);
+
+	buxn_vm_code_cache_t* cache = calloc(1, sizeof(buxn_vm_code_cache_t));
+	fixture.vm->config.code_cache = cache;
+	buxn_vm_mem_invalidate(fixture.vm, 0, BUXN_MEMORY_BANK_SIZE);
+	buxn_vm_reset(fixture.vm, BUXN_VM_RESET_STACK | BUXN_VM_RESET_ZERO_PAGE);
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	free(cache);
+	BTEST_EXPECT(fixture.vm->memory[0] == 0x12);
+	BTEST_EXPECT(fixture.vm->memory[1] == 0x34);
+}
+
+BTEST(vm, alloc) {
+	uint32_t memory_size = BUXN_MEMORY_BANK_SIZE * BUXN_MAX_NUM_MEMORY_BANKS;
+	buxn_vm_t* vm = buxn_vm_alloc(memory_size);
+	BTEST_ASSERT(vm != NULL);
+	BTEST_EXPECT(vm->config.memory_size == memory_size);
+	BTEST_EXPECT(vm->memory[0] == 0);
+	BTEST_EXPECT(vm->memory[memory_size - 1] == 0);
+	vm->config.zero_memory = buxn_vm_zero_memory;
+
+	// Both ends of the range share pages with data which must be kept
+	uint32_t addrs[] = {
+		0x00ff, 0x0100, 0x0fff, 0x1000, 0x1001,
+		BUXN_MEMORY_BANK_SIZE * 3 + 0x1234,
+		memory_size - 1,
+	};
+	int num_addrs = sizeof(addrs) / sizeof(addrs[0]);
+	for (int i = 0; i < num_addrs; ++i) {
+		vm->memory[addrs[i]] = 0xaa;
+	}
+	vm->device[0xff] = 0xbb;
+
+	buxn_vm_reset(vm, BUXN_VM_RESET_HIGH_MEM);
+	BTEST_EXPECT(vm->memory[0x00ff] == 0xaa);
+	BTEST_EXPECT(vm->device[0xff] == 0xbb);
+	for (int i = 1; i < num_addrs; ++i) {
+		BTEST_EXPECT(vm->memory[addrs[i]] == 0);
+	}
+
+	// Still usable after its pages were given back
+	vm->memory[0x1000] = 0xcc;
+	BTEST_EXPECT(vm->memory[0x1000] == 0xcc);
+
+	buxn_vm_free(vm);
+}
+
+static const char snapshot_tal[] =
+	"|00 @counter $1\n"
+	"|100\n"
+	".counter LDZ INC .counter STZ\n"
+	"#1234 ;data STA2\n"
+	"#56 #2fff STA\n"
+	"#abcd ;ptr LDA2 STA2\n"
+	"#01 BRK\n"
+	"@ptr 3fff\n"
+	"|200 @data $2\n";
+
+static void
+check_snapshot_restore(buxn_vm_t* vm, buxn_vm_snapshot_t* snapshot, buxn_vm_jit_t* jit) {
+	uint16_t data = 0x0200;
+	buxn_vm_snapshot(vm, snapshot);
+	for (size_t i = 0; i < BUXN_VM_MAX_NUM_PAGES; ++i) {
+		BTEST_EXPECT(vm->dirty_pages[i] == 0);
+	}
+
+	if (jit != NULL) {
+		buxn_vm_jit_execute(jit, BUXN_RESET_VECTOR);
+	} else {
+		buxn_vm_execute(vm, BUXN_RESET_VECTOR);
+	}
+	BTEST_EXPECT(vm->wsp == 1);
+	BTEST_EXPECT(vm->memory[0x00] == 1);
+	BTEST_EXPECT(buxn_vm_mem_load2(vm, data) == 0x1234);
+	BTEST_EXPECT(vm->memory[0x2fff] == 0x56);
+	BTEST_EXPECT(buxn_vm_mem_load2(vm, 0x3fff) == 0xabcd);
+	BTEST_EXPECT(vm->dirty_pages[0]);
+	BTEST_EXPECT(!vm->dirty_pages[1]);
+	BTEST_EXPECT(vm->dirty_pages[2]);
+	BTEST_EXPECT(vm->dirty_pages[3]);
+	BTEST_EXPECT(vm->dirty_pages[4]);
+	BTEST_EXPECT(!vm->dirty_pages[5]);
+
+	// The zero page is kept
+	buxn_vm_restore(vm, snapshot, BUXN_VM_RESET_SOFT);
+	BTEST_EXPECT(vm->wsp == 0);
+	BTEST_EXPECT(vm->memory[0x00] == 1);
+	BTEST_EXPECT(buxn_vm_mem_load2(vm, data) == 0x0000);
+	BTEST_EXPECT(vm->memory[0x2fff] == 0x00);
+	BTEST_EXPECT(buxn_vm_mem_load2(vm, 0x3fff) == 0x0000);
+	BTEST_EXPECT(vm->dirty_pages[0]);
+	BTEST_EXPECT(!vm->dirty_pages[2]);
+
+	buxn_vm_restore(vm, snapshot, BUXN_VM_RESET_ALL);
+	BTEST_EXPECT(vm->memory[0x00] == 0);
+	BTEST_EXPECT(!vm->dirty_pages[0]);
+
+	// Writes from devices are also tracked
+	buxn_vm_mem_invalidate(vm, BUXN_MEMORY_BANK_SIZE - 1, 2);
+	BTEST_EXPECT(vm->dirty_pages[BUXN_MEMORY_BANK_SIZE / BUXN_VM_PAGE_SIZE - 1]);
+}
+
+BTEST(vm, snapshot) {
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(&basm, snapshot_tal));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+	buxn_vm_snapshot_t* snapshot = barena_memalign(
+		&fixture.arena,
+		sizeof(buxn_vm_snapshot_t) + fixture.vm->config.memory_size,
+		_Alignof(buxn_vm_snapshot_t)
+	);
+
+	check_snapshot_restore(fixture.vm, snapshot, NULL);
+
+	buxn_vm_jit_t* jit = buxn_vm_jit_init(fixture.vm);
+	if (jit == NULL) { return; }
+
+	check_snapshot_restore(fixture.vm, snapshot, jit);
+	buxn_vm_jit_cleanup(jit);
+}
+
+static void
+write_copy_record(uint8_t* mem, uint8_t op, uint16_t length, uint16_t src, uint16_t dst) {
+	uint8_t record[] = {
+		op,
+		length >> 8, length & 0xff,
+		0x00, 0x00, src >> 8, src & 0xff,
+		0x00, 0x00, dst >> 8, dst & 0xff,
+	};
+	memcpy(mem, record, sizeof(record));
+}
+
+BTEST(vm, expansion) {
+	buxn_vm_t* vm = fixture.vm;
+	uint8_t* expected = barena_malloc(&fixture.arena, BUXN_MEMORY_BANK_SIZE);
+	vm->device[0x02] = 0x01;
+	vm->device[0x03] = 0x00;
+
+	int offsets[] = { -200, -64, -7, -1, 0, 1, 3, 64, 199, 200, 300 };
+	for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
+		for (uint8_t op = 0x01; op <= 0x02; ++op) {
+			uint16_t length = 200;
+			uint16_t src = 0x2000;
+			uint16_t dst = (uint16_t)(src + offsets[i]);
+			for (uint32_t addr = 0x1000; addr < 0x3000; ++addr) {
+				vm->memory[addr] = (uint8_t)(addr * 7 + 3);
+			}
+			write_copy_record(vm->memory + 0x0100, op, length, src, dst);
+
+			// Byte by byte, as described in the spec
+			memcpy(expected, vm->memory, BUXN_MEMORY_BANK_SIZE);
+			if (op == 0x01) {
+				for (uint16_t j = 0; j < length; ++j) {
+					expected[dst + j] = expected[src + j];
+				}
+			} else {
+				for (uint16_t j = length; j > 0; --j) {
+					expected[dst + j - 1] = expected[src + j - 1];
+				}
+			}
+
+			buxn_system_deo(vm, 0x03);
+			BTEST_EXPECT(memcmp(vm->memory, expected, BUXN_MEMORY_BANK_SIZE) == 0);
+		}
+	}
+
+	// Fill, then copy the filled bytes
+	uint8_t batch[] = {
+		BUXN_SYSTEM_EXPANSION_BATCH, 0x00, 0x03,
+		0x00, 0x10, 0x00, 0x00, 0x00, 0x40, 0x00, 0xaa,
+		0x01, 0x00, 0x08, 0x00, 0x00, 0x40, 0x0c, 0x00, 0x00, 0x50, 0x00,
+		0x00, 0x00, 0x01, 0x00, 0x00, 0x50, 0x02, 0xbb,
+		0x00, 0x00, 0x01, 0x00, 0x00, 0x50, 0x03, 0xcc,
+	};
+	memcpy(vm->memory + 0x0100, batch, sizeof(batch));
+	memset(vm->memory + 0x4000, 0, 0x2000);
+	buxn_system_deo(vm, 0x03);
+	BTEST_EXPECT(vm->memory[0x3fff] == 0x00);
+	BTEST_EXPECT(vm->memory[0x4000] == 0xaa);
+	BTEST_EXPECT(vm->memory[0x4fff] == 0xaa);
+	BTEST_EXPECT(vm->memory[0x5000] == 0xaa);
+	BTEST_EXPECT(vm->memory[0x5001] == 0xaa);
+	BTEST_EXPECT(vm->memory[0x5002] == 0xbb);
+	// Only 3 records
+	BTEST_EXPECT(vm->memory[0x5003] == 0xaa);
+	BTEST_EXPECT(vm->memory[0x5008] == 0x00);
+}
+
+static int num_debug_calls;
+
+static void
+count_debug_calls(buxn_vm_t* vm, uint8_t value) {
+	(void)vm;
+	(void)value;
+	++num_debug_calls;
+}
+
+BTEST(vm, noop_ports) {
+	buxn_port_table_t* ports = barena_malloc(&fixture.arena, sizeof(buxn_port_table_t));
+	buxn_port_table_init(ports);
+	buxn_port_table_register(ports, BUXN_DEVICE_SYSTEM, &buxn_system_ports, NULL);
+	BTEST_EXPECT(!ports->noop_ports.deo[0x0e]);  // System/debug
+	BTEST_EXPECT(ports->noop_ports.deo[0x0f]);  // System/state
+	BTEST_EXPECT(ports->noop_ports.deo[0x18]);  // Console is not registered
+	BTEST_EXPECT(!ports->noop_ports.dei[0x04]);  // System/wst
+	BTEST_EXPECT(ports->noop_ports.dei[0x06]);  // System/metadata
+	fixture.vm->config.noop_ports = &ports->noop_ports;
+	fixture.devices.system_dbg = count_debug_calls;
+	num_debug_calls = 0;
+
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(&basm, "|100 #01 #0e DEO #1234 #18 DEO2 BRK\n"));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(num_debug_calls == 1);
+	BTEST_EXPECT(buxn_vm_dev_load2(fixture.vm, 0x18) == 0x1234);
+
+	// The write to System/wst only lands in device memory
+	buxn_port_table_init(ports);
+	BTEST_ASSERT(buxn_asm_str(&basm, "|100 #aa #04 DEO #04 DEI BRK\n"));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(fixture.vm->wsp == 1);
+	BTEST_EXPECT(fixture.vm->ws[0] == 0xaa);
+
+	buxn_vm_jit_t* jit = buxn_vm_jit_init(fixture.vm);
+	if (jit == NULL) { return; }
+
+	BTEST_ASSERT(buxn_asm_str(&basm, "|100 #bb #04 DEO BRK\n"));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+	fixture.vm->wsp = 0;
+	buxn_vm_jit_execute(jit, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(fixture.vm->wsp == 0);
+	BTEST_EXPECT(fixture.vm->device[0x04] == 0xbb);
+
+	buxn_vm_jit_cleanup(jit);
+}
+
+static uint8_t clock_value;
+
+// Stands for a device which returns something else on every run like datetime
+static uint8_t
+clock_dei(buxn_vm_t* vm, void* device, uint8_t address) {
+	(void)vm;
+	(void)device;
+	(void)address;
+	return clock_value++;
+}
+
+static const buxn_port_device_t clock_ports = {
+	.dei = clock_dei,
+	.dei_ports = BUXN_PORT(0x6),
+};
+
+static const char replay_tal[] =
+	"|00 @sum $1 @sum2 $2\n"
+	"|100 ;on-console #10 DEO2 ;on-mouse #90 DEO2 BRK\n"
+	"@on-console #12 DEI #c6 DEI ADD .sum LDZ ADD .sum STZ BRK\n"
+	"@on-mouse #92 DEI2 #00 #c6 DEI ADD2 .sum2 LDZ2 ADD2 .sum2 STZ2 BRK\n";
+
+static void
+init_replay_devices(buxn_port_table_t* ports, buxn_replay_t* replay) {
+	buxn_port_table_init(ports);
+	buxn_port_table_register(ports, BUXN_DEVICE_CONSOLE, &buxn_console_ports, &fixture.devices.console);
+	buxn_port_table_register(ports, BUXN_DEVICE_MOUSE, &buxn_mouse_ports, &fixture.devices.mouse);
+	buxn_port_table_register(ports, BUXN_DEVICE_DATETIME, &clock_ports, NULL);
+	fixture.devices.ports = ports;
+
+	*replay = (buxn_replay_t){
+		.console = &fixture.devices.console,
+		.mouse = &fixture.devices.mouse,
+	};
+	buxn_replay_capture(replay, ports, BUXN_DEVICE_DATETIME);
+}
+
+BTEST(vm, replay) {
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(&basm, replay_tal));
+	buxn_vm_t* vm = fixture.vm;
+	buxn_port_table_t* ports = barena_malloc(&fixture.arena, sizeof(buxn_port_table_t));
+	buxn_replay_t* replay = barena_malloc(&fixture.arena, sizeof(buxn_replay_t));
+	FILE* file = tmpfile();
+	BTEST_ASSERT(file != NULL);
+
+	// Record
+	init_replay_devices(ports, replay);
+	BTEST_ASSERT(buxn_replay_begin_record(replay, file));
+	clock_value = 1;
+	memcpy(vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+	buxn_vm_execute(vm, BUXN_RESET_VECTOR);
+	buxn_replay_send(replay, vm, &(buxn_replay_event_t){
+		.type = BUXN_REPLAY_CONSOLE,
+		.console = { .type = BUXN_CONSOLE_STDIN, .value = 'a' },
+	});
+	buxn_replay_send(replay, vm, &(buxn_replay_event_t){
+		.type = BUXN_REPLAY_MOUSE,
+		.mouse = { .x = 0x1234, .y = 5, .scroll_y = -1 },
+	});
+	buxn_replay_send(replay, vm, &(buxn_replay_event_t){ .type = BUXN_REPLAY_SCREEN });
+	buxn_replay_send(replay, vm, &(buxn_replay_event_t){
+		.type = BUXN_REPLAY_CONSOLE,
+		.console = { .type = BUXN_CONSOLE_END },
+	});
+	BTEST_EXPECT(replay->num_events == 4);
+	uint8_t sum = vm->memory[0x00];
+	uint16_t sum2 = buxn_vm_mem_load2(vm, 0x01);
+	BTEST_EXPECT(sum == (uint8_t)('a' + 1 + 0 + 3));
+	BTEST_EXPECT(sum2 == 0x1234 + 2);
+
+	// Play back with a clock which gives other values
+	rewind(file);
+	buxn_vm_reset(vm, BUXN_VM_RESET_ALL);
+	init_replay_devices(ports, replay);
+	BTEST_ASSERT(buxn_replay_begin_play(replay, file));
+	BTEST_EXPECT(replay->screen_width == 0);
+	clock_value = 100;
+	memcpy(vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+	buxn_vm_execute(vm, BUXN_RESET_VECTOR);
+	buxn_replay_event_t event;
+	while (buxn_replay_next(replay, &event)) {
+		buxn_replay_send(replay, vm, &event);
+	}
+	BTEST_EXPECT(replay->num_events == 4);
+	BTEST_EXPECT(replay->num_mismatches == 0);
+	BTEST_EXPECT(fixture.devices.mouse.scroll_y == -1);
+	BTEST_EXPECT(vm->memory[0x00] == sum);
+	BTEST_EXPECT(buxn_vm_mem_load2(vm, 0x01) == sum2);
+	BTEST_EXPECT(clock_value == 100);
+
+	fclose(file);
+}
+
+static const char profile_tal[] =
+	"|100\n"
+	"#03 &loop double ;double JSR2 #01 SUB DUP ?&loop\n"
+	"POP BRK\n"
+	"@double JMP2r\n";
+
+BTEST(vm, profile) {
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(&basm, profile_tal));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+
+	buxn_vm_profile_t* profile = calloc(1, sizeof(buxn_vm_profile_t));
+	fixture.vm->config.profile = profile;
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(fixture.vm->wsp == 0);
+
+	BTEST_EXPECT(profile->pc_counts[0x0100] == 1);  // LIT
+	BTEST_EXPECT(profile->pc_counts[0x0102] == 3);  // JSI
+	BTEST_EXPECT(profile->pc_counts[0x0105] == 3);  // LIT2
+	BTEST_EXPECT(profile->pc_counts[0x0108] == 3);  // JSR2
+	BTEST_EXPECT(profile->opcode_counts[0x6c] == 6);  // JMP2r
+	BTEST_EXPECT(profile->opcode_counts[0x00] == 1);  // BRK
+
+	uint64_t num_calls = 0;
+	int num_edges = 0;
+	for (int i = 0; i < BUXN_VM_PROFILE_MAX_CALL_EDGES; ++i) {
+		const buxn_vm_call_edge_t* edge = &profile->call_edges[i];
+		if (edge->count == 0) { continue; }
+
+		BTEST_EXPECT(edge->from == 0x0102 || edge->from == 0x0108);
+		BTEST_EXPECT(edge->to == 0x0112);
+		BTEST_EXPECT(edge->count == 3);
+		num_calls += edge->count;
+		++num_edges;
+	}
+	BTEST_EXPECT(num_edges == 2);
+	BTEST_EXPECT(num_calls == 6);
+
+	// Reading adds to the existing counters
+	FILE* file = tmpfile();
+	BTEST_ASSERT(file != NULL);
+	BTEST_EXPECT(buxn_vm_profile_write(profile, file));
+	rewind(file);
+	BTEST_EXPECT(buxn_vm_profile_read(profile, file));
+	fclose(file);
+	BTEST_EXPECT(profile->pc_counts[0x0102] == 6);
+	BTEST_EXPECT(profile->opcode_counts[0x6c] == 12);
+	BTEST_EXPECT(buxn_vm_profile_call_edge(profile, 0x0108, 0x0112)->count == 6);
+
+	free(profile);
+}
+
+static const char profile_stack_tal[] =
+	"|100\n"
+	"outer BRK\n"
+	"@outer #1234 STH2 inner POP2r JMP2r\n"
+	"@inner JMP2r\n";
+
+BTEST(vm, profile_stack) {
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(&basm, profile_stack_tal));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+
+	buxn_vm_profile_t* profile = calloc(1, sizeof(buxn_vm_profile_t));
+	profile->sample_interval = 1;
+	fixture.vm->config.profile = profile;
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(fixture.vm->rsp == 0);
+
+	uint64_t num_samples = 0;
+	for (int i = 0; i < BUXN_VM_PROFILE_MAX_STACKS; ++i) {
+		num_samples += profile->stacks[i].count;
+	}
+	BTEST_EXPECT(num_samples == 8);
+
+	// The stashed #1234 is not a frame
+	uint16_t inner[] = { 0x0100, 0x0108, 0x010d };
+	BTEST_EXPECT(buxn_vm_profile_stack(profile, inner, 3)->count == 1);
+	uint16_t outer[] = { 0x0100, 0x010c };
+	BTEST_EXPECT(buxn_vm_profile_stack(profile, outer, 2)->count == 1);
+
+	FILE* file = tmpfile();
+	BTEST_ASSERT(file != NULL);
+	BTEST_EXPECT(buxn_vm_profile_write(profile, file));
+	rewind(file);
+	BTEST_EXPECT(buxn_vm_profile_read(profile, file));
+	fclose(file);
+	BTEST_EXPECT(buxn_vm_profile_stack(profile, inner, 3)->count == 2);
+
+	free(profile);
+}
+
+static const char trace_tal[] =
+	"|100\n"
+	"#03 &loop #01 SUB DUP ?&loop\n"
+	"POP BRK\n";
+
+BTEST(vm, trace) {
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(&basm, trace_tal));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+
+	size_t trace_size = buxn_vm_trace_mem_size(8);
+	buxn_vm_trace_t* trace = buxn_vm_trace_init(malloc(trace_size), 8, BUXN_VM_TRACE_TOS);
+	BTEST_EXPECT(buxn_vm_trace_is_valid(trace, trace_size));
+	BTEST_EXPECT(!buxn_vm_trace_is_valid(trace, trace_size - 1));
+	fixture.vm->config.trace = trace;
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(fixture.vm->wsp == 0);
+	// LIT, 3 times LIT SUB DUP JCI, POP and BRK
+	BTEST_EXPECT(trace->head == 15);
+
+	buxn_vm_trace_record_t records[8];
+	uint64_t first_index;
+	uint32_t num_records = buxn_vm_trace_copy(trace, records, &first_index);
+	BTEST_EXPECT(num_records == 7);
+	BTEST_EXPECT(first_index == 8);
+
+	// The last JCI which jumped back
+	BTEST_EXPECT(records[0].pc == 0x0106);
+	BTEST_EXPECT(records[0].opcode == 0x20);
+	BTEST_EXPECT(records[0].wsp == 2);
+	BTEST_EXPECT(records[0].tos == 0x0101);
+	// SUB
+	BTEST_EXPECT(records[2].pc == 0x0104);
+	BTEST_EXPECT(records[2].wsp == 2);
+	BTEST_EXPECT(records[2].tos == 0x0101);
+	// BRK
+	BTEST_EXPECT(records[6].pc == 0x010a);
+	BTEST_EXPECT(records[6].opcode == 0x00);
+	BTEST_EXPECT(records[6].wsp == 0);
+	BTEST_EXPECT(records[6].rsp == 0);
+
+	free(trace);
+}
+
+static const char coverage_tal[] =
+	"|100\n"
+	"#01 ?&yes #02 &yes\n"
+	"#00 ?&no #03 &no\n"
+	"POP BRK\n"
+	"@unused #04 JMP2r\n";
+
+BTEST(vm, coverage) {
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(&basm, coverage_tal));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+
+	buxn_vm_coverage_t* coverage = calloc(1, sizeof(buxn_vm_coverage_t));
+	coverage->record_branches = true;
+	fixture.vm->config.coverage = coverage;
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	BTEST_EXPECT(fixture.vm->wsp == 0);
+
+	BTEST_EXPECT(buxn_vm_bit_test(coverage->executed, 0x0100));  // #01
+	BTEST_EXPECT(buxn_vm_bit_test(coverage->executed, 0x0102));  // ?&yes
+	BTEST_EXPECT(!buxn_vm_bit_test(coverage->executed, 0x0103));  // Operand
+	BTEST_EXPECT(!buxn_vm_bit_test(coverage->executed, 0x0105));  // #02
+	BTEST_EXPECT(buxn_vm_bit_test(coverage->executed, 0x010c));  // #03
+	BTEST_EXPECT(buxn_vm_bit_test(coverage->executed, 0x010f));  // BRK
+	BTEST_EXPECT(!buxn_vm_bit_test(coverage->executed, 0x0110));  // @unused
+
+	BTEST_EXPECT(buxn_vm_bit_test(coverage->branch_taken, 0x0102));
+	BTEST_EXPECT(!buxn_vm_bit_test(coverage->branch_not_taken, 0x0102));
+	BTEST_EXPECT(!buxn_vm_bit_test(coverage->branch_taken, 0x0109));
+	BTEST_EXPECT(buxn_vm_bit_test(coverage->branch_not_taken, 0x0109));
+
+	FILE* file = tmpfile();
+	BTEST_ASSERT(file != NULL);
+	BTEST_EXPECT(buxn_vm_coverage_write(coverage, file));
+	rewind(file);
+	buxn_vm_coverage_t* merged = calloc(1, sizeof(buxn_vm_coverage_t));
+	BTEST_EXPECT(buxn_vm_coverage_read(merged, file));
+	fclose(file);
+	BTEST_EXPECT(memcmp(merged->executed, coverage->executed, sizeof(coverage->executed)) == 0);
+	BTEST_EXPECT(memcmp(merged->branch_taken, coverage->branch_taken, sizeof(coverage->branch_taken)) == 0);
+	BTEST_EXPECT(memcmp(merged->branch_not_taken, coverage->branch_not_taken, sizeof(coverage->branch_not_taken)) == 0);
+
+	free(merged);
+	free(coverage);
+}
+
+typedef struct {
+	int num_calls;
+	uint16_t last_pc;
+} hook_counter_t;
+
+static void
+count_hook(buxn_vm_t* vm, uint16_t pc, void* userdata) {
+	(void)vm;
+	hook_counter_t* counter = userdata;
+	++counter->num_calls;
+	counter->last_pc = pc;
+}
+
+static int
+count_hook_calls(const buxn_vm_hook_filter_t* filter, uint16_t* last_pc) {
+	hook_counter_t counter = { 0 };
+	fixture.vm->config.hook = (buxn_vm_hook_t){ .fn = count_hook, .userdata = &counter };
+	fixture.vm->config.hook_filter = filter;
+	fixture.vm->wsp = 0;
+	buxn_vm_execute(fixture.vm, BUXN_RESET_VECTOR);
+	if (last_pc != NULL) { *last_pc = counter.last_pc; }
+	return counter.num_calls;
+}
+
+static const char hook_filter_tal[] =
+	"|100\n"
+	"#0000 &loop INC2 DUP2 #0010 NEQ2 ?&loop POP2\n"
+	"#1234 #20ff STA2\n"
+	"#56 #ee DEO\n"
+	"BRK\n";
+
+BTEST(vm, hook_filter) {
+	buxn_asm_ctx_t basm = { .arena = &fixture.arena };
+	BTEST_ASSERT(buxn_asm_str(&basm, hook_filter_tal));
+	memcpy(fixture.vm->memory + BUXN_RESET_VECTOR, basm.rom, basm.rom_size);
+	uint16_t sta_pc = BUXN_RESET_VECTOR + 19;
+	uint16_t deo_pc = BUXN_RESET_VECTOR + 24;
+	BTEST_ASSERT(fixture.vm->memory[sta_pc] == 0x35 /* STA2 */);
+	BTEST_ASSERT(fixture.vm->memory[deo_pc] == 0x17 /* DEO */);
+
+	int num_opcodes = count_hook_calls(NULL, NULL);
+	BTEST_EXPECT(num_opcodes == 1 + 16 * 5 + 8);
+
+	buxn_vm_hook_filter_t* filter = calloc(1, sizeof(buxn_vm_hook_filter_t));
+
+	// Only the start of the vector
+	uint16_t last_pc;
+	BTEST_EXPECT(count_hook_calls(filter, &last_pc) == 1);
+	BTEST_EXPECT(last_pc == BUXN_RESET_VECTOR);
+
+	// INC2 on every iteration
+	buxn_vm_bit_set(filter->exec, BUXN_RESET_VECTOR + 3);
+	BTEST_EXPECT(count_hook_calls(filter, &last_pc) == 1 + 16);
+	BTEST_EXPECT(last_pc == BUXN_RESET_VECTOR + 3);
+
+	// The short store crosses into the watched page
+	filter->opcodes[0x35] = BUXN_VM_HOOK_FILTER_WATCH;
+	buxn_vm_bit_set(filter->mem_pages, 0x30);
+	BTEST_EXPECT(count_hook_calls(filter, NULL) == 1 + 16);
+	buxn_vm_bit_set(filter->mem_pages, 0x21);
+	BTEST_EXPECT(count_hook_calls(filter, &last_pc) == 1 + 16 + 1);
+	BTEST_EXPECT(last_pc == sta_pc);
+
+	filter->opcodes[0x17] = BUXN_VM_HOOK_FILTER_WATCH;
+	buxn_vm_bit_set(filter->dev_ports, 0xef);
+	BTEST_EXPECT(count_hook_calls(filter, NULL) == 1 + 16 + 1);
+	buxn_vm_bit_set(filter->dev_ports, 0xee);
+	BTEST_EXPECT(count_hook_calls(filter, &last_pc) == 1 + 16 + 2);
+	BTEST_EXPECT(last_pc == deo_pc);
+
+	filter->opcodes[0x00] = BUXN_VM_HOOK_FILTER_ALWAYS;
+	BTEST_EXPECT(count_hook_calls(filter, &last_pc) == 1 + 16 + 3);
+	BTEST_EXPECT(last_pc == deo_pc + 1);
+
+	filter->all = 1;
+	BTEST_EXPECT(count_hook_calls(filter, NULL) == num_opcodes);
+
+	free(filter);
+}